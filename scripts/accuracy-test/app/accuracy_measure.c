@@ -15,8 +15,8 @@
  */
 
 /**
-* The application expects four arguments on the command line in the following
- * order: MODEL WIDTH HEIGHT OUTPUT_SIZE.
+ * The application expects three arguments on the command line in the
+ * following order: MODEL WIDTH HEIGHT, and an optional fourth, OUTPUT_SIZE.
  *
  * First argument, MODEL, is a string describing path to the model.
  *
@@ -24,29 +24,60 @@
  *
  * Third argument, HEIGHT, is an integer for height size.
  *
- * Fourth argument, OUTPUT_SIZE, denotes the size in bytes of
- * the tensor output by model.
+ * Fourth, optional argument, OUTPUT_SIZE, is the size in bytes of the tensor
+ * output by the model. The buffers are sized from what larod reports for the
+ * tensors, so it is only compared with the size of the first output.
  *
- * The application has four optional arguments on the command line in the following
- * order: DEVICE LABEL GROUND_TRUTH.
+ * The images are read in one of three ways:
  *
- * First optional argument, DEVICE, is a string of the selected larod device.
+ *     default         one converted <n>.bin file per image in
+ *                     /var/spool/storage/SD_DISK/imagenet.
+ *     -d DATASET      a packed dataset file written by larod_convert.py or
+ *                     larod_convert with --pack, mapped once, and with
+ *                     --zero-copy bound directly to the input tensor.
+ *     --jpeg DIR      JPEG files DIR/<n>.JPEG, decoded on the device and
+ *                     cropped, scaled and converted by a larod preprocessing
+ *                     job on --preprocess-device, cpu-proc by default.
  *
- * Second optional argument, LABEL, is the path to a file labelling classifications.
+ * The other options are:
  *
- * Finally, fourth optional argument, GROUND_TRUTH, is the path to a file giving
- * the annotations of the images.
+ *     -c DEVICE       the larod device, by default that of a new connection.
+ *     -l LABELS       file labelling the classifications, one per row.
+ *     -g ANNOTATIONS  the class of every image, or with --detect its boxes.
+ *     --model-id ID   get a public model instead of loading MODEL.
+ *     --workers N, --inflight N, --read-ahead N, --io-backend BACKEND
+ *                     run N workers with their own connection, keep N jobs
+ *                     in flight per worker and read N files ahead.
+ *     --max-images N  only run the first N images.
+ *     --sample TOLERANCE, --seed N, --confidence LEVEL
+ *                     visit the images in a random order stratified by class
+ *                     and stop once top1 and top5 are known within
+ *                     TOLERANCE.
+ *     --cache DIR, --force
+ *                     keep the result of every image in DIR so that a run
+ *                     can resume, or start it over.
+ *     --detect FORMAT, --conf-threshold T, --iou-threshold T,
+ *     --max-detections N
+ *                     evaluate a yolov5, yolov8 or ssd detection model and
+ *                     log the COCO mAP.
+ *     --report FILE, --results FILE, --log-level LEVEL
+ *                     write a JSON report and a CSV of every image, and set
+ *                     what is logged.
  *
  * Then you could run the application with Google TPU with command:
  *     ./usr/local/packages/accuracy_measure/accuracy_measure \
  *     /usr/local/packages/accuracy_measure/model/mobilenet_v2_1.0_224_quant_edgetpu.tflite \
- *     224 224 1001 -c google-edge-tpu-tflite \
+ *     224 224 -c google-edge-tpu-tflite \
  *     -l /usr/local/packages/accuracy_measure/label/imagenet_labels.txt \
- *     -g /usr/local/packages/accuracy_measure/ground/ground_truth.txt"
+ *     -g /usr/local/packages/accuracy_measure/ground/ground_truth.txt
  */
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
@@ -54,28 +85,135 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 #include <math.h>
 #include <string.h>
 
+#include "arena.h"
 #include "argparse.h"
+#include "cache.h"
+#include "dataset.h"
+#include "detect.h"
+#include "ioengine.h"
+#include "jpeg.h"
 #include "larod.h"
+#include "mapeval.h"
+#include "pipeline.h"
+#include "postprocess.h"
+#include "results.h"
+#include "sampling.h"
+#include "stats.h"
+#include "tflite.h"
+#include "topk.h"
 
-#define N_IMAGES 50000
+// Number of highest scoring classes checked against the ground truth.
+#define TOP_K RESULTS_TOP_K
+
+// Number of images used to measure the copy path when running zero-copy.
+#define COPY_SAMPLE_IMAGES 16
+
+// Number of consecutive images a worker takes from the shared counter at a
+// time. Small enough to even out the load between workers, large enough for
+// the counter to be rarely contended.
+#define IMAGE_CHUNK 16
+
+// Width and height of the preprocessing input that JPEG images are decoded
+// into. Larger images are decoded at a reduced scale to fit.
+#define JPEG_MAX_SIDE 1024
+
+// Initial size of the read-ahead buffers for JPEG files, grown for larger
+// files.
+#define JPEG_READ_BYTES (256 * 1024)
+
+// Directory of the converted images, one <n>.bin file per image.
+#define BIN_IMAGE_DIR "/var/spool/storage/SD_DISK/imagenet"
 
 /**
- * brief Creates a temporary fd truncated to correct size and mapped.
- *
- * This convenience function creates temp files to be used for input and output.
- *
- * param fileName Pattern for how the temp file will be named in file system.
- * param fileSize How much space needed to be allocated (truncated) in fd.
- * param mappedAddr Pointer to the address of the fd mapped for this process.
- * param Pointer to the generated fd.
- * return False if any errors occur, otherwise true.
+ * State shared by all workers of a run.
  */
-static bool createAndMapTmpFile(char* fileName, size_t fileSize,
-                                void** mappedAddr, int* convFd);
+typedef struct runContext {
+    const args_t* args;
+    const outputFormat* format;
+    const dataset* packedDataset;
+    size_t inputBytes;
+    size_t numImages;
+    // Largest image number, the length of groundTruth and results.
+    size_t maxImageId;
+    // Expected class of every image, indexed by image number - 1, -1 if
+    // not known.
+    const int* groundTruth;
+    char** labels;
+    size_t numLabels;
+    // Result of every image, indexed by image number. Each image is scored
+    // by exactly one worker, so no two workers write the same record.
+    resultsSink* results;
+    // Ground truth and detections of a detection model, NULL for a
+    // classification model, which uses groundTruth and results instead.
+    // The images of the run are the images of the ground truth.
+    mapeval* eval;
+    // True if the result of every image is logged, see --log-level.
+    bool logImages;
+    // Position in the run of the first image not yet taken by a worker.
+    atomic_size_t nextImage;
+    // Dataset or annotation position of every position in the run, in the
+    // sampled order, NULL to run the images in order.
+    const size_t* order;
+    // Quantile of the confidence level of a sampled run.
+    double sampleZ;
+    // Images scored and hits so far in a sampled run, to decide when the
+    // accuracy is known well enough to stop.
+    atomic_size_t sampleScored;
+    atomic_size_t sampleTop1;
+    atomic_size_t sampleTop5;
+    // Set when a sampled run stopped before its last image.
+    atomic_bool stoppedEarly;
+    // Results of earlier runs of the same model, device and dataset, and
+    // where the results of this run are added, NULL without --cache.
+    resultsCache* cache;
+    // Set by a worker that fails, so that the others stop early.
+    atomic_bool failed;
+} runContext;
+
+/**
+ * A worker thread with its own larod connection, model and inference slots.
+ */
+typedef struct worker {
+    runContext* ctx;
+    size_t id;
+    pthread_t thread;
+    larodConnection* conn;
+    larodModel* model;
+    // Preprocessing model chained before model when reading JPEG images.
+    larodModel* preModel;
+    pipeline* pipe;
+    // File contents of the JPEG image being loaded, grown to the largest
+    // file read so far.
+    uint8_t* jpegData;
+    size_t jpegCap;
+    // Reads image files ahead of the loop, NULL without --read-ahead.
+    ioEngine* io;
+    // Decodes the output of a detection model into boxes, NULL for a
+    // classification model.
+    detector* det;
+    detectBox* boxes;
+    // Images of the chunk taken from the shared counter that are left.
+    size_t chunkNext;
+    size_t chunkEnd;
+    int sumTop1;
+    int sumTop5;
+    size_t numScored;
+    // Images counted from the cache instead of run.
+    size_t numCached;
+    uint64_t numDetections;
+    // Time per image of each stage, merged into the run report at the end.
+    statsHistogram stages[STATS_NUM_STAGES];
+    // Time per image spent waiting for read-ahead.
+    statsHistogram ioWait;
+    statsStartup startup;
+    uint64_t elapsedUs;
+    bool ok;
+} worker;
 
 /**
  * brief Sets up and configures a connection to larod, and loads a model.
@@ -83,16 +221,21 @@ static bool createAndMapTmpFile(char* fileName, size_t fileSize,
  * Opens a connection to larod, which is tied to larodConn. After opening a
  * larod connection the devivce specified by deviceName is set for the
  * connection. Then the model file specified by larodModelFd is loaded to the
- * device, and a corresponding larodModel object is tied to model.
+ * device, or the public model modelId is got from larod, and a
+ * corresponding larodModel object is tied to model. The time to connect and
+ * to load the model are set in startup.
  *
  * param deviceName Specifier for which larod device to use.
  * param larodModelFd Fd for a model file to load.
+ * param modelId Id of a public model to get instead, 0 to load the file.
  * param larodConn Pointer to a larod connection to be opened.
  * param model Pointer to a larodModel to be obtained.
+ * param startup Pointer to the startup times of the worker.
  * return False if error has occurred, otherwise true.
  */
 static bool setupLarod(const char* deviceName, const int larodModelFd,
-                       larodConnection** larodConn, larodModel** model);
+                       uint64_t modelId, larodConnection** larodConn,
+                       larodModel** model, statsStartup* startup);
 
 /**
  * brief Free up resources held by an array of labels.
@@ -116,77 +259,428 @@ static void freeLabels(char** labelsArray, char* labelFileBuffer);
 static bool parseLabels(char*** labelsPtr, char** labelFileBuffer,
                         char* labelsPath, size_t* numLabelsPtr);
 
+/**
+ * brief Splits a buffer of newline separated labels into an array.
+ *
+ * The newlines in the buffer are replaced with NULL chars, and the array
+ * entries point into the buffer.
+ *
+ * param labelsData Buffer with the labels text, with room for one extra
+ * terminating NULL char after labelsSize bytes.
+ * param labelsSize Size in bytes of the labels text.
+ * param labelsPtr Pointer to a string array.
+ * param numLabelsPtr Pointer to number which will store number of labels read.
+ * return False if any errors occur, otherwise true.
+ */
+static bool splitLabels(char* labelsData, size_t labelsSize, char*** labelsPtr,
+                        size_t* numLabelsPtr);
 
-static bool createAndMapTmpFile(char* fileName, size_t fileSize,
-                                void** mappedAddr, int* convFd) {
-    syslog(LOG_INFO, "%s: Setting up a temp fd with pattern %s and size %zu", __func__,
-           fileName, fileSize);
+/**
+ * brief Returns the time of the monotonic clock in microseconds.
+ *
+ * return Current time in microseconds.
+ */
+static uint64_t getTimeUs(void);
 
-    int fd = mkstemp(fileName);
-    if (fd < 0) {
-        syslog(LOG_ERR, "%s: Unable to open temp file %s: %s", __func__, fileName,
-               strerror(errno));
-        goto error;
-    }
+/**
+ * brief Measures the cost of copying images from a packed dataset.
+ *
+ * Used as a reference when the images are not copied during the run, so
+ * that the cost of both input paths can be reported side by side. The
+ * images are sampled evenly over the dataset.
+ *
+ * param packedDataset The dataset.
+ * param imageBytes Size in bytes of one image.
+ * return Mean time in microseconds to map and copy one image, 0 if it could
+ * not be measured.
+ */
+static double measureCopyPath(const dataset* packedDataset, size_t imageBytes);
 
-    // Allocate enough space in for the fd.
-    if (ftruncate(fd, (off_t) fileSize) < 0) {
-        syslog(LOG_ERR, "%s: Unable to truncate temp file %s: %s", __func__, fileName,
-               strerror(errno));
-        goto error;
-    }
+/**
+ * brief Connects a worker to larod and creates its inference slots.
+ *
+ * The model file is opened again for each worker, so that every connection
+ * loads its own copy of the model.
+ *
+ * param ctx The run.
+ * param w The worker to set up, zero initialized.
+ * param id Number of the worker, used in logs.
+ * return False if any errors occur, otherwise true.
+ */
+static bool setupWorker(runContext* ctx, worker* w, size_t id);
 
-    // Remove since we don't actually care about writing to the file system.
-    if (unlink(fileName)) {
-        syslog(LOG_ERR, "%s: Unable to unlink from temp file %s: %s", __func__,
-               fileName, strerror(errno));
-        goto error;
-    }
+/**
+ * brief Loads a preprocessing model and chains it before the inference job
+ * of every slot of a worker.
+ *
+ * The model crops and scales interleaved RGB images of up to JPEG_MAX_SIDE
+ * pixels to the input of the inference model.
+ *
+ * param ctx The run.
+ * param w The worker, with its slots created.
+ * return False if any errors occur, otherwise true.
+ */
+static bool setupPreprocessing(runContext* ctx, worker* w);
 
-    // Get an address to fd's memory for this process's memory space.
-    void* data =
-        mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+/**
+ * brief Tells whether the model takes planar input, from the layout larod
+ * reports for its first input tensor.
+ *
+ * param conn Connection the model is loaded on.
+ * param model The loaded model.
+ * return True for NCHW input, false otherwise or if not known.
+ */
+static bool hasPlanarInput(larodConnection* conn, const larodModel* model);
 
-    if (data == MAP_FAILED) {
-        syslog(LOG_ERR, "%s: Unable to mmap temp file %s: %s", __func__, fileName,
-               strerror(errno));
-        goto error;
-    }
+/**
+ * brief Chooses how the output of the model is decoded.
+ *
+ * The element type, the number of classes and the bytes between two scores
+ * are taken from the first output tensor as larod describes it. The type is
+ * read from the model file instead if larod does not know it, and the
+ * scores are taken as densely packed if larod reports no pitches.
+ *
+ * param conn Connection the model is loaded on.
+ * param model The loaded model.
+ * param outputBytes Size in bytes of the output buffer.
+ * param info Output tensor read from the model file, NULL if not known.
+ * param format Pointer to the description to set up.
+ * return False if the output cannot be decoded, otherwise true.
+ */
+static bool setupOutputFormat(larodConnection* conn, const larodModel* model,
+                              size_t outputBytes, const tfliteTensorInfo* info,
+                              outputFormat* format);
 
-    *mappedAddr = data;
-    *convFd = fd;
+/**
+ * brief Sets up the decoding of the output of a detection model.
+ *
+ * The number of anchors and classes are taken from the dimensions of the
+ * first output tensor, the element type as in setupOutputFormat and the
+ * quantization from the model file. SSD models are checked by
+ * setupSsdOutputs instead.
+ *
+ * param conn Connection the model is loaded on.
+ * param model The loaded model.
+ * param modelInfo Sizes of the output buffers.
+ * param info Output tensor read from the model file, NULL if not known.
+ * param args The arguments, giving the layout and thresholds.
+ * param config Pointer to the configuration to fill in.
+ * return False if the output cannot be decoded, otherwise true.
+ */
+static bool setupDetection(larodConnection* conn, const larodModel* model,
+                           const pipelineModelInfo* modelInfo,
+                           const tfliteTensorInfo* info, const args_t* args,
+                           detectConfig* config);
 
-    return true;
+/**
+ * brief Checks the four outputs of an SSD model with built in
+ * post-processing and takes the number of boxes from the first.
+ *
+ * param tensors The output tensors as larod describes them.
+ * param numTensors Number of output tensors.
+ * param modelInfo Sizes of the output buffers.
+ * param config Pointer to the configuration, with the format set.
+ * return False if the outputs are not those of an SSD model, otherwise
+ * true.
+ */
+static bool setupSsdOutputs(larodTensor** tensors, size_t numTensors,
+                            const pipelineModelInfo* modelInfo,
+                            detectConfig* config);
 
-error:
-    if (fd >= 0) {
-        close(fd);
-    }
+/**
+ * brief Finds the element type of an output tensor.
+ *
+ * param tensor The tensor.
+ * param info The tensor read from the model file, NULL if not known. Used
+ * if larod does not report the type.
+ * param type Pointer to the type.
+ * return False if the type is not supported, otherwise true.
+ */
+static bool getOutputType(const larodTensor* tensor,
+                          const tfliteTensorInfo* info, topkType* type);
+
+/**
+ * brief Returns the image number of a position in the run.
+ *
+ * param ctx The run.
+ * param i Position of the image in the run.
+ * return One-based image number, the number in the ground truth for a
+ * detection model.
+ */
+static size_t imageNumber(const runContext* ctx, size_t i);
+
+/**
+ * brief Formats the path of the file of an image.
+ *
+ * param ctx The run.
+ * param count One-based image number.
+ * param path Buffer for the path.
+ * param size Size of path.
+ */
+static void imagePath(const runContext* ctx, size_t count, char* path,
+                      size_t size);
+
+/**
+ * brief Takes the position of the next image to run from the chunk of the
+ * worker, taking a new chunk from the shared counter when it is empty.
+ *
+ * param w The worker.
+ * param i Pointer to the position of the image in the run.
+ * return False if no images are left or the run has failed, otherwise true.
+ */
+static bool takeImage(worker* w, size_t* i);
+
+/**
+ * brief Counts an image from the cache instead of running it, if it is
+ * there.
+ *
+ * param w The worker that took the image.
+ * param i Position of the image in the run.
+ * return True if the image was in the cache, otherwise false.
+ */
+static bool takeCached(worker* w, size_t i);
+
+/**
+ * brief Adds the hits of a scored image to the sums of a worker and, for a
+ * sampled run, to the counts of the run.
+ *
+ * param w The worker.
+ * param record Result of the image.
+ */
+static void countHits(worker* w, const resultRecord* record);
+
+/**
+ * brief Returns the number of the image at a dataset or annotations
+ * position.
+ *
+ * param ctx The run.
+ * param i Position of the image in the run.
+ * return The one-based image number.
+ */
+static size_t positionImageId(const runContext* ctx, size_t i);
+
+/**
+ * brief Checks if the top1 and top5 accuracies of a sampled run are known
+ * well enough, from the images scored so far by all workers.
+ *
+ * param ctx The run.
+ * return True if both confidence intervals are within the tolerance.
+ */
+static bool samplePrecise(runContext* ctx);
+
+/**
+ * brief Reads a whole file into the JPEG buffer of a worker.
+ *
+ * param w The worker.
+ * param path Path of the file.
+ * param size Pointer to the size of the file.
+ * param found Pointer set to false if the file is missing or unreadable.
+ * return False if the buffer could not be allocated, otherwise true.
+ */
+static bool readJpegFile(worker* w, const char* path, size_t* size,
+                         bool* found);
+
+/**
+ * brief Decodes a JPEG image into the preprocessing input of a slot.
+ *
+ * param w The worker owning the slot.
+ * param slot Slot to load the image into.
+ * param count One-based image number.
+ * param buf The file read ahead, or NULL to read it here.
+ * param loaded Pointer set to false if the image is missing or could not be
+ * decoded.
+ * return False if a larod error occurs, otherwise true.
+ */
+static bool loadJpeg(worker* w, pipelineSlot* slot, size_t count,
+                     const ioBuffer* buf, bool* loaded);
+
+/**
+ * brief Waits for the jobs of a worker and releases its larod resources.
+ *
+ * param w The worker.
+ */
+static void destroyWorker(worker* w);
+
+/**
+ * brief Scores the result held by a slot.
+ *
+ * param w The worker owning the slot.
+ * param slot Slot with a completed job.
+ * return False if the job failed, otherwise true.
+ */
+static bool scoreSlot(worker* w, pipelineSlot* slot);
+
+/**
+ * brief Loads an image into the input of a slot.
+ *
+ * param w The worker owning the slot.
+ * param slot Slot to load the image into.
+ * param i Position of the image in the run.
+ * param buf The file of the image read ahead, or NULL to read it here.
+ * param count Pointer to the one-based image number, set if loaded.
+ * param loaded Pointer set to false if the image is missing and skipped.
+ * return False if a larod error occurs, otherwise true.
+ */
+static bool loadImage(worker* w, pipelineSlot* slot, size_t i,
+                      const ioBuffer* buf, size_t* count, bool* loaded);
+
+/**
+ * brief Runs inference on images taken from the shared counter until none
+ * are left.
+ *
+ * param w The worker.
+ * return False if any errors occur, otherwise true.
+ */
+static bool runWorker(worker* w);
+
+/**
+ * brief Thread entry point calling runWorker.
+ *
+ * param arg The worker.
+ * return NULL.
+ */
+static void* workerThread(void* arg);
+
+/**
+ * brief Counts the annotations in an annotations file.
+ *
+ * param path Path to the annotations file, one class per line.
+ * param count Pointer to the number of annotations, i.e. lines.
+ * return False if the file could not be read, otherwise true.
+ */
+static bool countAnnotations(const char* path, size_t* count);
+
+/**
+ * brief Reads the annotations file into the ground truth array.
+ *
+ * The class on line n is the ground truth of image n. It is stored plus
+ * one, since the output has a background class first.
+ *
+ * param path Path to the annotations file, one class per line.
+ * param groundTruth Array of ground truths, indexed by image number - 1.
+ * param count Length of groundTruth, from countAnnotations.
+ * return False if the file could not be read, otherwise true.
+ */
+static bool readAnnotations(const char* path, int* groundTruth, size_t count);
+
+/**
+ * brief Orders the images of a sampled run, stratified by their ground
+ * truth, see sampling.h.
+ *
+ * param packedDataset The dataset, NULL if the images are files numbered
+ * from 1.
+ * param groundTruth Array of ground truths, indexed by image number - 1.
+ * param maxImageId Length of groundTruth.
+ * param count Number of images in the dataset or annotations file.
+ * param seed Seed of the order.
+ * param order Array of count positions to fill in.
+ * return False if out of memory, otherwise true.
+ */
+static bool sampleOrder(const dataset* packedDataset, const int* groundTruth,
+                        size_t maxImageId, size_t count, uint64_t seed,
+                        size_t* order);
+
+/**
+ * brief Computes the key of the cache file of a run, a hash of everything
+ * that decides the result of an image: the model file, the device, the OS
+ * release and the dataset, or the annotations and the image files read.
+ *
+ * param args The arguments of the run.
+ * param packedDataset The dataset, NULL if the images are files.
+ * param key Pointer to the key.
+ * return False if the model or annotations could not be read, otherwise
+ * true.
+ */
+static bool cacheKey(const args_t* args, const dataset* packedDataset,
+                     uint64_t* key);
+
+/**
+ * brief Tells whether messages of a priority get past the syslog mask.
+ *
+ * param priority Syslog priority, e.g. LOG_INFO.
+ * return True if messages of that priority are logged.
+ */
+static bool isLogged(int priority);
+
+/**
+ * brief Finds the top results of one inference output and scores them.
+ *
+ * param format Description of the output of the model.
+ * param outputPtr Output tensor data of the image.
+ * param count One-based index of the image that was run.
+ * param groundTruth Expected class of the image.
+ * param labels Array of label strings, may be NULL.
+ * param numLabels Number of entries in the labels array.
+ * param logImage True to log the result of the image to syslog.
+ * param record Record of the image in the results sink, filled in.
+ * param stages Histograms the topk and decode times are recorded in.
+ * return Time in ns spent in the topk and decode stages.
+ */
+static uint64_t processOutput(const outputFormat* format,
+                              const uint8_t* outputPtr, size_t count,
+                              int groundTruth, char** labels, size_t numLabels,
+                              bool logImage, resultRecord* record,
+                              statsHistogram* stages);
+
+/**
+ * brief Finds the boxes of the outputs of one image and matches them
+ * against the ground truth.
+ *
+ * param w The worker, whose detector and boxes are used.
+ * param slot Slot with the outputs of the image.
+ * return Time in ns spent in the decode and nms stages.
+ */
+static uint64_t processDetections(worker* w, const pipelineSlot* slot);
+
+/**
+ * brief Returns the label of a class for log messages.
+ *
+ * param labels Array of label strings, may be NULL.
+ * param numLabels Number of entries in the labels array.
+ * param idx Class index.
+ * return The label, or "unknown" if there is none for the class.
+ */
+static const char* labelName(char** labels, size_t numLabels, size_t idx);
 
-    return false;
-}
 
 static bool setupLarod(const char* deviceName, const int larodModelFd,
-                       larodConnection** larodConn, larodModel** model) {
+                       uint64_t modelId, larodConnection** larodConn,
+                       larodModel** model, statsStartup* startup) {
     larodError* error = NULL;
     larodConnection* conn = NULL;
     larodModel* loadedModel = NULL;
     bool ret = false;
 
     // Set up larod connection.
+    const uint64_t startNs = statsNowNs();
     if (!larodConnect(&conn, &error)) {
         syslog(LOG_ERR, "%s: Could not connect to larod: %s", __func__, error->msg);
         goto end;
     }
-
-    const larodDevice* dev = larodGetDevice(conn, deviceName, 0, &error);
-
-    loadedModel = larodLoadModel(conn, larodModelFd, dev, LAROD_ACCESS_PRIVATE,
-                                 "Accuracy test model", NULL, &error);
-    if (!loadedModel) {
-        syslog(LOG_ERR, "%s: Unable to load model: %s", __func__, error->msg);
-        goto error;
+    const uint64_t connectedNs = statsNowNs();
+    startup->connectNs = connectedNs - startNs;
+
+    if (modelId) {
+        // A public model runs on the device it was loaded on.
+        loadedModel = larodGetModel(conn, modelId, &error);
+        if (!loadedModel) {
+            syslog(LOG_ERR, "%s: Unable to get model %llu: %s", __func__,
+                   (unsigned long long) modelId, error->msg);
+            goto error;
+        }
+    } else {
+        const larodDevice* dev = larodGetDevice(conn, deviceName, 0, &error);
+
+        loadedModel = larodLoadModel(conn, larodModelFd, dev,
+                                     LAROD_ACCESS_PRIVATE,
+                                     "Accuracy test model", NULL, &error);
+        if (!loadedModel) {
+            syslog(LOG_ERR, "%s: Unable to load model: %s", __func__,
+                   error->msg);
+            goto error;
+        }
     }
+    startup->loadNs = statsNowNs() - connectedNs;
 
     *larodConn = conn;
     *model = loadedModel;
@@ -215,11 +709,10 @@ void freeLabels(char** labelsArray, char* labelFileBuffer) {
 
 bool parseLabels(char*** labelsPtr, char** labelFileBuffer, char* labelsPath,
                  size_t* numLabelsPtr) {
-    // We cut off every row at 60 characters.
-    const size_t LINE_MAX_LEN = 60;
     bool ret = false;
     char* labelsData = NULL;  // Buffer containing the label file contents.
     char** labelArray = NULL; // Pointers to each line in the labels text.
+    size_t numLines = 0;
 
     struct stat fileStats = {0};
     if (stat(labelsPath, &fileStats) < 0) {
@@ -270,10 +763,40 @@ bool parseLabels(char*** labelsPtr, char** labelFileBuffer, char* labelsPath,
         fileReadPtr += numBytesRead;
     }
 
+    if (!splitLabels(labelsData, labelsFileSize, &labelArray, &numLines)) {
+        goto end;
+    }
+
+    *labelsPtr = labelArray;
+    *numLabelsPtr = numLines;
+    *labelFileBuffer = labelsData;
+
+    ret = true;
+
+end:
+    if (!ret) {
+        freeLabels(labelArray, labelsData);
+    }
+    close(labelsFd);
+
+    return ret;
+}
+
+static bool splitLabels(char* labelsData, size_t labelsSize, char*** labelsPtr,
+                        size_t* numLabelsPtr) {
+    // We cut off every row at 60 characters.
+    const size_t LINE_MAX_LEN = 60;
+    char** labelArray = NULL; // Pointers to each line in the labels text.
+
+    if (labelsSize == 0) {
+        syslog(LOG_ERR, "%s: Labels text is empty", __func__);
+        return false;
+    }
+
     // Now count number of lines in the file - check all bytes except the last
     // one in the file.
     size_t numLines = 0;
-    for (size_t i = 0; i < (labelsFileSize - 1); i++) {
+    for (size_t i = 0; i < (labelsSize - 1); i++) {
         if (labelsData[i] == '\n') {
             numLines++;
         }
@@ -288,18 +811,20 @@ bool parseLabels(char*** labelsPtr, char** labelFileBuffer, char* labelsPath,
     if (!labelArray) {
         syslog(LOG_ERR, "%s: Unable to allocate labels array: %s", __func__,
                strerror(errno));
-        ret = false;
-        goto end;
+        return false;
     }
 
     size_t labelIdx = 0;
     labelArray[labelIdx] = labelsData;
     labelIdx++;
-    for (size_t i = 0; i < labelsFileSize; i++) {
+    for (size_t i = 0; i < labelsSize; i++) {
         if (labelsData[i] == '\n') {
-            // Register the string start in the list of labels.
-            labelArray[labelIdx] = labelsData + i + 1;
-            labelIdx++;
+            // Register the string start in the list of labels, unless this is
+            // the newline at the very end of the file.
+            if (i + 1 < labelsSize) {
+                labelArray[labelIdx] = labelsData + i + 1;
+                labelIdx++;
+            }
             // Replace the newline char with string-ending NULL char.
             labelsData[i] = '\0';
         }
@@ -308,13 +833,13 @@ bool parseLabels(char*** labelsPtr, char** labelFileBuffer, char* labelsPath,
     // If the very last byte in the labels file was a new-line we just
     // replace that with a NULL-char. Refer previous for loop skipping looking
     // for new-line at the end of file.
-    if (labelsData[labelsFileSize - 1] == '\n') {
-        labelsData[labelsFileSize - 1] = '\0';
+    if (labelsData[labelsSize - 1] == '\n') {
+        labelsData[labelsSize - 1] = '\0';
     }
 
     // Make sure we always have a terminating NULL char after the label file
     // contents.
-    labelsData[labelsFileSize] = '\0';
+    labelsData[labelsSize] = '\0';
 
     // Now go through the list of strings and cap if strings too long.
     for (size_t i = 0; i < numLines; i++) {
@@ -327,361 +852,1614 @@ bool parseLabels(char*** labelsPtr, char** labelFileBuffer, char* labelsPath,
 
     *labelsPtr = labelArray;
     *numLabelsPtr = numLines;
-    *labelFileBuffer = labelsData;
-
-    ret = true;
-
-end:
-    if (!ret) {
-        freeLabels(labelArray, labelsData);
-    }
-    close(labelsFd);
 
-    return ret;
+    return true;
 }
 
-/**
- * brief Main function
- */
-int main(int argc, char** argv) {
-    // Hardcode to use three image "color" channels (eg. RGB).
-    const unsigned int CHANNELS = 3;
-
-    // Name patterns for the temp file we will create.
-    char CONV_INP_FILE_PATTERN[] = "/tmp/larod.in.test-XXXXXX";
-    char CONV_OUT_FILE_PATTERN[] = "/tmp/larod.out.test-XXXXXX";
-
-    bool ret = false;
-    larodError* error = NULL;
-    larodConnection* conn = NULL;
-    larodTensor** inputTensors = NULL;
-    size_t numInputs = 0;
-    larodTensor** outputTensors = NULL;
-    size_t numOutputs = 0;
-    larodJobRequest* infReq = NULL;
-    void* larodInputAddr = MAP_FAILED;
-    void* larodOutputAddr = MAP_FAILED;
-    int larodModelFd = -1;
-    int larodInputFd = -1;
-    int larodOutputFd = -1;
-    char** labels = NULL; // This is the array of label strings. The label
-                          // entries points into the large labelFileData buffer.
-    size_t numLabels = 0; // Number of entries in the labels array.
-    char* labelFileData =
-        NULL; // Buffer holding the complete collection of label strings.
-    args_t args;
+static uint64_t getTimeUs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    // Open the syslog to report messages for "accuracy_measure"
-    openlog("accuracy_measure", LOG_PID|LOG_CONS, LOG_USER);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
 
-    syslog(LOG_INFO, "Starting ...");
+static double measureCopyPath(const dataset* packedDataset, size_t imageBytes) {
+    // Copy into the same kind of buffer the input tensors would use.
+    char copyFilePattern[] = "/tmp/larod.copy.test-XXXXXX";
+    void* dst = MAP_FAILED;
+    int dstFd = -1;
+    if (!createAndMapTmpFile(copyFilePattern, imageBytes, &dst, &dstFd)) {
+        return 0.0;
+    }
 
-    if (!parseArgs(argc, argv, &args)) {
-        goto end;
+    const size_t count = datasetGetCount(packedDataset);
+    const size_t samples = count < COPY_SAMPLE_IMAGES ? count
+                                                      : COPY_SAMPLE_IMAGES;
+    uint64_t totalUs = 0;
+
+    for (size_t i = 0; i < samples; i++) {
+        const uint64_t startUs = getTimeUs();
+        const void* image = datasetMapImage(packedDataset, i * count / samples);
+        if (image) {
+            memcpy(dst, image, imageBytes);
+            datasetUnmapImage(packedDataset, image);
+        }
+        totalUs += getTimeUs() - startUs;
     }
+    munmap(dst, imageBytes);
+    close(dstFd);
 
-    larodModelFd = open(args.modelFile, O_RDONLY);
-    if (larodModelFd < 0) {
-        syslog(LOG_ERR, "Unable to open model file %s: %s", args.modelFile,
+    return samples ? (double) totalUs / (double) samples : 0.0;
+}
+
+static bool countAnnotations(const char* path, size_t* count) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        syslog(LOG_ERR, "Failed to open annotations file %s: %s", path,
                strerror(errno));
-        goto end;
+        return false;
     }
 
-    syslog(LOG_INFO, "Setting up larod connection with device %s and model %s", args.deviceName,
-           args.modelFile);
-    larodModel* model = NULL;
-    if (!setupLarod(args.deviceName, larodModelFd, &conn, &model)) {
-        goto end;
+    // Count lines, including a last one without a newline.
+    char buf[4096];
+    size_t n = 0;
+    size_t lines = 0;
+    char last = '\n';
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            lines += buf[i] == '\n';
+        }
+        last = buf[n - 1];
+    }
+    const bool failed = ferror(file) != 0;
+    fclose(file);
+    if (failed) {
+        syslog(LOG_ERR, "Failed to read annotations file %s", path);
+        return false;
     }
+    *count = lines + (last != '\n');
 
-    syslog(LOG_INFO, "Creating temporary files and memmaps for inference input and "
-           "output tensors");
+    return true;
+}
 
-    if (!createAndMapTmpFile(CONV_INP_FILE_PATTERN,
-                             args.width * args.height * CHANNELS,
-                             &larodInputAddr, &larodInputFd)) {
-        goto end;
+static bool readAnnotations(const char* path, int* groundTruth, size_t count) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        syslog(LOG_ERR, "Failed to open annotations file %s: %s", path,
+               strerror(errno));
+        return false;
     }
 
-    if (!createAndMapTmpFile(CONV_OUT_FILE_PATTERN, args.outputBytes,
-                             &larodOutputAddr, &larodOutputFd)) {
-        goto end;
+    char line[256];
+    size_t b = 0;
+    while (b < count && fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "%d", &groundTruth[b]) == 1) {
+            groundTruth[b] += 1;
+        } else {
+            groundTruth[b] = -1;
+        }
+        b++;
     }
+    fclose(file);
 
-    inputTensors = larodCreateModelInputs(model, &numInputs, &error);
-    if (!inputTensors) {
-        syslog(LOG_ERR, "Failed retrieving input tensors: %s", error->msg);
-        goto end;
-    }
-    // This app only supports 1 input tensor right now.
-    if (numInputs != 1) {
-        syslog(LOG_ERR, "Model has %zu inputs, app only supports 1 input tensor.",
-               numInputs);
-        goto end;
+    return true;
+}
+
+static bool sampleOrder(const dataset* packedDataset, const int* groundTruth,
+                        size_t maxImageId, size_t count, uint64_t seed,
+                        size_t* order) {
+    int* classes = malloc(count * sizeof(int));
+    if (!classes) {
+        syslog(LOG_ERR, "Out of memory for the classes of the images");
+        return false;
     }
-    if (!larodSetTensorFd(inputTensors[0], larodInputFd, &error)) {
-        syslog(LOG_ERR, "Failed setting input tensor fd: %s", error->msg);
-        goto end;
+    for (size_t i = 0; i < count; i++) {
+        const size_t imageId =
+            packedDataset ? datasetGetEntry(packedDataset, i)->imageId : i + 1;
+        classes[i] = imageId >= 1 && imageId <= maxImageId
+                         ? groundTruth[imageId - 1]
+                         : -1;
     }
+    const bool ret = samplingStratifiedOrder(classes, count, seed, order);
+    free(classes);
 
-    outputTensors = larodCreateModelOutputs(model, &numOutputs, &error);
-    if (!outputTensors) {
-        syslog(LOG_ERR, "Failed retrieving output tensors: %s", error->msg);
-        goto end;
+    return ret;
+}
+
+static bool cacheKey(const args_t* args, const dataset* packedDataset,
+                     uint64_t* key) {
+    const char* deviceName = args->deviceName ? args->deviceName : "default";
+    uint64_t hash = CACHE_HASH_INIT;
+
+    if (!cacheHashFile(&hash, args->modelFile)) {
+        syslog(LOG_ERR, "Unable to read model file %s", args->modelFile);
+        return false;
+    }
+    hash = cacheHash(hash, deviceName, strlen(deviceName) + 1);
+    // Another firmware may bring another larod or driver. Not every system
+    // has the file, which then leaves the OS out of the key.
+    cacheHashFile(&hash, "/etc/os-release");
+    hash = cacheHash(hash, &args->width, sizeof(args->width));
+    hash = cacheHash(hash, &args->height, sizeof(args->height));
+
+    if (packedDataset) {
+        // The index holds the size, offset and ground truth of every image,
+        // which changes with any image that is repacked.
+        hash = cacheHash(hash, datasetGetHeader(packedDataset),
+                         sizeof(datasetHeader));
+        for (size_t i = 0; i < datasetGetCount(packedDataset); i++) {
+            hash = cacheHash(hash, datasetGetEntry(packedDataset, i),
+                             sizeof(datasetIndexEntry));
+        }
+    } else {
+        const char* dir = args->jpegDir ? args->jpegDir : BIN_IMAGE_DIR;
+        hash = cacheHash(hash, dir, strlen(dir) + 1);
+        if (args->jpegDir) {
+            hash = cacheHash(hash, args->preprocessDevice,
+                             strlen(args->preprocessDevice) + 1);
+        }
+    }
+    if (args->annotationsFile &&
+        !cacheHashFile(&hash, args->annotationsFile)) {
+        syslog(LOG_ERR, "Unable to read annotations file %s",
+               args->annotationsFile);
+        return false;
+    }
+    *key = hash;
+
+    return true;
+}
+
+static bool isLogged(int priority) {
+    return (setlogmask(0) & LOG_MASK(priority)) != 0;
+}
+
+static const char* labelName(char** labels, size_t numLabels, size_t idx) {
+    return labels && idx < numLabels ? labels[idx] : "unknown";
+}
+
+static uint64_t processOutput(const outputFormat* format,
+                              const uint8_t* outputPtr, size_t count,
+                              int groundTruth, char** labels, size_t numLabels,
+                              bool logImage, resultRecord* record,
+                              statsHistogram* stages) {
+    // Classes are ranked on the raw scores, dequantization and softmax do
+    // not change the order.
+    topkResult results[TOP_K];
+    const uint64_t topkStartNs = statsNowNs();
+    const size_t numResults =
+        format->decoder->run(outputPtr, format->numClasses, format->stride,
+                             TOP_K, results);
+    uint64_t stageNs = statsNowNs() - topkStartNs;
+    statsRecord(&stages[STATS_STAGE_TOPK], stageNs);
+
+    record->imageId = (uint32_t) count;
+    record->groundTruth = groundTruth;
+    record->numClasses = (uint8_t) numResults;
+    record->hits = 0;
+    if (numResults == 0) {
+        syslog(LOG_ERR, "Image %zu has no valid scores", count);
+        return stageNs;
+    }
+
+    // Compute the most likely index.
+    const size_t maxIdx = results[0].index;
+    record->topScore = results[0].score;
+    for (size_t mm = 0; mm < numResults; mm++) {
+        record->classes[mm] = (uint32_t) results[mm].index;
+        if ((size_t) groundTruth == results[mm].index) {
+            record->hits |= RESULTS_HIT_TOP5;
+        }
+    }
+    if ((int) maxIdx == groundTruth) {
+        record->hits |= RESULTS_HIT_TOP1;
+    }
+
+    if (!logImage) {
+        return stageNs;
+    }
+
+    // The probability is only needed for the log, so it is not computed
+    // unless it is printed.
+    const uint64_t decodeStartNs = statsNowNs();
+    const float maxProb =
+        100.0f * postprocessProbability(format, outputPtr, maxIdx, maxIdx);
+    const uint64_t decodeNs = statsNowNs() - decodeStartNs;
+    statsRecord(&stages[STATS_STAGE_DECODE], decodeNs);
+    stageNs += decodeNs;
+
+    syslog(LOG_DEBUG, "Image %zu: top result is index %zu (%s) with score %.2f%%",
+           count, maxIdx, labelName(labels, numLabels, maxIdx), maxProb);
+    if (record->hits & RESULTS_HIT_TOP5) {
+        syslog(LOG_DEBUG, "Image %zu found in top5.", count);
+    } else {
+        syslog(LOG_DEBUG, "Image %zu is not top5, it's supposed to be %s, but it is classified as %s",
+               count, labelName(labels, numLabels, (size_t) groundTruth),
+               labelName(labels, numLabels, maxIdx));
+    }
+    if (record->hits & RESULTS_HIT_TOP1) {
+        syslog(LOG_DEBUG, "Image %zu found in top1.", count);
+    } else {
+        syslog(LOG_DEBUG, "Image %zu is not top1, it's supposed to be %s, but it is classified as %s",
+               count, labelName(labels, numLabels, (size_t) groundTruth),
+               labelName(labels, numLabels, maxIdx));
+    }
+
+    return stageNs;
+}
+
+static uint64_t processDetections(worker* w, const pipelineSlot* slot) {
+    runContext* ctx = w->ctx;
+    const size_t count = slot->imageIdx;
+    const size_t numOutputs = pipelineGetModelInfo(w->pipe)->numOutputs;
+    const void* outputs[PIPELINE_MAX_TENSORS];
+    for (size_t o = 0; o < numOutputs; o++) {
+        outputs[o] = slot->outputs[o].addr;
+    }
+
+    size_t idx = 0;
+    if (!mapevalFindImage(ctx->eval, count, &idx)) {
+        syslog(LOG_WARNING, "Image %zu is not in the ground truth", count);
+        return 0;
+    }
+
+    const uint64_t decodeStartNs = statsNowNs();
+    const size_t numFound = detectorDecode(w->det, outputs);
+    const uint64_t nmsStartNs = statsNowNs();
+    const size_t numKept = detectorSuppress(w->det, w->boxes);
+    const uint64_t endNs = statsNowNs();
+    statsRecord(&w->stages[STATS_STAGE_DECODE], nmsStartNs - decodeStartNs);
+    statsRecord(&w->stages[STATS_STAGE_NMS], endNs - nmsStartNs);
+
+    mapevalAddImage(ctx->eval, idx, w->boxes, numKept);
+    w->numDetections += numKept;
+
+    if (ctx->logImages) {
+        syslog(LOG_DEBUG, "Image %zu: %zu boxes above the threshold, %zu kept",
+               count, numFound, numKept);
+        for (size_t b = 0; b < numKept; b++) {
+            const detectBox* box = &w->boxes[b];
+            syslog(LOG_DEBUG, "Image %zu: %s %.3f at %.3f %.3f %.3f %.3f",
+                   count,
+                   labelName(ctx->labels, ctx->numLabels, box->classIdx),
+                   (double) box->score, (double) box->x1, (double) box->y1,
+                   (double) box->x2, (double) box->y2);
+        }
+    }
+
+    return endNs - decodeStartNs;
+}
+
+static bool setupWorker(runContext* ctx, worker* w, size_t id) {
+    const args_t* args = ctx->args;
+    larodError* error = NULL;
+    bool ret = false;
+
+    w->ctx = ctx;
+    w->id = id;
+
+    int modelFd = open(args->modelFile, O_RDONLY);
+    if (modelFd < 0) {
+        syslog(LOG_ERR, "Unable to open model file %s: %s", args->modelFile,
+               strerror(errno));
+        goto end;
     }
-    // This app only supports 1 output tensor right now.
-    if (numOutputs != 1) {
-        syslog(LOG_ERR, "Model has %zu outputs, app only supports 1 output tensor.",
-               numOutputs);
+
+    syslog(LOG_INFO, "Worker %zu: Setting up larod connection with device %s "
+           "and model %s", id,
+           args->deviceName ? args->deviceName : "default", args->modelFile);
+    if (!setupLarod(args->deviceName, modelFd, args->modelId, &w->conn,
+                    &w->model, &w->startup)) {
         goto end;
     }
-    if (!larodSetTensorFd(outputTensors[0], larodOutputFd, &error)) {
-        syslog(LOG_ERR, "Failed setting output tensor fd: %s", error->msg);
+    syslog(LOG_INFO, "Worker %zu: Connected in %.1f ms, %s model in %.1f ms",
+           id, (double) w->startup.connectNs / 1e6,
+           args->modelId ? "got" : "loaded",
+           (double) w->startup.loadNs / 1e6);
+
+    syslog(LOG_INFO, "Worker %zu: Creating %zu inference slots with buffers "
+           "for every input and output tensor", id, args->inflight);
+    if (!pipelineCreate(w->conn, w->model, args->inflight, args->zeroCopy,
+                        &w->pipe)) {
         goto end;
     }
-    // App supports only one input/output tensor.
-    infReq = larodCreateJobRequest(model, inputTensors, 1, outputTensors,
-                                         1, NULL, &error);
-    if (!infReq) {
-        syslog(LOG_ERR, "Failed creating inference request: %s", error->msg);
+
+    // Images are loaded into the first input. With zero-copy, larod reads the
+    // whole input from the dataset, so the sizes have to match exactly.
+    const size_t modelInputBytes = pipelineGetModelInfo(w->pipe)->inputBytes[0];
+    if (modelInputBytes < ctx->inputBytes ||
+        (args->zeroCopy && modelInputBytes != ctx->inputBytes)) {
+        syslog(LOG_ERR, "Images are %zu bytes but the model input is %zu bytes",
+               ctx->inputBytes, modelInputBytes);
         goto end;
     }
 
-    if (args.labelsFile) {
-        if (!parseLabels(&labels, &labelFileData, args.labelsFile,
-                         &numLabels)) {
-            syslog(LOG_ERR, "Failed creating parsing labels file");
+    if (args->jpegDir && !setupPreprocessing(ctx, w)) {
+        goto end;
+    }
+
+    if (args->readAhead) {
+        if (!ioEngineCreate(args->ioBackend, args->readAhead,
+                            args->jpegDir ? JPEG_READ_BYTES : ctx->inputBytes,
+                            &w->io)) {
             goto end;
         }
+        syslog(LOG_INFO, "Worker %zu: Reading %zu files ahead with %s", id,
+               args->readAhead, ioEngineBackendName(w->io));
     }
 
-    /* make arrays of ground truths */
-    int ground_truth[50000];
-    FILE* file = fopen(args.annotationsFile, "r");
-    if (file == NULL) {
-        syslog(LOG_ERR, "Error : Failed to open annotations file: %s\n", strerror(errno));
+    if (args->zeroCopy) {
+        // From here on larod reads every image straight from the dataset
+        // file, only the offset of the tensor changes between jobs.
+        if (!pipelineBindInputFd(w->pipe, datasetGetFd(ctx->packedDataset),
+                                 &error)) {
+            syslog(LOG_ERR, "Failed binding input tensors to dataset: %s",
+                   error->msg);
+            goto end;
+        }
+    }
 
-        return 1;
+    ret = true;
+
+end:
+    if (modelFd >= 0) {
+        close(modelFd);
     }
-    char line[256];
-    int b = 0;
-    while (fgets(line, sizeof(line), file)) {
+    larodClearError(&error);
+
+    return ret;
+}
+
+static bool setupPreprocessing(runContext* ctx, worker* w) {
+    const args_t* args = ctx->args;
+    larodError* error = NULL;
+    larodMap* params = NULL;
+    bool ret = false;
+
+    // The cvflow models take planar input, like the .bin files converted
+    // for them.
+    const bool isPlanar = hasPlanarInput(w->conn, w->model);
+
+    params = larodCreateMap(&error);
+    if (!params ||
+        !larodMapSetStr(params, "image.input.format", "rgb-interleaved",
+                        &error) ||
+        !larodMapSetIntArr2(params, "image.input.size", JPEG_MAX_SIDE,
+                            JPEG_MAX_SIDE, &error) ||
+        !larodMapSetStr(params, "image.output.format",
+                        isPlanar ? "rgb-planar" : "rgb-interleaved", &error) ||
+        !larodMapSetIntArr2(params, "image.output.size", args->width,
+                            args->height, &error)) {
+        syslog(LOG_ERR, "Failed setting preprocessing parameters: %s",
+               error ? error->msg : "out of memory");
+        goto end;
+    }
+
+    const larodDevice* dev =
+        larodGetDevice(w->conn, args->preprocessDevice, 0, &error);
+    if (!dev) {
+        syslog(LOG_ERR, "Unable to get preprocessing device %s: %s",
+               args->preprocessDevice, error->msg);
+        goto end;
+    }
+    w->preModel = larodLoadModel(w->conn, -1, dev, LAROD_ACCESS_PRIVATE,
+                                 "Accuracy test preprocessing", params, &error);
+    if (!w->preModel) {
+        syslog(LOG_ERR, "Unable to load preprocessing model: %s", error->msg);
+        goto end;
+    }
+
+    syslog(LOG_INFO, "Worker %zu: Chaining preprocessing on %s before "
+           "inference", w->id, args->preprocessDevice);
+    if (!pipelineChainPreprocessing(w->pipe, w->preModel,
+                                    JPEG_MAX_SIDE * JPEG_MAX_SIDE * 3,
+                                    &error)) {
+        syslog(LOG_ERR, "Failed setting up preprocessing jobs: %s",
+               error ? error->msg : "out of memory");
+        goto end;
+    }
+
+    ret = true;
+
+end:
+    larodDestroyMap(&params);
+    larodClearError(&error);
+
+    return ret;
+}
+
+static bool hasPlanarInput(larodConnection* conn, const larodModel* model) {
+    larodError* error = NULL;
+    size_t numTensors = 0;
+    bool planar = false;
+
+    larodTensor** tensors = larodCreateModelInputs(model, &numTensors, &error);
+    if (tensors && numTensors > 0) {
+        planar = larodGetTensorLayout(tensors[0], &error) ==
+                 LAROD_TENSOR_LAYOUT_NCHW;
+    }
+    larodClearError(&error);
+    if (tensors) {
+        larodDestroyTensors(conn, &tensors, numTensors, &error);
+        larodClearError(&error);
+    }
+
+    return planar;
+}
+
+static bool setupOutputFormat(larodConnection* conn, const larodModel* model,
+                              size_t outputBytes, const tfliteTensorInfo* info,
+                              outputFormat* format) {
+    larodError* error = NULL;
+    size_t numTensors = 0;
+    bool ret = false;
+
+    larodTensor** tensors = larodCreateModelOutputs(model, &numTensors, &error);
+    if (!tensors || numTensors == 0) {
+        syslog(LOG_ERR, "Unable to describe the model output: %s",
+               error ? error->msg : "no outputs");
+        goto end;
+    }
+
+    topkType type = TOPK_TYPE_UINT8;
+    if (!getOutputType(tensors[0], info, &type)) {
+        goto end;
+    }
+
+    // The classes lie along the largest dimension, all others are 1, e.g.
+    // 1x1001 or 1x1001x1x1. The pitch of the next dimension is the distance
+    // between two scores, which is 32 bytes on the cvflow devices.
+    const size_t typeSize = topkTypeSize(type);
+    size_t numClasses = outputBytes / typeSize;
+    size_t stride = typeSize;
+    const larodTensorDims* dims = larodGetTensorDims(tensors[0], &error);
+    larodClearError(&error);
+    const larodTensorPitches* pitches =
+        larodGetTensorPitches(tensors[0], &error);
+    larodClearError(&error);
+    if (dims && dims->len > 0) {
+        size_t classDim = 0;
+        for (size_t d = 1; d < dims->len; d++) {
+            if (dims->dims[d] > dims->dims[classDim]) {
+                classDim = d;
+            }
+        }
+        numClasses = dims->dims[classDim];
+        for (size_t d = classDim + 1; d < dims->len; d++) {
+            stride *= dims->dims[d];
+        }
+        if (classDim + 1 < dims->len && pitches &&
+            pitches->len == dims->len) {
+            stride = pitches->pitches[classDim + 1];
+        }
+    }
+
+    if (numClasses == 0 || outputBytes < typeSize ||
+        numClasses > (outputBytes - typeSize) / stride + 1) {
+        syslog(LOG_ERR, "Output of %zu classes %zu bytes apart does not fit "
+               "in %zu bytes", numClasses, stride, outputBytes);
+        goto end;
+    }
+    const topkDecoder* decoder = topkFindDecoder(type, stride);
+    if (!decoder) {
+        syslog(LOG_ERR, "No decoder for scores %zu bytes apart", stride);
+        goto end;
+    }
+
+    postprocessInit(format, decoder, stride, numClasses, info);
+    syslog(LOG_INFO, "Output decoder %s: %zu classes %zu bytes apart",
+           decoder->name, numClasses, stride);
+    if (info) {
+        syslog(LOG_INFO, "Output has %zu classes with scale %g and zero point %d%s",
+               format->numClasses, (double) format->scale, format->zeroPoint,
+               format->isProbability ? ", written by softmax" : "");
+    }
+
+    ret = true;
+
+end:
+    if (tensors) {
+        larodDestroyTensors(conn, &tensors, numTensors, &error);
+    }
+    larodClearError(&error);
+
+    return ret;
+}
+
+static bool setupDetection(larodConnection* conn, const larodModel* model,
+                           const pipelineModelInfo* modelInfo,
+                           const tfliteTensorInfo* info, const args_t* args,
+                           detectConfig* config) {
+    larodError* error = NULL;
+    size_t numTensors = 0;
+    bool ret = false;
+
+    larodTensor** tensors = larodCreateModelOutputs(model, &numTensors, &error);
+    if (!tensors || numTensors == 0) {
+        syslog(LOG_ERR, "Unable to describe the model output: %s",
+               error ? error->msg : "no outputs");
+        goto end;
+    }
+
+    *config = (detectConfig){
+        .format = args->detectFormat,
+        .scale = 1.0f,
+        .confThreshold = args->confThreshold,
+        .iouThreshold = args->iouThreshold,
+        .maxDetections = args->maxDetections,
+    };
+    if (config->format == DETECT_FORMAT_SSD) {
+        if (!setupSsdOutputs(tensors, numTensors, modelInfo, config)) {
+            goto end;
+        }
+        syslog(LOG_INFO, "Detection output ssd: %zu boxes, confidence "
+               "threshold %g", config->numAnchors,
+               (double) config->confThreshold);
+        ret = true;
+        goto end;
+    }
+    if (!getOutputType(tensors[0], info, &config->type)) {
+        goto end;
+    }
+    if (config->type == TOPK_TYPE_UINT8 || config->type == TOPK_TYPE_INT8) {
+        if (!info || !info->quantized || !(info->scale > 0.0f)) {
+            syslog(LOG_ERR, "The quantization of the detection output is "
+                   "not known");
+            goto end;
+        }
+        config->scale = info->scale;
+        config->zeroPoint = info->zeroPoint;
+    }
+
+    // YOLOv5 outputs 1 x anchors x (5 + classes) and YOLOv8 outputs
+    // 1 x (4 + classes) x anchors, both densely packed.
+    const larodTensorDims* dims = larodGetTensorDims(tensors[0], &error);
+    larodClearError(&error);
+    if (!dims || dims->len < 3) {
+        syslog(LOG_ERR, "The detection output has fewer than three "
+               "dimensions");
+        goto end;
+    }
+    const size_t rows = dims->dims[dims->len - 2];
+    const size_t cols = dims->dims[dims->len - 1];
+    const size_t header = config->format == DETECT_FORMAT_YOLOV5 ? 5 : 4;
+    const size_t classValues =
+        config->format == DETECT_FORMAT_YOLOV5 ? cols : rows;
+    config->numAnchors = config->format == DETECT_FORMAT_YOLOV5 ? rows : cols;
+    config->numClasses = classValues > header ? classValues - header : 0;
+    if (config->numAnchors == 0 || config->numClasses == 0 ||
+        detectOutputBytes(config) > modelInfo->outputBytes[0]) {
+        syslog(LOG_ERR, "Output of %zu x %zu values is not a %s output",
+               rows, cols, detectFormatName(config->format));
+        goto end;
+    }
+
+    syslog(LOG_INFO, "Detection output %s: %zu anchors of %zu classes, "
+           "confidence threshold %g, IoU threshold %g",
+           detectFormatName(config->format), config->numAnchors,
+           config->numClasses, (double) config->confThreshold,
+           (double) config->iouThreshold);
+
+    ret = true;
+
+end:
+    if (tensors) {
+        larodDestroyTensors(conn, &tensors, numTensors, &error);
+    }
+    larodClearError(&error);
+
+    return ret;
+}
+
+static bool setupSsdOutputs(larodTensor** tensors, size_t numTensors,
+                            const pipelineModelInfo* modelInfo,
+                            detectConfig* config) {
+    larodError* error = NULL;
 
-        /* note that fgets don't strip the terminating \n, checking its
-        presence would allow to handle lines longer that sizeof(line) */
-        // syslog(LOG_INFO, "element in each line of text file %s", line);
-        //ground_truth[b] = atoi(line);
-        sscanf(line, "%d", &ground_truth[b]);
-        ground_truth[b] += 1;
-        if (b<10) {
-            // printf("%3d: %s\n", ground_truth[b], line);
+    if (numTensors < DETECT_SSD_OUTPUTS ||
+        modelInfo->numOutputs < DETECT_SSD_OUTPUTS) {
+        syslog(LOG_ERR, "An ssd model has %d outputs, boxes, classes, scores "
+               "and count, but this model has %zu", DETECT_SSD_OUTPUTS,
+               numTensors);
+        return false;
+    }
+    // The detection post-processing always writes floats.
+    for (size_t t = 0; t < DETECT_SSD_OUTPUTS; t++) {
+        const larodTensorDataType dataType =
+            larodGetTensorDataType(tensors[t], &error);
+        larodClearError(&error);
+        if (dataType != LAROD_TENSOR_DATA_TYPE_FLOAT32 &&
+            dataType != LAROD_TENSOR_DATA_TYPE_UNSPECIFIED &&
+            dataType != LAROD_TENSOR_DATA_TYPE_INVALID) {
+            syslog(LOG_ERR, "Output %zu of an ssd model must be float32", t);
+            return false;
         }
-        b += 1;
     }
+    config->type = TOPK_TYPE_FLOAT32;
+
+    // The boxes are 1 x boxes x 4, followed by the classes and scores of
+    // every box and the count.
+    const larodTensorDims* dims = larodGetTensorDims(tensors[0], &error);
+    larodClearError(&error);
+    if (!dims || dims->len < 2 || dims->dims[dims->len - 1] != 4) {
+        syslog(LOG_ERR, "The first output of an ssd model must hold four "
+               "corners per box");
+        return false;
+    }
+    config->numAnchors = dims->dims[dims->len - 2];
+    const size_t numBoxes = config->numAnchors;
+    if (numBoxes == 0 ||
+        detectOutputBytes(config) > modelInfo->outputBytes[0] ||
+        numBoxes * sizeof(float) > modelInfo->outputBytes[1] ||
+        numBoxes * sizeof(float) > modelInfo->outputBytes[2] ||
+        sizeof(float) > modelInfo->outputBytes[3]) {
+        syslog(LOG_ERR, "The outputs of %zu, %zu, %zu and %zu bytes do not "
+               "hold %zu ssd boxes", modelInfo->outputBytes[0],
+               modelInfo->outputBytes[1], modelInfo->outputBytes[2],
+               modelInfo->outputBytes[3], numBoxes);
+        return false;
+    }
+
+    return true;
+}
+
+static bool getOutputType(const larodTensor* tensor,
+                          const tfliteTensorInfo* info, topkType* type) {
+    larodError* error = NULL;
+
+    const larodTensorDataType dataType =
+        larodGetTensorDataType(tensor, &error);
+    larodClearError(&error);
+    switch (dataType) {
+    case LAROD_TENSOR_DATA_TYPE_UINT8:
+        *type = TOPK_TYPE_UINT8;
+        break;
+    case LAROD_TENSOR_DATA_TYPE_INT8:
+        *type = TOPK_TYPE_INT8;
+        break;
+    case LAROD_TENSOR_DATA_TYPE_FLOAT16:
+        *type = TOPK_TYPE_FLOAT16;
+        break;
+    case LAROD_TENSOR_DATA_TYPE_FLOAT32:
+        *type = TOPK_TYPE_FLOAT32;
+        break;
+    case LAROD_TENSOR_DATA_TYPE_INVALID:
+    case LAROD_TENSOR_DATA_TYPE_UNSPECIFIED:
+        // Models other than TensorFlow Lite are expected to output uint8_t
+        // values.
+        if (!info || info->type == TFLITE_TYPE_UINT8) {
+            *type = TOPK_TYPE_UINT8;
+        } else if (info->type == TFLITE_TYPE_INT8) {
+            *type = TOPK_TYPE_INT8;
+        } else if (info->type == TFLITE_TYPE_FLOAT16) {
+            *type = TOPK_TYPE_FLOAT16;
+        } else if (info->type == TFLITE_TYPE_FLOAT32) {
+            *type = TOPK_TYPE_FLOAT32;
+        } else {
+            syslog(LOG_ERR, "Unsupported output tensor type %d", info->type);
+            return false;
+        }
+        break;
+    default:
+        syslog(LOG_ERR, "Unsupported output tensor type %d", dataType);
+        return false;
+    }
+
+    return true;
+}
+
+static size_t imageNumber(const runContext* ctx, size_t i) {
+    return ctx->eval ? mapevalGetImageId(ctx->eval, i) : i + 1;
+}
+
+static void imagePath(const runContext* ctx, size_t count, char* path,
+                      size_t size) {
+    if (ctx->args->jpegDir) {
+        snprintf(path, size, "%s/%zu.JPEG", ctx->args->jpegDir, count);
+    } else {
+        snprintf(path, size, BIN_IMAGE_DIR "/%zu.bin", count);
+    }
+}
+
+static bool samplePrecise(runContext* ctx) {
+    const size_t scored = atomic_load(&ctx->sampleScored);
+    samplingInterval top1;
+    samplingInterval top5;
+
+    samplingWilson(atomic_load(&ctx->sampleTop1), scored, ctx->sampleZ, &top1);
+    samplingWilson(atomic_load(&ctx->sampleTop5), scored, ctx->sampleZ, &top5);
+    const double tolerance = ctx->args->sampleTolerance;
+
+    return top1.rate - top1.low <= tolerance &&
+           top1.high - top1.rate <= tolerance &&
+           top5.rate - top5.low <= tolerance &&
+           top5.high - top5.rate <= tolerance;
+}
+
+static bool takeImage(worker* w, size_t* i) {
+    runContext* ctx = w->ctx;
+
+    do {
+        if (w->chunkNext == w->chunkEnd) {
+            if (atomic_load(&ctx->failed) ||
+                atomic_load(&ctx->stoppedEarly)) {
+                return false;
+            }
+            if (ctx->order && samplePrecise(ctx)) {
+                atomic_store(&ctx->stoppedEarly, true);
+                return false;
+            }
+            const size_t first =
+                atomic_fetch_add(&ctx->nextImage, IMAGE_CHUNK);
+            if (first >= ctx->numImages) {
+                return false;
+            }
+            w->chunkNext = first;
+            w->chunkEnd = first + IMAGE_CHUNK < ctx->numImages
+                              ? first + IMAGE_CHUNK
+                              : ctx->numImages;
+        }
+        *i = ctx->order ? ctx->order[w->chunkNext] : w->chunkNext;
+        w->chunkNext++;
+    } while (ctx->cache && takeCached(w, *i));
+
+    return true;
+}
+
+static bool takeCached(worker* w, size_t i) {
+    runContext* ctx = w->ctx;
+    const size_t imageId = positionImageId(ctx, i);
+
+    if (!cacheHas(ctx->cache, imageId)) {
+        return false;
+    }
+    countHits(w, resultsGet(ctx->results, imageId));
+    w->numCached++;
+
+    return true;
+}
+
+static void countHits(worker* w, const resultRecord* record) {
+    runContext* ctx = w->ctx;
+    const bool top1 = (record->hits & RESULTS_HIT_TOP1) != 0;
+    const bool top5 = (record->hits & RESULTS_HIT_TOP5) != 0;
+
+    w->sumTop1 += top1;
+    w->sumTop5 += top5;
+    if (ctx->order) {
+        atomic_fetch_add(&ctx->sampleTop1, top1);
+        atomic_fetch_add(&ctx->sampleTop5, top5);
+        atomic_fetch_add(&ctx->sampleScored, 1);
+    }
+}
+
+static size_t positionImageId(const runContext* ctx, size_t i) {
+    return ctx->packedDataset ? datasetGetEntry(ctx->packedDataset, i)->imageId
+                              : imageNumber(ctx, i);
+}
+
+static bool readJpegFile(worker* w, const char* path, size_t* size,
+                         bool* found) {
+    bool ret = true;
+
+    *found = false;
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return true;
+    }
+
+    struct stat fileStats = {0};
+    if (fstat(fileno(file), &fileStats) < 0 || fileStats.st_size <= 0) {
+        syslog(LOG_WARNING, "Unable to get size of %s", path);
+        goto end;
+    }
+    *size = (size_t) fileStats.st_size;
+    if (*size > w->jpegCap) {
+        uint8_t* data = realloc(w->jpegData, *size);
+        if (!data) {
+            syslog(LOG_ERR, "Failed allocating %zu bytes for %s", *size, path);
+            ret = false;
+            goto end;
+        }
+        w->jpegData = data;
+        w->jpegCap = *size;
+    }
+    if (fread(w->jpegData, 1, *size, file) != *size) {
+        syslog(LOG_WARNING, "Unable to read %s", path);
+        goto end;
+    }
+    *found = true;
+
+end:
     fclose(file);
-    int top1[N_IMAGES] = {0};
-    int sum_top1 = 0;
-    int sum_top5 = 0;
 
-    int top5[N_IMAGES] = {0};
-    float avg_top1;
-    float avg_top5;
+    return ret;
+}
 
-    for (size_t count = 1; count <= N_IMAGES; count++) {
-        char img_name[50];
-        snprintf(img_name, 50, "/var/spool/storage/SD_DISK/imagenet/%zu.bin", count);
-        //printf("image name is %s\n", img_name);
+static bool loadJpeg(worker* w, pipelineSlot* slot, size_t count,
+                     const ioBuffer* buf, bool* loaded) {
+    larodError* error = NULL;
+
+    *loaded = false;
+    char path[PATH_MAX];
+    imagePath(w->ctx, count, path, sizeof(path));
+
+    const uint8_t* data = NULL;
+    size_t size = 0;
+    if (buf) {
+        if (!buf->ok) {
+            return true;
+        }
+        data = buf->data;
+        size = buf->size;
+    } else {
+        bool found = false;
+        if (!readJpegFile(w, path, &size, &found)) {
+            return false;
+        }
+        if (!found) {
+            return true;
+        }
+        data = w->jpegData;
+    }
+
+    size_t width = 0;
+    size_t height = 0;
+    if (!jpegDecode(data, size, JPEG_MAX_SIDE, JPEG_MAX_SIDE,
+                    slot->preInputAddr, &width, &height)) {
+        syslog(LOG_WARNING, "Unable to decode %s", path);
+        return true;
+    }
+    // The image fills the top left corner of the preprocessing input and is
+    // scaled as a whole, like larod_convert.py does.
+    if (!pipelineSetCrop(slot, 0, 0, width, height, &error)) {
+        syslog(LOG_ERR, "Failed setting preprocessing crop: %s", error->msg);
+        larodClearError(&error);
+        return false;
+    }
+    *loaded = true;
+
+    return true;
+}
+
+static void destroyWorker(worker* w) {
+    // The ring waits for any job still in flight before the tensors it
+    // references are destroyed.
+    pipelineDestroy(&w->pipe);
+    // Only the model handle is released here. We count on larod service to
+    // release the privately loaded model when the session is disconnected in
+    // larodDisconnect().
+    larodDestroyModel(&w->model);
+    larodDestroyModel(&w->preModel);
+    ioEngineDestroy(&w->io);
+    detectorDestroy(&w->det);
+    free(w->jpegData);
+    w->jpegData = NULL;
+    if (w->conn) {
+        larodDisconnect(&w->conn, NULL);
+    }
+}
+
+static bool scoreSlot(worker* w, pipelineSlot* slot) {
+    runContext* ctx = w->ctx;
+
+    if (slot->failed) {
+        syslog(LOG_ERR, "Unable to run inference on model %s: %s",
+               ctx->args->modelFile, slot->errorMsg);
+        return false;
+    }
+    if (slot->preJobReq) {
+        statsRecord(&w->stages[STATS_STAGE_PREPROCESS],
+                    slot->preDoneNs - slot->submitNs);
+    }
+    if (w->stages[STATS_STAGE_INFERENCE].count == 0) {
+        w->startup.firstInferenceNs = slot->doneNs - slot->preDoneNs;
+    }
+    statsRecord(&w->stages[STATS_STAGE_INFERENCE],
+                slot->doneNs - slot->preDoneNs);
+
+    // Everything that is not topk, decode or nms counts as bookkeeping.
+    const uint64_t startNs = statsNowNs();
+    uint64_t stageNs = 0;
+    if (ctx->eval) {
+        stageNs = processDetections(w, slot);
+    } else {
+        resultRecord* record = resultsGet(ctx->results, slot->imageIdx);
+        stageNs = processOutput(ctx->format, slot->outputs[0].addr,
+                                slot->imageIdx,
+                                ctx->groundTruth[slot->imageIdx - 1],
+                                ctx->labels, ctx->numLabels, ctx->logImages,
+                                record, w->stages);
+        countHits(w, record);
+        if (ctx->cache) {
+            cacheAppend(ctx->cache, record);
+        }
+    }
+    w->numScored++;
+    const uint64_t elapsedNs = statsNowNs() - startNs;
+    statsRecord(&w->stages[STATS_STAGE_BOOKKEEPING],
+                elapsedNs > stageNs ? elapsedNs - stageNs : 0);
+
+    return true;
+}
+
+static bool loadImage(worker* w, pipelineSlot* slot, size_t i,
+                      const ioBuffer* buf, size_t* count, bool* loaded) {
+    runContext* ctx = w->ctx;
+    const dataset* packedDataset = ctx->packedDataset;
+    larodError* error = NULL;
+
+    *loaded = false;
+    if (packedDataset) {
+        *count = datasetGetEntry(packedDataset, i)->imageId;
+        if (*count < 1 || *count > ctx->maxImageId) {
+            syslog(LOG_ERR, "Image number %zu in dataset is out of range",
+                   *count);
+            return true;
+        }
+        const uint64_t loadStartNs = statsNowNs();
+        if (ctx->args->zeroCopy) {
+            const int64_t offset =
+                (int64_t) datasetGetEntry(packedDataset, i)->offset;
+            if (!larodSetTensorFdOffset(slot->inputTensors[0], offset, &error)) {
+                syslog(LOG_ERR, "Failed setting input tensor offset: %s",
+                       error->msg);
+                larodClearError(&error);
+                return false;
+            }
+        } else {
+            const void* image = datasetMapImage(packedDataset, i);
+            if (!image) {
+                return true;
+            }
+            memcpy(slot->inputs[0].addr, image, ctx->inputBytes);
+            datasetUnmapImage(packedDataset, image);
+        }
+        statsRecord(&w->stages[STATS_STAGE_LOAD], statsNowNs() - loadStartNs);
+    } else if (ctx->args->jpegDir) {
+        *count = imageNumber(ctx, i);
+        const uint64_t loadStartNs = statsNowNs();
+        if (!loadJpeg(w, slot, *count, buf, loaded)) {
+            return false;
+        }
+        if (!*loaded) {
+            return true;
+        }
+        statsRecord(&w->stages[STATS_STAGE_LOAD], statsNowNs() - loadStartNs);
+    } else {
+        *count = imageNumber(ctx, i);
+        const uint64_t loadStartNs = statsNowNs();
+        if (buf) {
+            if (!buf->ok) {
+                return true;
+            }
+            if (buf->size != ctx->inputBytes) {
+                syslog(LOG_ERR, "Unable to load image");
+            }
+            memcpy(slot->inputs[0].addr, buf->data,
+                   buf->size < ctx->inputBytes ? buf->size : ctx->inputBytes);
+            statsRecord(&w->stages[STATS_STAGE_LOAD],
+                        statsNowNs() - loadStartNs);
+            *loaded = true;
+            return true;
+        }
+        char img_name[PATH_MAX];
+        imagePath(ctx, *count, img_name, sizeof(img_name));
         FILE *fp_input;
         fp_input = fopen(img_name, "rb");
         if (fp_input == NULL) {
-            continue;
+            return true;
         }
-        if (fread(larodInputAddr, 1, args.width * args.height * 3, fp_input) != args.width * args.height * 3) {
+        if (fread(slot->inputs[0].addr, 1, ctx->inputBytes, fp_input) !=
+            ctx->inputBytes) {
             syslog(LOG_ERR, "Unable to load image");
         }
         fclose(fp_input);
+        statsRecord(&w->stages[STATS_STAGE_LOAD], statsNowNs() - loadStartNs);
+    }
+    *loaded = true;
+
+    return true;
+}
+
+static bool runWorker(worker* w) {
+    runContext* ctx = w->ctx;
+    larodError* error = NULL;
+    bool ret = false;
+    const uint64_t startUs = getTimeUs();
+
+    // Images are loaded and submitted in order while up to args.inflight
+    // jobs run in the background. A slot handed back by the ring still holds
+    // the output of the image it was last submitted with, which is scored
+    // before the slot is reused for the next image. With read-ahead, the
+    // files of the next images are read while this goes on, and each image
+    // is loaded from its buffer once the read is done.
+    while (!atomic_load(&ctx->failed)) {
+        size_t i = 0;
+        const ioBuffer* buf = NULL;
+        if (w->io) {
+            while (ioEnginePending(w->io) < ctx->args->readAhead &&
+                   takeImage(w, &i)) {
+                char path[PATH_MAX];
+                imagePath(ctx, imageNumber(ctx, i), path, sizeof(path));
+                if (!ioEngineSubmit(w->io, path,
+                                    ctx->args->jpegDir ? 0 : ctx->inputBytes,
+                                    i)) {
+                    goto end;
+                }
+            }
+            const uint64_t waitStartNs = statsNowNs();
+            buf = ioEngineWait(w->io);
+            if (!buf) {
+                break;
+            }
+            statsRecord(&w->ioWait, statsNowNs() - waitStartNs);
+            i = buf->tag;
+        } else if (!takeImage(w, &i)) {
+            break;
+        }
+
+        pipelineSlot* slot = pipelineNext(w->pipe);
+        if (pipelineSlotHasResult(slot) && !scoreSlot(w, slot)) {
+            goto end;
+        }
 
-        if (!larodRunJob(conn, infReq, &error)) {
+        size_t count = 0;
+        bool loaded = false;
+        const bool loadOk = loadImage(w, slot, i, buf, &count, &loaded);
+        if (w->io) {
+            ioEngineRelease(w->io);
+        }
+        if (!loadOk) {
+            goto end;
+        }
+        if (!loaded) {
+            continue;
+        }
+
+        if (!pipelineSubmit(w->pipe, slot, count, &error)) {
             syslog(LOG_ERR, "Unable to run inference on model %s: %s (%d)",
-                args.modelFile, error->msg, error->code);
+                ctx->args->modelFile, error->msg, error->code);
             goto end;
         }
+    }
 
-        // Compute the most likely index.
-        float maxProb = 0;
-        uint8_t maxScore = 0;
-        size_t maxIdx = 0;
-        uint8_t* outputPtr = (uint8_t*) larodOutputAddr;
-        int score_array_size = args.outputBytes;
-        int score_array[score_array_size];
-        float score_array_cv25[score_array_size];
-        int score_array_indices[score_array_size];
-        // The output has to be read differently depending on larod device.
-        // In the case of the cv25, the space per element is 32 bytes and the
-        // output is a float padded with zeros.
-        // In the cases of artpec7, artpec8, and artpec9, the space per element is 1 byte
-        // and the output is an uint8_t that has to be processed with softmax.
-        // This part of the code can be improved by using better pointer casting,
-        // subject to future changes.
-        int spacePerElement;
-        if (strcmp(args.deviceName, "ambarella-cvflow") == 0) {
-            spacePerElement = 32;
-            float score;
-            for (size_t j = 0; j < args.outputBytes/spacePerElement; j++) {
-                score = *((float*) (outputPtr + (j*spacePerElement)));
-                score_array_cv25[j] = score;
-                score_array_indices[j] = j;
-                if (score > maxProb) {
-                    maxProb = score;
-                    maxIdx = j;
-                }
+    // Score the jobs that are still in flight.
+    pipelineSlot* slot;
+    while ((slot = pipelineDrain(w->pipe))) {
+        pipelineSlotHasResult(slot);
+        if (!scoreSlot(w, slot)) {
+            goto end;
         }
-        } else {
-            spacePerElement = 1;
-            uint8_t score;
-            for (size_t j = 0; j < args.outputBytes/spacePerElement; j++) {
-                score = *((uint8_t*) (outputPtr + (j*spacePerElement)));
-                score_array[j] = score;
-                score_array_indices[j] = j;
-                if (score > maxScore) {
-                    maxScore = score;
-                    maxIdx = j;
-                }
-            }
+    }
 
-            float sum = 0.0;
-            for (size_t j = 0; j < args.outputBytes/spacePerElement; j++) {
-                score = *((uint8_t*) (outputPtr + (j*spacePerElement)));
-                sum += exp(score - maxScore);
-            }
-            maxProb = 1/sum;
+    ret = true;
+
+end:
+    if (!ret) {
+        atomic_store(&ctx->failed, true);
+    }
+    w->elapsedUs = getTimeUs() - startUs;
+    w->ok = ret;
+    larodClearError(&error);
+
+    return ret;
+}
+
+static void* workerThread(void* arg) {
+    runWorker(arg);
+
+    return NULL;
+}
+
+/**
+ * brief Main function
+ */
+int main(int argc, char** argv) {
+    // Hardcode to use three image "color" channels (eg. RGB).
+    const unsigned int CHANNELS = 3;
+
+    bool ret = false;
+    worker* workers = NULL;
+    size_t numWorkers = 0;
+    dataset* packedDataset = NULL;
+    arena* runArena = NULL;
+    resultsSink* results = NULL;
+    resultsCache* cache = NULL;
+    mapeval* eval = NULL;
+    // Merged timing of all workers.
+    statsRun* run = NULL;
+    int larodModelFd = -1;
+    char** labels = NULL; // This is the array of label strings. The label
+                          // entries points into the large labelFileData buffer.
+    size_t numLabels = 0; // Number of entries in the labels array.
+    char* labelFileData =
+        NULL; // Buffer holding the complete collection of label strings.
+    args_t args;
+
+    // Open the syslog to report messages for "accuracy_measure"
+    openlog("accuracy_measure", LOG_PID|LOG_CONS, LOG_USER);
+
+    syslog(LOG_INFO, "Starting ...");
+
+    if (!parseArgs(argc, argv, &args)) {
+        goto end;
+    }
+    setlogmask(LOG_UPTO(args.logLevel));
+
+    larodModelFd = open(args.modelFile, O_RDONLY);
+    if (larodModelFd < 0) {
+        syslog(LOG_ERR, "Unable to open model file %s: %s", args.modelFile,
+               strerror(errno));
+        goto end;
+    }
+
+    // For TensorFlow Lite models, the quantization of the scores is read
+    // from the output tensor in the model file. How the scores are laid out
+    // is asked from larod once the model is loaded, see setupOutputFormat().
+    // Without a device name, the default device of the connection is used.
+    tfliteTensorInfo outputInfo;
+    const bool haveOutputInfo = tfliteGetOutputInfo(larodModelFd, 0, &outputInfo);
+    outputFormat format;
+
+    const size_t inputBytes = args.width * args.height * CHANNELS;
+    if (args.datasetFile) {
+        if (!datasetOpen(args.datasetFile, &packedDataset)) {
+            goto end;
+        }
+        const datasetHeader* header = datasetGetHeader(packedDataset);
+        if (header->imageBytes != inputBytes) {
+            syslog(LOG_ERR, "Dataset images are %llu bytes but the model "
+                   "expects %zu bytes", (unsigned long long) header->imageBytes,
+                   inputBytes);
+            goto end;
         }
+    }
 
-        int l, m;
-        int max, temp;
+    if (args.jpegDir && args.datasetFile) {
+        syslog(LOG_ERR, "JPEG images cannot be read together with a dataset");
+        goto end;
+    }
+    if (args.readAhead && args.datasetFile) {
+        syslog(LOG_ERR, "Read-ahead only applies to image files, the dataset "
+               "is mapped");
+        goto end;
+    }
 
-        // Partial selection sort, move k max elements to front
-        if (strcmp(args.deviceName, "ambarella-cvflow") == 0) {
+    double copySampleUs = 0.0;
+    if (args.zeroCopy) {
+        if (!packedDataset) {
+            syslog(LOG_ERR, "Zero-copy input requires a packed dataset");
+            goto end;
+        }
+        copySampleUs = measureCopyPath(packedDataset, inputBytes);
+        syslog(LOG_INFO, "Input tensors are bound directly to the dataset file");
+    }
 
-            for (l = 0; l < 5; l++) {
+    if (args.labelsFile) {
+        if (!parseLabels(&labels, &labelFileData, args.labelsFile,
+                         &numLabels)) {
+            syslog(LOG_ERR, "Failed creating parsing labels file");
+            goto end;
+        }
+    } else if (packedDataset) {
+        size_t labelsSize = 0;
+        const char* datasetLabels = datasetGetLabels(packedDataset, &labelsSize);
+        if (datasetLabels) {
+            // The mapping is read only, so split a copy of the labels text.
+            labelFileData = malloc(labelsSize + 1);
+            if (!labelFileData) {
+                syslog(LOG_ERR, "Failed allocating labels text buffer: %s",
+                       strerror(errno));
+                goto end;
+            }
+            memcpy(labelFileData, datasetLabels, labelsSize);
+            if (!splitLabels(labelFileData, labelsSize, &labels, &numLabels)) {
+                syslog(LOG_ERR, "Failed parsing labels embedded in dataset");
+                goto end;
+            }
+        }
+    }
 
-            max = l;
-            // Find next max index
-            for (m = l+1; m < score_array_size; m++) {
-                if (score_array_cv25[m] > score_array_cv25[max]) {
-                    max = m;
-                }
+    // The number of images is taken from the dataset, or else from the
+    // annotations file. Images are numbered from 1, and the ground truth and
+    // results are indexed by image number. The ground truth of a detection
+    // model lists the numbers of its images, which need not be contiguous.
+    const bool isDetection = args.detectFormat != DETECT_FORMAT_NONE;
+    size_t numAnnotations = 0;
+    if (isDetection) {
+        if (!args.annotationsFile) {
+            syslog(LOG_ERR, "Detection models need the boxes of every image "
+                   "in ANNOTATIONS");
+            goto end;
+        }
+        if (args.resultsFile) {
+            syslog(LOG_ERR, "--results only applies to classification models");
+            goto end;
+        }
+        if (args.sampleTolerance > 0.0) {
+            syslog(LOG_ERR, "--sample only applies to classification models");
+            goto end;
+        }
+        if (args.cacheDir) {
+            syslog(LOG_ERR, "--cache only applies to classification models");
+            goto end;
+        }
+        if (!mapevalLoad(args.annotationsFile, &eval)) {
+            goto end;
+        }
+        numAnnotations = mapevalGetNumImages(eval);
+    } else if (args.annotationsFile) {
+        if (!countAnnotations(args.annotationsFile, &numAnnotations)) {
+            goto end;
+        }
+    } else if (!packedDataset ||
+               !(datasetGetHeader(packedDataset)->flags &
+                 DATASET_FLAG_GROUND_TRUTH)) {
+        syslog(LOG_ERR, "No annotations given and none embedded in the dataset");
+        goto end;
+    }
+    size_t numImages = numAnnotations;
+    size_t maxImageId = numAnnotations;
+    if (eval && numAnnotations) {
+        maxImageId = mapevalGetImageId(eval, numAnnotations - 1);
+    }
+    if (packedDataset) {
+        numImages = datasetGetCount(packedDataset);
+        for (size_t i = 0; i < numImages; i++) {
+            const size_t imageId = datasetGetEntry(packedDataset, i)->imageId;
+            maxImageId = imageId > maxImageId ? imageId : maxImageId;
+        }
+    }
+    // A sampled run orders all images and runs at most maxImages of them.
+    const bool sampled = args.sampleTolerance > 0.0;
+    const size_t numAvailable = numImages;
+    if (args.maxImages && args.maxImages < numImages) {
+        numImages = args.maxImages;
+    }
+    if (numImages == 0) {
+        syslog(LOG_ERR, "There are no images to run");
+        goto end;
+    }
+    if (maxImageId > SIZE_MAX / (2 * sizeof(resultRecord))) {
+        syslog(LOG_ERR, "Image number %zu is too large", maxImageId);
+        goto end;
+    }
+    syslog(LOG_INFO, "Running %zu images", numImages);
+
+    // All buffers of the run are carved from one allocation, so nothing is
+    // allocated while images are processed. Detection models record their
+    // results in the evaluation instead of the ground truth and results
+    // arrays.
+    const size_t numRecords = isDetection ? 0 : maxImageId;
+    const size_t boxesBytes = args.maxDetections * sizeof(detectBox);
+    const size_t arenaSize =
+        arenaAlignedSize(numRecords * sizeof(int)) +
+        resultsArenaSize(numRecords) +
+        arenaAlignedSize(args.workers * sizeof(worker)) +
+        arenaAlignedSize(sizeof(statsRun)) +
+        (sampled ? arenaAlignedSize(numAvailable * sizeof(size_t)) : 0) +
+        (args.cacheDir ? cacheArenaSize(numRecords) : 0) +
+        (eval ? mapevalArenaSize(eval) +
+                    args.workers * arenaAlignedSize(boxesBytes)
+              : 0);
+    if (!arenaCreate(arenaSize, &runArena)) {
+        goto end;
+    }
+    int* groundTruth = arenaAlloc(runArena, numRecords * sizeof(int));
+    workers = arenaAlloc(runArena, args.workers * sizeof(worker));
+    run = arenaAlloc(runArena, sizeof(statsRun));
+    size_t* order =
+        sampled ? arenaAlloc(runArena, numAvailable * sizeof(size_t)) : NULL;
+    if (!groundTruth || !workers || !run || (sampled && !order) ||
+        !resultsCreate(runArena, numRecords, &results)) {
+        goto end;
+    }
+    if (eval) {
+        if (!mapevalReserve(eval, runArena)) {
+            goto end;
+        }
+        for (size_t w = 0; w < args.workers; w++) {
+            workers[w].boxes = arenaAlloc(runArena, boxesBytes);
+            if (!workers[w].boxes) {
+                goto end;
             }
-            // Swap numbers in input array
-            temp = score_array_cv25[l];
-            score_array_cv25[l] = score_array_cv25[max];
-            score_array_cv25[max] = temp;
-            // Swap indexes in tracking array
-            temp = score_array_indices[l];
-            score_array_indices[l] = score_array_indices[max];
-            score_array_indices[max] = temp;
+        }
+    }
+
+    for (size_t i = 0; i < numRecords; i++) {
+        groundTruth[i] = -1;
+    }
+    if (isDetection) {
+        // The boxes are in the evaluation.
+    } else if (args.annotationsFile) {
+        if (!readAnnotations(args.annotationsFile, groundTruth,
+                             numAnnotations)) {
+            goto end;
+        }
+    } else {
+        // Use the annotations embedded in the dataset, indexed the same way
+        // as the annotations file by image number.
+        for (size_t i = 0; i < datasetGetCount(packedDataset); i++) {
+            const datasetIndexEntry* entry = datasetGetEntry(packedDataset, i);
+            if (entry->imageId >= 1) {
+                groundTruth[entry->imageId - 1] = entry->groundTruth + 1;
             }
+        }
+    }
 
-        } else {
+    uint64_t seed = args.seed;
+    if (sampled) {
+        if (!seed) {
+            seed = statsNowNs() ^ ((uint64_t) getpid() << 32);
+            seed = seed ? seed : 1;
+        }
+        if (!sampleOrder(packedDataset, groundTruth, maxImageId, numAvailable,
+                         seed, order)) {
+            goto end;
+        }
+        syslog(LOG_INFO, "Sampling in an order stratified by class with seed "
+               "%llu, until top1 and top5 are known within %g at %g%% "
+               "confidence", (unsigned long long) seed, args.sampleTolerance,
+               100.0 * args.confidence);
+    }
 
-            for (l = 0; l < 5; l++) {
+    if (args.cacheDir) {
+        uint64_t key;
+        if (!cacheKey(&args, packedDataset, &key) ||
+            !cacheOpen(runArena, args.cacheDir, key, numRecords, args.force,
+                       results, &cache)) {
+            goto end;
+        }
+        syslog(LOG_INFO, "%zu images in cache %s/%016llx.cache%s",
+               cacheGetCount(cache), args.cacheDir, (unsigned long long) key,
+               args.force ? ", started over" : "");
+    }
 
-                max = l;
-                // Find next max index
-                for (m = l+1; m < score_array_size; m++) {
-                    if (score_array[m] > score_array[max]) {
-                        max = m;
-                    }
-                }
-                // Swap numbers in input array
-                temp = score_array[l];
-                score_array[l] = score_array[max];
-                score_array[max] = temp;
-                // Swap indexes in tracking array
-                temp = score_array_indices[l];
-                score_array_indices[l] = score_array_indices[max];
-                score_array_indices[max] = temp;
+    int sum_top1 = 0;
+    int sum_top5 = 0;
+
+    float avg_top1;
+    float avg_top5;
+
+    runContext ctx = {
+        .args = &args,
+        .format = &format,
+        .packedDataset = packedDataset,
+        .inputBytes = inputBytes,
+        .numImages = numImages,
+        .maxImageId = maxImageId,
+        .groundTruth = groundTruth,
+        .labels = labels,
+        .numLabels = numLabels,
+        .results = results,
+        .eval = eval,
+        .logImages = isLogged(LOG_DEBUG),
+        .order = order,
+        .sampleZ = sampled ? samplingZ(args.confidence) : 0.0,
+        .cache = cache,
+    };
+    atomic_init(&ctx.nextImage, 0);
+    atomic_init(&ctx.failed, false);
+    atomic_init(&ctx.sampleScored, 0);
+    atomic_init(&ctx.sampleTop1, 0);
+    atomic_init(&ctx.sampleTop5, 0);
+    atomic_init(&ctx.stoppedEarly, false);
+
+    // When every image of the run is in the cache, the images are counted
+    // on the main thread and the model is not even loaded.
+    bool allCached = cache != NULL;
+    for (size_t i = 0; allCached && i < numImages; i++) {
+        const size_t position = order ? order[i] : i;
+        allCached = cacheHas(cache, positionImageId(&ctx, position));
+    }
+
+    uint64_t runStartUs = getTimeUs();
+    if (allCached) {
+        syslog(LOG_INFO, "All images are in the cache, nothing to run");
+        size_t i;
+        workers[0].ctx = &ctx;
+        if (takeImage(&workers[0], &i)) {
+            syslog(LOG_ERR, "Image %zu is not in the cache", i + 1);
+            goto end;
+        }
+    } else {
+        for (; numWorkers < args.workers; numWorkers++) {
+            if (!setupWorker(&ctx, &workers[numWorkers], numWorkers)) {
+                numWorkers++;
+                goto end;
             }
         }
-        int indices_top5[5];
-        int ll;
-        for (ll = 0; ll < 5; ll++) {
-            indices_top5[ll] = score_array_indices[ll];
+        // The classification scores or the boxes are read from the first
+        // output, the boxes of an SSD model from the first four.
+        const pipelineModelInfo* modelInfo =
+            pipelineGetModelInfo(workers[0].pipe);
+        if (args.outputBytes &&
+            args.outputBytes != modelInfo->outputBytes[0]) {
+            syslog(LOG_WARNING, "OUTPUT_SIZE %zu is ignored, the model output "
+                   "is %zu bytes", args.outputBytes, modelInfo->outputBytes[0]);
         }
-        int mm;
-        top5[count-1] = 0;
-        for (mm = 0; mm < 5; mm++) {
-            if (ground_truth[count-1] == indices_top5[mm]) {
-                top5[count-1] = 1;
+        if (isDetection) {
+            detectConfig detConfig;
+            if (!setupDetection(workers[0].conn, workers[0].model, modelInfo,
+                                haveOutputInfo ? &outputInfo : NULL, &args,
+                                &detConfig)) {
+                goto end;
+            }
+            // SSD models do not tell how many classes they have.
+            if (detConfig.numClasses &&
+                detConfig.numClasses < mapevalGetNumClasses(eval)) {
+                syslog(LOG_WARNING, "The ground truth has %zu classes but the "
+                       "model only %zu", mapevalGetNumClasses(eval),
+                       detConfig.numClasses);
             }
+            for (size_t w = 0; w < numWorkers; w++) {
+                if (!detectorCreate(&detConfig, &workers[w].det)) {
+                    goto end;
+                }
+            }
+        } else if (!setupOutputFormat(workers[0].conn, workers[0].model,
+                                      modelInfo->outputBytes[0],
+                                      haveOutputInfo ? &outputInfo : NULL,
+                                      &format)) {
+            goto end;
         }
-        if (top5[count-1] == 0) {
-            syslog(LOG_INFO, "Image %zu is not top5, it's supposed to be %s, but it is classified as %s \n",
-                count, labels[(size_t)ground_truth[count-1]], labels[maxIdx]);
-            maxProb *= 100; //To have output int %
+
+        // A single worker runs on the main thread, like before there were
+        // workers.
+        runStartUs = getTimeUs();
+        if (numWorkers == 1) {
+            runWorker(&workers[0]);
+        } else {
+            size_t numStarted = 0;
+            for (; numStarted < numWorkers; numStarted++) {
+                int err = pthread_create(&workers[numStarted].thread, NULL,
+                                         workerThread, &workers[numStarted]);
+                if (err) {
+                    syslog(LOG_ERR, "Unable to start worker %zu: %s",
+                           numStarted, strerror(err));
+                    atomic_store(&ctx.failed, true);
+                    break;
+                }
+            }
+            for (size_t w = 0; w < numStarted; w++) {
+                pthread_join(workers[w].thread, NULL);
+            }
         }
-        else {
-            syslog(LOG_INFO, "Image %zu found in top5. \n", count);
+    }
+    const uint64_t runUs = getTimeUs() - runStartUs;
+    if (atomic_load(&ctx.failed)) {
+        goto end;
+    }
+
+    size_t numScored = 0;
+    size_t numCached = 0;
+    uint64_t numDetections = 0;
+    for (size_t w = 0; w < (allCached ? 1 : numWorkers); w++) {
+        sum_top1 += workers[w].sumTop1;
+        sum_top5 += workers[w].sumTop5;
+        numScored += workers[w].numScored;
+        numCached += workers[w].numCached;
+        numDetections += workers[w].numDetections;
+        for (size_t s = 0; s < STATS_NUM_STAGES; s++) {
+            statsMerge(&run->stages[s], &workers[w].stages[s]);
         }
-        if (labels) {
-            if (maxIdx > numLabels) {
-                syslog(LOG_INFO, "Top result: index %zu with score %.2f%% (index larger "
-                    "than num items in labels file) statement 2", maxIdx, maxProb);
-            }
-        } else {
-            syslog(LOG_INFO, "Top result: index %zu with score %.2f%% statement 3", maxIdx, maxProb);
+        statsMerge(&run->ioWait, &workers[w].ioWait);
+        if (workers[w].io) {
+            ioStats io;
+            ioEngineGetStats(workers[w].io, &io);
+            run->ioBackend = ioEngineBackendName(workers[w].io);
+            run->ioFiles += io.numFiles;
+            run->ioBytes += io.bytes;
         }
-        if ((int) maxIdx == ground_truth[count-1]) {
-            top1[count-1] = 1;
-            syslog(LOG_INFO, "Image %zu found in top1. \n", count);
-        } else {
-            top1[count-1] = 0;
-            syslog(LOG_INFO, "Image %zu is not top1, it's supposed to be %s, but it is classified as %s\n",
-                count, labels[(size_t)ground_truth[count-1]], labels[maxIdx]);
+        if (numWorkers > 1) {
+            syslog(LOG_INFO, "Worker %zu scored %zu images in %.2f s", w,
+                   workers[w].numScored, (double) workers[w].elapsedUs / 1e6);
         }
+    }
 
-        sum_top1 += top1[count-1];
-        sum_top5 += top5[count-1];
+    mapevalResult detResult = {0};
+    if (eval) {
+        if (!mapevalCompute(eval, &detResult)) {
+            goto end;
+        }
+        syslog(LOG_INFO, "\n");
+        syslog(LOG_INFO, "RESULTS:\n");
+        syslog(LOG_INFO, "mAP@0.5:0.95 %.4f\n mAP@0.5 %.4f\n mAP@0.75 %.4f\n",
+               detResult.map, detResult.map50, detResult.map75);
+        syslog(LOG_INFO, "%llu detections and %llu boxes of %zu classes in "
+               "%zu images", (unsigned long long) numDetections,
+               (unsigned long long) detResult.numGroundTruth,
+               detResult.numClasses, detResult.numImages);
+        syslog(LOG_INFO, "\n");
+    } else {
+        // A sampled run is scored on the images it visited.
+        const size_t numRun = sampled ? numScored + numCached : numImages;
+        avg_top1 = (float)sum_top1/numRun*100;
+        avg_top5 = (float)sum_top5/numRun*100;
+        syslog(LOG_INFO, "\n");
+        syslog(LOG_INFO, "RESULTS:\n");
+        syslog(LOG_INFO, "top1 sum %d\n top5 sum %d\n top1 avg %.6f%% \n top 5 avg %.6f%% \n", sum_top1, sum_top5, avg_top1, avg_top5);
+        syslog(LOG_INFO, "\n");
     }
 
-    avg_top1 = (float)sum_top1/N_IMAGES*100;
-    avg_top5 = (float)sum_top5/N_IMAGES*100;
-    syslog(LOG_INFO, "\n");
-    syslog(LOG_INFO, "RESULTS:\n");
-    syslog(LOG_INFO, "top1 sum %d\n top5 sum %d\n top1 avg %.6f%% \n top 5 avg %.6f%% \n", sum_top1, sum_top5, avg_top1, avg_top5);
-    syslog(LOG_INFO, "\n");
+    const statsHistogram* load = &run->stages[STATS_STAGE_LOAD];
+    const double stagingPerImageUs =
+        load->count ? (double) load->sumNs / (double) load->count / 1e3 : 0.0;
+    if (args.zeroCopy) {
+        syslog(LOG_INFO, "Input staging per image: %.1f us zero-copy, %.1f us "
+               "copy path (measured on %d images)", stagingPerImageUs,
+               copySampleUs, COPY_SAMPLE_IMAGES);
+    } else {
+        syslog(LOG_INFO, "Input staging per image: %.1f us copy path",
+               stagingPerImageUs);
+    }
+
+    syslog(LOG_INFO, "Throughput: %zu images in %.2f s, %.1f images/s with %zu "
+           "workers and %zu jobs in flight per worker", numScored,
+           (double) runUs / 1e6,
+           runUs ? (double) numScored * 1e6 / (double) runUs : 0.0,
+           numWorkers, args.inflight);
+    if (cache) {
+        syslog(LOG_INFO, "Cache: %zu images read from the cache, %zu run",
+               numCached, numScored);
+    }
+
+    run->modelFile = args.modelFile;
+    run->deviceName = args.deviceName;
+    run->numWorkers = numWorkers;
+    run->inflight = args.inflight;
+    run->numImages = numImages;
+    run->numScored = numScored;
+    run->numCached = numCached;
+    run->sumTop1 = sum_top1;
+    run->sumTop5 = sum_top5;
+    run->detection = eval != NULL;
+    run->map = detResult.map;
+    run->map50 = detResult.map50;
+    run->map75 = detResult.map75;
+    run->numDetections = numDetections;
+    run->wallNs = runUs * 1000;
+    run->modelReused = args.modelId != 0;
+    run->startup = workers[0].startup;
+    run->readAhead = args.readAhead;
+    if (sampled) {
+        run->sampling.enabled = true;
+        run->sampling.seed = seed;
+        run->sampling.confidence = args.confidence;
+        run->sampling.tolerance = args.sampleTolerance;
+        run->sampling.numAvailable = numAvailable;
+        run->sampling.stoppedEarly = atomic_load(&ctx.stoppedEarly);
+        samplingWilson((size_t) sum_top1, numScored + numCached, ctx.sampleZ,
+                       &run->sampling.top1);
+        samplingWilson((size_t) sum_top5, numScored + numCached, ctx.sampleZ,
+                       &run->sampling.top5);
+    }
+    statsLog(run);
+    if (args.reportFile && !statsWriteReport(run, args.reportFile)) {
+        goto end;
+    }
+    if (args.resultsFile) {
+        if (!resultsWriteCsv(results, args.resultsFile)) {
+            goto end;
+        }
+        syslog(LOG_INFO, "Results of every image written to %s",
+               args.resultsFile);
+    }
 
     ret = true;
 
 end:
-    // Only the model handle is released here. We count on larod service to
-    // release the privately loaded model when the session is disconnected in
-    // larodDisconnect().
-    larodDestroyModel(&model);
-    if (conn) {
-        larodDisconnect(&conn, NULL);
+    for (size_t w = 0; w < numWorkers; w++) {
+        destroyWorker(&workers[w]);
     }
+    cacheClose(&cache);
+    arenaDestroy(&runArena);
+    mapevalDestroy(&eval);
+    datasetClose(&packedDataset);
     if (larodModelFd >= 0) {
         close(larodModelFd);
     }
-    if (larodInputAddr != MAP_FAILED) {
-        munmap(larodInputAddr, args.width * args.height * CHANNELS);
-    }
-    if (larodInputFd >= 0) {
-        close(larodInputFd);
-    }
-    if (larodOutputAddr != MAP_FAILED) {
-        munmap(larodOutputAddr, args.outputBytes);
-    }
-    if (larodOutputFd >= 0) {
-        close(larodOutputFd);
-    }
-
-    larodDestroyJobRequest(&infReq);
-    larodDestroyTensors(conn, &inputTensors, numInputs, &error);
-    larodDestroyTensors(conn, &outputTensors, numOutputs, &error);
-    larodClearError(&error);
-
     if (labels) {
         freeLabels(labels, labelFileData);
     }
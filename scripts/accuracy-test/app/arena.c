@@ -0,0 +1,87 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * This file implements a bump allocator for the buffers of a run.
+ */
+
+#include "arena.h"
+
+#include <errno.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#define ARENA_ALIGN (alignof(max_align_t))
+
+struct arena {
+    unsigned char* base;
+    size_t size;
+    size_t used;
+};
+
+size_t arenaAlignedSize(size_t size) {
+    if (size > SIZE_MAX - (ARENA_ALIGN - 1)) {
+        return 0;
+    }
+
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+bool arenaCreate(size_t size, arena** arenaPtr) {
+    arena* a = calloc(1, sizeof(arena));
+    if (!a) {
+        syslog(LOG_ERR, "Unable to allocate arena: %s", strerror(errno));
+        return false;
+    }
+    // calloc, so that untouched pages are not backed by memory until used.
+    a->base = calloc(1, size ? size : 1);
+    if (!a->base) {
+        syslog(LOG_ERR, "Unable to allocate %zu bytes for the run: %s", size,
+               strerror(errno));
+        free(a);
+        return false;
+    }
+    a->size = size;
+    *arenaPtr = a;
+
+    return true;
+}
+
+void arenaDestroy(arena** arenaPtr) {
+    if (!arenaPtr || !*arenaPtr) {
+        return;
+    }
+    free((*arenaPtr)->base);
+    free(*arenaPtr);
+    *arenaPtr = NULL;
+}
+
+void* arenaAlloc(arena* a, size_t size) {
+    const size_t alignedSize = arenaAlignedSize(size);
+    if ((size && !alignedSize) || alignedSize > a->size - a->used) {
+        syslog(LOG_ERR, "Arena of %zu bytes is too small for another %zu "
+               "bytes", a->size, size);
+        return NULL;
+    }
+    void* ptr = a->base + a->used;
+    a->used += alignedSize;
+
+    return ptr;
+}
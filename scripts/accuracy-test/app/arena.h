@@ -0,0 +1,68 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * This header file declares a bump allocator for the buffers of a run.
+ *
+ * Everything that lives for the whole run is carved from one block that is
+ * allocated at startup, once the sizes are known from the dataset and the
+ * model. Nothing is allocated while images are processed and all of it is
+ * freed at once when the run is over.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct arena arena;
+
+/**
+ * brief Rounds a size up to the alignment of arena allocations.
+ *
+ * Used to add up the sizes of the buffers before the arena is created.
+ *
+ * param size Size in bytes.
+ * return The size rounded up, or 0 if it does not fit in a size_t.
+ */
+size_t arenaAlignedSize(size_t size);
+
+/**
+ * brief Allocates an arena.
+ *
+ * param size Total size in bytes of the allocations, each rounded up with
+ * arenaAlignedSize.
+ * param arenaPtr Pointer to the created arena.
+ * return False if the memory could not be allocated, otherwise true.
+ */
+bool arenaCreate(size_t size, arena** arenaPtr);
+
+/**
+ * brief Frees an arena and everything allocated from it.
+ *
+ * param arenaPtr Pointer to the arena. Set to NULL on return.
+ */
+void arenaDestroy(arena** arenaPtr);
+
+/**
+ * brief Carves a zeroed buffer from an arena.
+ *
+ * param a The arena.
+ * param size Size in bytes of the buffer.
+ * return The buffer, aligned for any type, or NULL if the arena is full.
+ */
+void* arenaAlloc(arena* a, size_t size);
@@ -22,12 +22,46 @@
 
 #include <argp.h>
 #include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
 
 #define KEY_USAGE (127)
+#define KEY_INFLIGHT (128)
+#define KEY_ZERO_COPY (129)
+#define KEY_WORKERS (130)
+#define KEY_REPORT (131)
+#define KEY_RESULTS (132)
+#define KEY_LOG_LEVEL (133)
+#define KEY_MAX_IMAGES (134)
+#define KEY_JPEG (135)
+#define KEY_PREPROCESS_DEVICE (136)
+#define KEY_READ_AHEAD (137)
+#define KEY_IO_BACKEND (138)
+#define KEY_DETECT (139)
+#define KEY_CONF_THRESHOLD (140)
+#define KEY_IOU_THRESHOLD (141)
+#define KEY_MAX_DETECTIONS (142)
+#define KEY_MODEL_ID (143)
+#define KEY_SAMPLE (144)
+#define KEY_SEED (145)
+#define KEY_CONFIDENCE (146)
+#define KEY_CACHE (147)
+#define KEY_FORCE (148)
+
+// Upper bound for the number of jobs kept in flight at the same time.
+#define MAX_INFLIGHT (64)
+// Upper bound for the number of worker threads, each with its own connection.
+#define MAX_WORKERS (32)
+// Upper bound for the number of image files read ahead by each worker.
+#define MAX_READ_AHEAD (256)
+// Upper bound for the number of boxes kept per image of a detection model.
+#define MAX_DETECTIONS (1000)
 
 static int parsePosInt(char* arg, unsigned long long* i,
                        unsigned long long limit);
 static int parseOpt(int key, char* arg, struct argp_state* state);
+static bool parseLogLevel(const char* arg, int* level);
+static bool parseFraction(const char* arg, float* value);
 
 const struct argp_option opts[] = {
     {"device", 'c', "DEVICE", 0,
@@ -46,20 +80,142 @@ const struct argp_option opts[] = {
      "consist of a number that corresponds to the class number in the labels file"
      "for the specific image.",
      0},
+    {"dataset", 'd', "DATASET", 0,
+     "Path to a packed dataset file written by larod_convert.py --pack. The "
+     "file is mapped once and the images are read from it instead of from "
+     "one .bin file per image. Labels and annotations embedded in the "
+     "dataset are used unless LABELS or ANNOTATIONS are given.",
+     0},
+    {"jpeg", KEY_JPEG, "DIR", 0,
+     "Read the images as JPEG files DIR/<n>.JPEG, as named by "
+     "rename_files.py, instead of converted .bin files. Each image is "
+     "decoded on the device and cropped, scaled and converted to the model "
+     "input by a larod preprocessing job chained before the inference job. "
+     "Cannot be combined with DATASET.",
+     0},
+    {"preprocess-device", KEY_PREPROCESS_DEVICE, "DEVICE", 0,
+     "Device that runs the preprocessing jobs of --jpeg. Default is "
+     "cpu-proc.",
+     0},
+    {"model-id", KEY_MODEL_ID, "ID", 0,
+     "Get the public model ID, e.g. loaded with larod_bench --public, in "
+     "every worker instead of loading MODEL. MODEL is still read for the "
+     "quantization of its output. The time to connect and to load or get "
+     "the model and the first inference are logged and in the report.",
+     0},
+    {"inflight", KEY_INFLIGHT, "N", 0,
+     "Number of inference jobs to keep in flight at the same time. Images "
+     "are loaded and results are post-processed while the jobs run. Each "
+     "job gets its own input and output buffers. Default is 1, i.e. images "
+     "are processed one at a time.",
+     0},
+    {"workers", KEY_WORKERS, "N", 0,
+     "Number of worker threads. Each worker opens its own larod connection, "
+     "loads its own copy of MODEL and keeps up to N jobs in flight as set "
+     "by --inflight. Workers take images in small contiguous chunks from a "
+     "shared counter. Default is 1.",
+     0},
+    {"read-ahead", KEY_READ_AHEAD, "N", 0,
+     "Keep reads of the next N image files in flight in each worker, so "
+     "that images are read from storage while earlier ones are processed. "
+     "Applies to .bin and --jpeg files, not to DATASET. The bytes read per "
+     "second and the time spent waiting for reads are logged at the end. "
+     "By default each file is read when its image is loaded.",
+     0},
+    {"io-backend", KEY_IO_BACKEND, "BACKEND", 0,
+     "How files are read ahead, one of io_uring, thread or auto. thread "
+     "reads the files on a separate thread after asking the kernel to "
+     "prefetch them. Default is auto, which uses io_uring if the kernel "
+     "supports it and thread otherwise.",
+     0},
+    {"max-images", KEY_MAX_IMAGES, "N", 0,
+     "Only run the first N images of the dataset or annotations file, or "
+     "with --sample at most N images of the sampled order. By default all "
+     "images are run.",
+     0},
+    {"sample", KEY_SAMPLE, "TOLERANCE", 0,
+     "Visit the images of a classification model in a random order "
+     "stratified by class, and stop once the confidence intervals of both "
+     "top1 and top5 are within TOLERANCE of the measured accuracy, e.g. "
+     "0.005 for half a percentage point, or when --max-images images have "
+     "been run.",
+     0},
+    {"seed", KEY_SEED, "N", 0,
+     "Seed of the order of --sample. The same seed visits the same images. "
+     "By default a seed is picked and logged.",
+     0},
+    {"confidence", KEY_CONFIDENCE, "LEVEL", 0,
+     "Confidence level of the intervals of --sample. Default is 0.95.",
+     0},
+    {"zero-copy", KEY_ZERO_COPY, NULL, 0,
+     "Bind the input tensor directly to the packed dataset file at the offset "
+     "of each image instead of copying the image into an input buffer. "
+     "Requires DATASET.",
+     0},
+    {"report", KEY_REPORT, "FILE", 0,
+     "Write a JSON report of the run to FILE: results, wall time, throughput "
+     "and p50, p90, p99 and max of the time per image of each stage (load, "
+     "preprocess, inference, decode, topk and bookkeeping).",
+     0},
+    {"results", KEY_RESULTS, "FILE", 0,
+     "Write the result of every image to the CSV file FILE when the run is "
+     "over: image number, ground truth, top1 and top5 hits, the five highest "
+     "scoring classes and the raw score of the best one.",
+     0},
+    {"cache", KEY_CACHE, "DIR", 0,
+     "Keep the result of every image of a classification model in a file "
+     "in DIR, named by a hash of MODEL, the device, the OS and the dataset "
+     "or annotations. Images already in the file are not run again, so an "
+     "interrupted run resumes where it stopped and a repeated run is read "
+     "from the file. Images changed in place are not noticed, see --force.",
+     0},
+    {"force", KEY_FORCE, NULL, 0,
+     "Run every image again and start the file of --cache over.",
+     0},
+    {"detect", KEY_DETECT, "FORMAT", 0,
+     "Evaluate an object detection MODEL instead of a classification model. "
+     "FORMAT is the layout of its output, yolov5 or yolov8, as exported by "
+     "ultralytics for TensorFlow Lite, or ssd for the four outputs of SSD "
+     "models with post-processing. ANNOTATIONS is then a file of boxes, "
+     "one per line as IMAGE CLASS X1 Y1 X2 Y2 [CROWD] with corners "
+     "normalized to the image, and the COCO mAP is logged at the end.",
+     0},
+    {"conf-threshold", KEY_CONF_THRESHOLD, "T", 0,
+     "Boxes of a detection model scoring less than T are dropped. Default "
+     "is 0.001, as used to measure the mAP.",
+     0},
+    {"iou-threshold", KEY_IOU_THRESHOLD, "T", 0,
+     "A box of a detection model is suppressed if its intersection over "
+     "union with a better box of the same class is larger than T. Default "
+     "is 0.6.",
+     0},
+    {"max-detections", KEY_MAX_DETECTIONS, "N", 0,
+     "Largest number of boxes kept per image of a detection model. Default "
+     "is 300.",
+     0},
+    {"log-level", KEY_LOG_LEVEL, "LEVEL", 0,
+     "Least important messages sent to syslog, one of error, warning, info "
+     "or debug. The result of every image is only logged at debug, which "
+     "slows down the run. Default is info.",
+     0},
     {"help", 'h', NULL, 0, "Print this help text and exit.", 0},
     {"usage", KEY_USAGE, NULL, 0, "Print short usage message and exit.", 0},
     {0}};
 const struct argp argp = {
     opts,
     parseOpt,
-    "MODEL WIDTH HEIGHT OUTPUT_SIZE",
-    "This is an example app which loads an image classification MODEL to "
-    "larod and then uses vdo to fetch frames of size WIDTH x HEIGHT in a yuv "
-    "format which are converted to an interleaved rgb format and then sent to "
-    "larod for inference on MODEL. OUTPUT_SIZE denotes the size in bytes of "
-    "the tensor output by MODEL.\n\nExample call:\n"
-    "accuracy-test-app /tmp/mobilenet_v2_1.0_224_quant.tflite 224 224 "
-    "1001 -c cpu-tflite "
+    "MODEL WIDTH HEIGHT [OUTPUT_SIZE]",
+    "Measures the accuracy of an image classification or object detection "
+    "MODEL with input of size WIDTH x HEIGHT on larod. The images are read "
+    "from a packed DATASET, from converted .bin files or from JPEG files "
+    "that larod preprocessing jobs crop, scale and convert to the input of "
+    "MODEL, and the results are compared with the ANNOTATIONS. The buffers "
+    "of every input and output of MODEL are sized from what larod reports "
+    "for the tensors. OUTPUT_SIZE, the size in bytes of the tensor output "
+    "by MODEL, is no longer needed and only compared with the size of the "
+    "first output.\n\nExample call:\n"
+    "accuracy_measure /tmp/mobilenet_v2_1.0_224_quant.tflite 224 224 "
+    "-c cpu-tflite "
     "-l /usr/local/packages/accuracy_measure/label/imagenet_labels.txt "
     "-g /usr/local/packages/accuracy_measure/label/ground_truth.txt ",
     NULL,
@@ -89,6 +245,138 @@ int parseOpt(int key, char* arg, struct argp_state* state) {
         args->annotationsFile = arg;
         break;
     }
+    case 'd': {
+        args->datasetFile = arg;
+        break;
+    }
+    case KEY_JPEG:
+        args->jpegDir = arg;
+        break;
+    case KEY_PREPROCESS_DEVICE:
+        args->preprocessDevice = arg;
+        break;
+    case KEY_INFLIGHT: {
+        unsigned long long inflight;
+        int ret = parsePosInt(arg, &inflight, MAX_INFLIGHT);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid number of jobs in flight");
+        }
+        args->inflight = (size_t) inflight;
+        break;
+    }
+    case KEY_WORKERS: {
+        unsigned long long workers;
+        int ret = parsePosInt(arg, &workers, MAX_WORKERS);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid number of workers");
+        }
+        args->workers = (size_t) workers;
+        break;
+    }
+    case KEY_READ_AHEAD: {
+        unsigned long long readAhead;
+        int ret = parsePosInt(arg, &readAhead, MAX_READ_AHEAD);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid read-ahead depth");
+        }
+        args->readAhead = (size_t) readAhead;
+        break;
+    }
+    case KEY_IO_BACKEND:
+        if (!ioEngineParseBackend(arg, &args->ioBackend)) {
+            argp_error(state, "invalid I/O backend %s", arg);
+        }
+        break;
+    case KEY_MAX_IMAGES: {
+        unsigned long long maxImages;
+        int ret = parsePosInt(arg, &maxImages, SIZE_MAX);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid number of images");
+        }
+        args->maxImages = (size_t) maxImages;
+        break;
+    }
+    case KEY_ZERO_COPY:
+        args->zeroCopy = true;
+        break;
+    case KEY_REPORT:
+        args->reportFile = arg;
+        break;
+    case KEY_RESULTS:
+        args->resultsFile = arg;
+        break;
+    case KEY_CACHE:
+        args->cacheDir = arg;
+        break;
+    case KEY_FORCE:
+        args->force = true;
+        break;
+    case KEY_DETECT:
+        if (!detectParseFormat(arg, &args->detectFormat)) {
+            argp_error(state, "invalid detection output format %s", arg);
+        }
+        break;
+    case KEY_CONF_THRESHOLD:
+        if (!parseFraction(arg, &args->confThreshold)) {
+            argp_error(state, "invalid confidence threshold %s", arg);
+        }
+        break;
+    case KEY_IOU_THRESHOLD:
+        if (!parseFraction(arg, &args->iouThreshold)) {
+            argp_error(state, "invalid IoU threshold %s", arg);
+        }
+        break;
+    case KEY_MAX_DETECTIONS: {
+        unsigned long long maxDetections;
+        int ret = parsePosInt(arg, &maxDetections, MAX_DETECTIONS);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret,
+                         "invalid number of detections");
+        }
+        args->maxDetections = (size_t) maxDetections;
+        break;
+    }
+    case KEY_MODEL_ID: {
+        unsigned long long modelId;
+        int ret = parsePosInt(arg, &modelId, ULLONG_MAX - 1);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid model id");
+        }
+        args->modelId = (uint64_t) modelId;
+        break;
+    }
+    case KEY_SAMPLE: {
+        float tolerance;
+        if (!parseFraction(arg, &tolerance) || tolerance <= 0.0f ||
+            tolerance >= 0.5f) {
+            argp_error(state, "invalid tolerance %s", arg);
+        }
+        args->sampleTolerance = tolerance;
+        break;
+    }
+    case KEY_SEED: {
+        unsigned long long seed;
+        int ret = parsePosInt(arg, &seed, ULLONG_MAX - 1);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid seed");
+        }
+        args->seed = (uint64_t) seed;
+        break;
+    }
+    case KEY_CONFIDENCE: {
+        float confidence;
+        if (!parseFraction(arg, &confidence) || confidence <= 0.0f ||
+            confidence >= 1.0f) {
+            argp_error(state, "invalid confidence level %s", arg);
+        }
+        args->confidence = confidence;
+        break;
+    }
+    case KEY_LOG_LEVEL:
+        if (!parseLogLevel(arg, &args->logLevel)) {
+            argp_error(state, "invalid log level %s", arg);
+        }
+        break;
     case 'h':
         argp_state_help(state, stdout, ARGP_HELP_STD_HELP);
         break;
@@ -129,11 +417,33 @@ int parseOpt(int key, char* arg, struct argp_state* state) {
         args->outputBytes = 0;
         args->deviceName = NULL;
         args->modelFile = NULL;
+        args->modelId = 0;
         args->labelsFile = NULL;
         args->annotationsFile = NULL;
+        args->datasetFile = NULL;
+        args->jpegDir = NULL;
+        args->preprocessDevice = "cpu-proc";
+        args->reportFile = NULL;
+        args->resultsFile = NULL;
+        args->cacheDir = NULL;
+        args->force = false;
+        args->inflight = 1;
+        args->workers = 1;
+        args->readAhead = 0;
+        args->ioBackend = IO_BACKEND_AUTO;
+        args->maxImages = 0;
+        args->sampleTolerance = 0.0;
+        args->seed = 0;
+        args->confidence = 0.95;
+        args->zeroCopy = false;
+        args->detectFormat = DETECT_FORMAT_NONE;
+        args->confThreshold = 0.001f;
+        args->iouThreshold = 0.6f;
+        args->maxDetections = 300;
+        args->logLevel = LOG_INFO;
         break;
     case ARGP_KEY_END:
-        if (state->arg_num != 4) {
+        if (state->arg_num != 3 && state->arg_num != 4) {
             argp_error(state, "Invalid number of arguments given");
         }
         break;
@@ -168,3 +478,47 @@ static int parsePosInt(char* arg, unsigned long long* i,
 
     return 0;
 }
+
+/**
+ * brief Parses the name of a log level
+ *
+ * param arg Name of the level: error, warning, info or debug.
+ * param level Pointer to the matching syslog priority.
+ * return False if the name is not known, otherwise true.
+ */
+static bool parseLogLevel(const char* arg, int* level) {
+    static const struct {
+        const char* name;
+        int priority;
+    } levels[] = {
+        {"error", LOG_ERR},
+        {"warning", LOG_WARNING},
+        {"info", LOG_INFO},
+        {"debug", LOG_DEBUG},
+    };
+
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        if (strcmp(arg, levels[i].name) == 0) {
+            *level = levels[i].priority;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * brief Parses a number between 0 and 1
+ *
+ * param arg String to parse.
+ * param value Pointer to the parsed number.
+ * return False if the string is not a number between 0 and 1, otherwise true.
+ */
+static bool parseFraction(const char* arg, float* value) {
+    char* endPtr;
+
+    *value = strtof(arg, &endPtr);
+
+    return endPtr != arg && *endPtr == '\0' && *value >= 0.0f &&
+           *value <= 1.0f;
+}
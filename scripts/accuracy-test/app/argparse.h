@@ -20,18 +20,60 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
+#include "detect.h"
+#include "ioengine.h"
 #include "larod.h"
 
 typedef struct args_t {
+    // Output size given on the command line, 0 if not given.
     size_t outputBytes;
     char* modelFile;
+    // Id of a public model to get instead of loading modelFile, 0 if not
+    // given.
+    uint64_t modelId;
     char* labelsFile;
     char* annotationsFile;
+    char* datasetFile;
+    // Directory of JPEG images to decode and preprocess on the device, NULL
+    // to read converted images.
+    char* jpegDir;
+    char* preprocessDevice;
+    char* reportFile;
+    char* resultsFile;
+    // Directory of the result cache files, NULL to run every image.
+    char* cacheDir;
+    // Run every image even if it is in the cache.
+    bool force;
     unsigned width;
     unsigned height;
     char* deviceName;
+    size_t inflight;
+    size_t workers;
+    // Number of image files each worker reads ahead, 0 to read them when
+    // they are loaded.
+    size_t readAhead;
+    ioBackend ioBackend;
+    // Largest number of images to run, 0 for all.
+    size_t maxImages;
+    // Half-width of the confidence intervals of top1 and top5 at which a
+    // sampled run stops, 0 to run every image in order.
+    double sampleTolerance;
+    // Seed of the order of a sampled run, 0 to pick one.
+    uint64_t seed;
+    double confidence;
+    bool zeroCopy;
+    // Output layout of a detection model, DETECT_FORMAT_NONE for a
+    // classification model.
+    detectFormat detectFormat;
+    float confThreshold;
+    float iouThreshold;
+    size_t maxDetections;
+    // Syslog priority of the least important messages that are logged.
+    int logLevel;
 } args_t;
 
 bool parseArgs(int argc, char** argv, args_t* args);
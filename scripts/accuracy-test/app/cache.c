@@ -0,0 +1,341 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file implements the cache of the per-image results.
+ */
+
+#include "cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+
+// Entries appended between two flushes to the disk.
+#define CACHE_SYNC_ENTRIES (256)
+// Entries read from the file at a time.
+#define CACHE_READ_ENTRIES (256)
+
+struct resultsCache {
+    int fd;
+    // One byte per image, 1 if the image was read back from the file.
+    uint8_t* cached;
+    size_t capacity;
+    size_t numCached;
+    atomic_size_t numAppended;
+    atomic_bool failed;
+    char path[PATH_MAX];
+};
+
+/**
+ * brief Computes the CRC-32 of some bytes, as used by zlib.
+ *
+ * param data The bytes.
+ * param size Number of bytes.
+ * return The CRC.
+ */
+static uint32_t crc32Of(const void* data, size_t size);
+
+/**
+ * brief Writes a fresh header to an empty cache file.
+ *
+ * param cache The cache.
+ * param key Hash of the model, device and dataset.
+ * return False if the header could not be written, otherwise true.
+ */
+static bool writeHeader(resultsCache* cache, uint64_t key);
+
+/**
+ * brief Checks the header of a cache file.
+ *
+ * param cache The cache, positioned at the start of the file.
+ * param key Hash of the model, device and dataset.
+ * return True if the file has a valid header for the key.
+ */
+static bool readHeader(resultsCache* cache, uint64_t key);
+
+/**
+ * brief Reads back the entries of a cache file, and truncates the file
+ * after the last valid entry.
+ *
+ * param cache The cache, positioned after the header.
+ * param sink The results of the run.
+ * return False if the file could not be read or truncated, otherwise true.
+ */
+static bool readEntries(resultsCache* cache, resultsSink* sink);
+
+static uint32_t crc32Of(const void* data, size_t size) {
+    const uint8_t* bytes = data;
+    uint32_t crc = 0xffffffffu;
+
+    for (size_t i = 0; i < size; i++) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1u)));
+        }
+    }
+
+    return ~crc;
+}
+
+static bool writeHeader(resultsCache* cache, uint64_t key) {
+    cacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.key = key;
+    header.entryBytes = sizeof(cacheEntry);
+    header.crc = crc32Of(&header, offsetof(cacheHeader, crc));
+
+    if (write(cache->fd, &header, sizeof(header)) != sizeof(header)) {
+        syslog(LOG_ERR, "Unable to write cache file %s: %s", cache->path,
+               strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static bool readHeader(resultsCache* cache, uint64_t key) {
+    cacheHeader header;
+
+    if (read(cache->fd, &header, sizeof(header)) != sizeof(header)) {
+        return false;
+    }
+
+    return memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+           header.version == CACHE_VERSION && header.key == key &&
+           header.entryBytes == sizeof(cacheEntry) &&
+           header.crc == crc32Of(&header, offsetof(cacheHeader, crc));
+}
+
+static bool readEntries(resultsCache* cache, resultsSink* sink) {
+    cacheEntry entries[CACHE_READ_ENTRIES];
+    off_t validEnd = sizeof(cacheHeader);
+    size_t pending = 0;
+    bool torn = false;
+
+    while (!torn) {
+        const ssize_t got = read(cache->fd, (uint8_t*) entries + pending,
+                                 sizeof(entries) - pending);
+        if (got < 0) {
+            syslog(LOG_ERR, "Unable to read cache file %s: %s", cache->path,
+                   strerror(errno));
+            return false;
+        }
+        if (got == 0) {
+            // A partial entry at the end is a write that was cut short.
+            torn = pending > 0;
+            break;
+        }
+        pending += (size_t) got;
+
+        const size_t count = pending / sizeof(cacheEntry);
+        for (size_t i = 0; i < count; i++) {
+            const cacheEntry* entry = &entries[i];
+            resultRecord* record = resultsGet(sink, entry->imageId);
+            if (entry->crc != crc32Of(entry, offsetof(cacheEntry, crc)) ||
+                !record || entry->numClasses > RESULTS_TOP_K) {
+                torn = true;
+                break;
+            }
+            record->imageId = entry->imageId;
+            record->groundTruth = entry->groundTruth;
+            memcpy(record->classes, entry->classes, sizeof(record->classes));
+            record->topScore = entry->topScore;
+            record->numClasses = entry->numClasses;
+            record->hits = entry->hits;
+            if (!cache->cached[entry->imageId - 1]) {
+                cache->cached[entry->imageId - 1] = 1;
+                cache->numCached++;
+            }
+            validEnd += (off_t) sizeof(cacheEntry);
+        }
+        const size_t used = count * sizeof(cacheEntry);
+        memmove(entries, (uint8_t*) entries + used, pending - used);
+        pending -= used;
+    }
+
+    if (torn) {
+        syslog(LOG_WARNING, "Dropping a torn entry at the end of %s",
+               cache->path);
+        if (ftruncate(cache->fd, validEnd)) {
+            syslog(LOG_ERR, "Unable to truncate cache file %s: %s",
+                   cache->path, strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint64_t cacheHash(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* bytes = data;
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+bool cacheHashFile(uint64_t* hash, const char* path) {
+    uint8_t buffer[65536];
+    bool ret = false;
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        *hash = cacheHash(*hash, buffer, got);
+    }
+    ret = !ferror(file);
+    fclose(file);
+
+    return ret;
+}
+
+size_t cacheArenaSize(size_t capacity) {
+    return arenaAlignedSize(sizeof(resultsCache)) + arenaAlignedSize(capacity);
+}
+
+bool cacheOpen(arena* a, const char* dir, uint64_t key, size_t capacity,
+               bool force, resultsSink* sink, resultsCache** cachePtr) {
+    resultsCache* cache = arenaAlloc(a, sizeof(resultsCache));
+    if (!cache) {
+        return false;
+    }
+    cache->cached = arenaAlloc(a, capacity ? capacity : 1);
+    if (!cache->cached) {
+        return false;
+    }
+    cache->capacity = capacity;
+    atomic_init(&cache->numAppended, 0);
+    atomic_init(&cache->failed, false);
+
+    if (mkdir(dir, 0755) && errno != EEXIST) {
+        syslog(LOG_ERR, "Unable to create cache directory %s: %s", dir,
+               strerror(errno));
+        return false;
+    }
+    const int len = snprintf(cache->path, sizeof(cache->path),
+                             "%s/%016llx.cache", dir, (unsigned long long) key);
+    if (len < 0 || (size_t) len >= sizeof(cache->path)) {
+        syslog(LOG_ERR, "Cache directory path too long: %s", dir);
+        return false;
+    }
+
+    cache->fd = open(cache->path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (cache->fd < 0) {
+        syslog(LOG_ERR, "Unable to open cache file %s: %s", cache->path,
+               strerror(errno));
+        return false;
+    }
+
+    if (!force && readHeader(cache, key)) {
+        if (!readEntries(cache, sink)) {
+            goto error;
+        }
+    } else {
+        if (!force && lseek(cache->fd, 0, SEEK_END) > 0) {
+            syslog(LOG_WARNING, "Starting over the invalid cache file %s",
+                   cache->path);
+        }
+        if (ftruncate(cache->fd, 0) || !writeHeader(cache, key)) {
+            syslog(LOG_ERR, "Unable to reset cache file %s: %s", cache->path,
+                   strerror(errno));
+            goto error;
+        }
+    }
+    *cachePtr = cache;
+
+    return true;
+
+error:
+    close(cache->fd);
+
+    return false;
+}
+
+void cacheClose(resultsCache** cachePtr) {
+    resultsCache* cache = *cachePtr;
+    if (!cache) {
+        return;
+    }
+
+    if (fdatasync(cache->fd)) {
+        syslog(LOG_WARNING, "Unable to flush cache file %s: %s", cache->path,
+               strerror(errno));
+    }
+    close(cache->fd);
+    *cachePtr = NULL;
+}
+
+bool cacheHas(const resultsCache* cache, size_t imageId) {
+    if (imageId < 1 || imageId > cache->capacity) {
+        return false;
+    }
+
+    return cache->cached[imageId - 1] != 0;
+}
+
+size_t cacheGetCount(const resultsCache* cache) {
+    return cache->numCached;
+}
+
+void cacheAppend(resultsCache* cache, const resultRecord* record) {
+    if (atomic_load_explicit(&cache->failed, memory_order_relaxed)) {
+        return;
+    }
+
+    cacheEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.imageId = record->imageId;
+    entry.groundTruth = record->groundTruth;
+    memcpy(entry.classes, record->classes, sizeof(entry.classes));
+    entry.topScore = record->topScore;
+    entry.numClasses = record->numClasses;
+    entry.hits = record->hits;
+    entry.crc = crc32Of(&entry, offsetof(cacheEntry, crc));
+
+    // O_APPEND makes each write land whole at the end, whichever worker
+    // writes it.
+    if (write(cache->fd, &entry, sizeof(entry)) != sizeof(entry)) {
+        if (!atomic_exchange(&cache->failed, true)) {
+            syslog(LOG_WARNING,
+                   "Unable to append to cache file %s, no more results are "
+                   "cached: %s",
+                   cache->path, strerror(errno));
+        }
+        return;
+    }
+
+    const size_t appended = atomic_fetch_add_explicit(
+                                &cache->numAppended, 1, memory_order_relaxed) +
+                            1;
+    if (appended % CACHE_SYNC_ENTRIES == 0) {
+        fdatasync(cache->fd);
+    }
+}
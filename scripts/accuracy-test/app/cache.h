@@ -0,0 +1,158 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file declares the cache of the per-image results, which lets
+ * an interrupted run resume and a repeated run skip the accelerator.
+ *
+ * The cache is one file per key in a directory, where the key is a hash of
+ * everything that decides the results: the model file, the device, the OS
+ * and the dataset or annotations. The file is laid out as follows, all
+ * integers little-endian:
+ *
+ *     cacheHeader
+ *     cacheEntry, one per scored image, in the order they were scored
+ *
+ * Entries are only ever appended, each with one write(), and every entry
+ * holds a CRC-32 of itself. When the file is opened, the entries up to the
+ * first one that is cut short or does not match its CRC are read back, and
+ * the file is truncated there, so a run killed in the middle of a write
+ * loses at most the entries that had not reached the disk.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "results.h"
+
+#define CACHE_MAGIC "AXRC"
+#define CACHE_VERSION (1)
+
+// Start value of cacheHash.
+#define CACHE_HASH_INIT (0xcbf29ce484222325ULL)
+
+typedef struct cacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    // Size of a cacheEntry, to catch files of other builds.
+    uint32_t entryBytes;
+    // CRC-32 of the fields above.
+    uint32_t crc;
+} cacheHeader;
+
+typedef struct cacheEntry {
+    // The resultRecord of the image, see results.h.
+    uint32_t imageId;
+    int32_t groundTruth;
+    uint32_t classes[RESULTS_TOP_K];
+    float topScore;
+    uint8_t numClasses;
+    uint8_t hits;
+    uint16_t reserved;
+    // CRC-32 of the fields above.
+    uint32_t crc;
+} cacheEntry;
+
+typedef struct resultsCache resultsCache;
+
+/**
+ * brief Adds bytes to a 64-bit FNV-1a hash.
+ *
+ * param hash The hash so far, CACHE_HASH_INIT to start.
+ * param data Bytes to add.
+ * param size Number of bytes.
+ * return The new hash.
+ */
+uint64_t cacheHash(uint64_t hash, const void* data, size_t size);
+
+/**
+ * brief Adds the contents of a file to a hash.
+ *
+ * param hash Pointer to the hash so far.
+ * param path The file.
+ * return False if the file could not be read, otherwise true.
+ */
+bool cacheHashFile(uint64_t* hash, const char* path);
+
+/**
+ * brief Returns the arena space needed for a cache.
+ *
+ * param capacity Largest image number that can be cached.
+ * return Size in bytes to reserve in the arena.
+ */
+size_t cacheArenaSize(size_t capacity);
+
+/**
+ * brief Opens or creates the cache file of a key and reads back its
+ * entries.
+ *
+ * Every entry read back is copied to the record of its image in the sink,
+ * and the image is marked as cached.
+ *
+ * param a Arena with at least cacheArenaSize(capacity) bytes left.
+ * param dir Directory of the cache files, created if missing.
+ * param key Hash of the model, device and dataset.
+ * param capacity Largest image number that can be cached.
+ * param force Throw away the entries in the file instead of reading them.
+ * param sink The results of the run.
+ * param cachePtr Pointer to the opened cache.
+ * return False if the file could not be opened or created, otherwise true.
+ */
+bool cacheOpen(arena* a, const char* dir, uint64_t key, size_t capacity,
+               bool force, resultsSink* sink, resultsCache** cachePtr);
+
+/**
+ * brief Closes a cache, after flushing it to the disk.
+ *
+ * param cachePtr Pointer to the cache. Set to NULL on return.
+ */
+void cacheClose(resultsCache** cachePtr);
+
+/**
+ * brief Checks if the result of an image was read back from the file.
+ *
+ * Safe to call from several threads at the same time.
+ *
+ * param cache The cache.
+ * param imageId One-based image number.
+ * return True if the image is cached.
+ */
+bool cacheHas(const resultsCache* cache, size_t imageId);
+
+/**
+ * brief Returns the number of images read back from the file.
+ *
+ * param cache The cache.
+ * return The number of images.
+ */
+size_t cacheGetCount(const resultsCache* cache);
+
+/**
+ * brief Appends the result of an image to the file.
+ *
+ * Safe to call from several threads at the same time. The file is flushed
+ * to the disk every few hundred entries. If a write fails, a warning is
+ * logged and nothing more is appended, since the run itself can go on.
+ *
+ * param cache The cache.
+ * param record The result of the image.
+ */
+void cacheAppend(resultsCache* cache, const resultRecord* record);
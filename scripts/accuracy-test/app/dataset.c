@@ -0,0 +1,258 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file reads the packed dataset container.
+ */
+
+#include "dataset.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+
+struct dataset {
+    int fd;
+    uint64_t fileSize;
+    // Mapping of the header, index and labels, i.e. [0, dataOffset).
+    uint8_t* meta;
+    size_t metaSize;
+    // Mapping of the whole file, MAP_FAILED if images are mapped one by one.
+    uint8_t* whole;
+    const datasetHeader* header;
+    const datasetIndexEntry* index;
+};
+
+/**
+ * brief Checks that a dataset header is consistent with the file size.
+ *
+ * param header Header read from the start of the file.
+ * param fileSize Size in bytes of the dataset file.
+ * return False if the file is not a valid dataset, otherwise true.
+ */
+static bool validateHeader(const datasetHeader* header, uint64_t fileSize);
+
+/**
+ * brief Checks that every image in the index lies inside the file.
+ *
+ * param ds The dataset, with header and index set.
+ * return False if the index is not valid, otherwise true.
+ */
+static bool validateIndex(const dataset* ds);
+
+static bool validateHeader(const datasetHeader* header, uint64_t fileSize) {
+    if (memcmp(header->magic, DATASET_MAGIC, sizeof(header->magic))) {
+        syslog(LOG_ERR, "%s: Not a packed dataset file", __func__);
+        return false;
+    }
+    if (header->version != DATASET_VERSION ||
+        header->headerBytes != sizeof(datasetHeader)) {
+        syslog(LOG_ERR, "%s: Unsupported dataset version %u", __func__,
+               header->version);
+        return false;
+    }
+
+    // Check every offset against the file size so that a truncated copy
+    // fails here instead of with SIGBUS in the middle of a run. Sizes are
+    // compared with the space left instead of added to offsets, so that a
+    // corrupt header cannot wrap around.
+    const uint64_t indexBytes =
+        (uint64_t) header->count * sizeof(datasetIndexEntry);
+    if (header->dataOffset > fileSize ||
+        header->indexOffset > header->dataOffset ||
+        indexBytes > header->dataOffset - header->indexOffset ||
+        header->labelsOffset > header->dataOffset ||
+        header->labelsBytes > header->dataOffset - header->labelsOffset ||
+        header->imageBytes == 0 || header->imageStride == 0 ||
+        header->imageBytes > header->imageStride) {
+        syslog(LOG_ERR, "%s: Corrupt dataset header", __func__);
+        return false;
+    }
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (header->dataOffset % (uint64_t) pageSize ||
+        header->imageStride % (uint64_t) pageSize) {
+        syslog(LOG_ERR, "%s: Dataset images are not aligned to the page size "
+               "%ld", __func__, pageSize);
+        return false;
+    }
+
+    return true;
+}
+
+static bool validateIndex(const dataset* ds) {
+    for (size_t i = 0; i < ds->header->count; i++) {
+        const datasetIndexEntry* entry = &ds->index[i];
+        if (entry->offset < ds->header->dataOffset ||
+            entry->offset % ds->header->imageStride !=
+                ds->header->dataOffset % ds->header->imageStride ||
+            ds->header->imageBytes > ds->fileSize ||
+            entry->offset > ds->fileSize - ds->header->imageBytes) {
+            syslog(LOG_ERR, "%s: Image %zu lies outside of the dataset file, "
+                   "is the file truncated?", __func__, i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool datasetOpen(const char* path, dataset** datasetPtr) {
+    dataset* ds = calloc(1, sizeof(dataset));
+    if (!ds) {
+        syslog(LOG_ERR, "%s: Unable to allocate dataset: %s", __func__,
+               strerror(errno));
+        return false;
+    }
+    ds->meta = MAP_FAILED;
+    ds->whole = MAP_FAILED;
+
+    ds->fd = open(path, O_RDONLY);
+    if (ds->fd < 0) {
+        syslog(LOG_ERR, "%s: Unable to open dataset %s: %s", __func__, path,
+               strerror(errno));
+        goto error;
+    }
+
+    struct stat fileStats = {0};
+    if (fstat(ds->fd, &fileStats) < 0) {
+        syslog(LOG_ERR, "%s: Unable to get stats for dataset %s: %s", __func__,
+               path, strerror(errno));
+        goto error;
+    }
+    ds->fileSize = (uint64_t) fileStats.st_size;
+
+    datasetHeader header;
+    if (pread(ds->fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+        syslog(LOG_ERR, "%s: Unable to read dataset header from %s", __func__,
+               path);
+        goto error;
+    }
+    if (!validateHeader(&header, ds->fileSize)) {
+        goto error;
+    }
+
+    // Map the whole file if the address space allows it. Otherwise only map
+    // the metadata here and map each image on its own when it is used.
+    if (ds->fileSize <= (uint64_t) (SIZE_MAX / 2)) {
+        ds->whole = mmap(NULL, (size_t) ds->fileSize, PROT_READ, MAP_SHARED,
+                         ds->fd, 0);
+    }
+    if (ds->whole != MAP_FAILED) {
+        // Images are visited in file order, let the kernel read ahead.
+        madvise(ds->whole, (size_t) ds->fileSize, MADV_SEQUENTIAL);
+        ds->meta = ds->whole;
+    } else {
+        syslog(LOG_INFO, "%s: Dataset %s does not fit in the address space, "
+               "images are mapped one at a time", __func__, path);
+        ds->meta = mmap(NULL, (size_t) header.dataOffset, PROT_READ, MAP_SHARED,
+                        ds->fd, 0);
+        if (ds->meta == MAP_FAILED) {
+            syslog(LOG_ERR, "%s: Unable to mmap dataset %s: %s", __func__, path,
+                   strerror(errno));
+            goto error;
+        }
+    }
+    ds->metaSize = (size_t) header.dataOffset;
+    ds->header = (const datasetHeader*) ds->meta;
+    ds->index = (const datasetIndexEntry*) (ds->meta + header.indexOffset);
+
+    if (!validateIndex(ds)) {
+        goto error;
+    }
+
+    syslog(LOG_INFO, "%s: Opened dataset %s with %u images of %ux%ux%u", __func__,
+           path, ds->header->count, ds->header->width, ds->header->height,
+           ds->header->channels);
+
+    *datasetPtr = ds;
+
+    return true;
+
+error:
+    datasetClose(&ds);
+
+    return false;
+}
+
+void datasetClose(dataset** datasetPtr) {
+    if (!datasetPtr || !*datasetPtr) {
+        return;
+    }
+    dataset* ds = *datasetPtr;
+
+    if (ds->whole != MAP_FAILED) {
+        munmap(ds->whole, (size_t) ds->fileSize);
+    } else if (ds->meta != MAP_FAILED) {
+        munmap(ds->meta, ds->metaSize);
+    }
+    if (ds->fd >= 0) {
+        close(ds->fd);
+    }
+    free(ds);
+    *datasetPtr = NULL;
+}
+
+const datasetHeader* datasetGetHeader(const dataset* ds) {
+    return ds->header;
+}
+
+size_t datasetGetCount(const dataset* ds) {
+    return ds->header->count;
+}
+
+const datasetIndexEntry* datasetGetEntry(const dataset* ds, size_t idx) {
+    return &ds->index[idx];
+}
+
+int datasetGetFd(const dataset* ds) {
+    return ds->fd;
+}
+
+const void* datasetMapImage(const dataset* ds, size_t idx) {
+    if (ds->whole != MAP_FAILED) {
+        return ds->whole + ds->index[idx].offset;
+    }
+
+    void* image = mmap(NULL, (size_t) ds->header->imageBytes, PROT_READ,
+                       MAP_SHARED, ds->fd, (off_t) ds->index[idx].offset);
+    if (image == MAP_FAILED) {
+        syslog(LOG_ERR, "%s: Unable to mmap image %zu: %s", __func__, idx,
+               strerror(errno));
+        return NULL;
+    }
+
+    return image;
+}
+
+void datasetUnmapImage(const dataset* ds, const void* image) {
+    if (ds->whole == MAP_FAILED && image) {
+        munmap((void*) image, (size_t) ds->header->imageBytes);
+    }
+}
+
+const char* datasetGetLabels(const dataset* ds, size_t* size) {
+    if (!(ds->header->flags & DATASET_FLAG_LABELS)) {
+        return NULL;
+    }
+    *size = (size_t) ds->header->labelsBytes;
+
+    return (const char*) (ds->meta + ds->header->labelsOffset);
+}
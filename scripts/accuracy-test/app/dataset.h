@@ -0,0 +1,176 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file declares the packed dataset container read by the
+ * application.
+ *
+ * A packed dataset is a single file holding every converted image, so the
+ * application only needs one open() and one mmap() at startup instead of one
+ * open/read/close per image. The file is laid out as follows, all integers
+ * little-endian:
+ *
+ *     datasetHeader
+ *     datasetIndexEntry[count]
+ *     labels text (optional, newline separated)
+ *     padding up to dataOffset
+ *     image 0, padding up to imageStride
+ *     image 1, ...
+ *
+ * dataOffset and imageStride are multiples of the alignment (the page size
+ * when written by larod_convert.py), so every image starts on a page
+ * boundary of the file. The whole file is mapped once when the address space
+ * allows it. On 32-bit builds a full ImageNet dataset does not fit, so each
+ * image is then mapped on its own at its page aligned offset. The format is
+ * written by larod_convert.py --pack.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DATASET_MAGIC "AXDS"
+#define DATASET_VERSION (1)
+
+#define DATASET_FLAG_LABELS (1U << 0)
+#define DATASET_FLAG_GROUND_TRUTH (1U << 1)
+
+typedef enum {
+    DATASET_LAYOUT_INTERLEAVED = 0,
+    DATASET_LAYOUT_PLANAR = 1,
+} datasetLayout;
+
+typedef enum {
+    DATASET_DATA_TYPE_UINT8 = 0,
+    DATASET_DATA_TYPE_FLOAT32 = 1,
+} datasetDataType;
+
+typedef struct datasetHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t headerBytes;
+    uint32_t flags;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t layout;
+    uint32_t dataType;
+    // Row pitch in bytes, 0 if rows are not padded.
+    uint32_t pitch;
+    uint32_t count;
+    uint32_t alignment;
+    uint64_t imageBytes;
+    uint64_t imageStride;
+    uint64_t indexOffset;
+    uint64_t dataOffset;
+    uint64_t labelsOffset;
+    uint64_t labelsBytes;
+} datasetHeader;
+
+typedef struct datasetIndexEntry {
+    // Offset of the image from the start of the file.
+    uint64_t offset;
+    // Image number, e.g. 13453 for ILSVRC2012_val_00013453.JPEG.
+    uint32_t imageId;
+    // Class as given in the annotations file, -1 if not known.
+    int32_t groundTruth;
+} datasetIndexEntry;
+
+typedef struct dataset dataset;
+
+/**
+ * brief Opens and maps a packed dataset file.
+ *
+ * param path Path to the dataset file.
+ * param datasetPtr Pointer to the opened dataset.
+ * return False if any errors occur, otherwise true.
+ */
+bool datasetOpen(const char* path, dataset** datasetPtr);
+
+/**
+ * brief Unmaps and closes a packed dataset file.
+ *
+ * param datasetPtr Pointer to the dataset to close. Set to NULL on return.
+ */
+void datasetClose(dataset** datasetPtr);
+
+/**
+ * brief Returns the header of a dataset.
+ *
+ * param ds The dataset.
+ * return Pointer to the header inside the mapping.
+ */
+const datasetHeader* datasetGetHeader(const dataset* ds);
+
+/**
+ * brief Returns the number of images in a dataset.
+ *
+ * param ds The dataset.
+ * return Number of images.
+ */
+size_t datasetGetCount(const dataset* ds);
+
+/**
+ * brief Returns the index entry of an image.
+ *
+ * param ds The dataset.
+ * param idx Position of the image in the dataset, less than the count.
+ * return Pointer to the index entry inside the mapping.
+ */
+const datasetIndexEntry* datasetGetEntry(const dataset* ds, size_t idx);
+
+/**
+ * brief Returns the file descriptor of a dataset.
+ *
+ * The fd is opened read only and stays valid until datasetClose.
+ *
+ * param ds The dataset.
+ * return The file descriptor.
+ */
+int datasetGetFd(const dataset* ds);
+
+/**
+ * brief Maps the data of an image.
+ *
+ * The returned pointer must be released with datasetUnmapImage. Safe to call
+ * from several threads at the same time.
+ *
+ * param ds The dataset.
+ * param idx Position of the image in the dataset, less than the count.
+ * return Pointer to header.imageBytes bytes of image data, or NULL if the
+ * image could not be mapped.
+ */
+const void* datasetMapImage(const dataset* ds, size_t idx);
+
+/**
+ * brief Releases an image mapped with datasetMapImage.
+ *
+ * param ds The dataset.
+ * param image Pointer returned by datasetMapImage.
+ */
+void datasetUnmapImage(const dataset* ds, const void* image);
+
+/**
+ * brief Returns the labels text embedded in a dataset.
+ *
+ * param ds The dataset.
+ * param size Pointer to the size in bytes of the labels text.
+ * return Pointer to the labels text inside the mapping (not NULL
+ * terminated), or NULL if the dataset has no labels.
+ */
+const char* datasetGetLabels(const dataset* ds, size_t* size);
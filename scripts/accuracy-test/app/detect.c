@@ -0,0 +1,766 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * This file implements the post-processing of object detection models.
+ */
+
+#include "detect.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Cells per side of the grid that kept boxes are entered in.
+#define GRID_SIDE (16)
+#define GRID_CELLS (GRID_SIDE * GRID_SIDE)
+
+// Values before the class scores in a YOLOv5 row and a YOLOv8 column.
+#define YOLOV5_HEADER (5)
+#define YOLOV8_HEADER (4)
+
+// Number of keys of a quantized value, see detector.keys.
+#define NUM_KEYS (256)
+
+typedef struct candidate {
+    float score;
+    uint32_t anchor;
+    uint32_t classIdx;
+    // Index of the box in the detector corner arrays.
+    uint32_t box;
+} candidate;
+
+struct detector {
+    detectConfig config;
+    // Bytes of one value of the output.
+    size_t valueBytes;
+    // Quantized values are compared as unsigned keys, the value XOR flip,
+    // so that int8 and uint8 outputs share one path: flipping the sign bit
+    // of an int8 orders it like a uint8. keyValues holds the dequantized
+    // value of every key, and a box passes if its key is at least
+    // keyThreshold, NUM_KEYS if no key passes.
+    bool quantized;
+    uint8_t flip;
+    unsigned keyThreshold;
+    float keyValues[NUM_KEYS];
+    // Largest class key or score of every anchor, YOLOv8 only.
+    uint8_t* maxKeys;
+    float* maxScores;
+    // Boxes that pass the threshold, sorted by score after decoding, and
+    // their corners.
+    candidate* candidates;
+    size_t numCandidates;
+    float* x1;
+    float* y1;
+    float* x2;
+    float* y2;
+    // Grid of kept boxes, one per class: the first entry of each cell of
+    // each class, -1 if empty, and for each entry the next entry of the same
+    // cell, the kept box and the cell. A kept box is in at most GRID_CELLS
+    // entries. Only the cells that got entries are cleared for the next
+    // output.
+    int32_t* cellHead;
+    int32_t* entryNext;
+    uint32_t* entryBox;
+    uint32_t* entryCell;
+    size_t numEntries;
+    // Area of each kept box, and the last candidate it was compared with,
+    // so that a box entered in several cells is only compared once.
+    float* keptArea;
+    uint32_t* keptStamp;
+};
+
+/**
+ * brief Reads a float or half precision value, which need not be aligned.
+ *
+ * param p Address of the value.
+ * param type TOPK_TYPE_FLOAT16 or TOPK_TYPE_FLOAT32.
+ * return The value.
+ */
+static float loadFloat(const uint8_t* p, topkType type);
+
+/**
+ * brief Reads a value of the output at a position.
+ *
+ * param det The detector.
+ * param output The output.
+ * param idx Position of the value, in values.
+ * return The dequantized value.
+ */
+static float loadValue(const detector* det, const uint8_t* output, size_t idx);
+
+/**
+ * brief Sets up the quantized threshold and the value of every key.
+ *
+ * param det The detector, with config set.
+ */
+static void setupKeys(detector* det);
+
+/**
+ * brief Finds the largest key of a row of quantized values.
+ *
+ * param row First value of the row.
+ * param count Number of values.
+ * param flip Mask XORed with every value, see detector.flip.
+ * param idx Pointer to the position of the first largest key.
+ * return The largest key.
+ */
+static uint8_t rowMaxKey(const uint8_t* row, size_t count, uint8_t flip,
+                         size_t* idx);
+
+/**
+ * brief Raises the largest key of every anchor to the key of one class.
+ *
+ * param maxKeys Largest key so far of every anchor.
+ * param row Scores of the class, one per anchor.
+ * param count Number of anchors.
+ * param flip Mask XORed with every value, see detector.flip.
+ */
+static void raiseMaxKeys(uint8_t* restrict maxKeys, const uint8_t* restrict row,
+                         size_t count, uint8_t flip);
+
+/**
+ * brief Finds the candidates of a YOLOv5 output.
+ *
+ * param det The detector.
+ * param output The output.
+ */
+static void findYolov5(detector* det, const uint8_t* output);
+
+/**
+ * brief Finds the candidates of a YOLOv8 output.
+ *
+ * param det The detector.
+ * param output The output.
+ */
+static void findYolov8(detector* det, const uint8_t* output);
+
+/**
+ * brief Finds the candidates of the outputs of an SSD model.
+ *
+ * param det The detector.
+ * param outputs The boxes, classes, scores and count outputs.
+ */
+static void findSsd(detector* det, const void* const* outputs);
+
+/**
+ * brief Converts the centre and size of every candidate to clipped corners.
+ *
+ * param det The detector, with the centres in x1 and y1 and the sizes in x2
+ * and y2.
+ */
+static void toCorners(detector* det);
+
+/**
+ * brief Orders candidates by descending score, then by ascending anchor.
+ *
+ * param a First candidate.
+ * param b Second candidate.
+ * return Negative if a comes first, positive if b comes first.
+ */
+static int compareCandidates(const void* a, const void* b);
+
+/**
+ * brief Returns the grid cell of a clipped coordinate.
+ *
+ * param v Coordinate between 0 and 1.
+ * return Column or row of the cell.
+ */
+static size_t gridCell(float v);
+
+bool detectParseFormat(const char* name, detectFormat* format) {
+    if (strcmp(name, "yolov5") == 0) {
+        *format = DETECT_FORMAT_YOLOV5;
+    } else if (strcmp(name, "yolov8") == 0) {
+        *format = DETECT_FORMAT_YOLOV8;
+    } else if (strcmp(name, "ssd") == 0) {
+        *format = DETECT_FORMAT_SSD;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+const char* detectFormatName(detectFormat format) {
+    switch (format) {
+    case DETECT_FORMAT_YOLOV5:
+        return "yolov5";
+    case DETECT_FORMAT_YOLOV8:
+        return "yolov8";
+    case DETECT_FORMAT_SSD:
+        return "ssd";
+    case DETECT_FORMAT_NONE:
+    default:
+        return "none";
+    }
+}
+
+size_t detectOutputBytes(const detectConfig* config) {
+    if (config->format == DETECT_FORMAT_SSD) {
+        return config->numAnchors * 4 * sizeof(float);
+    }
+    const size_t header = config->format == DETECT_FORMAT_YOLOV5
+                              ? YOLOV5_HEADER
+                              : YOLOV8_HEADER;
+
+    return config->numAnchors * (header + config->numClasses) *
+           topkTypeSize(config->type);
+}
+
+bool detectorCreate(const detectConfig* config, detector** detPtr) {
+    detector* det = NULL;
+
+    const bool isSsd = config->format == DETECT_FORMAT_SSD;
+    if (config->format == DETECT_FORMAT_NONE || config->numAnchors == 0 ||
+        (config->numClasses == 0 && !isSsd) ||
+        (isSsd && config->type != TOPK_TYPE_FLOAT32) ||
+        config->numClasses > UINT32_MAX / GRID_CELLS ||
+        config->maxDetections == 0 ||
+        config->maxDetections > INT32_MAX / GRID_CELLS) {
+        syslog(LOG_ERR, "Invalid detector configuration");
+        goto error;
+    }
+
+    det = calloc(1, sizeof(*det));
+    if (!det) {
+        goto nomem;
+    }
+    det->config = *config;
+    det->valueBytes = topkTypeSize(config->type);
+    setupKeys(det);
+
+    const size_t numAnchors = config->numAnchors;
+    const size_t maxEntries = config->maxDetections * GRID_CELLS;
+    det->candidates = malloc(numAnchors * sizeof(candidate));
+    det->x1 = malloc(numAnchors * sizeof(float));
+    det->y1 = malloc(numAnchors * sizeof(float));
+    det->x2 = malloc(numAnchors * sizeof(float));
+    det->y2 = malloc(numAnchors * sizeof(float));
+    if (!det->candidates || !det->x1 || !det->y1 || !det->x2 || !det->y2) {
+        goto nomem;
+    }
+    // SSD models suppress their boxes themselves, so they need no grid.
+    if (!isSsd) {
+        det->cellHead =
+            malloc(config->numClasses * GRID_CELLS * sizeof(int32_t));
+        det->entryNext = malloc(maxEntries * sizeof(int32_t));
+        det->entryBox = malloc(maxEntries * sizeof(uint32_t));
+        det->entryCell = malloc(maxEntries * sizeof(uint32_t));
+        det->keptArea = malloc(config->maxDetections * sizeof(float));
+        det->keptStamp = malloc(config->maxDetections * sizeof(uint32_t));
+        if (!det->cellHead || !det->entryNext || !det->entryBox ||
+            !det->entryCell || !det->keptArea || !det->keptStamp) {
+            goto nomem;
+        }
+        for (size_t c = 0; c < config->numClasses * GRID_CELLS; c++) {
+            det->cellHead[c] = -1;
+        }
+    }
+    if (config->format == DETECT_FORMAT_YOLOV8) {
+        if (det->quantized) {
+            det->maxKeys = malloc(numAnchors);
+        } else {
+            det->maxScores = malloc(numAnchors * sizeof(float));
+        }
+        if (!det->maxKeys && !det->maxScores) {
+            goto nomem;
+        }
+    }
+
+    *detPtr = det;
+
+    return true;
+
+nomem:
+    syslog(LOG_ERR, "Failed allocating detector for %zu anchors",
+           config->numAnchors);
+error:
+    detectorDestroy(&det);
+
+    return false;
+}
+
+void detectorDestroy(detector** detPtr) {
+    if (!detPtr || !*detPtr) {
+        return;
+    }
+
+    detector* det = *detPtr;
+    free(det->maxKeys);
+    free(det->maxScores);
+    free(det->candidates);
+    free(det->x1);
+    free(det->y1);
+    free(det->x2);
+    free(det->y2);
+    free(det->cellHead);
+    free(det->entryNext);
+    free(det->entryBox);
+    free(det->entryCell);
+    free(det->keptArea);
+    free(det->keptStamp);
+    free(det);
+    *detPtr = NULL;
+}
+
+size_t detectorDecode(detector* det, const void* const* outputs) {
+    det->numCandidates = 0;
+    if (det->config.format == DETECT_FORMAT_SSD) {
+        findSsd(det, outputs);
+    } else {
+        if (det->config.format == DETECT_FORMAT_YOLOV5) {
+            findYolov5(det, outputs[0]);
+        } else {
+            findYolov8(det, outputs[0]);
+        }
+        toCorners(det);
+    }
+    qsort(det->candidates, det->numCandidates, sizeof(candidate),
+          compareCandidates);
+
+    return det->numCandidates;
+}
+
+size_t detectorSuppress(detector* det, detectBox* boxes) {
+    const float iouThreshold = det->config.iouThreshold;
+    const size_t maxDetections = det->config.maxDetections;
+    size_t numKept = 0;
+
+    if (det->config.format == DETECT_FORMAT_SSD) {
+        for (; numKept < det->numCandidates && numKept < maxDetections;
+             numKept++) {
+            const candidate* cand = &det->candidates[numKept];
+            boxes[numKept] = (detectBox){
+                .x1 = det->x1[cand->box],
+                .y1 = det->y1[cand->box],
+                .x2 = det->x2[cand->box],
+                .y2 = det->y2[cand->box],
+                .score = cand->score,
+                .classIdx = cand->classIdx,
+            };
+        }
+        return numKept;
+    }
+
+    for (size_t e = 0; e < det->numEntries; e++) {
+        det->cellHead[det->entryCell[e]] = -1;
+    }
+    det->numEntries = 0;
+
+    for (size_t i = 0; i < det->numCandidates && numKept < maxDetections;
+         i++) {
+        const candidate* cand = &det->candidates[i];
+        const float x1 = det->x1[cand->box];
+        const float y1 = det->y1[cand->box];
+        const float x2 = det->x2[cand->box];
+        const float y2 = det->y2[cand->box];
+        const float area = (x2 - x1) * (y2 - y1);
+        const size_t col1 = gridCell(x1);
+        const size_t col2 = gridCell(x2);
+        const size_t row1 = gridCell(y1);
+        const size_t row2 = gridCell(y2);
+        int32_t* cellHead = &det->cellHead[cand->classIdx * GRID_CELLS];
+        // Stamps start at 1, so that no kept box has been compared with
+        // this candidate yet.
+        const uint32_t stamp = (uint32_t) i + 1;
+
+        bool suppressed = false;
+        for (size_t row = row1; row <= row2 && !suppressed; row++) {
+            for (size_t col = col1; col <= col2 && !suppressed; col++) {
+                for (int32_t e = cellHead[row * GRID_SIDE + col]; e >= 0;
+                     e = det->entryNext[e]) {
+                    const uint32_t k = det->entryBox[e];
+                    if (det->keptStamp[k] == stamp) {
+                        continue;
+                    }
+                    det->keptStamp[k] = stamp;
+                    const detectBox* kept = &boxes[k];
+                    const float w = fminf(x2, kept->x2) - fmaxf(x1, kept->x1);
+                    const float h = fminf(y2, kept->y2) - fmaxf(y1, kept->y1);
+                    if (w <= 0.0f || h <= 0.0f) {
+                        continue;
+                    }
+                    const float inter = w * h;
+                    if (inter > iouThreshold *
+                                    (area + det->keptArea[k] - inter)) {
+                        suppressed = true;
+                        break;
+                    }
+                }
+            }
+        }
+        if (suppressed) {
+            continue;
+        }
+
+        boxes[numKept] = (detectBox){
+            .x1 = x1,
+            .y1 = y1,
+            .x2 = x2,
+            .y2 = y2,
+            .score = cand->score,
+            .classIdx = cand->classIdx,
+        };
+        det->keptArea[numKept] = area;
+        det->keptStamp[numKept] = 0;
+        for (size_t row = row1; row <= row2; row++) {
+            for (size_t col = col1; col <= col2; col++) {
+                const size_t cell = row * GRID_SIDE + col;
+                const size_t e = det->numEntries++;
+                det->entryNext[e] = cellHead[cell];
+                det->entryBox[e] = (uint32_t) numKept;
+                det->entryCell[e] =
+                    (uint32_t) (cand->classIdx * GRID_CELLS + cell);
+                cellHead[cell] = (int32_t) e;
+            }
+        }
+        numKept++;
+    }
+
+    return numKept;
+}
+
+static float loadFloat(const uint8_t* p, topkType type) {
+    if (type == TOPK_TYPE_FLOAT16) {
+        uint16_t half;
+        memcpy(&half, p, sizeof(half));
+        return topkHalfToFloat(half);
+    }
+    float value;
+    memcpy(&value, p, sizeof(value));
+
+    return value;
+}
+
+static float loadValue(const detector* det, const uint8_t* output, size_t idx) {
+    if (det->quantized) {
+        return det->keyValues[output[idx] ^ det->flip];
+    }
+
+    return loadFloat(output + idx * det->valueBytes, det->config.type);
+}
+
+static void setupKeys(detector* det) {
+    const detectConfig* config = &det->config;
+
+    det->quantized = config->type == TOPK_TYPE_UINT8 ||
+                     config->type == TOPK_TYPE_INT8;
+    if (!det->quantized) {
+        return;
+    }
+
+    // Key k is the value k - 128 for int8 outputs and k for uint8 outputs.
+    det->flip = config->type == TOPK_TYPE_INT8 ? 0x80 : 0x00;
+    const int32_t keyOffset = config->type == TOPK_TYPE_INT8 ? 128 : 0;
+    det->keyThreshold = NUM_KEYS;
+    for (unsigned k = 0; k < NUM_KEYS; k++) {
+        const int32_t q = (int32_t) k - keyOffset;
+        det->keyValues[k] = config->scale * (float) (q - config->zeroPoint);
+    }
+    // The scale is positive, so the values grow with the keys and the
+    // threshold is the first key whose value reaches the confidence.
+    for (unsigned k = 0; k < NUM_KEYS; k++) {
+        if (det->keyValues[k] >= config->confThreshold) {
+            det->keyThreshold = k;
+            break;
+        }
+    }
+}
+
+static uint8_t rowMaxKey(const uint8_t* row, size_t count, uint8_t flip,
+                         size_t* idx) {
+    uint8_t maxKey = 0;
+    size_t i = 0;
+
+#if defined(__ARM_NEON) || defined(__SSE2__)
+    if (count >= 16) {
+        uint8_t lanes[16];
+#if defined(__ARM_NEON)
+        const uint8x16_t mask = vdupq_n_u8(flip);
+        uint8x16_t acc = vdupq_n_u8(0);
+        for (; i + 16 <= count; i += 16) {
+            acc = vmaxq_u8(acc, veorq_u8(vld1q_u8(row + i), mask));
+        }
+        vst1q_u8(lanes, acc);
+#else
+        const __m128i mask = _mm_set1_epi8((char) flip);
+        __m128i acc = _mm_setzero_si128();
+        for (; i + 16 <= count; i += 16) {
+            const __m128i values = _mm_loadu_si128((const __m128i*) (row + i));
+            acc = _mm_max_epu8(acc, _mm_xor_si128(values, mask));
+        }
+        _mm_storeu_si128((__m128i*) lanes, acc);
+#endif
+        for (size_t l = 0; l < sizeof(lanes); l++) {
+            maxKey = lanes[l] > maxKey ? lanes[l] : maxKey;
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        const uint8_t key = row[i] ^ flip;
+        maxKey = key > maxKey ? key : maxKey;
+    }
+
+    // Only the rows that pass the threshold get here, so the position is
+    // found by a second, short scan rather than tracked in the loop above.
+    for (i = 0; (uint8_t) (row[i] ^ flip) != maxKey; i++) {
+    }
+    *idx = i;
+
+    return maxKey;
+}
+
+static void raiseMaxKeys(uint8_t* restrict maxKeys, const uint8_t* restrict row,
+                         size_t count, uint8_t flip) {
+    size_t i = 0;
+
+#if defined(__ARM_NEON)
+    const uint8x16_t mask = vdupq_n_u8(flip);
+    for (; i + 16 <= count; i += 16) {
+        const uint8x16_t keys = veorq_u8(vld1q_u8(row + i), mask);
+        vst1q_u8(maxKeys + i, vmaxq_u8(vld1q_u8(maxKeys + i), keys));
+    }
+#elif defined(__SSE2__)
+    const __m128i mask = _mm_set1_epi8((char) flip);
+    for (; i + 16 <= count; i += 16) {
+        const __m128i keys =
+            _mm_xor_si128(_mm_loadu_si128((const __m128i*) (row + i)), mask);
+        const __m128i current = _mm_loadu_si128((const __m128i*) (maxKeys + i));
+        _mm_storeu_si128((__m128i*) (maxKeys + i), _mm_max_epu8(current, keys));
+    }
+#endif
+    for (; i < count; i++) {
+        const uint8_t key = row[i] ^ flip;
+        maxKeys[i] = key > maxKeys[i] ? key : maxKeys[i];
+    }
+}
+
+static void findYolov5(detector* det, const uint8_t* output) {
+    const detectConfig* config = &det->config;
+    const size_t rowValues = YOLOV5_HEADER + config->numClasses;
+    const size_t rowBytes = rowValues * det->valueBytes;
+    const float confThreshold = config->confThreshold;
+    size_t n = 0;
+
+    // The score of a box is its objectness times its best class score, and
+    // class scores are at most 1, so a box whose objectness is below the
+    // threshold cannot pass.
+    for (size_t a = 0; a < config->numAnchors; a++) {
+        const uint8_t* row = output + a * rowBytes;
+        size_t classIdx = 0;
+        float score = 0.0f;
+        if (det->quantized) {
+            const unsigned objKey = row[4] ^ det->flip;
+            if (objKey < det->keyThreshold) {
+                continue;
+            }
+            const uint8_t classKey =
+                rowMaxKey(row + YOLOV5_HEADER, config->numClasses, det->flip,
+                          &classIdx);
+            score = det->keyValues[objKey] * det->keyValues[classKey];
+        } else {
+            const float objectness = loadFloat(row + 4 * det->valueBytes,
+                                               config->type);
+            if (!(objectness >= confThreshold)) {
+                continue;
+            }
+            float best = -INFINITY;
+            for (size_t c = 0; c < config->numClasses; c++) {
+                const float value = loadFloat(
+                    row + (YOLOV5_HEADER + c) * det->valueBytes, config->type);
+                if (value > best) {
+                    best = value;
+                    classIdx = c;
+                }
+            }
+            score = objectness * best;
+        }
+        if (!(score >= confThreshold)) {
+            continue;
+        }
+
+        det->candidates[n] = (candidate){
+            .score = score,
+            .anchor = (uint32_t) a,
+            .classIdx = (uint32_t) classIdx,
+            .box = (uint32_t) n,
+        };
+        det->x1[n] = loadValue(det, row, 0);
+        det->y1[n] = loadValue(det, row, 1);
+        det->x2[n] = loadValue(det, row, 2);
+        det->y2[n] = loadValue(det, row, 3);
+        n++;
+    }
+    det->numCandidates = n;
+}
+
+static void findYolov8(detector* det, const uint8_t* output) {
+    const detectConfig* config = &det->config;
+    const size_t numAnchors = config->numAnchors;
+    const size_t rowBytes = numAnchors * det->valueBytes;
+    const uint8_t* classRows = output + YOLOV8_HEADER * rowBytes;
+    size_t n = 0;
+
+    // The best class of every anchor is found one class row at a time, so
+    // the output is read in order and the compares run on whole vectors.
+    if (det->quantized) {
+        memset(det->maxKeys, 0, numAnchors);
+        for (size_t c = 0; c < config->numClasses; c++) {
+            raiseMaxKeys(det->maxKeys, classRows + c * rowBytes, numAnchors,
+                         det->flip);
+        }
+    } else {
+        for (size_t a = 0; a < numAnchors; a++) {
+            det->maxScores[a] = -INFINITY;
+        }
+        for (size_t c = 0; c < config->numClasses; c++) {
+            const uint8_t* row = classRows + c * rowBytes;
+            for (size_t a = 0; a < numAnchors; a++) {
+                const float value =
+                    loadFloat(row + a * det->valueBytes, config->type);
+                det->maxScores[a] = value > det->maxScores[a]
+                                        ? value
+                                        : det->maxScores[a];
+            }
+        }
+    }
+
+    for (size_t a = 0; a < numAnchors; a++) {
+        size_t classIdx = 0;
+        float score = 0.0f;
+        if (det->quantized) {
+            const uint8_t maxKey = det->maxKeys[a];
+            if (maxKey < det->keyThreshold) {
+                continue;
+            }
+            while ((uint8_t) (classRows[classIdx * rowBytes + a] ^ det->flip) !=
+                   maxKey) {
+                classIdx++;
+            }
+            score = det->keyValues[maxKey];
+        } else {
+            score = det->maxScores[a];
+            if (!(score >= config->confThreshold)) {
+                continue;
+            }
+            while (loadFloat(classRows + classIdx * rowBytes +
+                                 a * det->valueBytes,
+                             config->type) < score) {
+                classIdx++;
+            }
+        }
+
+        det->candidates[n] = (candidate){
+            .score = score,
+            .anchor = (uint32_t) a,
+            .classIdx = (uint32_t) classIdx,
+            .box = (uint32_t) n,
+        };
+        det->x1[n] = loadValue(det, output, a);
+        det->y1[n] = loadValue(det, output, numAnchors + a);
+        det->x2[n] = loadValue(det, output, 2 * numAnchors + a);
+        det->y2[n] = loadValue(det, output, 3 * numAnchors + a);
+        n++;
+    }
+    det->numCandidates = n;
+}
+
+static void findSsd(detector* det, const void* const* outputs) {
+    const detectConfig* config = &det->config;
+    const float* locations = outputs[0];
+    const float* classes = outputs[1];
+    const float* scores = outputs[2];
+    const float count = *(const float*) outputs[3];
+    size_t n = 0;
+
+    // The count is a float, and a broken one must not read past the boxes.
+    size_t numBoxes = 0;
+    if (count > 0.0f) {
+        numBoxes = count < (float) config->numAnchors ? (size_t) count
+                                                      : config->numAnchors;
+    }
+    for (size_t i = 0; i < numBoxes; i++) {
+        const float score = scores[i];
+        const float classValue = classes[i];
+        if (!(score >= config->confThreshold) || !(classValue >= 0.0f) ||
+            !(classValue < (float) UINT16_MAX)) {
+            continue;
+        }
+
+        det->candidates[n] = (candidate){
+            .score = score,
+            .anchor = (uint32_t) i,
+            .classIdx = (uint32_t) classValue,
+            .box = (uint32_t) n,
+        };
+        const float* box = &locations[4 * i];
+        det->y1[n] = fminf(fmaxf(box[0], 0.0f), 1.0f);
+        det->x1[n] = fminf(fmaxf(box[1], 0.0f), 1.0f);
+        det->y2[n] = fminf(fmaxf(box[2], 0.0f), 1.0f);
+        det->x2[n] = fminf(fmaxf(box[3], 0.0f), 1.0f);
+        n++;
+    }
+    det->numCandidates = n;
+}
+
+static void toCorners(detector* det) {
+    float* restrict x1 = det->x1;
+    float* restrict y1 = det->y1;
+    float* restrict x2 = det->x2;
+    float* restrict y2 = det->y2;
+
+    // Plain loops over separate arrays, which the compiler turns into NEON
+    // or SSE code.
+    for (size_t i = 0; i < det->numCandidates; i++) {
+        const float halfW = 0.5f * x2[i];
+        const float halfH = 0.5f * y2[i];
+        const float cx = x1[i];
+        const float cy = y1[i];
+        x1[i] = fminf(fmaxf(cx - halfW, 0.0f), 1.0f);
+        y1[i] = fminf(fmaxf(cy - halfH, 0.0f), 1.0f);
+        x2[i] = fminf(fmaxf(cx + halfW, 0.0f), 1.0f);
+        y2[i] = fminf(fmaxf(cy + halfH, 0.0f), 1.0f);
+    }
+}
+
+static int compareCandidates(const void* a, const void* b) {
+    const candidate* ca = a;
+    const candidate* cb = b;
+
+    if (ca->score > cb->score) {
+        return -1;
+    }
+    if (ca->score < cb->score) {
+        return 1;
+    }
+
+    return ca->anchor < cb->anchor ? -1 : ca->anchor > cb->anchor;
+}
+
+static size_t gridCell(float v) {
+    const size_t cell = (size_t) (v * (float) GRID_SIDE);
+
+    return cell < GRID_SIDE ? cell : GRID_SIDE - 1;
+}
@@ -0,0 +1,168 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * This header file declares the post-processing of object detection models:
+ * decoding the boxes of one output and suppressing overlapping ones.
+ *
+ * Two output layouts are supported, as exported by ultralytics for
+ * TensorFlow Lite. YOLOv5 writes one row per anchor, x, y, w, h, objectness
+ * and the score of every class, e.g. 25200x85 at 640x640. YOLOv8 writes one
+ * row per value instead, 4 + number of classes rows of one score per anchor,
+ * e.g. 84x8400, and has no objectness. Box centres and sizes are normalized
+ * to the model input.
+ *
+ * SSD models with the TensorFlow Lite detection post-processing built in,
+ * e.g. ssd_mobilenet_v2_coco_quant_postprocess, have already suppressed
+ * their boxes and write four float outputs instead: the corners of every
+ * box as ymin, xmin, ymax, xmax, its class, its score and the number of
+ * boxes. Their boxes are only filtered by score and copied.
+ *
+ * Most anchors score far below the confidence threshold, so the threshold is
+ * converted to the quantized domain once and anchors are rejected on the raw
+ * output values, before anything is dequantized. For YOLOv5 that is a single
+ * compare of the objectness per anchor, for YOLOv8 the largest class score
+ * of every anchor is found with NEON or SSE2 one class row at a time. Only
+ * the boxes that pass are dequantized and converted to corners.
+ *
+ * Overlapping boxes of the same class are suppressed greedily in score
+ * order. Each kept box is entered in the cells it covers of a uniform grid
+ * over the image, one grid per class, so a box is only compared with the
+ * kept boxes of its class that share a cell with it instead of with all of
+ * them.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "topk.h"
+
+typedef enum {
+    DETECT_FORMAT_NONE,
+    DETECT_FORMAT_YOLOV5,
+    DETECT_FORMAT_YOLOV8,
+    DETECT_FORMAT_SSD,
+} detectFormat;
+
+// Number of outputs of an SSD model: boxes, classes, scores and count.
+#define DETECT_SSD_OUTPUTS (4)
+
+typedef struct detectConfig {
+    detectFormat format;
+    // Element type of the output. Integer outputs are dequantized with
+    // scale and zeroPoint, float outputs are used as they are.
+    topkType type;
+    float scale;
+    int32_t zeroPoint;
+    // Number of anchors, or of output boxes for SSD.
+    size_t numAnchors;
+    // Number of classes, 0 if not known, which is only allowed for SSD.
+    size_t numClasses;
+    // Boxes scoring less than this are dropped before suppression.
+    float confThreshold;
+    // A box is suppressed if its intersection over union with a kept box of
+    // the same class is larger than this.
+    float iouThreshold;
+    // Largest number of boxes kept per image, the best scoring ones.
+    size_t maxDetections;
+} detectConfig;
+
+typedef struct detectBox {
+    // Corners, normalized to the model input and clipped to 0..1.
+    float x1;
+    float y1;
+    float x2;
+    float y2;
+    float score;
+    uint32_t classIdx;
+} detectBox;
+
+typedef struct detector detector;
+
+/**
+ * brief Parses the name of an output format.
+ *
+ * param name Name of the format, yolov5, yolov8 or ssd.
+ * param format Pointer to the parsed format.
+ * return False if the name is not known, otherwise true.
+ */
+bool detectParseFormat(const char* name, detectFormat* format);
+
+/**
+ * brief Returns the name of an output format.
+ *
+ * param format The format.
+ * return Name of the format.
+ */
+const char* detectFormatName(detectFormat format);
+
+/**
+ * brief Returns the size of the output of a configuration.
+ *
+ * param config The configuration.
+ * return Size in bytes of one output, of the boxes output for SSD.
+ */
+size_t detectOutputBytes(const detectConfig* config);
+
+/**
+ * brief Creates a detector with the scratch buffers for one output.
+ *
+ * Each worker needs its own detector, nothing is allocated once it is
+ * created.
+ *
+ * param config The configuration, copied.
+ * param detPtr Pointer to the created detector.
+ * return False if out of memory or the configuration is invalid, otherwise
+ * true.
+ */
+bool detectorCreate(const detectConfig* config, detector** detPtr);
+
+/**
+ * brief Destroys a detector created with detectorCreate.
+ *
+ * param detPtr Pointer to the detector. Set to NULL on return.
+ */
+void detectorDestroy(detector** detPtr);
+
+/**
+ * brief Finds the boxes of an output that score above the threshold.
+ *
+ * The boxes are kept in the detector until the next call, sorted by score,
+ * best first.
+ *
+ * param det The detector.
+ * param outputs The outputs of the model. YOLO models only use the first,
+ * of detectOutputBytes(config) bytes, SSD models the first
+ * DETECT_SSD_OUTPUTS.
+ * return Number of boxes found.
+ */
+size_t detectorDecode(detector* det, const void* const* outputs);
+
+/**
+ * brief Suppresses overlapping boxes found by the last detectorDecode.
+ *
+ * The boxes of SSD models are already suppressed, they are only copied.
+ *
+ * param det The detector.
+ * param boxes Array of at least config->maxDetections boxes, filled with the
+ * boxes that are kept, best first.
+ * return Number of boxes kept.
+ */
+size_t detectorSuppress(detector* det, detectBox* boxes);
@@ -0,0 +1,652 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * This file reads image files ahead of the inference loop, with io_uring or
+ * with a reader thread.
+ *
+ * io_uring is used through its system calls, so no library is needed on the
+ * device.
+ */
+
+#include "ioengine.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <syslog.h>
+#include <unistd.h>
+
+// Alignment of the buffers, a page.
+#define IO_ALIGNMENT (4096)
+
+typedef struct ioRequest {
+    // Handed to the caller by ioEngineWait.
+    ioBuffer buffer;
+    uint8_t* data;
+    size_t capacity;
+    int fd;
+    // Bytes to read from the start of the file and bytes read so far.
+    size_t wanted;
+    size_t done;
+    // Errno of a failed open or read, 0 if there is none.
+    int error;
+    // Set once the read is over, successfully or not.
+    bool complete;
+    struct iovec iov;
+    // Path of the file, only used in log messages.
+    char path[256];
+} ioRequest;
+
+typedef struct ioUring {
+    int fd;
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe* sqes;
+    size_t sqesSize;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+} ioUring;
+
+struct ioEngine {
+    // IO_BACKEND_URING or IO_BACKEND_THREAD.
+    ioBackend backend;
+    ioRequest* requests;
+    size_t depth;
+    // Oldest request not released and next request to submit, counted from
+    // the start of the engine, so tail - head requests are pending.
+    size_t head;
+    size_t tail;
+    ioStats stats;
+    ioUring ring;
+    // Reader thread of IO_BACKEND_THREAD. It reads the requests in order and
+    // next is the first one it has not completed. The mutex protects tail,
+    // next, stop and complete of every request.
+    pthread_t thread;
+    bool threadStarted;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    size_t next;
+    bool stop;
+};
+
+/**
+ * brief Makes sure the buffer of a request can hold a number of bytes.
+ *
+ * param req The request, not pending.
+ * param size Size in bytes.
+ * return False if out of memory, otherwise true.
+ */
+static bool growBuffer(ioRequest* req, size_t size);
+
+/**
+ * brief Marks a request as over and closes its file.
+ *
+ * param req The request.
+ * param error Errno of a failed read, 0 on success.
+ */
+static void finishRequest(ioRequest* req, int error);
+
+/**
+ * brief Sets up an io_uring instance with room for the depth of the engine.
+ *
+ * param engine The engine.
+ * return False if io_uring is not available, with errno set, otherwise true.
+ */
+static bool setupUring(ioEngine* engine);
+
+/**
+ * brief Unmaps and closes the io_uring instance of an engine.
+ *
+ * param engine The engine.
+ */
+static void destroyUring(ioEngine* engine);
+
+/**
+ * brief Queues a read of the rest of the file of a request on io_uring.
+ *
+ * param engine The engine.
+ * param req The request, with an open file.
+ * return False if the read could not be submitted, otherwise true.
+ */
+static bool submitUring(ioEngine* engine, ioRequest* req);
+
+/**
+ * brief Waits for at least one io_uring completion and handles all that are
+ * ready.
+ *
+ * Reads that came back short are submitted again for the rest of the file.
+ *
+ * param engine The engine.
+ * return False if io_uring failed, otherwise true.
+ */
+static bool reapUring(ioEngine* engine);
+
+/**
+ * brief Reads the file of a request with blocking reads.
+ *
+ * The request is not finished, so that the reader thread can do it with the
+ * mutex held.
+ *
+ * param req The request, with an open file.
+ * return Errno of a failed read, 0 on success.
+ */
+static int readFile(ioRequest* req);
+
+/**
+ * brief Reads the queued requests in order until the engine is stopped.
+ *
+ * param arg The engine.
+ * return NULL.
+ */
+static void* readerThread(void* arg);
+
+static bool growBuffer(ioRequest* req, size_t size) {
+    if (size <= req->capacity && req->data) {
+        return true;
+    }
+    const size_t capacity =
+        (size + IO_ALIGNMENT - 1) / IO_ALIGNMENT * IO_ALIGNMENT;
+    void* data = NULL;
+    const int err = posix_memalign(&data, IO_ALIGNMENT,
+                                   capacity ? capacity : IO_ALIGNMENT);
+    if (err) {
+        syslog(LOG_ERR, "%s: Unable to allocate %zu byte read buffer: %s",
+               __func__, capacity, strerror(err));
+        return false;
+    }
+    free(req->data);
+    req->data = data;
+    req->capacity = capacity;
+
+    return true;
+}
+
+static void finishRequest(ioRequest* req, int error) {
+    if (req->fd >= 0) {
+        close(req->fd);
+        req->fd = -1;
+    }
+    req->error = error;
+    req->complete = true;
+}
+
+static bool setupUring(ioEngine* engine) {
+#ifdef __NR_io_uring_setup
+    ioUring* ring = &engine->ring;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    const long fd = syscall(__NR_io_uring_setup, (unsigned) engine->depth,
+                            &params);
+    if (fd < 0) {
+        return false;
+    }
+    ring->fd = (int) fd;
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    const bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap) {
+        ring->sqRingSize = ring->sqRingSize > ring->cqRingSize
+                               ? ring->sqRingSize
+                               : ring->cqRingSize;
+        ring->cqRingSize = ring->sqRingSize;
+    }
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED) {
+        goto error;
+    }
+    ring->cqRing = singleMmap
+                       ? ring->sqRing
+                       : mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, ring->fd,
+                              IORING_OFF_CQ_RING);
+    if (ring->cqRing == MAP_FAILED) {
+        goto error;
+    }
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        goto error;
+    }
+
+    uint8_t* sq = ring->sqRing;
+    uint8_t* cq = ring->cqRing;
+    ring->sqTail = (unsigned*) (sq + params.sq_off.tail);
+    ring->sqMask = (unsigned*) (sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned*) (sq + params.sq_off.array);
+    ring->cqHead = (unsigned*) (cq + params.cq_off.head);
+    ring->cqTail = (unsigned*) (cq + params.cq_off.tail);
+    ring->cqMask = (unsigned*) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+    return true;
+
+error:
+    {
+        const int err = errno;
+        destroyUring(engine);
+        errno = err;
+    }
+
+    return false;
+#else
+    (void) engine;
+    errno = ENOSYS;
+
+    return false;
+#endif
+}
+
+static void destroyUring(ioEngine* engine) {
+    ioUring* ring = &engine->ring;
+
+    if (ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqesSize);
+        ring->sqes = MAP_FAILED;
+    }
+    if (ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing) {
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+    ring->cqRing = MAP_FAILED;
+    if (ring->sqRing != MAP_FAILED) {
+        munmap(ring->sqRing, ring->sqRingSize);
+        ring->sqRing = MAP_FAILED;
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+        ring->fd = -1;
+    }
+}
+
+static bool submitUring(ioEngine* engine, ioRequest* req) {
+#ifdef __NR_io_uring_enter
+    ioUring* ring = &engine->ring;
+
+    // Only this thread writes the tail, the kernel only reads it.
+    const unsigned tail = *ring->sqTail;
+    const unsigned idx = tail & *ring->sqMask;
+    struct io_uring_sqe* sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    req->iov.iov_base = req->data + req->done;
+    req->iov.iov_len = req->wanted - req->done;
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = req->fd;
+    sqe->addr = (uint64_t) (uintptr_t) &req->iov;
+    sqe->len = 1;
+    sqe->off = req->done;
+    sqe->user_data = (uint64_t) (uintptr_t) req;
+    ring->sqArray[idx] = idx;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    long ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0);
+    } while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+    if (ret < 0) {
+        syslog(LOG_ERR, "%s: Unable to submit read of %s: %s", __func__,
+               req->path, strerror(errno));
+        return false;
+    }
+
+    return true;
+#else
+    (void) engine;
+    (void) req;
+
+    return false;
+#endif
+}
+
+static bool reapUring(ioEngine* engine) {
+#ifdef __NR_io_uring_enter
+    ioUring* ring = &engine->ring;
+
+    unsigned head = *ring->cqHead;
+    unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+    while (head == tail) {
+        const long ret = syscall(__NR_io_uring_enter, ring->fd, 0, 1,
+                                 IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0 && errno != EINTR && errno != EAGAIN) {
+            syslog(LOG_ERR, "%s: Unable to wait for reads: %s", __func__,
+                   strerror(errno));
+            return false;
+        }
+        tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+    }
+
+    for (; head != tail; head++) {
+        const struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cqMask];
+        ioRequest* req = (ioRequest*) (uintptr_t) cqe->user_data;
+        const int res = cqe->res;
+        if (res < 0) {
+            finishRequest(req, -res);
+            continue;
+        }
+        req->done += (size_t) res;
+        // A read of 0 bytes means the file is shorter than it was when
+        // opened, keep what was read.
+        if (res > 0 && req->done < req->wanted) {
+            if (!submitUring(engine, req)) {
+                finishRequest(req, EIO);
+            }
+            continue;
+        }
+        finishRequest(req, 0);
+    }
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+
+    return true;
+#else
+    (void) engine;
+
+    return false;
+#endif
+}
+
+static int readFile(ioRequest* req) {
+    while (req->done < req->wanted) {
+        const ssize_t ret = pread(req->fd, req->data + req->done,
+                                  req->wanted - req->done, (off_t) req->done);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret < 0) {
+            return errno;
+        }
+        if (ret == 0) {
+            break;
+        }
+        req->done += (size_t) ret;
+    }
+
+    return 0;
+}
+
+static void* readerThread(void* arg) {
+    ioEngine* engine = arg;
+
+    pthread_mutex_lock(&engine->mutex);
+    for (;;) {
+        while (!engine->stop && engine->next == engine->tail) {
+            pthread_cond_wait(&engine->cond, &engine->mutex);
+        }
+        if (engine->next == engine->tail) {
+            break;
+        }
+        ioRequest* req = &engine->requests[engine->next % engine->depth];
+        if (!req->complete) {
+            pthread_mutex_unlock(&engine->mutex);
+            const int err = readFile(req);
+            pthread_mutex_lock(&engine->mutex);
+            finishRequest(req, err);
+        }
+        engine->next++;
+        pthread_cond_broadcast(&engine->cond);
+    }
+    pthread_mutex_unlock(&engine->mutex);
+
+    return NULL;
+}
+
+bool ioEngineParseBackend(const char* name, ioBackend* backend) {
+    if (!strcmp(name, "auto")) {
+        *backend = IO_BACKEND_AUTO;
+    } else if (!strcmp(name, "io_uring")) {
+        *backend = IO_BACKEND_URING;
+    } else if (!strcmp(name, "thread")) {
+        *backend = IO_BACKEND_THREAD;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+bool ioEngineCreate(ioBackend backend, size_t depth, size_t bufferBytes,
+                    ioEngine** enginePtr) {
+    ioEngine* engine = calloc(1, sizeof(ioEngine));
+    if (!engine) {
+        syslog(LOG_ERR, "%s: Unable to allocate I/O engine", __func__);
+        return false;
+    }
+    engine->depth = depth;
+    engine->ring.fd = -1;
+    engine->ring.sqRing = MAP_FAILED;
+    engine->ring.cqRing = MAP_FAILED;
+    engine->ring.sqes = MAP_FAILED;
+    pthread_mutex_init(&engine->mutex, NULL);
+    pthread_cond_init(&engine->cond, NULL);
+
+    engine->requests = calloc(depth, sizeof(ioRequest));
+    if (!engine->requests) {
+        syslog(LOG_ERR, "%s: Unable to allocate %zu read requests", __func__,
+               depth);
+        goto error;
+    }
+    for (size_t i = 0; i < depth; i++) {
+        engine->requests[i].fd = -1;
+        if (!growBuffer(&engine->requests[i], bufferBytes)) {
+            goto error;
+        }
+    }
+
+    engine->backend = IO_BACKEND_THREAD;
+    if (backend != IO_BACKEND_THREAD) {
+        if (setupUring(engine)) {
+            engine->backend = IO_BACKEND_URING;
+        } else if (backend == IO_BACKEND_URING) {
+            syslog(LOG_ERR, "%s: io_uring is not available: %s", __func__,
+                   strerror(errno));
+            goto error;
+        } else {
+            syslog(LOG_INFO, "io_uring is not available (%s), reading with a "
+                   "thread instead", strerror(errno));
+        }
+    }
+    if (engine->backend == IO_BACKEND_THREAD) {
+        const int err =
+            pthread_create(&engine->thread, NULL, readerThread, engine);
+        if (err) {
+            syslog(LOG_ERR, "%s: Unable to start reader thread: %s", __func__,
+                   strerror(err));
+            goto error;
+        }
+        engine->threadStarted = true;
+    }
+
+    *enginePtr = engine;
+
+    return true;
+
+error:
+    ioEngineDestroy(&engine);
+
+    return false;
+}
+
+void ioEngineDestroy(ioEngine** enginePtr) {
+    ioEngine* engine = *enginePtr;
+    if (!engine) {
+        return;
+    }
+
+    // The buffers and files of pending reads are still used by the kernel
+    // or the reader thread.
+    while (ioEngineWait(engine)) {
+        ioEngineRelease(engine);
+    }
+    if (engine->threadStarted) {
+        pthread_mutex_lock(&engine->mutex);
+        engine->stop = true;
+        pthread_cond_broadcast(&engine->cond);
+        pthread_mutex_unlock(&engine->mutex);
+        pthread_join(engine->thread, NULL);
+    }
+    destroyUring(engine);
+
+    if (engine->requests) {
+        for (size_t i = 0; i < engine->depth; i++) {
+            free(engine->requests[i].data);
+        }
+    }
+    free(engine->requests);
+    pthread_cond_destroy(&engine->cond);
+    pthread_mutex_destroy(&engine->mutex);
+    free(engine);
+    *enginePtr = NULL;
+}
+
+const char* ioEngineBackendName(const ioEngine* engine) {
+    return engine->backend == IO_BACKEND_URING ? "io_uring" : "thread";
+}
+
+size_t ioEnginePending(const ioEngine* engine) {
+    return engine->tail - engine->head;
+}
+
+bool ioEngineSubmit(ioEngine* engine, const char* path, size_t maxBytes,
+                    size_t tag) {
+    if (engine->tail - engine->head >= engine->depth) {
+        syslog(LOG_ERR, "%s: All %zu read buffers are in use", __func__,
+               engine->depth);
+        return false;
+    }
+
+    ioRequest* req = &engine->requests[engine->tail % engine->depth];
+    req->buffer.tag = tag;
+    req->wanted = 0;
+    req->done = 0;
+    req->error = 0;
+    req->complete = false;
+    snprintf(req->path, sizeof(req->path), "%s", path);
+
+    struct stat fileStats;
+    req->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (req->fd < 0 || fstat(req->fd, &fileStats) < 0) {
+        finishRequest(req, errno);
+    } else {
+        const size_t fileSize = (size_t) fileStats.st_size;
+        req->wanted = maxBytes && maxBytes < fileSize ? maxBytes : fileSize;
+        if (!growBuffer(req, req->wanted)) {
+            finishRequest(req, 0);
+            return false;
+        }
+        if (req->wanted == 0) {
+            finishRequest(req, 0);
+        }
+    }
+
+    if (!req->complete && engine->backend == IO_BACKEND_URING) {
+        if (!submitUring(engine, req)) {
+            finishRequest(req, 0);
+            return false;
+        }
+    } else if (!req->complete) {
+        // Starts reading the file in the background, so that it is in the
+        // page cache by the time the reader thread gets to it.
+        posix_fadvise(req->fd, 0, (off_t) req->wanted, POSIX_FADV_WILLNEED);
+    }
+
+    if (engine->backend == IO_BACKEND_THREAD) {
+        pthread_mutex_lock(&engine->mutex);
+        engine->tail++;
+        pthread_cond_broadcast(&engine->cond);
+        pthread_mutex_unlock(&engine->mutex);
+    } else {
+        engine->tail++;
+    }
+
+    return true;
+}
+
+const ioBuffer* ioEngineWait(ioEngine* engine) {
+    if (engine->head == engine->tail) {
+        return NULL;
+    }
+
+    ioRequest* req = &engine->requests[engine->head % engine->depth];
+    if (engine->backend == IO_BACKEND_THREAD) {
+        // Requests that failed to open are complete from the start, but the
+        // reader thread still looks at them, so wait until it has passed.
+        pthread_mutex_lock(&engine->mutex);
+        while (engine->next <= engine->head) {
+            pthread_cond_wait(&engine->cond, &engine->mutex);
+        }
+        pthread_mutex_unlock(&engine->mutex);
+    } else {
+        while (!req->complete) {
+            if (!reapUring(engine)) {
+                // The ring is unusable, so nothing more will complete.
+                for (size_t i = engine->head; i < engine->tail; i++) {
+                    ioRequest* pending = &engine->requests[i % engine->depth];
+                    if (!pending->complete) {
+                        finishRequest(pending, EIO);
+                    }
+                }
+            }
+        }
+    }
+
+    req->buffer.data = req->data;
+    req->buffer.size = req->done;
+    req->buffer.ok = req->error == 0;
+    if (req->buffer.ok) {
+        engine->stats.numFiles++;
+        engine->stats.bytes += req->done;
+    } else {
+        engine->stats.numFailed++;
+        // Missing images are skipped without a word, as when they are read
+        // without the engine.
+        if (req->error != ENOENT) {
+            syslog(LOG_WARNING, "Unable to read %s: %s", req->path,
+                   strerror(req->error));
+        }
+    }
+
+    return &req->buffer;
+}
+
+void ioEngineRelease(ioEngine* engine) {
+    if (engine->head != engine->tail) {
+        engine->head++;
+    }
+}
+
+void ioEngineGetStats(const ioEngine* engine, ioStats* stats) {
+    *stats = engine->stats;
+}
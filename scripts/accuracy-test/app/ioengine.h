@@ -0,0 +1,152 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * This header file declares an engine that reads image files ahead of the
+ * inference loop.
+ *
+ * Reads for the next images are submitted while the current ones are
+ * processed, so the worker only blocks on storage when the queue runs dry.
+ * Reads are done with io_uring when the kernel allows it. Otherwise one
+ * thread per engine reads the files in turn, after asking the kernel to
+ * start reading all queued files with posix_fadvise.
+ *
+ * Every queued read owns one buffer of a fixed pool, aligned to a page.
+ * Reads complete in the order they were submitted, and a buffer is recycled
+ * for a new read once the caller has released it.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct ioEngine ioEngine;
+
+typedef enum {
+    // io_uring if the kernel supports it, otherwise a reader thread.
+    IO_BACKEND_AUTO,
+    IO_BACKEND_URING,
+    IO_BACKEND_THREAD,
+} ioBackend;
+
+typedef struct ioBuffer {
+    // Contents of the file, aligned to a page.
+    const uint8_t* data;
+    // Number of bytes read.
+    size_t size;
+    // Value passed to ioEngineSubmit, e.g. the position of the image.
+    size_t tag;
+    // False if the file could not be opened or read.
+    bool ok;
+} ioBuffer;
+
+typedef struct ioStats {
+    // Files read without errors and the bytes read from them.
+    uint64_t numFiles;
+    uint64_t bytes;
+    // Files that could not be opened or read.
+    uint64_t numFailed;
+} ioStats;
+
+/**
+ * brief Parses the name of a backend.
+ *
+ * param name One of auto, io_uring or thread.
+ * param backend Pointer to the parsed backend.
+ * return False if the name is not known, otherwise true.
+ */
+bool ioEngineParseBackend(const char* name, ioBackend* backend);
+
+/**
+ * brief Creates an engine and its buffers.
+ *
+ * param backend Backend to use. With IO_BACKEND_URING, creation fails if
+ * io_uring is not available.
+ * param depth Largest number of reads queued at the same time.
+ * param bufferBytes Initial size in bytes of each buffer. A buffer grows
+ * when a whole file larger than it is read.
+ * param enginePtr Pointer to the created engine.
+ * return False if any errors occur, otherwise true.
+ */
+bool ioEngineCreate(ioBackend backend, size_t depth, size_t bufferBytes,
+                    ioEngine** enginePtr);
+
+/**
+ * brief Waits for the queued reads and frees an engine.
+ *
+ * param enginePtr Pointer to the engine. Set to NULL on return.
+ */
+void ioEngineDestroy(ioEngine** enginePtr);
+
+/**
+ * brief Returns the name of the backend in use, as taken by
+ * ioEngineParseBackend.
+ *
+ * param engine The engine.
+ * return Name of the backend.
+ */
+const char* ioEngineBackendName(const ioEngine* engine);
+
+/**
+ * brief Returns the number of reads queued and not yet released.
+ *
+ * param engine The engine.
+ * return Number of reads, at most the depth of the engine.
+ */
+size_t ioEnginePending(const ioEngine* engine);
+
+/**
+ * brief Queues a read of a file.
+ *
+ * The file is opened right away. A file that does not exist is not an
+ * error, its buffer is handed back by ioEngineWait with ok set to false.
+ *
+ * param engine The engine, with fewer reads pending than its depth.
+ * param path Path of the file.
+ * param maxBytes Largest number of bytes to read from the start of the
+ * file, 0 to read the whole file.
+ * param tag Value handed back with the buffer.
+ * return False if the read could not be queued, otherwise true.
+ */
+bool ioEngineSubmit(ioEngine* engine, const char* path, size_t maxBytes,
+                    size_t tag);
+
+/**
+ * brief Waits for the oldest queued read to complete.
+ *
+ * param engine The engine.
+ * return The buffer of the oldest read, valid until ioEngineRelease. NULL if
+ * no read is pending.
+ */
+const ioBuffer* ioEngineWait(ioEngine* engine);
+
+/**
+ * brief Recycles the buffer returned by the last call to ioEngineWait.
+ *
+ * param engine The engine.
+ */
+void ioEngineRelease(ioEngine* engine);
+
+/**
+ * brief Reads the counters of an engine.
+ *
+ * param engine The engine.
+ * param stats Pointer to the counters, set on return.
+ */
+void ioEngineGetStats(const ioEngine* engine, ioStats* stats);
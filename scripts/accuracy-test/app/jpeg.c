@@ -0,0 +1,141 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * This file decodes JPEG images with libjpeg.
+ */
+
+#include "jpeg.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <syslog.h>
+
+#include <jpeglib.h>
+
+// Largest denominator of the scaled decoding done by libjpeg.
+#define MAX_SCALE_DENOM (8)
+
+typedef struct jpegError {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+} jpegError;
+
+/**
+ * brief libjpeg error handler, returns to jpegDecode.
+ *
+ * param cinfo The decompressor.
+ */
+static void errorExit(j_common_ptr cinfo);
+
+/**
+ * brief libjpeg message handler, sends warnings to syslog.
+ *
+ * param cinfo The decompressor.
+ */
+static void outputMessage(j_common_ptr cinfo);
+
+/**
+ * brief Converts a row of CMYK pixels to RGB, the same way as OpenCV.
+ *
+ * param cmyk Row of CMYK pixels, as stored by Adobe applications.
+ * param rgb Row of RGB pixels.
+ * param width Number of pixels.
+ */
+static void cmykToRgb(const uint8_t* cmyk, uint8_t* rgb, size_t width);
+
+static void errorExit(j_common_ptr cinfo) {
+    jpegError* err = (jpegError*) cinfo->err;
+    longjmp(err->jump, 1);
+}
+
+static void outputMessage(j_common_ptr cinfo) {
+    char msg[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, msg);
+    syslog(LOG_DEBUG, "JPEG: %s", msg);
+}
+
+static void cmykToRgb(const uint8_t* cmyk, uint8_t* rgb, size_t width) {
+    for (size_t i = 0; i < width; i++) {
+        const int k = cmyk[4 * i + 3];
+        for (size_t c = 0; c < 3; c++) {
+            rgb[3 * i + c] = (uint8_t) (k - (((255 - cmyk[4 * i + c]) * k) >> 8));
+        }
+    }
+}
+
+bool jpegDecode(const uint8_t* data, size_t size, size_t maxWidth,
+                size_t maxHeight, uint8_t* dst, size_t* width, size_t* height) {
+    struct jpeg_decompress_struct cinfo;
+    jpegError err;
+
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = errorExit;
+    err.mgr.output_message = outputMessage;
+    if (setjmp(err.jump)) {
+        char msg[JMSG_LENGTH_MAX];
+        (*cinfo.err->format_message)((j_common_ptr) &cinfo, msg);
+        syslog(LOG_WARNING, "Unable to decode JPEG image: %s", msg);
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, data, (unsigned long) size);
+    jpeg_read_header(&cinfo, TRUE);
+
+    // libjpeg converts everything but CMYK to RGB itself.
+    const bool isCmyk = cinfo.num_components == 4;
+    cinfo.out_color_space = isCmyk ? JCS_CMYK : JCS_RGB;
+    cinfo.scale_num = 1;
+    for (cinfo.scale_denom = 1;; cinfo.scale_denom *= 2) {
+        jpeg_calc_output_dimensions(&cinfo);
+        if (cinfo.output_width <= maxWidth && cinfo.output_height <= maxHeight) {
+            break;
+        }
+        if (cinfo.scale_denom == MAX_SCALE_DENOM) {
+            syslog(LOG_WARNING, "JPEG image of %ux%u pixels is too large",
+                   cinfo.image_width, cinfo.image_height);
+            jpeg_destroy_decompress(&cinfo);
+            return false;
+        }
+    }
+    jpeg_start_decompress(&cinfo);
+
+    const size_t pitch = maxWidth * 3;
+    // CMYK rows are wider than RGB rows, so they go through a row owned by
+    // libjpeg, which frees it with the decompressor.
+    JSAMPARRAY cmykRow =
+        isCmyk ? (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE,
+                                            cinfo.output_width * 4, 1)
+               : NULL;
+    while (cinfo.output_scanline < cinfo.output_height) {
+        uint8_t* rgbRow = dst + (size_t) cinfo.output_scanline * pitch;
+        if (isCmyk) {
+            jpeg_read_scanlines(&cinfo, cmykRow, 1);
+            cmykToRgb(cmykRow[0], rgbRow, cinfo.output_width);
+        } else {
+            JSAMPROW row = rgbRow;
+            jpeg_read_scanlines(&cinfo, &row, 1);
+        }
+    }
+    *width = cinfo.output_width;
+    *height = cinfo.output_height;
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    return true;
+}
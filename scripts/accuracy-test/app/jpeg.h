@@ -0,0 +1,51 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * This header file declares the JPEG decoder used to read the images of the
+ * dataset as they are, without converting them first.
+ *
+ * Images are decoded on the CPU with libjpeg straight into the input buffer
+ * of a preprocessing job, which then crops and scales them on a larod
+ * preprocessing device. Images larger than the buffer are decoded at 1/2,
+ * 1/4 or 1/8 of their size, which libjpeg does at a fraction of the cost of
+ * a full decode.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * brief Decodes a JPEG image into interleaved RGB.
+ *
+ * Grayscale and CMYK images are converted to RGB.
+ *
+ * param data The JPEG file contents.
+ * param size Size in bytes of the file.
+ * param maxWidth Width in pixels of the destination buffer.
+ * param maxHeight Height in pixels of the destination buffer.
+ * param dst Destination buffer of maxHeight rows of maxWidth * 3 bytes.
+ * The image is written to its top left corner.
+ * param width Pointer to the width of the decoded image.
+ * param height Pointer to the height of the decoded image.
+ * return False if the image could not be decoded, otherwise true.
+ */
+bool jpegDecode(const uint8_t* data, size_t size, size_t maxWidth,
+                size_t maxHeight, uint8_t* dst, size_t* width, size_t* height);
@@ -0,0 +1,705 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * This file implements the COCO style mean average precision of a
+ * detection run.
+ */
+
+#include "mapeval.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+// Largest number of ground truth boxes of one image.
+#define MAX_IMAGE_BOXES (1024)
+
+// Largest class index in the ground truth.
+#define MAX_CLASS (UINT16_MAX - 1)
+
+// Largest image number, which bounds the size of the table the images are
+// looked up in.
+#define MAX_IMAGE_ID (1u << 24)
+
+// Number of recall points the precision is interpolated at.
+#define NUM_RECALL_POINTS (101)
+
+// Scores of each class are counted in bins of equal width within each
+// octave below 1, so low scores get as fine bins relative to their size as
+// high scores. The highest octave, 0.5 to 1, has bins 1/512 wide, and the
+// lowest starts just below 0.001.
+#define SCORE_OCTAVES (10)
+#define SCORE_OCTAVE_BINS (256)
+#define NUM_SCORE_BINS (SCORE_OCTAVES * SCORE_OCTAVE_BINS)
+
+// Number of matched detections of an image that are counted at a time.
+#define MATCH_BATCH (64)
+
+typedef struct gtBox {
+    float x1;
+    float y1;
+    float x2;
+    float y2;
+    uint16_t classIdx;
+    uint8_t crowd;
+} gtBox;
+
+typedef struct gtImage {
+    size_t imageId;
+    // Boxes of the image, sorted by class with the crowd regions of a class
+    // after the other boxes.
+    uint32_t firstBox;
+    uint16_t numBoxes;
+    // Set once the detections of the image are counted.
+    bool scored;
+} gtImage;
+
+// Detections of one class in one score bin.
+typedef struct scoreBin {
+    uint32_t numDets;
+    // Detections that are true positives and that are ignored, i.e. matched
+    // a crowd region, at each IoU threshold.
+    uint32_t tp[MAPEVAL_NUM_THRESHOLDS];
+    uint32_t ignored[MAPEVAL_NUM_THRESHOLDS];
+} scoreBin;
+
+// The detections of one bin, not counting ignored ones, as a segment of the
+// precision and recall curve, with the counts of the bins before it.
+typedef struct scoreSegment {
+    double tpStart;
+    double fpStart;
+    double tp;
+    double fp;
+    // Largest precision from this segment to the end of the curve.
+    double bestAfter;
+} scoreSegment;
+
+// Match of one detection, before it is counted.
+typedef struct detMatch {
+    // Bin of the detection, class times NUM_SCORE_BINS plus score bin.
+    uint32_t bin;
+    // One bit per IoU threshold, set if the detection is a true positive or
+    // ignored at that threshold.
+    uint16_t tp;
+    uint16_t ignored;
+} detMatch;
+
+struct mapeval {
+    gtImage* images;
+    size_t numImages;
+    // Index in images of every image number up to the largest, UINT32_MAX
+    // for numbers that are not in the ground truth.
+    uint32_t* imageIndex;
+    size_t maxImageId;
+    gtBox* boxes;
+    size_t numClasses;
+    // Carved from the arena: NUM_SCORE_BINS bins per class, and the number
+    // of detections counted, guarded by mutex.
+    scoreBin* bins;
+    uint64_t numDetections;
+    pthread_mutex_t mutex;
+    bool mutexCreated;
+};
+
+// A line of the ground truth file, before sorting.
+typedef struct gtLine {
+    size_t imageId;
+    size_t line;
+    bool hasBox;
+    gtBox box;
+} gtLine;
+
+/**
+ * brief Parses one line of the ground truth file.
+ *
+ * param text The line.
+ * param entry Pointer to the parsed line.
+ * param skip Pointer set to true if the line is empty or a comment.
+ * return False if the line is malformed, otherwise true.
+ */
+static bool parseLine(const char* text, gtLine* entry, bool* skip);
+
+/**
+ * brief Orders lines by image number, class, crowd and line number.
+ *
+ * param a First line.
+ * param b Second line.
+ * return Negative if a comes first, positive if b comes first.
+ */
+static int compareLines(const void* a, const void* b);
+
+/**
+ * brief Returns the score bin of a detection.
+ *
+ * param score Score of the detection.
+ * return Bin, in the order of the scores. Scores outside 0..1 are counted
+ * in the first or last bin.
+ */
+static uint32_t scoreBinIndex(float score);
+
+/**
+ * brief Adds matched detections to the counts.
+ *
+ * param eval The evaluation.
+ * param matches The matches.
+ * param numMatches Number of matches.
+ */
+static void countMatches(mapeval* eval, const detMatch* matches,
+                         size_t numMatches);
+
+/**
+ * brief Computes the overlap of a detection and a ground truth box.
+ *
+ * param det The detection.
+ * param gt The box.
+ * return Intersection over union, or over the detection area for a crowd
+ * region.
+ */
+static double overlap(const detectBox* det, const gtBox* gt);
+
+/**
+ * brief Computes the average precision of one class at one threshold.
+ *
+ * The order of the detections within a bin is not known, so the precision
+ * at each true positive of a bin is the one expected if they came in a
+ * random order, like tied scores are in pycocotools.
+ *
+ * param bins Score bins of the class.
+ * param numPositives Number of ground truth boxes of the class, not 0.
+ * param threshold Index of the IoU threshold.
+ * param segments Scratch array of NUM_SCORE_BINS segments.
+ * return The average precision.
+ */
+static double averagePrecision(const scoreBin* bins, uint64_t numPositives,
+                               size_t threshold, scoreSegment* segments);
+
+/**
+ * brief Returns the expected precision at a true positive of a segment.
+ *
+ * param seg The segment.
+ * param k Number of the true positive in the segment, from 1.
+ * return The precision.
+ */
+static double segmentPrecision(const scoreSegment* seg, double k);
+
+bool mapevalLoad(const char* path, mapeval** evalPtr) {
+    mapeval* eval = NULL;
+    gtLine* lines = NULL;
+    size_t numLines = 0;
+    size_t capLines = 0;
+    char text[256];
+    bool ret = false;
+
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        syslog(LOG_ERR, "Failed to open ground truth file %s: %s", path,
+               strerror(errno));
+        return false;
+    }
+
+    for (size_t lineNo = 1; fgets(text, sizeof(text), file); lineNo++) {
+        gtLine entry;
+        bool skip = false;
+        if (!parseLine(text, &entry, &skip)) {
+            syslog(LOG_ERR, "Malformed line %zu in ground truth file %s",
+                   lineNo, path);
+            goto end;
+        }
+        if (skip) {
+            continue;
+        }
+        if (numLines == capLines) {
+            const size_t cap = capLines ? 2 * capLines : 4096;
+            gtLine* grown = realloc(lines, cap * sizeof(gtLine));
+            if (!grown) {
+                syslog(LOG_ERR, "Failed allocating ground truth lines");
+                goto end;
+            }
+            lines = grown;
+            capLines = cap;
+        }
+        entry.line = lineNo;
+        lines[numLines++] = entry;
+    }
+    if (ferror(file)) {
+        syslog(LOG_ERR, "Failed to read ground truth file %s", path);
+        goto end;
+    }
+    qsort(lines, numLines, sizeof(gtLine), compareLines);
+
+    eval = calloc(1, sizeof(*eval));
+    if (!eval) {
+        syslog(LOG_ERR, "Failed allocating ground truth");
+        goto end;
+    }
+    size_t numBoxes = 0;
+    for (size_t i = 0; i < numLines; i++) {
+        eval->numImages += i == 0 || lines[i].imageId != lines[i - 1].imageId;
+        numBoxes += lines[i].hasBox;
+    }
+    if (numBoxes > UINT32_MAX) {
+        syslog(LOG_ERR, "Ground truth file %s has more than %u boxes", path,
+               UINT32_MAX);
+        goto end;
+    }
+    // The lines are sorted, so the last one has the largest image number.
+    eval->maxImageId = numLines ? lines[numLines - 1].imageId : 0;
+    eval->images = calloc(eval->numImages ? eval->numImages : 1,
+                          sizeof(gtImage));
+    eval->imageIndex = malloc((eval->maxImageId + 1) * sizeof(uint32_t));
+    eval->boxes = calloc(numBoxes ? numBoxes : 1, sizeof(gtBox));
+    if (!eval->images || !eval->imageIndex || !eval->boxes) {
+        syslog(LOG_ERR, "Failed allocating ground truth of %zu boxes",
+               numBoxes);
+        goto end;
+    }
+    for (size_t id = 0; id <= eval->maxImageId; id++) {
+        eval->imageIndex[id] = UINT32_MAX;
+    }
+
+    size_t numImages = 0;
+    numBoxes = 0;
+    for (size_t i = 0; i < numLines; i++) {
+        if (i == 0 || lines[i].imageId != lines[i - 1].imageId) {
+            eval->imageIndex[lines[i].imageId] = (uint32_t) numImages;
+            eval->images[numImages++] = (gtImage){
+                .imageId = lines[i].imageId,
+                .firstBox = (uint32_t) numBoxes,
+            };
+        }
+        if (!lines[i].hasBox) {
+            continue;
+        }
+        gtImage* image = &eval->images[numImages - 1];
+        if (image->numBoxes == MAX_IMAGE_BOXES) {
+            syslog(LOG_ERR, "Image %zu has more than %d boxes",
+                   image->imageId, MAX_IMAGE_BOXES);
+            goto end;
+        }
+        image->numBoxes++;
+        eval->boxes[numBoxes++] = lines[i].box;
+        if ((size_t) lines[i].box.classIdx + 1 > eval->numClasses) {
+            eval->numClasses = (size_t) lines[i].box.classIdx + 1;
+        }
+    }
+    if (pthread_mutex_init(&eval->mutex, NULL) != 0) {
+        syslog(LOG_ERR, "Failed creating ground truth mutex");
+        goto end;
+    }
+    eval->mutexCreated = true;
+    syslog(LOG_INFO, "Ground truth has %zu images with %zu boxes of %zu "
+           "classes", eval->numImages, numBoxes, eval->numClasses);
+
+    *evalPtr = eval;
+    eval = NULL;
+    ret = true;
+
+end:
+    mapevalDestroy(&eval);
+    free(lines);
+    fclose(file);
+
+    return ret;
+}
+
+void mapevalDestroy(mapeval** evalPtr) {
+    if (!evalPtr || !*evalPtr) {
+        return;
+    }
+
+    if ((*evalPtr)->mutexCreated) {
+        pthread_mutex_destroy(&(*evalPtr)->mutex);
+    }
+    free((*evalPtr)->images);
+    free((*evalPtr)->imageIndex);
+    free((*evalPtr)->boxes);
+    free(*evalPtr);
+    *evalPtr = NULL;
+}
+
+size_t mapevalGetNumImages(const mapeval* eval) {
+    return eval->numImages;
+}
+
+size_t mapevalGetImageId(const mapeval* eval, size_t idx) {
+    return eval->images[idx].imageId;
+}
+
+bool mapevalFindImage(const mapeval* eval, size_t imageId, size_t* idx) {
+    if (imageId > eval->maxImageId || eval->imageIndex[imageId] == UINT32_MAX) {
+        return false;
+    }
+    *idx = eval->imageIndex[imageId];
+
+    return true;
+}
+
+size_t mapevalGetNumClasses(const mapeval* eval) {
+    return eval->numClasses;
+}
+
+size_t mapevalArenaSize(const mapeval* eval) {
+    return arenaAlignedSize(eval->numClasses * NUM_SCORE_BINS *
+                            sizeof(scoreBin));
+}
+
+bool mapevalReserve(mapeval* eval, arena* a) {
+    // The arena is zeroed, and the pages of bins that nothing is counted in
+    // are never backed by memory.
+    eval->bins =
+        arenaAlloc(a, eval->numClasses * NUM_SCORE_BINS * sizeof(scoreBin));
+
+    return eval->bins != NULL || eval->numClasses == 0;
+}
+
+void mapevalAddImage(mapeval* eval, size_t idx, const detectBox* boxes,
+                     size_t numBoxes) {
+    gtImage* image = &eval->images[idx];
+    const gtBox* gts = &eval->boxes[image->firstBox];
+    // Thresholds at which each box of the image has been matched.
+    uint16_t matched[MAX_IMAGE_BOXES] = {0};
+    double ious[MAX_IMAGE_BOXES];
+    detMatch matches[MATCH_BATCH];
+    size_t numMatches = 0;
+
+    for (size_t d = 0; d < numBoxes; d++) {
+        const detectBox* det = &boxes[d];
+        if (det->classIdx >= eval->numClasses) {
+            // No class without ground truth is evaluated.
+            continue;
+        }
+
+        // The boxes of the class, with the crowd regions last.
+        size_t first = 0;
+        while (first < image->numBoxes && gts[first].classIdx < det->classIdx) {
+            first++;
+        }
+        size_t last = first;
+        while (last < image->numBoxes && gts[last].classIdx == det->classIdx) {
+            ious[last] = overlap(det, &gts[last]);
+            last++;
+        }
+
+        detMatch* record = &matches[numMatches++];
+        *record = (detMatch){
+            .bin = det->classIdx * NUM_SCORE_BINS + scoreBinIndex(det->score),
+        };
+        for (size_t t = 0; t < MAPEVAL_NUM_THRESHOLDS; t++) {
+            const uint16_t bit = (uint16_t) (1u << t);
+            double best = 0.5 + 0.05 * (double) t;
+            best = best < 1.0 - 1e-10 ? best : 1.0 - 1e-10;
+            size_t match = SIZE_MAX;
+            for (size_t g = first; g < last; g++) {
+                if ((matched[g] & bit) && !gts[g].crowd) {
+                    continue;
+                }
+                // Once a box is matched, crowd regions are not considered.
+                if (match != SIZE_MAX && !gts[match].crowd && gts[g].crowd) {
+                    break;
+                }
+                if (ious[g] < best) {
+                    continue;
+                }
+                best = ious[g];
+                match = g;
+            }
+            if (match == SIZE_MAX) {
+                continue;
+            }
+            if (gts[match].crowd) {
+                record->ignored |= bit;
+            } else {
+                record->tp |= bit;
+                matched[match] |= bit;
+            }
+        }
+
+        if (numMatches == MATCH_BATCH) {
+            countMatches(eval, matches, numMatches);
+            numMatches = 0;
+        }
+    }
+
+    pthread_mutex_lock(&eval->mutex);
+    image->scored = true;
+    pthread_mutex_unlock(&eval->mutex);
+    countMatches(eval, matches, numMatches);
+}
+
+bool mapevalCompute(const mapeval* eval, mapevalResult* result) {
+    memset(result, 0, sizeof(*result));
+    uint64_t* numPositives = calloc(eval->numClasses + 1, sizeof(uint64_t));
+    scoreSegment* segments = malloc(NUM_SCORE_BINS * sizeof(scoreSegment));
+    if (!numPositives || !segments) {
+        syslog(LOG_ERR, "Failed allocating mAP accumulation");
+        free(numPositives);
+        free(segments);
+        return false;
+    }
+
+    // Count the boxes of each class in the scored images.
+    for (size_t i = 0; i < eval->numImages; i++) {
+        const gtImage* image = &eval->images[i];
+        if (!image->scored) {
+            continue;
+        }
+        result->numImages++;
+        for (size_t b = 0; b < image->numBoxes; b++) {
+            const gtBox* gt = &eval->boxes[image->firstBox + b];
+            numPositives[gt->classIdx] += !gt->crowd;
+            result->numGroundTruth += !gt->crowd;
+        }
+    }
+    result->numDetections = eval->numDetections;
+
+    double sum = 0.0;
+    double sum50 = 0.0;
+    double sum75 = 0.0;
+    for (size_t c = 0; c < eval->numClasses; c++) {
+        if (numPositives[c] == 0) {
+            continue;
+        }
+        const scoreBin* bins = &eval->bins[c * NUM_SCORE_BINS];
+        for (size_t t = 0; t < MAPEVAL_NUM_THRESHOLDS; t++) {
+            const double ap =
+                averagePrecision(bins, numPositives[c], t, segments);
+            sum += ap;
+            sum50 += t == 0 ? ap : 0.0;
+            sum75 += t == 5 ? ap : 0.0;
+        }
+        result->numClasses++;
+    }
+    if (result->numClasses) {
+        const double n = (double) result->numClasses;
+        result->map = sum / n / MAPEVAL_NUM_THRESHOLDS;
+        result->map50 = sum50 / n;
+        result->map75 = sum75 / n;
+    }
+    free(numPositives);
+    free(segments);
+
+    return true;
+}
+
+static bool parseLine(const char* text, gtLine* entry, bool* skip) {
+    size_t imageId = 0;
+    unsigned classIdx = 0;
+    unsigned crowd = 0;
+    float x1 = 0.0f;
+    float y1 = 0.0f;
+    float x2 = 0.0f;
+    float y2 = 0.0f;
+    char rest = '\0';
+
+    const size_t blank = strspn(text, " \t\r\n");
+    *skip = text[blank] == '\0' || text[blank] == '#';
+    if (*skip) {
+        return true;
+    }
+
+    const int n = sscanf(text, "%zu %u %f %f %f %f %u %c", &imageId,
+                         &classIdx, &x1, &y1, &x2, &y2, &crowd, &rest);
+    if ((n != 1 && n != 6 && n != 7) || imageId == 0 ||
+        imageId > MAX_IMAGE_ID || classIdx > MAX_CLASS || crowd > 1) {
+        return false;
+    }
+    *entry = (gtLine){
+        .imageId = imageId,
+        .hasBox = n > 1,
+        .box = {
+            .x1 = x1,
+            .y1 = y1,
+            .x2 = x2,
+            .y2 = y2,
+            .classIdx = (uint16_t) classIdx,
+            .crowd = (uint8_t) crowd,
+        },
+    };
+
+    return true;
+}
+
+static int compareLines(const void* a, const void* b) {
+    const gtLine* la = a;
+    const gtLine* lb = b;
+
+    if (la->imageId != lb->imageId) {
+        return la->imageId < lb->imageId ? -1 : 1;
+    }
+    if (la->box.classIdx != lb->box.classIdx) {
+        return la->box.classIdx < lb->box.classIdx ? -1 : 1;
+    }
+    if (la->box.crowd != lb->box.crowd) {
+        return la->box.crowd < lb->box.crowd ? -1 : 1;
+    }
+
+    return la->line < lb->line ? -1 : la->line > lb->line;
+}
+
+static uint32_t scoreBinIndex(float score) {
+    if (!(score < 1.0f)) {
+        return NUM_SCORE_BINS - 1;
+    }
+    int exponent = 0;
+    const float mantissa = frexpf(score, &exponent);
+    // Scores below the lowest octave share its first bin.
+    if (!(score > 0.0f) || exponent <= -SCORE_OCTAVES) {
+        return 0;
+    }
+    // The mantissa is 0.5 to 1 and the exponent 0 for the highest octave.
+    const uint32_t octave = (uint32_t) (SCORE_OCTAVES - 1 + exponent);
+    uint32_t step =
+        (uint32_t) ((mantissa - 0.5f) * (float) (2 * SCORE_OCTAVE_BINS));
+    step = step < SCORE_OCTAVE_BINS ? step : SCORE_OCTAVE_BINS - 1;
+
+    return octave * SCORE_OCTAVE_BINS + step;
+}
+
+static void countMatches(mapeval* eval, const detMatch* matches,
+                         size_t numMatches) {
+    if (numMatches == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&eval->mutex);
+    for (size_t m = 0; m < numMatches; m++) {
+        scoreBin* bin = &eval->bins[matches[m].bin];
+        bin->numDets++;
+        for (size_t t = 0; t < MAPEVAL_NUM_THRESHOLDS; t++) {
+            bin->tp[t] += (matches[m].tp >> t) & 1u;
+            bin->ignored[t] += (matches[m].ignored >> t) & 1u;
+        }
+    }
+    eval->numDetections += numMatches;
+    pthread_mutex_unlock(&eval->mutex);
+}
+
+static double overlap(const detectBox* det, const gtBox* gt) {
+    const double w = (double) (det->x2 < gt->x2 ? det->x2 : gt->x2) -
+                     (double) (det->x1 > gt->x1 ? det->x1 : gt->x1);
+    const double h = (double) (det->y2 < gt->y2 ? det->y2 : gt->y2) -
+                     (double) (det->y1 > gt->y1 ? det->y1 : gt->y1);
+    if (w <= 0.0 || h <= 0.0) {
+        return 0.0;
+    }
+    const double inter = w * h;
+    const double detArea =
+        ((double) det->x2 - det->x1) * ((double) det->y2 - det->y1);
+    if (gt->crowd) {
+        return detArea > 0.0 ? inter / detArea : 0.0;
+    }
+    const double gtArea =
+        ((double) gt->x2 - gt->x1) * ((double) gt->y2 - gt->y1);
+    const double area = detArea + gtArea - inter;
+
+    return area > 0.0 ? inter / area : 0.0;
+}
+
+static double averagePrecision(const scoreBin* bins, uint64_t numPositives,
+                               size_t threshold, scoreSegment* segments) {
+    size_t n = 0;
+    double tp = 0.0;
+    double fp = 0.0;
+
+    // One segment per bin that has detections that are not ignored, from
+    // the highest scores down.
+    for (size_t b = NUM_SCORE_BINS; b-- > 0;) {
+        const scoreBin* bin = &bins[b];
+        const uint32_t counted = bin->numDets - bin->ignored[threshold];
+        if (counted == 0) {
+            continue;
+        }
+        scoreSegment* seg = &segments[n++];
+        seg->tpStart = tp;
+        seg->fpStart = fp;
+        seg->tp = bin->tp[threshold];
+        seg->fp = counted - bin->tp[threshold];
+        tp += seg->tp;
+        fp += seg->fp;
+    }
+
+    // Make the precision non-increasing, from the end. The precision is
+    // monotonic within a segment, so its largest value is at the first or
+    // last true positive or at the end.
+    double best = 0.0;
+    for (size_t s = n; s-- > 0;) {
+        scoreSegment* seg = &segments[s];
+        const double end = (seg->tpStart + seg->tp) /
+                           (seg->tpStart + seg->tp + seg->fpStart + seg->fp);
+        best = end > best ? end : best;
+        if (seg->tp > 0.0) {
+            const double first = segmentPrecision(seg, 1.0);
+            const double last = segmentPrecision(seg, seg->tp);
+            best = first > best ? first : best;
+            best = last > best ? last : best;
+        }
+        seg->bestAfter = best;
+    }
+
+    // Precision at the first true positive reaching each recall, 0 if it is
+    // never reached.
+    double sum = 0.0;
+    size_t s = 0;
+    for (size_t r = 0; r < NUM_RECALL_POINTS && n > 0; r++) {
+        const double target = (double) r / (NUM_RECALL_POINTS - 1);
+        // True positives needed, guarding against the rounding of target.
+        const double rounded = ceil(target * (double) numPositives);
+        uint64_t needed = (uint64_t) rounded;
+        if (needed > 0 &&
+            (double) (needed - 1) / (double) numPositives >= target) {
+            needed--;
+        }
+        if (needed == 0) {
+            // Reached by the first detection.
+            sum += segments[0].bestAfter;
+            continue;
+        }
+        while (s < n && segments[s].tpStart + segments[s].tp < (double) needed) {
+            s++;
+        }
+        if (s == n) {
+            break;
+        }
+        const scoreSegment* seg = &segments[s];
+        const double at =
+            segmentPrecision(seg, (double) needed - seg->tpStart);
+        const double last = segmentPrecision(seg, seg->tp);
+        const double end = (seg->tpStart + seg->tp) /
+                           (seg->tpStart + seg->tp + seg->fpStart + seg->fp);
+        double precision = at > last ? at : last;
+        precision = end > precision ? end : precision;
+        if (s + 1 < n && segments[s + 1].bestAfter > precision) {
+            precision = segments[s + 1].bestAfter;
+        }
+        sum += precision;
+    }
+
+    return sum / NUM_RECALL_POINTS;
+}
+
+static double segmentPrecision(const scoreSegment* seg, double k) {
+    // In a random order, (tp + 1) / (fp + 1) of the false positives come
+    // before the k-th true positive on average.
+    const double fp = seg->fpStart + k * seg->fp / (seg->tp + 1.0);
+
+    return (seg->tpStart + k) / (seg->tpStart + k + fp);
+}
@@ -0,0 +1,177 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * This header file declares the COCO style mean average precision of a
+ * detection run.
+ *
+ * The ground truth is a text file with one box per line,
+ *
+ *     IMAGE CLASS X1 Y1 X2 Y2 [CROWD]
+ *
+ * where IMAGE is the image number, at most 2^24, CLASS the index of the
+ * class in the model output, X1 Y1 X2 Y2 the corners normalized to the width
+ * and height of the image and CROWD 1 for a crowd region. A line with only
+ * IMAGE adds an image without boxes. Lines starting with # are skipped.
+ *
+ * The ground truth is read once into one array of images, indexed by image
+ * number through a table, and one array of boxes, so the boxes of an image
+ * are found without a search.
+ *
+ * The detections of every image are matched against its ground truth as
+ * soon as the image is scored, at the ten IoU thresholds 0.50, 0.55, ...,
+ * 0.95, as pycocotools does: each detection, best first, takes the unmatched
+ * box of its class it overlaps most, and a detection that only matches a
+ * crowd region is ignored. The matches are then counted in a fixed number of
+ * score bins per class, and nothing is kept per detection, so the memory of
+ * the evaluation does not grow with the number of images or detections.
+ * The precision is interpolated at 101 recall points per class and
+ * threshold once the run is over, with the detections of one bin taken as
+ * one point of the precision and recall curve. Scores quantized in steps of
+ * 1/256, as those of most quantized models, each get a bin of their own.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "detect.h"
+
+// Number of IoU thresholds averaged, 0.50 to 0.95 in steps of 0.05.
+#define MAPEVAL_NUM_THRESHOLDS (10)
+
+typedef struct mapevalResult {
+    // Mean over classes and IoU thresholds, the COCO mAP.
+    double map;
+    // Mean over classes at IoU 0.50 and 0.75.
+    double map50;
+    double map75;
+    // Number of classes with ground truth in the scored images, the classes
+    // the means are taken over.
+    size_t numClasses;
+    size_t numImages;
+    uint64_t numDetections;
+    // Boxes of the scored images that are not crowd regions.
+    uint64_t numGroundTruth;
+} mapevalResult;
+
+typedef struct mapeval mapeval;
+
+/**
+ * brief Reads a ground truth file.
+ *
+ * param path The file.
+ * param evalPtr Pointer to the created evaluation.
+ * return False if the file could not be read or is malformed, otherwise true.
+ */
+bool mapevalLoad(const char* path, mapeval** evalPtr);
+
+/**
+ * brief Destroys an evaluation created with mapevalLoad.
+ *
+ * The counts carved with mapevalReserve are freed with the arena.
+ *
+ * param evalPtr Pointer to the evaluation. Set to NULL on return.
+ */
+void mapevalDestroy(mapeval** evalPtr);
+
+/**
+ * brief Returns the number of images in the ground truth.
+ *
+ * param eval The evaluation.
+ * return Number of images.
+ */
+size_t mapevalGetNumImages(const mapeval* eval);
+
+/**
+ * brief Returns the image number of an image.
+ *
+ * param eval The evaluation.
+ * param idx Index of the image, images are sorted by image number.
+ * return Image number.
+ */
+size_t mapevalGetImageId(const mapeval* eval, size_t idx);
+
+/**
+ * brief Finds an image by its image number.
+ *
+ * Takes constant time, the image is looked up in a table.
+ *
+ * param eval The evaluation.
+ * param imageId Image number.
+ * param idx Pointer to the index of the image, set if it is found.
+ * return False if the image is not in the ground truth, otherwise true.
+ */
+bool mapevalFindImage(const mapeval* eval, size_t imageId, size_t* idx);
+
+/**
+ * brief Returns the number of classes of the ground truth.
+ *
+ * param eval The evaluation.
+ * return Largest class plus one.
+ */
+size_t mapevalGetNumClasses(const mapeval* eval);
+
+/**
+ * brief Returns the arena space needed by mapevalReserve.
+ *
+ * The space only depends on the number of classes.
+ *
+ * param eval The evaluation.
+ * return Size in bytes to reserve in the arena.
+ */
+size_t mapevalArenaSize(const mapeval* eval);
+
+/**
+ * brief Carves the match counts of every class from an arena.
+ *
+ * param eval The evaluation.
+ * param a Arena with at least mapevalArenaSize bytes left.
+ * return False if the arena is too small, otherwise true.
+ */
+bool mapevalReserve(mapeval* eval, arena* a);
+
+/**
+ * brief Matches the detections of an image against its ground truth.
+ *
+ * Different images may be added from different threads at the same time.
+ * The matching runs without locking, only adding the matches to the counts
+ * is serialized.
+ *
+ * param eval The evaluation.
+ * param idx Index of the image.
+ * param boxes Detections sorted by descending score, in coordinates
+ * normalized to the image.
+ * param numBoxes Number of detections.
+ */
+void mapevalAddImage(mapeval* eval, size_t idx, const detectBox* boxes,
+                     size_t numBoxes);
+
+/**
+ * brief Computes the mean average precision over the images added so far.
+ *
+ * Only the ground truth of the added images counts, so a run of a subset
+ * of the images is scored on that subset.
+ *
+ * param eval The evaluation.
+ * param result Pointer to the result.
+ * return False if out of memory, otherwise true.
+ */
+bool mapevalCompute(const mapeval* eval, mapevalResult* result);
@@ -0,0 +1,692 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file implements a ring of inference slots used to keep several larod
+ * jobs in flight at the same time.
+ */
+
+#include "pipeline.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+struct pipeline {
+    larodConnection* conn;
+    pipelineSlot* slots;
+    size_t depth;
+    pipelineModelInfo info;
+    // Size of the preprocessing input of each slot, 0 if there is none.
+    size_t preInputBytes;
+    // Next slot to hand out by pipelineNext.
+    size_t head;
+    // Protects done, failed and errorMsg of all slots.
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+/**
+ * brief Callback invoked by larod when an asynchronous job has finished.
+ *
+ * Runs on a larod library thread, so it only flags the slot as done and wakes
+ * up the thread waiting in pipelineNext or pipelineDrain.
+ *
+ * param userData The slot the job was submitted for.
+ * param error Error of the finished job, or NULL on success.
+ */
+static void jobDoneCallback(void* userData, larodError* error);
+
+/**
+ * brief Callback invoked by larod when a preprocessing job has finished.
+ *
+ * Submits the inference job of the slot, whose input the preprocessing job
+ * has just written. Errors are reported through jobDoneCallback.
+ *
+ * param userData The slot the job was submitted for.
+ * param error Error of the finished job, or NULL on success.
+ */
+static void preprocessDoneCallback(void* userData, larodError* error);
+
+/**
+ * brief Sets up the preprocessing buffers, tensors and job of one slot.
+ *
+ * param preModel The preprocessing model.
+ * param preInputBytes Size in bytes of the preprocessing input.
+ * param slot Slot to set up, with its inference input set up.
+ * param error Pointer to larod error, set on failure.
+ * return False if any errors occur, otherwise true.
+ */
+static bool setupPreprocessing(larodModel* preModel, size_t preInputBytes,
+                               pipelineSlot* slot, larodError** error);
+
+/**
+ * brief Gets the size in bytes of a tensor.
+ *
+ * param tensor The tensor.
+ * param bytes Pointer to the size, including any padding.
+ * return False if larod reports no size, otherwise true.
+ */
+static bool getTensorBytes(const larodTensor* tensor, size_t* bytes);
+
+/**
+ * brief Maps the fd larod allocated for a tensor.
+ *
+ * param tensor Tensor allocated by larod.
+ * param buffer Buffer to set up.
+ * return False if the fd cannot be mapped, otherwise true.
+ */
+static bool mapLarodBuffer(const larodTensor* tensor, pipelineBuffer* buffer);
+
+/**
+ * brief Creates the input or output tensors of a model with a buffer each.
+ *
+ * The tensors are allocated by larod if it can, with the fd properties
+ * tried in order, and otherwise created with a temporary file each.
+ *
+ * param conn Connection the tensors are allocated on.
+ * param model The model.
+ * param isInput True for the inputs, false for the outputs.
+ * param useLarod False to skip the larod allocation.
+ * param tensorsPtr Pointer to the created tensors, set also on failure so
+ * that they can be destroyed.
+ * param numTensors Pointer to the number of tensors.
+ * param buffers Array of PIPELINE_MAX_TENSORS buffers to set up.
+ * param memory Pointer to a description of how the buffers are allocated.
+ * return False if any errors occur, otherwise true.
+ */
+static bool allocTensors(larodConnection* conn, larodModel* model,
+                         bool isInput, bool useLarod, larodTensor*** tensorsPtr,
+                         size_t* numTensors, pipelineBuffer* buffers,
+                         const char** memory);
+
+/**
+ * brief Unmaps buffers and closes the fds that they own.
+ *
+ * param buffers The buffers.
+ * param numBuffers Number of buffers, at most PIPELINE_MAX_TENSORS are freed.
+ */
+static void freeBuffers(pipelineBuffer* buffers, size_t numBuffers);
+
+/**
+ * brief Sets up buffers, tensors and job request of one slot.
+ *
+ * param pipe The ring, whose model info is set from the first slot.
+ * param model Model the job request is created for.
+ * param externalInput True to create the inputs with temporary files.
+ * param slot Slot to set up.
+ * return False if any errors occur, otherwise true.
+ */
+static bool setupSlot(pipeline* pipe, larodModel* model, bool externalInput,
+                      pipelineSlot* slot);
+
+/**
+ * brief Frees buffers, tensors and job request of one slot.
+ *
+ * param conn Connection the tensors were created for.
+ * param slot Slot to free.
+ */
+static void freeSlot(larodConnection* conn, pipelineSlot* slot);
+
+/**
+ * brief Frees the preprocessing buffers, tensors and job of one slot.
+ *
+ * param conn Connection the tensors were created for.
+ * param preInputBytes Size in bytes of the preprocessing input.
+ * param slot Slot to free.
+ */
+static void freePreprocessing(larodConnection* conn, size_t preInputBytes,
+                              pipelineSlot* slot);
+
+/**
+ * brief Blocks until the job of a slot in flight has completed.
+ *
+ * param pipe The ring.
+ * param slot Slot to wait for.
+ */
+static void waitForSlot(pipeline* pipe, pipelineSlot* slot);
+
+bool createAndMapTmpFile(char* fileName, size_t fileSize, void** mappedAddr,
+                         int* convFd) {
+    syslog(LOG_INFO, "%s: Setting up a temp fd with pattern %s and size %zu", __func__,
+           fileName, fileSize);
+
+    int fd = mkstemp(fileName);
+    if (fd < 0) {
+        syslog(LOG_ERR, "%s: Unable to open temp file %s: %s", __func__, fileName,
+               strerror(errno));
+        goto error;
+    }
+
+    // Allocate enough space in for the fd.
+    if (ftruncate(fd, (off_t) fileSize) < 0) {
+        syslog(LOG_ERR, "%s: Unable to truncate temp file %s: %s", __func__, fileName,
+               strerror(errno));
+        goto error;
+    }
+
+    // Remove since we don't actually care about writing to the file system.
+    if (unlink(fileName)) {
+        syslog(LOG_ERR, "%s: Unable to unlink from temp file %s: %s", __func__,
+               fileName, strerror(errno));
+        goto error;
+    }
+
+    // Get an address to fd's memory for this process's memory space.
+    void* data =
+        mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (data == MAP_FAILED) {
+        syslog(LOG_ERR, "%s: Unable to mmap temp file %s: %s", __func__, fileName,
+               strerror(errno));
+        goto error;
+    }
+
+    *mappedAddr = data;
+    *convFd = fd;
+
+    return true;
+
+error:
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    return false;
+}
+
+static void jobDoneCallback(void* userData, larodError* error) {
+    pipelineSlot* slot = userData;
+    pipeline* pipe = slot->owner;
+
+    const uint64_t doneNs = statsNowNs();
+
+    pthread_mutex_lock(&pipe->mutex);
+    slot->doneNs = doneNs;
+    if (error) {
+        slot->failed = true;
+        snprintf(slot->errorMsg, sizeof(slot->errorMsg), "%s (%d)", error->msg,
+                 error->code);
+    }
+    slot->done = true;
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->mutex);
+}
+
+static void preprocessDoneCallback(void* userData, larodError* error) {
+    pipelineSlot* slot = userData;
+    pipeline* pipe = slot->owner;
+
+    // Only this callback writes preDoneNs while the job is in flight, and it
+    // is read after done is set under the mutex.
+    slot->preDoneNs = statsNowNs();
+    if (error) {
+        jobDoneCallback(slot, error);
+        return;
+    }
+
+    larodError* runError = NULL;
+    if (!larodRunJobAsync(pipe->conn, slot->jobReq, jobDoneCallback, slot,
+                          &runError)) {
+        jobDoneCallback(slot, runError);
+        larodClearError(&runError);
+    }
+}
+
+static bool getTensorBytes(const larodTensor* tensor, size_t* bytes) {
+    larodError* error = NULL;
+
+    if (!larodGetTensorByteSize(tensor, bytes, &error) || *bytes == 0) {
+        larodClearError(&error);
+        // The pitch of the first dimension covers the whole tensor.
+        const larodTensorPitches* pitches =
+            larodGetTensorPitches(tensor, &error);
+        *bytes = pitches && pitches->len > 0 ? pitches->pitches[0] : 0;
+    }
+    larodClearError(&error);
+    if (*bytes == 0) {
+        syslog(LOG_ERR, "%s: larod reports no size for a tensor", __func__);
+        return false;
+    }
+
+    return true;
+}
+
+static bool mapLarodBuffer(const larodTensor* tensor, pipelineBuffer* buffer) {
+    larodError* error = NULL;
+
+    const int fd = larodGetTensorFd(tensor, &error);
+    larodClearError(&error);
+    const int64_t offset = larodGetTensorFdOffset(tensor, &error);
+    larodClearError(&error);
+    if (fd < 0 || offset < 0 || !getTensorBytes(tensor, &buffer->size)) {
+        return false;
+    }
+
+    // mmap() takes a page aligned offset, the data starts inside the page.
+    const int64_t pageSize = sysconf(_SC_PAGESIZE);
+    const int64_t mapOffset = offset - offset % pageSize;
+    const size_t mapSize = (size_t) (offset - mapOffset) + buffer->size;
+    void* data = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                      (off_t) mapOffset);
+    if (data == MAP_FAILED) {
+        syslog(LOG_DEBUG, "%s: Unable to mmap tensor fd %d: %s", __func__, fd,
+               strerror(errno));
+        return false;
+    }
+
+    buffer->mapAddr = data;
+    buffer->mapSize = mapSize;
+    buffer->addr = (uint8_t*) data + (offset - mapOffset);
+    buffer->fd = fd;
+    buffer->offset = offset;
+    buffer->ownsFd = false;
+
+    return true;
+}
+
+static bool allocTensors(larodConnection* conn, larodModel* model,
+                         bool isInput, bool useLarod, larodTensor*** tensorsPtr,
+                         size_t* numTensors, pipelineBuffer* buffers,
+                         const char** memory) {
+    // Mappable dma-buf first, then any mappable memory larod prefers.
+    const uint32_t larodProps[] = {LAROD_FD_TYPE_DMA, LAROD_FD_PROP_MAP};
+    const char* larodMemory[] = {"dma-buf", "larod memory"};
+    const size_t numAttempts = useLarod ? 2 : 0;
+    const char* kind = isInput ? "input" : "output";
+    larodError* error = NULL;
+    bool ret = false;
+
+    for (size_t a = 0; a < numAttempts; a++) {
+        larodTensor** tensors =
+            isInput ? larodAllocModelInputs(conn, model, larodProps[a],
+                                            numTensors, NULL, &error)
+                    : larodAllocModelOutputs(conn, model, larodProps[a],
+                                             numTensors, NULL, &error);
+        larodClearError(&error);
+        if (!tensors) {
+            continue;
+        }
+        size_t mapped = 0;
+        while (*numTensors <= PIPELINE_MAX_TENSORS && mapped < *numTensors &&
+               mapLarodBuffer(tensors[mapped], &buffers[mapped])) {
+            mapped++;
+        }
+        if (mapped == *numTensors) {
+            *tensorsPtr = tensors;
+            *memory = larodMemory[a];
+            return true;
+        }
+        freeBuffers(buffers, mapped);
+        larodDestroyTensors(conn, &tensors, *numTensors, &error);
+        larodClearError(&error);
+    }
+
+    *tensorsPtr = isInput ? larodCreateModelInputs(model, numTensors, &error)
+                          : larodCreateModelOutputs(model, numTensors, &error);
+    if (!*tensorsPtr) {
+        syslog(LOG_ERR, "Failed retrieving %s tensors: %s", kind, error->msg);
+        goto end;
+    }
+    if (*numTensors > PIPELINE_MAX_TENSORS) {
+        syslog(LOG_ERR, "Model has %zu %ss, the app supports at most %d",
+               *numTensors, kind, PIPELINE_MAX_TENSORS);
+        goto end;
+    }
+    for (size_t i = 0; i < *numTensors; i++) {
+        // Name pattern for the temp file we will create.
+        char pattern[32];
+        snprintf(pattern, sizeof(pattern), "/tmp/larod.%s.test-XXXXXX",
+                 isInput ? "in" : "out");
+        pipelineBuffer* buffer = &buffers[i];
+        if (!getTensorBytes((*tensorsPtr)[i], &buffer->size) ||
+            !createAndMapTmpFile(pattern, buffer->size, &buffer->mapAddr,
+                                 &buffer->fd)) {
+            goto end;
+        }
+        buffer->mapSize = buffer->size;
+        buffer->addr = buffer->mapAddr;
+        buffer->offset = 0;
+        buffer->ownsFd = true;
+        if (!larodSetTensorFd((*tensorsPtr)[i], buffer->fd, &error)) {
+            syslog(LOG_ERR, "Failed setting %s tensor fd: %s", kind,
+                   error->msg);
+            goto end;
+        }
+    }
+    *memory = "temporary files";
+
+    ret = true;
+
+end:
+    larodClearError(&error);
+
+    return ret;
+}
+
+static void freeBuffers(pipelineBuffer* buffers, size_t numBuffers) {
+    for (size_t i = 0; i < numBuffers && i < PIPELINE_MAX_TENSORS; i++) {
+        if (buffers[i].mapAddr) {
+            munmap(buffers[i].mapAddr, buffers[i].mapSize);
+        }
+        if (buffers[i].ownsFd) {
+            close(buffers[i].fd);
+        }
+        memset(&buffers[i], 0, sizeof(buffers[i]));
+    }
+}
+
+static bool setupSlot(pipeline* pipe, larodModel* model, bool externalInput,
+                      pipelineSlot* slot) {
+    larodError* error = NULL;
+    const char* inputMemory = NULL;
+    const char* outputMemory = NULL;
+    bool ret = false;
+
+    if (!allocTensors(pipe->conn, model, true, !externalInput,
+                      &slot->inputTensors, &slot->numInputs, slot->inputs,
+                      &inputMemory) ||
+        !allocTensors(pipe->conn, model, false, true, &slot->outputTensors,
+                      &slot->numOutputs, slot->outputs, &outputMemory)) {
+        goto end;
+    }
+    if (slot->numInputs == 0 || slot->numOutputs == 0) {
+        syslog(LOG_ERR, "Model has %zu inputs and %zu outputs, at least one "
+               "of each is needed", slot->numInputs, slot->numOutputs);
+        goto end;
+    }
+
+    slot->jobReq = larodCreateJobRequest(model, slot->inputTensors,
+                                         slot->numInputs, slot->outputTensors,
+                                         slot->numOutputs, NULL, &error);
+    if (!slot->jobReq) {
+        syslog(LOG_ERR, "Failed creating inference request: %s", error->msg);
+        goto end;
+    }
+
+    // All slots are created alike, the first one describes the model.
+    pipelineModelInfo* info = &pipe->info;
+    if (slot == &pipe->slots[0]) {
+        info->numInputs = slot->numInputs;
+        info->numOutputs = slot->numOutputs;
+        for (size_t i = 0; i < slot->numInputs; i++) {
+            info->inputBytes[i] = slot->inputs[i].size;
+        }
+        for (size_t i = 0; i < slot->numOutputs; i++) {
+            info->outputBytes[i] = slot->outputs[i].size;
+        }
+        info->inputMemory = inputMemory;
+        info->outputMemory = outputMemory;
+    }
+
+    ret = true;
+
+end:
+    larodClearError(&error);
+
+    return ret;
+}
+
+static bool setupPreprocessing(larodModel* preModel, size_t preInputBytes,
+                               pipelineSlot* slot, larodError** error) {
+    char PRE_INP_FILE_PATTERN[] = "/tmp/larod.pre.test-XXXXXX";
+
+    if (!createAndMapTmpFile(PRE_INP_FILE_PATTERN, preInputBytes,
+                             &slot->preInputAddr, &slot->preInputFd)) {
+        return false;
+    }
+
+    slot->preInputTensors =
+        larodCreateModelInputs(preModel, &slot->numPreInputs, error);
+    if (!slot->preInputTensors || slot->numPreInputs != 1 ||
+        !larodSetTensorFd(slot->preInputTensors[0], slot->preInputFd, error)) {
+        syslog(LOG_ERR, "Failed setting up preprocessing input tensor");
+        return false;
+    }
+    // The preprocessing job writes straight into the input of the inference
+    // job, so the two jobs share the buffer and nothing is copied.
+    slot->preOutputTensors =
+        larodCreateModelOutputs(preModel, &slot->numPreOutputs, error);
+    if (!slot->preOutputTensors || slot->numPreOutputs != 1 ||
+        !larodSetTensorFd(slot->preOutputTensors[0], slot->inputs[0].fd,
+                          error) ||
+        !larodSetTensorFdOffset(slot->preOutputTensors[0],
+                                slot->inputs[0].offset, error)) {
+        syslog(LOG_ERR, "Failed setting up preprocessing output tensor");
+        return false;
+    }
+
+    slot->preParams = larodCreateMap(error);
+    if (!slot->preParams) {
+        return false;
+    }
+    slot->preJobReq = larodCreateJobRequest(preModel, slot->preInputTensors, 1,
+                                            slot->preOutputTensors, 1, NULL,
+                                            error);
+    if (!slot->preJobReq) {
+        syslog(LOG_ERR, "Failed creating preprocessing request");
+        return false;
+    }
+
+    return true;
+}
+
+static void freeSlot(larodConnection* conn, pipelineSlot* slot) {
+    larodError* error = NULL;
+
+    larodDestroyJobRequest(&slot->jobReq);
+    // Buffers from larod are unmapped before their tensors close the fds.
+    freeBuffers(slot->inputs, slot->numInputs);
+    freeBuffers(slot->outputs, slot->numOutputs);
+    larodDestroyTensors(conn, &slot->inputTensors, slot->numInputs, &error);
+    larodDestroyTensors(conn, &slot->outputTensors, slot->numOutputs, &error);
+    larodClearError(&error);
+}
+
+static void freePreprocessing(larodConnection* conn, size_t preInputBytes,
+                              pipelineSlot* slot) {
+    larodError* error = NULL;
+
+    if (slot->preInputAddr != MAP_FAILED) {
+        munmap(slot->preInputAddr, preInputBytes);
+        slot->preInputAddr = MAP_FAILED;
+    }
+    if (slot->preInputFd >= 0) {
+        close(slot->preInputFd);
+        slot->preInputFd = -1;
+    }
+    larodDestroyJobRequest(&slot->preJobReq);
+    larodDestroyMap(&slot->preParams);
+    larodDestroyTensors(conn, &slot->preInputTensors, slot->numPreInputs,
+                        &error);
+    larodDestroyTensors(conn, &slot->preOutputTensors, slot->numPreOutputs,
+                        &error);
+    larodClearError(&error);
+}
+
+bool pipelineCreate(larodConnection* conn, larodModel* model, size_t depth,
+                    bool externalInput, pipeline** pipePtr) {
+    pipeline* pipe = calloc(1, sizeof(pipeline));
+    if (!pipe) {
+        syslog(LOG_ERR, "%s: Unable to allocate pipeline: %s", __func__,
+               strerror(errno));
+        return false;
+    }
+
+    pipe->slots = calloc(depth, sizeof(pipelineSlot));
+    if (!pipe->slots) {
+        syslog(LOG_ERR, "%s: Unable to allocate %zu pipeline slots: %s",
+               __func__, depth, strerror(errno));
+        free(pipe);
+        return false;
+    }
+    pipe->conn = conn;
+    pipe->depth = depth;
+    pthread_mutex_init(&pipe->mutex, NULL);
+    pthread_cond_init(&pipe->cond, NULL);
+
+    for (size_t i = 0; i < depth; i++) {
+        pipe->slots[i].preInputAddr = MAP_FAILED;
+        pipe->slots[i].preInputFd = -1;
+        pipe->slots[i].owner = pipe;
+    }
+
+    for (size_t i = 0; i < depth; i++) {
+        if (!setupSlot(pipe, model, externalInput, &pipe->slots[i])) {
+            pipelineDestroy(&pipe);
+            return false;
+        }
+    }
+
+    syslog(LOG_INFO, "%s: %zu inputs in %s and %zu outputs in %s per slot",
+           __func__, pipe->info.numInputs, pipe->info.inputMemory,
+           pipe->info.numOutputs, pipe->info.outputMemory);
+    *pipePtr = pipe;
+
+    return true;
+}
+
+const pipelineModelInfo* pipelineGetModelInfo(const pipeline* pipe) {
+    return &pipe->info;
+}
+
+void pipelineDestroy(pipeline** pipePtr) {
+    if (!pipePtr || !*pipePtr) {
+        return;
+    }
+    pipeline* pipe = *pipePtr;
+
+    // The larod callbacks reference the slots, so every job must have
+    // finished before the slots can be freed.
+    for (size_t i = 0; i < pipe->depth; i++) {
+        if (pipe->slots[i].inFlight) {
+            waitForSlot(pipe, &pipe->slots[i]);
+        }
+    }
+    for (size_t i = 0; i < pipe->depth; i++) {
+        freePreprocessing(pipe->conn, pipe->preInputBytes, &pipe->slots[i]);
+        freeSlot(pipe->conn, &pipe->slots[i]);
+    }
+
+    pthread_cond_destroy(&pipe->cond);
+    pthread_mutex_destroy(&pipe->mutex);
+    free(pipe->slots);
+    free(pipe);
+    *pipePtr = NULL;
+}
+
+static void waitForSlot(pipeline* pipe, pipelineSlot* slot) {
+    pthread_mutex_lock(&pipe->mutex);
+    while (!slot->done) {
+        pthread_cond_wait(&pipe->cond, &pipe->mutex);
+    }
+    pthread_mutex_unlock(&pipe->mutex);
+}
+
+bool pipelineBindInputFd(pipeline* pipe, int fd, larodError** error) {
+    for (size_t i = 0; i < pipe->depth; i++) {
+        larodTensor* tensor = pipe->slots[i].inputTensors[0];
+        // The fd is only read by larod, either through read() or by mapping
+        // it at the page aligned offset of each image.
+        if (!larodSetTensorFd(tensor, fd, error) ||
+            !larodSetTensorFdProps(tensor, LAROD_FD_TYPE_DISK, error)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool pipelineChainPreprocessing(pipeline* pipe, larodModel* preModel,
+                                size_t preInputBytes, larodError** error) {
+    pipe->preInputBytes = preInputBytes;
+    for (size_t i = 0; i < pipe->depth; i++) {
+        if (!setupPreprocessing(preModel, preInputBytes, &pipe->slots[i],
+                                error)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool pipelineSetCrop(pipelineSlot* slot, size_t x, size_t y, size_t width,
+                     size_t height, larodError** error) {
+    return larodMapSetIntArr4(slot->preParams, "image.input.crop", (int64_t) x,
+                              (int64_t) y, (int64_t) width, (int64_t) height,
+                              error) &&
+           larodSetJobRequestParams(slot->preJobReq, slot->preParams, error);
+}
+
+pipelineSlot* pipelineNext(pipeline* pipe) {
+    pipelineSlot* slot = &pipe->slots[pipe->head];
+    pipe->head = (pipe->head + 1) % pipe->depth;
+
+    if (slot->inFlight) {
+        waitForSlot(pipe, slot);
+    }
+
+    return slot;
+}
+
+pipelineSlot* pipelineDrain(pipeline* pipe) {
+    for (size_t i = 0; i < pipe->depth; i++) {
+        pipelineSlot* slot = pipelineNext(pipe);
+        if (slot->inFlight) {
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+bool pipelineSlotHasResult(pipelineSlot* slot) {
+    bool hasResult = slot->inFlight;
+    slot->inFlight = false;
+
+    return hasResult;
+}
+
+bool pipelineSubmit(pipeline* pipe, pipelineSlot* slot, size_t imageIdx,
+                    larodError** error) {
+    slot->imageIdx = imageIdx;
+    slot->done = false;
+    slot->failed = false;
+    slot->errorMsg[0] = '\0';
+    slot->inFlight = true;
+    slot->submitNs = statsNowNs();
+    slot->preDoneNs = slot->submitNs;
+
+    const bool submitted =
+        slot->preJobReq
+            ? larodRunJobAsync(pipe->conn, slot->preJobReq,
+                               preprocessDoneCallback, slot, error)
+            : larodRunJobAsync(pipe->conn, slot->jobReq, jobDoneCallback, slot,
+                               error);
+    if (!submitted) {
+        slot->inFlight = false;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,251 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file declares a ring of inference slots used to keep several
+ * larod jobs in flight at the same time.
+ *
+ * Each slot owns its own input and output buffers, tensors and job request.
+ * There is one buffer for every input and output of the model, sized from
+ * what larod reports for the tensor. The buffers are allocated by larod where
+ * possible, as dma-buf the accelerator can use without a copy, and are
+ * otherwise temporary files in /tmp. Slots are handed out in ring order, so
+ * results always come back in the order the images were submitted and can
+ * be attributed by imageIdx.
+ *
+ * A preprocessing job can be chained before the inference job of every slot,
+ * see pipelineChainPreprocessing. Its output tensor is the input buffer of
+ * the inference job, and the inference job is submitted from the callback of
+ * the preprocessing job, so the application only waits for the final result.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "larod.h"
+
+// Largest number of inputs or outputs of a model.
+#define PIPELINE_MAX_TENSORS (8)
+
+typedef struct pipeline pipeline;
+
+typedef struct pipelineBuffer {
+    // Tensor data, mapped in this process.
+    void* addr;
+    // Size in bytes of the tensor.
+    size_t size;
+    int fd;
+    // Offset of the tensor data in fd.
+    int64_t offset;
+    // Mapping holding addr, mapSize bytes from a page boundary of fd.
+    void* mapAddr;
+    size_t mapSize;
+    // True for temporary files, false for fds owned by the larod tensor.
+    bool ownsFd;
+} pipelineBuffer;
+
+typedef struct pipelineModelInfo {
+    size_t numInputs;
+    size_t numOutputs;
+    // Size in bytes of each input and output.
+    size_t inputBytes[PIPELINE_MAX_TENSORS];
+    size_t outputBytes[PIPELINE_MAX_TENSORS];
+    // How the buffers are allocated, e.g. "dma-buf" or "temporary files".
+    const char* inputMemory;
+    const char* outputMemory;
+} pipelineModelInfo;
+
+typedef struct pipelineSlot {
+    pipeline* owner;
+    // One buffer per input and output of the model. Images are loaded into
+    // inputs[0].
+    pipelineBuffer inputs[PIPELINE_MAX_TENSORS];
+    pipelineBuffer outputs[PIPELINE_MAX_TENSORS];
+    larodTensor** inputTensors;
+    size_t numInputs;
+    larodTensor** outputTensors;
+    size_t numOutputs;
+    larodJobRequest* jobReq;
+    // Preprocessing job run before jobReq, NULL if there is none. Its input
+    // buffer is preInputAddr and its output is inputs[0].
+    void* preInputAddr;
+    int preInputFd;
+    larodTensor** preInputTensors;
+    size_t numPreInputs;
+    larodTensor** preOutputTensors;
+    size_t numPreOutputs;
+    larodJobRequest* preJobReq;
+    larodMap* preParams;
+    // Index of the image currently held by the slot.
+    size_t imageIdx;
+    // True from submit until the result has been handed back by the ring.
+    bool inFlight;
+    // Written by the larod callback thread, protected by the ring mutex.
+    bool done;
+    bool failed;
+    char errorMsg[128];
+    // Monotonic time in ns when the job was submitted, when the
+    // preprocessing job was done (submitNs if there is none) and when larod
+    // reported the inference job done, see statsNowNs.
+    uint64_t submitNs;
+    uint64_t preDoneNs;
+    uint64_t doneNs;
+} pipelineSlot;
+
+/**
+ * brief Creates a temporary fd truncated to correct size and mapped.
+ *
+ * This convenience function creates temp files to be used for input and output.
+ *
+ * param fileName Pattern for how the temp file will be named in file system.
+ * param fileSize How much space needed to be allocated (truncated) in fd.
+ * param mappedAddr Pointer to the address of the fd mapped for this process.
+ * param Pointer to the generated fd.
+ * return False if any errors occur, otherwise true.
+ */
+bool createAndMapTmpFile(char* fileName, size_t fileSize, void** mappedAddr,
+                         int* convFd);
+
+/**
+ * brief Creates a ring of inference slots for a loaded model.
+ *
+ * Buffers are first asked from larod as mappable dma-buf, then as any
+ * mappable memory, and are temporary files if larod cannot allocate them.
+ *
+ * param conn Connection the jobs will be run on.
+ * param model Model the job requests are created for.
+ * param depth Number of slots, i.e. the maximum number of jobs in flight.
+ * param externalInput True if the first input will be bound to another fd
+ * with pipelineBindInputFd. The inputs are then temporary files, since the
+ * jobs read the bound fd instead and larod memory would go unused.
+ * param pipePtr Pointer to the created ring.
+ * return False if any errors occur, otherwise true.
+ */
+bool pipelineCreate(larodConnection* conn, larodModel* model, size_t depth,
+                    bool externalInput, pipeline** pipePtr);
+
+/**
+ * brief Describes the inputs and outputs of the model of a ring.
+ *
+ * param pipe The ring.
+ * return The description, valid until the ring is destroyed.
+ */
+const pipelineModelInfo* pipelineGetModelInfo(const pipeline* pipe);
+
+/**
+ * brief Waits for outstanding jobs and frees all slots.
+ *
+ * param pipePtr Pointer to the ring to destroy. Set to NULL on return.
+ */
+void pipelineDestroy(pipeline** pipePtr);
+
+/**
+ * brief Binds the input tensor of every slot to an external fd.
+ *
+ * Used to let larod read input data directly from a file instead of from the
+ * input buffer of the slot. The offset of the data in the fd is then set per
+ * job with larodSetTensorFdOffset on slot->inputTensors[0]. The input buffer
+ * of each slot is kept but no longer used by the jobs.
+ *
+ * param pipe The ring, created with externalInput, with no job in flight.
+ * param fd File descriptor to read input data from.
+ * param error Pointer to larod error, set if a tensor could not be bound.
+ * return False if any errors occur, otherwise true.
+ */
+bool pipelineBindInputFd(pipeline* pipe, int fd, larodError** error);
+
+/**
+ * brief Chains a preprocessing job before the inference job of every slot.
+ *
+ * Each slot gets an input buffer for the preprocessing model, and the output
+ * of the preprocessing model is written to the input buffer of the slot.
+ *
+ * param pipe The ring, with no job in flight.
+ * param preModel Preprocessing model, e.g. loaded on cpu-proc. Its output
+ * must be the size of the model input.
+ * param preInputBytes Size in bytes of the input of preModel.
+ * param error Pointer to larod error, set if the job could not be created.
+ * return False if any errors occur, otherwise true.
+ */
+bool pipelineChainPreprocessing(pipeline* pipe, larodModel* preModel,
+                                size_t preInputBytes, larodError** error);
+
+/**
+ * brief Sets the part of the preprocessing input that is scaled to the
+ * model input.
+ *
+ * param slot Slot returned by pipelineNext, with a preprocessing job.
+ * param x Left edge of the crop in pixels.
+ * param y Top edge of the crop in pixels.
+ * param width Width of the crop in pixels.
+ * param height Height of the crop in pixels.
+ * param error Pointer to larod error, set if the crop could not be set.
+ * return False if any errors occur, otherwise true.
+ */
+bool pipelineSetCrop(pipelineSlot* slot, size_t x, size_t y, size_t width,
+                     size_t height, larodError** error);
+
+/**
+ * brief Returns the next slot in ring order.
+ *
+ * If the slot still has a job in flight, this blocks until that job has
+ * completed. The caller must then consume the result of slot->imageIdx (see
+ * pipelineSlotHasResult) before loading a new image into the slot.
+ *
+ * param pipe The ring.
+ * return The next slot, never NULL.
+ */
+pipelineSlot* pipelineNext(pipeline* pipe);
+
+/**
+ * brief Returns the oldest slot that still has a job in flight.
+ *
+ * Used to drain the ring once all images have been submitted. Blocks until
+ * the job of the returned slot has completed.
+ *
+ * param pipe The ring.
+ * return The completed slot, or NULL if no job is in flight.
+ */
+pipelineSlot* pipelineDrain(pipeline* pipe);
+
+/**
+ * brief Tells whether a slot returned by the ring holds a completed result.
+ *
+ * The result is consumed by this call; the next call returns false until the
+ * slot has been submitted again.
+ *
+ * param slot Slot returned by pipelineNext or pipelineDrain.
+ * return True if the outputs of the slot hold the result for slot->imageIdx.
+ */
+bool pipelineSlotHasResult(pipelineSlot* slot);
+
+/**
+ * brief Submits an asynchronous job for the image loaded into a slot.
+ *
+ * With a chained preprocessing job, the preprocessing job is submitted and
+ * the inference job follows when it is done.
+ *
+ * param pipe The ring.
+ * param slot Slot returned by pipelineNext, with its input buffer filled.
+ * param imageIdx Index of the image that was loaded into the slot.
+ * param error Pointer to larod error, set if the job could not be queued.
+ * return False if any errors occur, otherwise true.
+ */
+bool pipelineSubmit(pipeline* pipe, pipelineSlot* slot, size_t imageIdx,
+                    larodError** error);
@@ -0,0 +1,188 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file turns the scores of a classification output into probabilities.
+ */
+
+#include "postprocess.h"
+
+#include <math.h>
+#include <string.h>
+
+/**
+ * brief Approximates exp(x) for x <= 0.
+ *
+ * Splits x into an integer and a fractional power of two. The fraction is
+ * evaluated with a polynomial and the integer part is put straight into the
+ * exponent bits, so there are no branches and the loops calling it can be
+ * vectorised. The relative error is below 2e-4, far below what is printed.
+ *
+ * param x Exponent, at most 0.
+ * return Approximation of exp(x), 0 for x below -87.
+ */
+static float fastExp(float x);
+
+/**
+ * brief Reads the score of a class as a float.
+ *
+ * param format Description of the output.
+ * param output Start of the output.
+ * param idx Class index.
+ * return The score as stored, not dequantized.
+ */
+static float readScore(const outputFormat* format, const uint8_t* output,
+                       size_t idx);
+
+/**
+ * brief Computes exp(x - max) summed over all scores of a float output.
+ *
+ * param format Description of the output.
+ * param output Start of the output.
+ * param max Highest score of the output.
+ * return The sum, at least 1.
+ */
+static float sumExpFloat(const outputFormat* format, const uint8_t* output,
+                         float max);
+
+static float fastExp(float x) {
+    float t = x * 1.44269504f;
+    t = t < -126.0f ? -126.0f : t;
+    const float n = floorf(t);
+    const float f = t - n;
+    // 2^f for f in [0, 1).
+    const float p =
+        1.0f +
+        f * (0.69314718f +
+             f * (0.24022651f +
+                  f * (0.05550411f + f * (0.00961813f + f * 0.00133336f))));
+    const uint32_t bits = (uint32_t) ((int32_t) n + 127) << 23;
+    float exponent;
+    memcpy(&exponent, &bits, sizeof(exponent));
+
+    return x < -87.0f ? 0.0f : p * exponent;
+}
+
+static float readScore(const outputFormat* format, const uint8_t* output,
+                       size_t idx) {
+    const uint8_t* p = output + idx * format->stride;
+    float score = 0.0f;
+    switch (format->decoder->type) {
+    case TOPK_TYPE_UINT8:
+        score = *p;
+        break;
+    case TOPK_TYPE_INT8:
+        score = (int8_t) *p;
+        break;
+    case TOPK_TYPE_FLOAT16: {
+        uint16_t half;
+        memcpy(&half, p, sizeof(half));
+        score = topkHalfToFloat(half);
+        break;
+    }
+    case TOPK_TYPE_FLOAT32:
+        memcpy(&score, p, sizeof(score));
+        break;
+    }
+
+    return score;
+}
+
+static float sumExpFloat(const outputFormat* format, const uint8_t* output,
+                         float max) {
+    float sum = 0.0f;
+    if (format->decoder->type == TOPK_TYPE_FLOAT32 &&
+        format->stride == sizeof(float) &&
+        (uintptr_t) output % sizeof(float) == 0) {
+        const float* scores = (const float*) output;
+        for (size_t i = 0; i < format->numClasses; i++) {
+            sum += fastExp(scores[i] - max);
+        }
+    } else {
+        for (size_t i = 0; i < format->numClasses; i++) {
+            sum += fastExp(readScore(format, output, i) - max);
+        }
+    }
+
+    return sum;
+}
+
+void postprocessInit(outputFormat* format, const topkDecoder* decoder,
+                     size_t stride, size_t numClasses,
+                     const tfliteTensorInfo* info) {
+    memset(format, 0, sizeof(*format));
+    format->decoder = decoder;
+    format->stride = stride;
+    format->numClasses = numClasses;
+
+    const bool isFloat = decoder->type == TOPK_TYPE_FLOAT16 ||
+                         decoder->type == TOPK_TYPE_FLOAT32;
+    if (info) {
+        format->scale = isFloat || !info->quantized ? 0.0f : info->scale;
+        format->zeroPoint = info->quantized ? info->zeroPoint : 0;
+        format->isProbability = info->fromSoftmax;
+    } else {
+        format->scale = isFloat ? 0.0f : 1.0f;
+        format->isProbability = isFloat;
+    }
+    if (!isFloat && format->scale <= 0.0f) {
+        format->scale = 1.0f;
+    }
+
+    for (size_t d = 0; d < sizeof(format->expTable) / sizeof(float); d++) {
+        format->expTable[d] = expf(-format->scale * (float) d);
+    }
+}
+
+float postprocessProbability(const outputFormat* format, const void* output,
+                             size_t idx, size_t maxIdx) {
+    const uint8_t* data = output;
+    const float score = readScore(format, data, idx);
+
+    if (format->isProbability) {
+        if (format->scale > 0.0f) {
+            return format->scale * (score - (float) format->zeroPoint);
+        }
+        return score;
+    }
+
+    const float max = readScore(format, data, maxIdx);
+    if (format->scale <= 0.0f) {
+        return fastExp(score - max) / sumExpFloat(format, data, max);
+    }
+
+    // The zero point cancels out, only differences to the top score matter.
+    // Those are at most 255 for both uint8 and int8.
+    const int maxScore = (int) max;
+    float sum = 0.0f;
+    if (format->stride != sizeof(uint8_t)) {
+        for (size_t i = 0; i < format->numClasses; i++) {
+            const float value = readScore(format, data, i);
+            sum += format->expTable[maxScore - (int) value];
+        }
+    } else if (format->decoder->type == TOPK_TYPE_UINT8) {
+        for (size_t i = 0; i < format->numClasses; i++) {
+            sum += format->expTable[maxScore - data[i]];
+        }
+    } else {
+        const int8_t* scores = output;
+        for (size_t i = 0; i < format->numClasses; i++) {
+            sum += format->expTable[maxScore - scores[i]];
+        }
+    }
+
+    return format->expTable[maxScore - (int) score] / sum;
+}
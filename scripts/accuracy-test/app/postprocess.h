@@ -0,0 +1,82 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file declares how the scores of a classification output are
+ * turned into probabilities.
+ *
+ * Dequantization and softmax are both monotonic, so the top classes are found
+ * on the raw scores (see topk.h) and probabilities are only computed for the
+ * classes that are reported. For quantized outputs, softmax only depends on
+ * the difference between a score and the top score, which is one of 256
+ * values, so exp() is replaced by a table built once per model.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tflite.h"
+#include "topk.h"
+
+typedef struct outputFormat {
+    // Decoder finding the top classes, chosen for the type and stride.
+    const topkDecoder* decoder;
+    // Bytes from one score to the next.
+    size_t stride;
+    size_t numClasses;
+    // Real value of a score is scale * (score - zeroPoint). Scale is 0 for
+    // float outputs.
+    float scale;
+    int32_t zeroPoint;
+    // True if the scores are probabilities already, e.g. written by softmax.
+    bool isProbability;
+    // expTable[d] = exp(-scale * d), used for softmax of quantized scores.
+    float expTable[256];
+} outputFormat;
+
+/**
+ * brief Describes the output of a model.
+ *
+ * param format Pointer to the description to set up.
+ * param decoder Decoder for the type and stride of the scores, see
+ * topkFindDecoder.
+ * param stride Bytes from one score to the next.
+ * param numClasses Number of classes in the output.
+ * param info Output tensor read from the model file, NULL if not known. When
+ * not known, quantized scores are used as logits with scale 1 and float
+ * scores as probabilities.
+ */
+void postprocessInit(outputFormat* format, const topkDecoder* decoder,
+                     size_t stride, size_t numClasses,
+                     const tfliteTensorInfo* info);
+
+/**
+ * brief Computes the probability of one class.
+ *
+ * Costs one pass over the output if the model does not end with softmax,
+ * so only call this for results that are actually reported.
+ *
+ * param format Description of the output.
+ * param output Start of the output.
+ * param idx Class to compute the probability of.
+ * param maxIdx Class with the highest score, e.g. the first topk result.
+ * return Probability of class idx, between 0 and 1.
+ */
+float postprocessProbability(const outputFormat* format, const void* output,
+                             size_t idx, size_t maxIdx);
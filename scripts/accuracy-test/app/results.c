@@ -0,0 +1,103 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * This file implements the sink the per-image results of a run are recorded
+ * in.
+ */
+
+#include "results.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+
+struct resultsSink {
+    resultRecord* records;
+    size_t capacity;
+};
+
+size_t resultsArenaSize(size_t capacity) {
+    return arenaAlignedSize(sizeof(resultsSink)) +
+           arenaAlignedSize(capacity * sizeof(resultRecord));
+}
+
+bool resultsCreate(arena* a, size_t capacity, resultsSink** sinkPtr) {
+    resultsSink* sink = arenaAlloc(a, sizeof(resultsSink));
+    if (!sink) {
+        return false;
+    }
+    sink->records = arenaAlloc(a, capacity * sizeof(resultRecord));
+    if (!sink->records) {
+        return false;
+    }
+    sink->capacity = capacity;
+    *sinkPtr = sink;
+
+    return true;
+}
+
+resultRecord* resultsGet(resultsSink* sink, size_t imageId) {
+    if (imageId < 1 || imageId > sink->capacity) {
+        return NULL;
+    }
+
+    return &sink->records[imageId - 1];
+}
+
+bool resultsWriteCsv(const resultsSink* sink, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        syslog(LOG_ERR, "Unable to open results file %s: %s", path,
+               strerror(errno));
+        return false;
+    }
+
+    fputs("image,ground_truth,top1,top5", file);
+    for (size_t k = 0; k < RESULTS_TOP_K; k++) {
+        fprintf(file, ",class%zu", k + 1);
+    }
+    fputs(",score\n", file);
+
+    for (size_t i = 0; i < sink->capacity; i++) {
+        const resultRecord* record = &sink->records[i];
+        if (record->imageId == 0) {
+            continue;
+        }
+        fprintf(file, "%u,%d,%d,%d", (unsigned) record->imageId,
+                (int) record->groundTruth,
+                (record->hits & RESULTS_HIT_TOP1) != 0,
+                (record->hits & RESULTS_HIT_TOP5) != 0);
+        for (size_t k = 0; k < RESULTS_TOP_K; k++) {
+            if (k < record->numClasses) {
+                fprintf(file, ",%u", (unsigned) record->classes[k]);
+            } else {
+                fputc(',', file);
+            }
+        }
+        fprintf(file, ",%g\n", (double) record->topScore);
+    }
+
+    const bool writeFailed = ferror(file) != 0;
+    if (fclose(file) != 0 || writeFailed) {
+        syslog(LOG_ERR, "Unable to write results file %s", path);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,98 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * This header file declares the sink the per-image results of a run are
+ * recorded in.
+ *
+ * The sink is carved from the run arena before the run, with one record per
+ * possible image. Each image is scored by exactly one worker, so workers fill in
+ * their records without locking. The records are written to a file once the
+ * run is over, instead of logging every image while the run is timed.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+// Number of highest scoring classes recorded per image.
+#define RESULTS_TOP_K (5)
+
+// Flags of resultRecord.hits.
+#define RESULTS_HIT_TOP1 (1u << 0)
+#define RESULTS_HIT_TOP5 (1u << 1)
+
+typedef struct resultRecord {
+    // One-based image number, 0 if the image was not scored.
+    uint32_t imageId;
+    // Expected class, as an index in the output.
+    int32_t groundTruth;
+    // Highest scoring classes, best first.
+    uint32_t classes[RESULTS_TOP_K];
+    // Score of the best class as read from the output, not scaled.
+    float topScore;
+    uint8_t numClasses;
+    uint8_t hits;
+} resultRecord;
+
+typedef struct resultsSink resultsSink;
+
+/**
+ * brief Returns the arena space needed for a sink.
+ *
+ * param capacity Largest image number that can be recorded.
+ * return Size in bytes to reserve in the arena.
+ */
+size_t resultsArenaSize(size_t capacity);
+
+/**
+ * brief Creates a sink in an arena, with room for a number of images.
+ *
+ * The sink is freed together with the arena.
+ *
+ * param a Arena with at least resultsArenaSize(capacity) bytes left.
+ * param capacity Largest image number that can be recorded.
+ * param sinkPtr Pointer to the created sink.
+ * return False if the arena is too small, otherwise true.
+ */
+bool resultsCreate(arena* a, size_t capacity, resultsSink** sinkPtr);
+
+/**
+ * brief Returns the record of an image.
+ *
+ * param sink The sink.
+ * param imageId One-based image number.
+ * return The record, or NULL if imageId is out of range.
+ */
+resultRecord* resultsGet(resultsSink* sink, size_t imageId);
+
+/**
+ * brief Writes all recorded images to a CSV file, in image order.
+ *
+ * Each row holds image, ground_truth, top1, top5, class1 to class5 and
+ * score, where top1 and top5 are 1 for a hit and 0 for a miss, and score is
+ * the raw score of class1.
+ *
+ * param sink The sink.
+ * param path File to write, replaced if it exists.
+ * return False if the file could not be written, otherwise true.
+ */
+bool resultsWriteCsv(const resultsSink* sink, const char* path);
@@ -0,0 +1,185 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file implements the sampled runs.
+ */
+
+#include "sampling.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <syslog.h>
+
+typedef struct sortKey {
+    double key;
+    size_t pos;
+} sortKey;
+
+/**
+ * brief Steps a xorshift64* generator.
+ *
+ * param state State of the generator, never 0.
+ * return The next random number.
+ */
+static uint64_t nextRandom(uint64_t* state);
+
+/**
+ * brief Returns a random number in [0, 1).
+ *
+ * param state State of the generator.
+ * return The number, with 53 random bits.
+ */
+static double nextUniform(uint64_t* state);
+
+/**
+ * brief Compares two sort keys, by key and then by position.
+ *
+ * param a First sortKey.
+ * param b Second sortKey.
+ * return Negative, zero or positive as for qsort.
+ */
+static int compareKeys(const void* a, const void* b);
+
+static uint64_t nextRandom(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static double nextUniform(uint64_t* state) {
+    const uint64_t bits = nextRandom(state) >> 11;
+
+    return (double) bits / 9007199254740992.0;
+}
+
+static int compareKeys(const void* a, const void* b) {
+    const sortKey* ka = a;
+    const sortKey* kb = b;
+
+    if (ka->key < kb->key) {
+        return -1;
+    }
+    if (ka->key > kb->key) {
+        return 1;
+    }
+
+    return (ka->pos > kb->pos) - (ka->pos < kb->pos);
+}
+
+double samplingZ(double confidence) {
+    // Solve erfc(z / sqrt(2)) = 1 - confidence by bisection, erfc falls
+    // monotonically.
+    const double tail = 1.0 - confidence;
+    double low = 0.0;
+    double high = 40.0;
+
+    for (int i = 0; i < 200; i++) {
+        const double mid = 0.5 * (low + high);
+        if (erfc(mid / sqrt(2.0)) > tail) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    return 0.5 * (low + high);
+}
+
+void samplingWilson(size_t hits, size_t count, double z,
+                    samplingInterval* interval) {
+    if (count == 0) {
+        interval->rate = 0.0;
+        interval->low = 0.0;
+        interval->high = 1.0;
+        return;
+    }
+    const double n = (double) count;
+    const double p = (double) hits / n;
+    const double z2 = z * z;
+    const double center = (p + z2 / (2.0 * n)) / (1.0 + z2 / n);
+    const double margin =
+        z * sqrt(p * (1.0 - p) / n + z2 / (4.0 * n * n)) / (1.0 + z2 / n);
+
+    interval->rate = p;
+    interval->low = center - margin > 0.0 ? center - margin : 0.0;
+    interval->high = center + margin < 1.0 ? center + margin : 1.0;
+}
+
+bool samplingStratifiedOrder(const int* classes, size_t count, uint64_t seed,
+                             size_t* order) {
+    bool ret = false;
+    uint64_t state = seed ? seed : 1;
+    int maxClass = -1;
+
+    for (size_t i = 0; i < count; i++) {
+        maxClass = classes[i] > maxClass ? classes[i] : maxClass;
+    }
+    // Bucket 0 holds the images without ground truth.
+    const size_t numBuckets = (size_t) maxClass + 2;
+    size_t* starts = calloc(numBuckets + 1, sizeof(size_t));
+    size_t* byClass = malloc(count * sizeof(size_t));
+    sortKey* keys = malloc(count * sizeof(sortKey));
+    if (!starts || !byClass || !keys) {
+        syslog(LOG_ERR, "Out of memory for the order of the images");
+        goto end;
+    }
+
+    // Group the positions by class, in position order.
+    for (size_t i = 0; i < count; i++) {
+        starts[classes[i] < 0 ? 1 : (size_t) classes[i] + 2]++;
+    }
+    for (size_t b = 1; b <= numBuckets; b++) {
+        starts[b] += starts[b - 1];
+    }
+    for (size_t i = 0; i < count; i++) {
+        byClass[starts[classes[i] < 0 ? 0 : (size_t) classes[i] + 1]++] = i;
+    }
+    // starts[b] is now the end of bucket b, and the start of bucket b + 1.
+
+    size_t begin = 0;
+    for (size_t b = 0; b < numBuckets; b++) {
+        const size_t end = starts[b];
+        const size_t n = end - begin;
+        // Shuffle the class, then spread it evenly over [0, 1).
+        for (size_t k = n; k > 1; k--) {
+            const size_t j = (size_t) (nextRandom(&state) % k);
+            const size_t tmp = byClass[begin + k - 1];
+            byClass[begin + k - 1] = byClass[begin + j];
+            byClass[begin + j] = tmp;
+        }
+        for (size_t k = 0; k < n; k++) {
+            keys[begin + k].key =
+                ((double) k + nextUniform(&state)) / (double) n;
+            keys[begin + k].pos = byClass[begin + k];
+        }
+        begin = end;
+    }
+    qsort(keys, count, sizeof(sortKey), compareKeys);
+    for (size_t i = 0; i < count; i++) {
+        order[i] = keys[i].pos;
+    }
+    ret = true;
+
+end:
+    free(starts);
+    free(byClass);
+    free(keys);
+
+    return ret;
+}
@@ -0,0 +1,81 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file declares the sampled runs, which stop once the top1 and
+ * top5 accuracies are known precisely enough.
+ *
+ * The images are visited in a random order stratified by class: every
+ * prefix of the order holds about the same share of each class as the whole
+ * set, so the accuracy of the first images is not skewed by classes that
+ * happen to come early. The order only depends on the classes and the seed,
+ * so a run with the same seed visits the same images.
+ *
+ * The accuracies are binomial proportions, and their confidence intervals
+ * are Wilson score intervals, which unlike the normal approximation stay
+ * inside [0, 1] and hold up for accuracies close to 0 or 1.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct samplingInterval {
+    // Hits divided by count, 0 if nothing was counted.
+    double rate;
+    double low;
+    double high;
+} samplingInterval;
+
+/**
+ * brief Returns the quantile of the standard normal distribution for a
+ * two-sided confidence level, e.g. 1.96 for 0.95.
+ *
+ * param confidence Confidence level between 0 and 1, both excluded.
+ * return The quantile.
+ */
+double samplingZ(double confidence);
+
+/**
+ * brief Computes the Wilson score interval of a proportion.
+ *
+ * param hits Number of successes.
+ * param count Number of trials, the interval is [0, 1] if 0.
+ * param z Quantile of the confidence level, see samplingZ.
+ * param interval Pointer to the interval to fill in.
+ */
+void samplingWilson(size_t hits, size_t count, double z,
+                    samplingInterval* interval);
+
+/**
+ * brief Orders images at random, stratified by class.
+ *
+ * Each image of a class of n images gets the key (k + u) / n, where k is
+ * its place in a random permutation of the class and u is uniform in
+ * [0, 1), and the images are sorted by key.
+ *
+ * param classes Class of every image, any negative class is one class of
+ * images without ground truth.
+ * param count Number of images.
+ * param seed Seed of the order, the same seed gives the same order.
+ * param order Array of count positions in classes to fill in, in the order
+ * the images are to be visited.
+ * return False if out of memory, otherwise true.
+ */
+bool samplingStratifiedOrder(const int* classes, size_t count, uint64_t seed,
+                             size_t* order);
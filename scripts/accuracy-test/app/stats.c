@@ -0,0 +1,333 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * This file implements the timing statistics of a run.
+ */
+
+#include "stats.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+/**
+ * brief Returns the bucket a value is counted in.
+ *
+ * param ns The value.
+ * return Index of the bucket.
+ */
+static size_t bucketIndex(uint64_t ns);
+
+/**
+ * brief Returns the middle of a bucket.
+ *
+ * param idx Index of the bucket.
+ * return The value in the middle of the bucket.
+ */
+static uint64_t bucketMiddle(size_t idx);
+
+/**
+ * brief Computes a percentile of a histogram in microseconds.
+ *
+ * param hist The histogram.
+ * param percentile Percentile between 0 and 100.
+ * return The percentile in microseconds.
+ */
+static double percentileUs(const statsHistogram* hist, double percentile);
+
+/**
+ * brief Writes a string as a JSON string, with quotes and escapes.
+ *
+ * param file File to write to.
+ * param str String to write, NULL is written as null.
+ */
+static void writeJsonString(FILE* file, const char* str);
+
+/**
+ * brief Computes the mean of a histogram in microseconds.
+ *
+ * param hist The histogram.
+ * return The mean in microseconds, 0 if the histogram is empty.
+ */
+static double meanUs(const statsHistogram* hist);
+
+static const char* const stageNames[STATS_NUM_STAGES] = {
+    [STATS_STAGE_LOAD] = "load",
+    [STATS_STAGE_PREPROCESS] = "preprocess",
+    [STATS_STAGE_INFERENCE] = "inference",
+    [STATS_STAGE_DECODE] = "decode",
+    [STATS_STAGE_TOPK] = "topk",
+    [STATS_STAGE_NMS] = "nms",
+    [STATS_STAGE_BOOKKEEPING] = "bookkeeping",
+};
+
+static size_t bucketIndex(uint64_t ns) {
+    if (ns < STATS_SUB_BUCKETS) {
+        return (size_t) ns;
+    }
+    const unsigned exponent = 63u - (unsigned) __builtin_clzll(ns);
+    const unsigned shift = exponent - STATS_SUB_BITS;
+
+    return (size_t) (shift + 1) * STATS_SUB_BUCKETS +
+           (size_t) ((ns >> shift) & (STATS_SUB_BUCKETS - 1));
+}
+
+static uint64_t bucketMiddle(size_t idx) {
+    if (idx < STATS_SUB_BUCKETS) {
+        return idx;
+    }
+    const unsigned shift = (unsigned) (idx / STATS_SUB_BUCKETS) - 1;
+    const uint64_t lower = (uint64_t) (STATS_SUB_BUCKETS + idx % STATS_SUB_BUCKETS)
+                           << shift;
+
+    return lower + (((uint64_t) 1 << shift) >> 1);
+}
+
+static double percentileUs(const statsHistogram* hist, double percentile) {
+    const uint64_t ns = statsPercentile(hist, percentile);
+
+    return (double) ns / 1e3;
+}
+
+static double meanUs(const statsHistogram* hist) {
+    return hist->count ? (double) hist->sumNs / (double) hist->count / 1e3
+                       : 0.0;
+}
+
+static void writeJsonString(FILE* file, const char* str) {
+    if (!str) {
+        fputs("null", file);
+        return;
+    }
+    fputc('"', file);
+    for (const unsigned char* c = (const unsigned char*) str; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(file, "\\u%04x", *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+uint64_t statsNowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+void statsRecord(statsHistogram* hist, uint64_t ns) {
+    hist->buckets[bucketIndex(ns)]++;
+    hist->count++;
+    hist->sumNs += ns;
+    if (ns > hist->maxNs) {
+        hist->maxNs = ns;
+    }
+}
+
+void statsMerge(statsHistogram* dst, const statsHistogram* src) {
+    for (size_t i = 0; i < STATS_NUM_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+    dst->count += src->count;
+    dst->sumNs += src->sumNs;
+    if (src->maxNs > dst->maxNs) {
+        dst->maxNs = src->maxNs;
+    }
+}
+
+uint64_t statsPercentile(const statsHistogram* hist, double percentile) {
+    if (hist->count == 0) {
+        return 0;
+    }
+    // Rank of the value, counted from 1.
+    uint64_t rank = (uint64_t) (percentile / 100.0 * (double) hist->count + 0.5);
+    rank = rank < 1 ? 1 : rank > hist->count ? hist->count : rank;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < STATS_NUM_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            const uint64_t middle = bucketMiddle(i);
+            return middle < hist->maxNs ? middle : hist->maxNs;
+        }
+    }
+
+    return hist->maxNs;
+}
+
+const char* statsStageName(statsStage stage) {
+    return stage < STATS_NUM_STAGES ? stageNames[stage] : "unknown";
+}
+
+void statsLog(const statsRun* run) {
+    syslog(LOG_INFO, "Startup: connect %.1f ms, %s model %.1f ms, first "
+           "inference %.1f ms, median inference %.1f ms",
+           (double) run->startup.connectNs / 1e6,
+           run->modelReused ? "get" : "load",
+           (double) run->startup.loadNs / 1e6,
+           (double) run->startup.firstInferenceNs / 1e6,
+           percentileUs(&run->stages[STATS_STAGE_INFERENCE], 50.0) / 1e3);
+
+    for (size_t s = 0; s < STATS_NUM_STAGES; s++) {
+        const statsHistogram* hist = &run->stages[s];
+        if (hist->count == 0) {
+            continue;
+        }
+        syslog(LOG_INFO, "Stage %s: %llu samples, p50 %.1f us, p90 %.1f us, "
+               "p99 %.1f us, max %.1f us", statsStageName((statsStage) s),
+               (unsigned long long) hist->count,
+               percentileUs(hist, 50.0),
+               percentileUs(hist, 90.0),
+               percentileUs(hist, 99.0),
+               (double) hist->maxNs / 1e3);
+    }
+
+    if (run->detection) {
+        // Every scored image is decoded and suppressed, so the means add up
+        // to the post-processing time per image.
+        const double postUs = meanUs(&run->stages[STATS_STAGE_DECODE]) +
+                              meanUs(&run->stages[STATS_STAGE_NMS]);
+        const double inferenceUs = meanUs(&run->stages[STATS_STAGE_INFERENCE]);
+        syslog(LOG_INFO, "Detection post-processing: decode + nms %.1f us, "
+               "inference %.1f us per image, %.1f%% of the two",
+               postUs, inferenceUs,
+               postUs + inferenceUs > 0.0
+                   ? 100.0 * postUs / (postUs + inferenceUs)
+                   : 0.0);
+    }
+
+    if (run->sampling.enabled) {
+        const statsSampling* sampling = &run->sampling;
+        syslog(LOG_INFO, "Sampled %zu of %zu images with seed %llu%s: top1 "
+               "%.2f%% (%.2f - %.2f%%), top5 %.2f%% (%.2f - %.2f%%) at %g%% "
+               "confidence", run->numScored + run->numCached,
+               sampling->numAvailable,
+               (unsigned long long) sampling->seed,
+               sampling->stoppedEarly ? "" : ", intervals wider than wanted",
+               100.0 * sampling->top1.rate, 100.0 * sampling->top1.low,
+               100.0 * sampling->top1.high, 100.0 * sampling->top5.rate,
+               100.0 * sampling->top5.low, 100.0 * sampling->top5.high,
+               100.0 * sampling->confidence);
+    }
+
+    if (run->readAhead) {
+        const double wallS = (double) run->wallNs / 1e9;
+        syslog(LOG_INFO, "Read-ahead with %s and queue depth %zu: %llu files, "
+               "%.1f MB, %.2f MB/s, waited %.2f s, p50 %.1f us, p99 %.1f us "
+               "per image", run->ioBackend, run->readAhead,
+               (unsigned long long) run->ioFiles, (double) run->ioBytes / 1e6,
+               wallS > 0.0 ? (double) run->ioBytes / 1e6 / wallS : 0.0,
+               (double) run->ioWait.sumNs / 1e9,
+               percentileUs(&run->ioWait, 50.0),
+               percentileUs(&run->ioWait, 99.0));
+    }
+}
+
+bool statsWriteReport(const statsRun* run, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        syslog(LOG_ERR, "Unable to open report file %s: %s", path,
+               strerror(errno));
+        return false;
+    }
+
+    const double wallS = (double) run->wallNs / 1e9;
+    fputs("{\n  \"model\": ", file);
+    writeJsonString(file, run->modelFile);
+    fputs(",\n  \"device\": ", file);
+    writeJsonString(file, run->deviceName);
+    fprintf(file, ",\n  \"workers\": %zu,\n  \"inflight\": %zu,\n"
+            "  \"images\": %zu,\n  \"scored\": %zu,\n  \"cached\": %zu,\n",
+            run->numWorkers, run->inflight, run->numImages, run->numScored,
+            run->numCached);
+    if (run->detection) {
+        fprintf(file, "  \"map\": %.6f,\n  \"map50\": %.6f,\n"
+                "  \"map75\": %.6f,\n  \"detections\": %llu,\n"
+                "  \"postprocess_mean_us\": %.3f,\n",
+                run->map, run->map50, run->map75,
+                (unsigned long long) run->numDetections,
+                meanUs(&run->stages[STATS_STAGE_DECODE]) +
+                    meanUs(&run->stages[STATS_STAGE_NMS]));
+    } else {
+        fprintf(file, "  \"top1\": %d,\n  \"top5\": %d,\n", run->sumTop1,
+                run->sumTop5);
+    }
+    if (run->sampling.enabled) {
+        const statsSampling* sampling = &run->sampling;
+        fprintf(file, "  \"sampling\": {\"seed\": %llu, \"confidence\": %g, "
+                "\"tolerance\": %g, \"available\": %zu, "
+                "\"stopped_early\": %s,\n    \"top1\": {\"rate\": %.6f, "
+                "\"low\": %.6f, \"high\": %.6f},\n    \"top5\": {\"rate\": "
+                "%.6f, \"low\": %.6f, \"high\": %.6f}},\n",
+                (unsigned long long) sampling->seed, sampling->confidence,
+                sampling->tolerance, sampling->numAvailable,
+                sampling->stoppedEarly ? "true" : "false",
+                sampling->top1.rate, sampling->top1.low, sampling->top1.high,
+                sampling->top5.rate, sampling->top5.low, sampling->top5.high);
+    }
+    fprintf(file, "  \"wall_time_s\": %.6f,\n  \"throughput_ips\": %.3f,\n",
+            wallS, wallS > 0.0 ? (double) run->numScored / wallS : 0.0);
+    fprintf(file, "  \"startup\": {\"model_reused\": %s, "
+            "\"connect_ms\": %.3f, \"load_ms\": %.3f, "
+            "\"first_inference_ms\": %.3f},\n  \"stages\": {",
+            run->modelReused ? "true" : "false",
+            (double) run->startup.connectNs / 1e6,
+            (double) run->startup.loadNs / 1e6,
+            (double) run->startup.firstInferenceNs / 1e6);
+    for (size_t s = 0; s < STATS_NUM_STAGES; s++) {
+        const statsHistogram* hist = &run->stages[s];
+        fprintf(file, "%s\n    \"%s\": {\"count\": %llu, \"mean_us\": %.3f, "
+                "\"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, "
+                "\"max_us\": %.3f}",
+                s ? "," : "", statsStageName((statsStage) s),
+                (unsigned long long) hist->count, meanUs(hist),
+                percentileUs(hist, 50.0),
+                percentileUs(hist, 90.0),
+                percentileUs(hist, 99.0),
+                (double) hist->maxNs / 1e3);
+    }
+    fputs("\n  }", file);
+    if (run->readAhead) {
+        fputs(",\n  \"io\": {\"backend\": ", file);
+        writeJsonString(file, run->ioBackend);
+        fprintf(file, ", \"queue_depth\": %zu, \"files\": %llu, "
+                "\"bytes\": %llu, \"bytes_per_s\": %.1f, \"wait_s\": %.6f, "
+                "\"wait_p50_us\": %.3f, \"wait_p99_us\": %.3f}",
+                run->readAhead, (unsigned long long) run->ioFiles,
+                (unsigned long long) run->ioBytes,
+                wallS > 0.0 ? (double) run->ioBytes / wallS : 0.0,
+                (double) run->ioWait.sumNs / 1e9,
+                percentileUs(&run->ioWait, 50.0),
+                percentileUs(&run->ioWait, 99.0));
+    }
+    fputs("\n}\n", file);
+
+    const bool writeFailed = ferror(file) != 0;
+    if (fclose(file) != 0 || writeFailed) {
+        syslog(LOG_ERR, "Unable to write report file %s", path);
+        return false;
+    }
+
+    return true;
+}
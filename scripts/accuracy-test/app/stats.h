@@ -0,0 +1,197 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * This header file declares the timing statistics of a run.
+ *
+ * The time of each stage of every image is recorded in a histogram with
+ * fixed buckets, so recording is a few instructions and needs no allocation,
+ * and the histograms of several workers are merged by adding them. Bucket
+ * widths grow with the value: every power of two is split into
+ * STATS_SUB_BUCKETS buckets, so a percentile is within 2% of the
+ * exact value no matter if it is in nanoseconds or seconds.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sampling.h"
+
+// Buckets per power of two, as a power of two.
+#define STATS_SUB_BITS (5)
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+
+// Enough buckets for any uint64_t value.
+#define STATS_NUM_BUCKETS ((64 - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+typedef enum {
+    // Reading or staging the input of an image, including JPEG decoding.
+    STATS_STAGE_LOAD,
+    // From submitting the preprocessing job until larod reported it done.
+    STATS_STAGE_PREPROCESS,
+    // From submitting the inference job until larod reported it done.
+    STATS_STAGE_INFERENCE,
+    // Dequantization and softmax of the reported scores, or for detection
+    // models thresholding the boxes and decoding the ones that pass.
+    STATS_STAGE_DECODE,
+    // Finding the highest scoring classes.
+    STATS_STAGE_TOPK,
+    // Suppressing overlapping boxes of a detection model.
+    STATS_STAGE_NMS,
+    // Comparing with the ground truth, logging and counting.
+    STATS_STAGE_BOOKKEEPING,
+    STATS_NUM_STAGES,
+} statsStage;
+
+typedef struct statsHistogram {
+    uint64_t count;
+    uint64_t sumNs;
+    uint64_t maxNs;
+    uint32_t buckets[STATS_NUM_BUCKETS];
+} statsHistogram;
+
+typedef struct statsStartup {
+    uint64_t connectNs;
+    // Time to load the model, or to get it by id if reused.
+    uint64_t loadNs;
+    // The first inference job of a worker, measured as every other one.
+    uint64_t firstInferenceNs;
+} statsStartup;
+
+typedef struct statsSampling {
+    // False for a run of every image, when the rest is not set.
+    bool enabled;
+    uint64_t seed;
+    double confidence;
+    // Largest half-width of the intervals at which the run stops.
+    double tolerance;
+    // Images the run could have visited.
+    size_t numAvailable;
+    // The intervals got narrow enough before every image was visited.
+    bool stoppedEarly;
+    samplingInterval top1;
+    samplingInterval top5;
+} statsSampling;
+
+typedef struct statsRun {
+    const char* modelFile;
+    const char* deviceName;
+    size_t numWorkers;
+    size_t inflight;
+    size_t numImages;
+    size_t numScored;
+    // Images read from the cache instead of run, see cache.h. They count in
+    // the results but not in the throughput.
+    size_t numCached;
+    int sumTop1;
+    int sumTop5;
+    // Mean average precision of a detection model, see mapeval.h. Only set
+    // if detection is true.
+    bool detection;
+    double map;
+    double map50;
+    double map75;
+    uint64_t numDetections;
+    uint64_t wallNs;
+    // Startup of the first worker. The model is a public one got by id if
+    // modelReused is true.
+    bool modelReused;
+    statsStartup startup;
+    statsHistogram stages[STATS_NUM_STAGES];
+    // Read-ahead of the image files, see ioengine.h. readAhead is 0 if the
+    // workers read the files themselves.
+    const char* ioBackend;
+    size_t readAhead;
+    uint64_t ioFiles;
+    uint64_t ioBytes;
+    // Time per image the workers were blocked waiting for a read.
+    statsHistogram ioWait;
+    // Sampled run of a classification model, see sampling.h.
+    statsSampling sampling;
+} statsRun;
+
+/**
+ * brief Reads the monotonic clock.
+ *
+ * return Time in nanoseconds from an arbitrary starting point.
+ */
+uint64_t statsNowNs(void);
+
+/**
+ * brief Adds one value to a histogram.
+ *
+ * param hist The histogram.
+ * param ns The value, in nanoseconds.
+ */
+void statsRecord(statsHistogram* hist, uint64_t ns);
+
+/**
+ * brief Adds all values of one histogram to another.
+ *
+ * param dst Histogram to add to.
+ * param src Histogram to add.
+ */
+void statsMerge(statsHistogram* dst, const statsHistogram* src);
+
+/**
+ * brief Computes a percentile of the values in a histogram.
+ *
+ * param hist The histogram.
+ * param percentile Percentile between 0 and 100.
+ * return The middle of the bucket holding the percentile, in nanoseconds,
+ * never more than the largest value. 0 if the histogram is empty.
+ */
+uint64_t statsPercentile(const statsHistogram* hist, double percentile);
+
+/**
+ * brief Returns the name of a stage, as used in logs and reports.
+ *
+ * param stage The stage.
+ * return Name of the stage.
+ */
+const char* statsStageName(statsStage stage);
+
+/**
+ * brief Logs the startup of the first worker against the median inference
+ * time, the percentiles of every stage, the read rate and wait of the
+ * read-ahead, and for detection models the mean time of decode and nms next
+ * to the mean inference time, to syslog.
+ *
+ * param run The run.
+ */
+void statsLog(const statsRun* run);
+
+/**
+ * brief Writes a JSON report of a run.
+ *
+ * The report holds the run configuration, the results, the wall time and
+ * throughput, the startup of the first worker in milliseconds, and count,
+ * mean, p50, p90, p99 and max of every stage in microseconds. For detection
+ * models the results are the mAP instead of the top1 and top5 hits,
+ * together with the mean time of decode and nms. With read-ahead, it also
+ * holds the bytes read per second of the run and the time spent waiting for
+ * reads. A sampled run also holds the seed and the confidence intervals of
+ * top1 and top5.
+ *
+ * param run The run.
+ * param path File to write, replaced if it exists.
+ * return False if the file could not be written, otherwise true.
+ */
+bool statsWriteReport(const statsRun* run, const char* path);
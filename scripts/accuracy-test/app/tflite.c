@@ -0,0 +1,365 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file reads output tensor descriptions from TensorFlow Lite models.
+ *
+ * A flatbuffer table starts with a signed offset back to its vtable. The
+ * vtable holds its own size followed by the offset of every field within the
+ * table, 0 for fields that are not set. Fields that are tables, vectors or
+ * strings hold an unsigned offset relative to the field itself. All reads are
+ * checked against the size of the file, since the model comes from the user.
+ */
+
+#include "tflite.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <syslog.h>
+
+#define TFLITE_IDENTIFIER "TFL3"
+
+// Field numbers in the TensorFlow Lite schema.
+#define MODEL_OPERATOR_CODES (1)
+#define MODEL_SUBGRAPHS (2)
+#define SUBGRAPH_TENSORS (0)
+#define SUBGRAPH_OUTPUTS (2)
+#define SUBGRAPH_OPERATORS (3)
+#define TENSOR_SHAPE (0)
+#define TENSOR_TYPE (1)
+#define TENSOR_QUANTIZATION (4)
+#define QUANTIZATION_SCALE (2)
+#define QUANTIZATION_ZERO_POINT (3)
+#define OPERATOR_OPCODE_INDEX (0)
+#define OPERATOR_OUTPUTS (2)
+#define OPERATOR_CODE_DEPRECATED_BUILTIN (0)
+#define OPERATOR_CODE_BUILTIN (3)
+
+#define BUILTIN_SOFTMAX (25)
+
+typedef struct flatbuffer {
+    const uint8_t* data;
+    size_t size;
+} flatbuffer;
+
+/**
+ * brief Reads a little-endian value of size bytes at pos.
+ *
+ * param fb The flatbuffer.
+ * param pos Position in the flatbuffer.
+ * param value Destination of size bytes.
+ * param size Size of the value.
+ * return False if the value lies outside of the flatbuffer, otherwise true.
+ */
+static bool readValue(const flatbuffer* fb, size_t pos, void* value, size_t size);
+
+/**
+ * brief Finds the position of a field of a table.
+ *
+ * param fb The flatbuffer.
+ * param table Position of the table.
+ * param field Field number.
+ * param fieldPos Position of the field, set if it is present.
+ * return False if the field is not set or the table is corrupt.
+ */
+static bool findField(const flatbuffer* fb, size_t table, unsigned field,
+                      size_t* fieldPos);
+
+/**
+ * brief Follows a field holding an offset, i.e. a table, vector or string.
+ *
+ * param fb The flatbuffer.
+ * param table Position of the table.
+ * param field Field number.
+ * param target Position the field points to.
+ * return False if the field is not set or the offset is out of bounds.
+ */
+static bool followField(const flatbuffer* fb, size_t table, unsigned field,
+                        size_t* target);
+
+/**
+ * brief Finds a vector field of a table.
+ *
+ * param fb The flatbuffer.
+ * param table Position of the table.
+ * param field Field number.
+ * param elements Position of the first element.
+ * param length Number of elements.
+ * return False if the field is not set or the vector is corrupt.
+ */
+static bool getVector(const flatbuffer* fb, size_t table, unsigned field,
+                      size_t* elements, uint32_t* length);
+
+/**
+ * brief Finds element idx of a vector of tables.
+ *
+ * param fb The flatbuffer.
+ * param elements Position of the first element of the vector.
+ * param idx Index of the element, less than the vector length.
+ * param table Position of the element table.
+ * return False if the offset is out of bounds, otherwise true.
+ */
+static bool getVectorTable(const flatbuffer* fb, size_t elements, size_t idx,
+                           size_t* table);
+
+/**
+ * brief Tells whether a tensor is written by a SOFTMAX operator.
+ *
+ * param fb The flatbuffer.
+ * param model Position of the model table.
+ * param subgraph Position of the subgraph table.
+ * param tensorIdx Index of the tensor in the subgraph.
+ * return True if the operator writing the tensor is SOFTMAX.
+ */
+static bool isSoftmaxOutput(const flatbuffer* fb, size_t model, size_t subgraph,
+                            int32_t tensorIdx);
+
+static bool readValue(const flatbuffer* fb, size_t pos, void* value, size_t size) {
+    if (pos > fb->size || size > fb->size - pos) {
+        return false;
+    }
+    memcpy(value, fb->data + pos, size);
+
+    return true;
+}
+
+static bool findField(const flatbuffer* fb, size_t table, unsigned field,
+                      size_t* fieldPos) {
+    int32_t vtableOffset;
+    if (!readValue(fb, table, &vtableOffset, sizeof(vtableOffset))) {
+        return false;
+    }
+    const int64_t vtable = (int64_t) table - vtableOffset;
+    if (vtable < 0 || (uint64_t) vtable >= fb->size) {
+        return false;
+    }
+
+    uint16_t vtableSize;
+    uint16_t offset;
+    const size_t entry = 4 + 2 * (size_t) field;
+    if (!readValue(fb, (size_t) vtable, &vtableSize, sizeof(vtableSize)) ||
+        entry + sizeof(offset) > vtableSize ||
+        !readValue(fb, (size_t) vtable + entry, &offset, sizeof(offset)) ||
+        offset == 0) {
+        return false;
+    }
+    *fieldPos = table + offset;
+
+    return true;
+}
+
+static bool followField(const flatbuffer* fb, size_t table, unsigned field,
+                        size_t* target) {
+    size_t pos;
+    uint32_t offset;
+    if (!findField(fb, table, field, &pos) ||
+        !readValue(fb, pos, &offset, sizeof(offset)) ||
+        offset > fb->size - pos) {
+        return false;
+    }
+    *target = pos + offset;
+
+    return true;
+}
+
+static bool getVector(const flatbuffer* fb, size_t table, unsigned field,
+                      size_t* elements, uint32_t* length) {
+    size_t vector;
+    if (!followField(fb, table, field, &vector) ||
+        !readValue(fb, vector, length, sizeof(*length))) {
+        return false;
+    }
+    *elements = vector + sizeof(*length);
+
+    // Every element takes at least one byte, so this bounds the length.
+    return *length <= fb->size - *elements;
+}
+
+static bool getVectorTable(const flatbuffer* fb, size_t elements, size_t idx,
+                           size_t* table) {
+    const size_t pos = elements + idx * sizeof(uint32_t);
+    uint32_t offset;
+    if (!readValue(fb, pos, &offset, sizeof(offset)) ||
+        offset > fb->size - pos) {
+        return false;
+    }
+    *table = pos + offset;
+
+    return true;
+}
+
+static bool isSoftmaxOutput(const flatbuffer* fb, size_t model, size_t subgraph,
+                            int32_t tensorIdx) {
+    size_t operators;
+    uint32_t numOperators;
+    if (!getVector(fb, subgraph, SUBGRAPH_OPERATORS, &operators, &numOperators)) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < numOperators; i++) {
+        size_t op;
+        size_t outputs;
+        uint32_t numOutputs;
+        if (!getVectorTable(fb, operators, i, &op) ||
+            !getVector(fb, op, OPERATOR_OUTPUTS, &outputs, &numOutputs)) {
+            continue;
+        }
+        bool writesTensor = false;
+        for (uint32_t j = 0; j < numOutputs && !writesTensor; j++) {
+            int32_t output;
+            writesTensor = readValue(fb, outputs + j * sizeof(output), &output,
+                                     sizeof(output)) &&
+                           output == tensorIdx;
+        }
+        if (!writesTensor) {
+            continue;
+        }
+
+        // An absent opcode_index means 0.
+        uint32_t opcodeIdx = 0;
+        size_t pos;
+        if (findField(fb, op, OPERATOR_OPCODE_INDEX, &pos) &&
+            !readValue(fb, pos, &opcodeIdx, sizeof(opcodeIdx))) {
+            return false;
+        }
+        size_t codes;
+        uint32_t numCodes;
+        size_t code;
+        if (!getVector(fb, model, MODEL_OPERATOR_CODES, &codes, &numCodes) ||
+            opcodeIdx >= numCodes || !getVectorTable(fb, codes, opcodeIdx, &code)) {
+            return false;
+        }
+
+        // Older models only set the deprecated 8-bit code, newer models set
+        // both. The larger of the two is the real one.
+        int8_t deprecatedBuiltin = 0;
+        int32_t builtin = 0;
+        if (findField(fb, code, OPERATOR_CODE_DEPRECATED_BUILTIN, &pos)) {
+            readValue(fb, pos, &deprecatedBuiltin, sizeof(deprecatedBuiltin));
+        }
+        if (findField(fb, code, OPERATOR_CODE_BUILTIN, &pos)) {
+            readValue(fb, pos, &builtin, sizeof(builtin));
+        }
+
+        return (deprecatedBuiltin > builtin ? deprecatedBuiltin : builtin) ==
+               BUILTIN_SOFTMAX;
+    }
+
+    return false;
+}
+
+bool tfliteGetOutputInfo(int fd, size_t outputIdx, tfliteTensorInfo* info) {
+    bool ret = false;
+    struct stat fileStats = {0};
+    if (fstat(fd, &fileStats) < 0) {
+        syslog(LOG_ERR, "%s: Unable to get stats for model file: %s", __func__,
+               strerror(errno));
+        return false;
+    }
+    if ((uint64_t) fileStats.st_size < 8 ||
+        (uint64_t) fileStats.st_size > (uint64_t) (SIZE_MAX / 2)) {
+        return false;
+    }
+
+    flatbuffer fb = {NULL, (size_t) fileStats.st_size};
+    void* data = mmap(NULL, fb.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        syslog(LOG_ERR, "%s: Unable to mmap model file: %s", __func__,
+               strerror(errno));
+        return false;
+    }
+    fb.data = data;
+
+    if (memcmp(fb.data + 4, TFLITE_IDENTIFIER, strlen(TFLITE_IDENTIFIER))) {
+        goto end;
+    }
+
+    uint32_t rootOffset;
+    size_t subgraphs;
+    uint32_t numSubgraphs;
+    size_t subgraph;
+    size_t outputs;
+    uint32_t numOutputs;
+    int32_t tensorIdx;
+    size_t tensors;
+    uint32_t numTensors;
+    size_t tensor;
+    if (!readValue(&fb, 0, &rootOffset, sizeof(rootOffset)) ||
+        !getVector(&fb, rootOffset, MODEL_SUBGRAPHS, &subgraphs, &numSubgraphs) ||
+        numSubgraphs == 0 || !getVectorTable(&fb, subgraphs, 0, &subgraph) ||
+        !getVector(&fb, subgraph, SUBGRAPH_OUTPUTS, &outputs, &numOutputs) ||
+        outputIdx >= numOutputs ||
+        !readValue(&fb, outputs + outputIdx * sizeof(tensorIdx), &tensorIdx,
+                   sizeof(tensorIdx)) ||
+        !getVector(&fb, subgraph, SUBGRAPH_TENSORS, &tensors, &numTensors) ||
+        tensorIdx < 0 || (uint32_t) tensorIdx >= numTensors ||
+        !getVectorTable(&fb, tensors, (size_t) tensorIdx, &tensor)) {
+        syslog(LOG_ERR, "%s: Model has no output %zu or is corrupt", __func__,
+               outputIdx);
+        goto end;
+    }
+
+    memset(info, 0, sizeof(*info));
+
+    // The type defaults to FLOAT32 when not set.
+    size_t pos;
+    int8_t type = TFLITE_TYPE_FLOAT32;
+    if (findField(&fb, tensor, TENSOR_TYPE, &pos)) {
+        readValue(&fb, pos, &type, sizeof(type));
+    }
+    info->type = type;
+
+    size_t dims;
+    uint32_t numDims;
+    if (getVector(&fb, tensor, TENSOR_SHAPE, &dims, &numDims)) {
+        info->numDims = numDims < TFLITE_MAX_DIMS ? numDims : TFLITE_MAX_DIMS;
+        for (size_t i = 0; i < info->numDims; i++) {
+            readValue(&fb, dims + i * sizeof(int32_t), &info->dims[i],
+                      sizeof(int32_t));
+        }
+    }
+
+    // Only per-tensor quantization is used for classification outputs, so
+    // the first scale and zero point are enough.
+    size_t quantization;
+    size_t scales;
+    uint32_t numScales;
+    if (followField(&fb, tensor, TENSOR_QUANTIZATION, &quantization) &&
+        getVector(&fb, quantization, QUANTIZATION_SCALE, &scales, &numScales) &&
+        numScales > 0 && readValue(&fb, scales, &info->scale, sizeof(float))) {
+        size_t zeroPoints;
+        uint32_t numZeroPoints;
+        int64_t zeroPoint = 0;
+        if (getVector(&fb, quantization, QUANTIZATION_ZERO_POINT, &zeroPoints,
+                      &numZeroPoints) &&
+            numZeroPoints > 0) {
+            readValue(&fb, zeroPoints, &zeroPoint, sizeof(zeroPoint));
+        }
+        info->quantized = info->scale > 0.0f;
+        info->zeroPoint = (int32_t) zeroPoint;
+    }
+
+    info->fromSoftmax = isSoftmaxOutput(&fb, rootOffset, subgraph, tensorIdx);
+
+    ret = true;
+
+end:
+    munmap(data, fb.size);
+
+    return ret;
+}
@@ -0,0 +1,72 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file declares a minimal reader of TensorFlow Lite model files.
+ *
+ * larod does not expose the quantization of the tensors of a model, so it is
+ * read from the model file itself. Only the few fields needed to interpret an
+ * output tensor are decoded from the flatbuffer, so no TensorFlow Lite
+ * library is needed.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Tensor types as numbered in the TensorFlow Lite schema.
+typedef enum {
+    TFLITE_TYPE_FLOAT32 = 0,
+    TFLITE_TYPE_FLOAT16 = 1,
+    TFLITE_TYPE_INT32 = 2,
+    TFLITE_TYPE_UINT8 = 3,
+    TFLITE_TYPE_INT64 = 4,
+    TFLITE_TYPE_INT16 = 7,
+    TFLITE_TYPE_INT8 = 9,
+} tfliteTensorType;
+
+// Largest number of dimensions read from a tensor shape.
+#define TFLITE_MAX_DIMS (8)
+
+typedef struct tfliteTensorInfo {
+    // One of tfliteTensorType.
+    int32_t type;
+    size_t numDims;
+    int32_t dims[TFLITE_MAX_DIMS];
+    // False if the tensor has no quantization parameters.
+    bool quantized;
+    // Real value is scale * (quantized value - zeroPoint).
+    float scale;
+    int32_t zeroPoint;
+    // True if the tensor is written by a SOFTMAX operator.
+    bool fromSoftmax;
+} tfliteTensorInfo;
+
+/**
+ * brief Reads the description of an output tensor of a TensorFlow Lite model.
+ *
+ * The file offset of fd is not changed, so the same fd can be passed to
+ * larodLoadModel afterwards.
+ *
+ * param fd File descriptor of the model file.
+ * param outputIdx Index of the output of the main subgraph.
+ * param info Pointer to the description, set on success.
+ * return False if the file is not a TensorFlow Lite model or the output does
+ * not exist, otherwise true.
+ */
+bool tfliteGetOutputInfo(int fd, size_t outputIdx, tfliteTensorInfo* info);
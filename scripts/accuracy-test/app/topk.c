@@ -0,0 +1,432 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file implements the top-k search over the scores of one
+ * classification output.
+ */
+
+#include "topk.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Number of scores compared against the threshold at once.
+#if defined(__ARM_NEON) || defined(__SSE2__)
+#define BLOCK_INT8 (16)
+#define BLOCK_FLOAT16 (8)
+#define BLOCK_FLOAT32 (8)
+#else
+#define BLOCK_INT8 (1)
+#define BLOCK_FLOAT16 (1)
+#define BLOCK_FLOAT32 (1)
+#endif
+
+// Key of a half precision NaN, below the key of every other value.
+#define FLOAT16_KEY_NAN INT16_MIN
+
+/**
+ * brief Tells whether any of BLOCK_INT8 uint8_t scores is above a threshold.
+ *
+ * param scores First score of the block.
+ * param threshold Smallest score currently in the top k.
+ * return True if at least one score is larger than threshold.
+ */
+static bool anyAboveUint8(const uint8_t* scores, uint8_t threshold);
+
+/**
+ * brief Tells whether any of BLOCK_INT8 int8_t scores is above a threshold.
+ *
+ * See anyAboveUint8.
+ */
+static bool anyAboveInt8(const int8_t* scores, int8_t threshold);
+
+/**
+ * brief Tells whether any of BLOCK_FLOAT32 float scores is above a threshold.
+ *
+ * See anyAboveUint8.
+ */
+static bool anyAboveFloat32(const float* scores, float threshold);
+
+/**
+ * brief Tells whether any of BLOCK_FLOAT16 half precision scores has a key
+ * above a threshold, see loadFloat16Key. NaN scores may count as above.
+ *
+ * See anyAboveUint8.
+ */
+static bool anyAboveFloat16(const uint16_t* scores, int16_t threshold);
+
+/**
+ * brief Reads a uint8_t score.
+ *
+ * param p Address of the score.
+ * return The score.
+ */
+static uint8_t loadUint8(const uint8_t* p);
+
+/**
+ * brief Reads an int8_t score.
+ *
+ * See loadUint8.
+ */
+static int8_t loadInt8(const uint8_t* p);
+
+/**
+ * brief Reads a half precision score, which need not be aligned, as a key.
+ *
+ * Keys compare like the values they come from, so the search needs no
+ * conversion to float: the key of a value is its magnitude bits, negated
+ * for negative values. NaN gets FLOAT16_KEY_NAN.
+ *
+ * See loadUint8.
+ */
+static int16_t loadFloat16Key(const uint8_t* p);
+
+/**
+ * brief Converts a key from loadFloat16Key back to the value as a float.
+ *
+ * param key The key, not FLOAT16_KEY_NAN.
+ * return The value.
+ */
+static float float16KeyToFloat(int16_t key);
+
+/**
+ * brief Reads a float score, which need not be aligned.
+ *
+ * See loadUint8.
+ */
+static float loadFloat32(const uint8_t* p);
+
+static bool anyAboveUint8(const uint8_t* scores, uint8_t threshold) {
+#if defined(__ARM_NEON)
+    const uint64x2_t above =
+        vreinterpretq_u64_u8(vcgtq_u8(vld1q_u8(scores), vdupq_n_u8(threshold)));
+
+    return (vgetq_lane_u64(above, 0) | vgetq_lane_u64(above, 1)) != 0;
+#elif defined(__SSE2__)
+    // SSE2 has no unsigned byte compare, a score is above the threshold
+    // exactly when max(score, threshold) differs from the threshold.
+    const __m128i values = _mm_loadu_si128((const __m128i*) scores);
+    const __m128i limit = _mm_set1_epi8((char) threshold);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(values, limit), limit)) !=
+           0xFFFF;
+#else
+    return *scores > threshold;
+#endif
+}
+
+static bool anyAboveInt8(const int8_t* scores, int8_t threshold) {
+#if defined(__ARM_NEON)
+    const uint64x2_t above =
+        vreinterpretq_u64_u8(vcgtq_s8(vld1q_s8(scores), vdupq_n_s8(threshold)));
+
+    return (vgetq_lane_u64(above, 0) | vgetq_lane_u64(above, 1)) != 0;
+#elif defined(__SSE2__)
+    const __m128i values = _mm_loadu_si128((const __m128i*) scores);
+
+    return _mm_movemask_epi8(_mm_cmpgt_epi8(values, _mm_set1_epi8(threshold))) != 0;
+#else
+    return *scores > threshold;
+#endif
+}
+
+static bool anyAboveFloat32(const float* scores, float threshold) {
+#if defined(__ARM_NEON)
+    const float32x4_t limit = vdupq_n_f32(threshold);
+    const uint64x2_t above = vreinterpretq_u64_u32(
+        vorrq_u32(vcgtq_f32(vld1q_f32(scores), limit),
+                  vcgtq_f32(vld1q_f32(scores + 4), limit)));
+
+    return (vgetq_lane_u64(above, 0) | vgetq_lane_u64(above, 1)) != 0;
+#elif defined(__SSE2__)
+    const __m128 limit = _mm_set1_ps(threshold);
+
+    return (_mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(scores), limit)) |
+            _mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(scores + 4), limit))) != 0;
+#else
+    return *scores > threshold;
+#endif
+}
+
+static bool anyAboveFloat16(const uint16_t* scores, int16_t threshold) {
+    // Same keys as loadFloat16Key, without the NaN check.
+#if defined(__ARM_NEON)
+    const int16x8_t values = vreinterpretq_s16_u16(vld1q_u16(scores));
+    const int16x8_t sign = vshrq_n_s16(values, 15);
+    const int16x8_t magnitude = vandq_s16(values, vdupq_n_s16(0x7FFF));
+    const int16x8_t keys = vsubq_s16(veorq_s16(magnitude, sign), sign);
+    const uint64x2_t above =
+        vreinterpretq_u64_u16(vcgtq_s16(keys, vdupq_n_s16(threshold)));
+
+    return (vgetq_lane_u64(above, 0) | vgetq_lane_u64(above, 1)) != 0;
+#elif defined(__SSE2__)
+    const __m128i values = _mm_loadu_si128((const __m128i*) scores);
+    const __m128i sign = _mm_srai_epi16(values, 15);
+    const __m128i magnitude = _mm_and_si128(values, _mm_set1_epi16(0x7FFF));
+    const __m128i keys =
+        _mm_sub_epi16(_mm_xor_si128(magnitude, sign), sign);
+
+    return _mm_movemask_epi8(_mm_cmpgt_epi16(keys, _mm_set1_epi16(threshold))) !=
+           0;
+#else
+    return loadFloat16Key((const uint8_t*) scores) > threshold;
+#endif
+}
+
+static uint8_t loadUint8(const uint8_t* p) {
+    return *p;
+}
+
+static int8_t loadInt8(const uint8_t* p) {
+    return (int8_t) *p;
+}
+
+static int16_t loadFloat16Key(const uint8_t* p) {
+    uint16_t half;
+    memcpy(&half, p, sizeof(half));
+    const int16_t magnitude = (int16_t) (half & 0x7FFF);
+    const int16_t key = (half & 0x8000) ? (int16_t) -magnitude : magnitude;
+
+    return magnitude > 0x7C00 ? FLOAT16_KEY_NAN : key;
+}
+
+static float float16KeyToFloat(int16_t key) {
+    const uint16_t half =
+        key < 0 ? (uint16_t) (0x8000 | -key) : (uint16_t) key;
+
+    return topkHalfToFloat(half);
+}
+
+static float loadFloat32(const uint8_t* p) {
+    float score;
+    memcpy(&score, p, sizeof(score));
+
+    return score;
+}
+
+// Keeps the best k scores seen so far in topScores/topIndices, sorted by
+// descending score. A new score only moves past strictly smaller ones, so
+// equal scores stay in the order they were seen, i.e. by ascending index.
+#define TOPK_INSERT(score, index)                                              \
+    do {                                                                       \
+        size_t pos = filled < k ? filled++ : k - 1;                            \
+        while (pos > 0 && topScores[pos - 1] < (score)) {                      \
+            topScores[pos] = topScores[pos - 1];                               \
+            topIndices[pos] = topIndices[pos - 1];                             \
+            pos--;                                                             \
+        }                                                                      \
+        topScores[pos] = (score);                                              \
+        topIndices[pos] = (index);                                             \
+    } while (0)
+
+// Body shared by all decoders, specialised by the type scores are compared
+// as, how a score is loaded, whether a score can be used at all (false for
+// NaN), the block size and test used to skip scores that cannot enter the
+// top k, and how a score is converted to a float for the results.
+#define TOPK_BODY(type, LOAD, VALID, BLOCK, ANY_ABOVE, SCORE)                  \
+    type topScores[TOPK_MAX_K];                                                \
+    size_t topIndices[TOPK_MAX_K];                                             \
+    size_t filled = 0;                                                         \
+    size_t i = 0;                                                              \
+                                                                               \
+    if (k > TOPK_MAX_K) {                                                      \
+        k = TOPK_MAX_K;                                                        \
+    }                                                                          \
+    if (k == 0) {                                                              \
+        return 0;                                                              \
+    }                                                                          \
+                                                                               \
+    for (; i < numClasses && filled < k; i++) {                                \
+        const type score = LOAD(i);                                            \
+        if (VALID(score)) {                                                    \
+            TOPK_INSERT(score, i);                                             \
+        }                                                                      \
+    }                                                                          \
+    if (filled == k) {                                                         \
+        for (; i + (BLOCK) <= numClasses; i += (BLOCK)) {                      \
+            if (!ANY_ABOVE(i, topScores[k - 1])) {                             \
+                continue;                                                      \
+            }                                                                  \
+            for (size_t j = i; j < i + (BLOCK); j++) {                         \
+                const type score = LOAD(j);                                    \
+                if (score > topScores[k - 1]) {                                \
+                    TOPK_INSERT(score, j);                                     \
+                }                                                              \
+            }                                                                  \
+        }                                                                      \
+        for (; i < numClasses; i++) {                                          \
+            const type score = LOAD(i);                                        \
+            if (score > topScores[k - 1]) {                                    \
+                TOPK_INSERT(score, i);                                         \
+            }                                                                  \
+        }                                                                      \
+    }                                                                          \
+                                                                               \
+    for (size_t j = 0; j < filled; j++) {                                      \
+        results[j].index = topIndices[j];                                      \
+        results[j].score = SCORE(topScores[j]);                                \
+    }                                                                          \
+                                                                               \
+    return filled
+
+// Scores are read from bytes, step bytes apart. The decoders below set step
+// to a constant wherever they can, so the offset is folded into the load.
+#define LOAD_UINT8(idx) loadUint8(bytes + (idx) * step)
+#define LOAD_INT8(idx) loadInt8(bytes + (idx) * step)
+#define LOAD_FLOAT16(idx) loadFloat16Key(bytes + (idx) * step)
+#define LOAD_FLOAT32(idx) loadFloat32(bytes + (idx) * step)
+#define ALWAYS_VALID(score) ((void) (score), 1)
+#define NOT_NAN(score) (!isnan(score))
+#define NOT_NAN_KEY(key) ((key) != FLOAT16_KEY_NAN)
+#define TO_FLOAT(score) ((float) (score))
+// The block tests read BLOCK consecutive scores, so they are only used when
+// the scores are densely packed.
+#define ANY_ABOVE_UINT8(idx, threshold) anyAboveUint8(bytes + (idx), threshold)
+#define ANY_ABOVE_INT8(idx, threshold)                                         \
+    anyAboveInt8((const int8_t*) (bytes + (idx)), threshold)
+#define ANY_ABOVE_FLOAT16(idx, threshold)                                      \
+    anyAboveFloat16((const uint16_t*) (bytes + (idx) * sizeof(uint16_t)),      \
+                    threshold)
+#define ANY_ABOVE_FLOAT32(idx, threshold)                                      \
+    anyAboveFloat32((const float*) (bytes + (idx) * sizeof(float)), threshold)
+#define ANY_ABOVE_ALWAYS(idx, threshold) ((void) (idx), (void) (threshold), 1)
+
+// Defines a decoder with the element type, how a score is loaded and the
+// stride fixed at compile time. STEP is either a constant or stride, the
+// latter for the generic decoders.
+#define DEFINE_DECODER(name, type, LOAD, VALID, STEP, BLOCK, ANY_ABOVE, SCORE) \
+    static size_t name(const void* output, size_t numClasses, size_t stride,   \
+                       size_t k, topkResult* results) {                        \
+        const uint8_t* bytes = output;                                         \
+        const size_t step = (STEP);                                            \
+        (void) stride;                                                         \
+        TOPK_BODY(type, LOAD, VALID, BLOCK, ANY_ABOVE, SCORE);                 \
+    }
+
+// Densely packed outputs, e.g. TensorFlow Lite models on the CPU and DLPUs.
+DEFINE_DECODER(topkUint8, uint8_t, LOAD_UINT8, ALWAYS_VALID, sizeof(uint8_t),
+               BLOCK_INT8, ANY_ABOVE_UINT8, TO_FLOAT)
+DEFINE_DECODER(topkInt8, int8_t, LOAD_INT8, ALWAYS_VALID, sizeof(int8_t),
+               BLOCK_INT8, ANY_ABOVE_INT8, TO_FLOAT)
+DEFINE_DECODER(topkFloat16, int16_t, LOAD_FLOAT16, NOT_NAN_KEY,
+               sizeof(uint16_t), BLOCK_FLOAT16, ANY_ABOVE_FLOAT16,
+               float16KeyToFloat)
+DEFINE_DECODER(topkFloat32, float, LOAD_FLOAT32, NOT_NAN, sizeof(float),
+               BLOCK_FLOAT32, ANY_ABOVE_FLOAT32, TO_FLOAT)
+
+// Outputs of the ambarella-cvflow devices. Only one score in every 32 bytes
+// is used, so there is nothing to gain from vector loads. The scalar
+// threshold test is the whole filter.
+DEFINE_DECODER(topkUint8Cvflow, uint8_t, LOAD_UINT8, ALWAYS_VALID,
+               TOPK_CVFLOW_STRIDE, 1, ANY_ABOVE_ALWAYS, TO_FLOAT)
+DEFINE_DECODER(topkInt8Cvflow, int8_t, LOAD_INT8, ALWAYS_VALID,
+               TOPK_CVFLOW_STRIDE, 1, ANY_ABOVE_ALWAYS, TO_FLOAT)
+DEFINE_DECODER(topkFloat16Cvflow, int16_t, LOAD_FLOAT16, NOT_NAN_KEY,
+               TOPK_CVFLOW_STRIDE, 1, ANY_ABOVE_ALWAYS, float16KeyToFloat)
+DEFINE_DECODER(topkFloat32Cvflow, float, LOAD_FLOAT32, NOT_NAN,
+               TOPK_CVFLOW_STRIDE, 1, ANY_ABOVE_ALWAYS, TO_FLOAT)
+
+// Any other pitch.
+DEFINE_DECODER(topkUint8Generic, uint8_t, LOAD_UINT8, ALWAYS_VALID, stride, 1,
+               ANY_ABOVE_ALWAYS, TO_FLOAT)
+DEFINE_DECODER(topkInt8Generic, int8_t, LOAD_INT8, ALWAYS_VALID, stride, 1,
+               ANY_ABOVE_ALWAYS, TO_FLOAT)
+DEFINE_DECODER(topkFloat16Generic, int16_t, LOAD_FLOAT16, NOT_NAN_KEY, stride,
+               1, ANY_ABOVE_ALWAYS, float16KeyToFloat)
+DEFINE_DECODER(topkFloat32Generic, float, LOAD_FLOAT32, NOT_NAN, stride, 1,
+               ANY_ABOVE_ALWAYS, TO_FLOAT)
+
+static const topkDecoder decoders[] = {
+    {"uint8", TOPK_TYPE_UINT8, sizeof(uint8_t), topkUint8},
+    {"int8", TOPK_TYPE_INT8, sizeof(int8_t), topkInt8},
+    {"float16", TOPK_TYPE_FLOAT16, sizeof(uint16_t), topkFloat16},
+    {"float32", TOPK_TYPE_FLOAT32, sizeof(float), topkFloat32},
+    {"uint8/32", TOPK_TYPE_UINT8, TOPK_CVFLOW_STRIDE, topkUint8Cvflow},
+    {"int8/32", TOPK_TYPE_INT8, TOPK_CVFLOW_STRIDE, topkInt8Cvflow},
+    {"float16/32", TOPK_TYPE_FLOAT16, TOPK_CVFLOW_STRIDE, topkFloat16Cvflow},
+    {"float32/32", TOPK_TYPE_FLOAT32, TOPK_CVFLOW_STRIDE, topkFloat32Cvflow},
+    {"uint8/any", TOPK_TYPE_UINT8, 0, topkUint8Generic},
+    {"int8/any", TOPK_TYPE_INT8, 0, topkInt8Generic},
+    {"float16/any", TOPK_TYPE_FLOAT16, 0, topkFloat16Generic},
+    {"float32/any", TOPK_TYPE_FLOAT32, 0, topkFloat32Generic},
+};
+
+const topkDecoder* topkFindDecoder(topkType type, size_t stride) {
+    const topkDecoder* generic = NULL;
+
+    if (stride < topkTypeSize(type)) {
+        return NULL;
+    }
+    for (size_t i = 0; i < sizeof(decoders) / sizeof(decoders[0]); i++) {
+        if (decoders[i].type != type) {
+            continue;
+        }
+        if (decoders[i].stride == stride) {
+            return &decoders[i];
+        }
+        if (decoders[i].stride == 0) {
+            generic = &decoders[i];
+        }
+    }
+
+    return generic;
+}
+
+const topkDecoder* topkGetDecoders(size_t* count) {
+    *count = sizeof(decoders) / sizeof(decoders[0]);
+
+    return decoders;
+}
+
+size_t topkTypeSize(topkType type) {
+    switch (type) {
+    case TOPK_TYPE_UINT8:
+    case TOPK_TYPE_INT8:
+        return sizeof(uint8_t);
+    case TOPK_TYPE_FLOAT16:
+        return sizeof(uint16_t);
+    case TOPK_TYPE_FLOAT32:
+        return sizeof(float);
+    }
+
+    return 1;
+}
+
+float topkHalfToFloat(uint16_t half) {
+    const uint32_t magnitude = (uint32_t) (half & 0x7FFF) << 13;
+    float value;
+
+    if ((half & 0x7C00) == 0x7C00) {
+        // Infinity or NaN. The mantissa is kept, so NaN stays NaN.
+        const uint32_t bits = magnitude | 0x7F800000;
+        memcpy(&value, &bits, sizeof(value));
+    } else {
+        // The exponent bias goes from 15 to 127, which also turns half
+        // precision subnormals into normal floats.
+        memcpy(&value, &magnitude, sizeof(value));
+        value *= 0x1p112f;
+    }
+
+    return (half & 0x8000) ? -value : value;
+}
@@ -0,0 +1,120 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file declares the top-k search over the scores of one
+ * classification output.
+ *
+ * The search is done by a decoder, picked once per model from the element
+ * type of the output and the number of bytes between two scores, as reported
+ * by larod for the output tensor. Each decoder is its own function with the
+ * type and the stride fixed at compile time, so loading a score is a single
+ * load at a constant offset. Only pitches without a specialised decoder use
+ * the generic one of the type, which takes the stride at run time.
+ *
+ * All decoders make a single pass over the scores: the current top k are kept
+ * sorted in a small array, and a score is only inserted if it beats the
+ * smallest of them. Once the array is full, almost no score does, so for
+ * densely packed outputs blocks of scores are first compared against that
+ * threshold with NEON or SSE2 and skipped as a whole when none of them is
+ * larger.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest k supported by the top-k functions.
+#define TOPK_MAX_K (16)
+
+// Space per element of the ambarella-cvflow outputs, which pad every score
+// to 32 bytes.
+#define TOPK_CVFLOW_STRIDE (32)
+
+typedef enum {
+    TOPK_TYPE_UINT8,
+    TOPK_TYPE_INT8,
+    // IEEE 754 half precision.
+    TOPK_TYPE_FLOAT16,
+    TOPK_TYPE_FLOAT32,
+} topkType;
+
+typedef struct topkResult {
+    // Class index, i.e. position of the score in the output.
+    size_t index;
+    // Score as read from the output, not scaled.
+    float score;
+} topkResult;
+
+/**
+ * brief Finds the k highest scores of an output. NaN scores are never
+ * returned.
+ *
+ * param output Start of the output.
+ * param numClasses Number of scores.
+ * param stride Bytes from one score to the next. Only read by the generic
+ * decoders, the others have it built in.
+ * param k Number of results wanted, at most TOPK_MAX_K.
+ * param results Array of at least k results, sorted by descending score on
+ * return. Equal scores are ordered by ascending index.
+ * return Number of results written, the smaller of k and numClasses.
+ */
+typedef size_t (*topkFunc)(const void* output, size_t numClasses,
+                           size_t stride, size_t k, topkResult* results);
+
+typedef struct topkDecoder {
+    // Name used in logs and the benchmark, e.g. "float32/32".
+    const char* name;
+    topkType type;
+    // Bytes from one score to the next, 0 for the generic decoder of a type.
+    size_t stride;
+    topkFunc run;
+} topkDecoder;
+
+/**
+ * brief Finds the decoder for an output.
+ *
+ * param type Element type of the output.
+ * param stride Bytes from one score to the next.
+ * return The decoder specialised for type and stride if there is one, else
+ * the generic decoder of the type. NULL if stride is smaller than a score.
+ */
+const topkDecoder* topkFindDecoder(topkType type, size_t stride);
+
+/**
+ * brief Lists all decoders, e.g. to benchmark them.
+ *
+ * param count Pointer to the number of decoders, set on return.
+ * return Array of count decoders.
+ */
+const topkDecoder* topkGetDecoders(size_t* count);
+
+/**
+ * brief Returns the size in bytes of one element of a type.
+ *
+ * param type Element type.
+ * return Size of one score.
+ */
+size_t topkTypeSize(topkType type);
+
+/**
+ * brief Converts a half precision float to a float.
+ *
+ * param half Bits of the half precision value.
+ * return The same value as a float, including infinities and NaN.
+ */
+float topkHalfToFloat(uint16_t half);
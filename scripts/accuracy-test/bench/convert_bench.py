@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+
+# Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0>
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Benchmark of convert/larod_convert against larod_convert.py.
+#
+# Writes a fixed set of JPEG images of varied sizes, packs them with both
+# converters and compares the time taken and the packed datasets. The
+# headers and indexes must be equal and no pixel may differ by more than one
+# step. Options after "--" are passed to both converters, e.g. "-- -p -f".
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+import time
+import cv2
+import numpy as np
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+PYTHON_CONVERT = os.path.join(SCRIPT_DIR, '..', 'larod_convert.py')
+NATIVE_CONVERT = os.path.join(SCRIPT_DIR, '..', 'convert', 'larod_convert')
+# Same layout as DATASET_HEADER in larod_convert.py.
+HEADER_BYTES = 96
+INDEX_ENTRY_BYTES = 16
+def write_images(directory, count, seed):
+    """Write count JPEG images made of gradients and noise"""
+    rng = np.random.default_rng(seed)
+    for i in range(count):
+        height = int(rng.integers(120, 900))
+        width = int(rng.integers(120, 900))
+        y_grid, x_grid = np.mgrid[0:height, 0:width].astype(np.float32)
+        img = np.empty((height, width, 3), dtype=np.float32)
+        for channel in range(3):
+            fx, fy, phase = rng.uniform(0.002, 0.05, 2).tolist() + [
+                float(rng.uniform(0, 6.3))]
+            img[:, :, channel] = 128 + 100 * np.sin(x_grid * fx +
+                                                    y_grid * fy + phase)
+        img += rng.normal(0, 12, img.shape)
+        img = np.clip(img, 0, 255).astype(np.uint8)
+        if i % 10 == 9:
+            img = cv2.cvtColor(cv2.cvtColor(img, cv2.COLOR_BGR2GRAY),
+                               cv2.COLOR_GRAY2BGR)
+        cv2.imwrite(os.path.join(directory, '{}.JPEG'.format(i + 1)), img,
+                    [cv2.IMWRITE_JPEG_QUALITY, int(rng.integers(60, 96))])
+def run(command):
+    """Run a converter and return the wall time in seconds"""
+    start = time.monotonic()
+    subprocess.run(command, check=True, stdout=subprocess.DEVNULL)
+    return time.monotonic() - start
+def compare(python_file, native_file, to_float):
+    """Compare two packed datasets, return the largest difference of a value
+    or None if the layouts differ"""
+    with open(python_file, 'rb') as f:
+        python_data = f.read()
+    with open(native_file, 'rb') as f:
+        native_data = f.read()
+    header = np.frombuffer(python_data, dtype='<u4', count=12)
+    count = int(header[10])
+    fields = np.frombuffer(python_data, dtype='<u8', count=6, offset=48)
+    image_bytes = int(fields[0])
+    if python_data[:HEADER_BYTES] != native_data[:HEADER_BYTES]:
+        print("Headers differ")
+        return None
+    index_end = HEADER_BYTES + count * INDEX_ENTRY_BYTES
+    if python_data[HEADER_BYTES:index_end] != native_data[HEADER_BYTES:index_end]:
+        print("Indexes differ")
+        return None
+    labels = slice(int(fields[4]), int(fields[4]) + int(fields[5]))
+    if python_data[labels] != native_data[labels]:
+        print("Labels differ")
+        return None
+    dtype = np.float32 if to_float else np.uint8
+    max_diff = 0.0
+    identical = 0
+    total = 0
+    for entry in range(count):
+        offset = int(np.frombuffer(python_data, dtype='<u8', count=1,
+                                   offset=HEADER_BYTES +
+                                   entry * INDEX_ENTRY_BYTES)[0])
+        expected = np.frombuffer(python_data, dtype=dtype,
+                                 count=image_bytes // np.dtype(dtype).itemsize,
+                                 offset=offset).astype(np.float64)
+        actual = np.frombuffer(native_data, dtype=dtype,
+                               count=image_bytes // np.dtype(dtype).itemsize,
+                               offset=offset).astype(np.float64)
+        diff = np.abs(expected - actual)
+        max_diff = max(max_diff, float(diff.max()))
+        identical += int(np.count_nonzero(diff == 0))
+        total += diff.size
+    print("Images compared: {}".format(count))
+    print("Identical values: {:.4%}".format(identical / max(total, 1)))
+    print("Largest difference: {}".format(max_diff))
+    return max_diff
+def main():
+    """Run the benchmark"""
+    parser = argparse.ArgumentParser(description="Compare the native image "
+                                     "converter with larod_convert.py.")
+    parser.add_argument("--images", type=int, default=200,
+                        help="Number of images to convert. Default is 200.")
+    parser.add_argument("--seed", type=int, default=1,
+                        help="Seed of the generated images. Default is 1.")
+    parser.add_argument("--size", type=int, default=224,
+                        help="Width and height to resize to. Default is 224.")
+    parser.add_argument("--threads", type=int, default=0,
+                        help="Threads of the native converter. Default is "
+                        "the number of online CPUs.")
+    parser.add_argument("options", nargs='*',
+                        help="Options passed to both converters.")
+    args = parser.parse_args()
+    if not os.path.exists(NATIVE_CONVERT):
+        sys.exit("ERROR: Build {} first".format(NATIVE_CONVERT))
+    with tempfile.TemporaryDirectory() as work_dir:
+        image_dir = os.path.join(work_dir, 'images')
+        os.mkdir(image_dir)
+        write_images(image_dir, args.images, args.seed)
+        python_file = os.path.join(work_dir, 'python.axds')
+        native_file = os.path.join(work_dir, 'native.axds')
+        common = [str(args.size), str(args.size), image_dir] + args.options
+        python_time = run([sys.executable, PYTHON_CONVERT] + common +
+                          ['-k', python_file])
+        native = [NATIVE_CONVERT] + common + ['-k', native_file]
+        if args.threads:
+            native += ['-j', str(args.threads)]
+        native_time = run(native)
+        single_time = run([NATIVE_CONVERT] + common +
+                          ['-k', native_file, '-j', '1'])
+        print("larod_convert.py:          {:8.3f} s {:8.1f} images/s".format(
+            python_time, args.images / python_time))
+        print("larod_convert, 1 thread:   {:8.3f} s {:8.1f} images/s".format(
+            single_time, args.images / single_time))
+        print("larod_convert, all threads:{:8.3f} s {:8.1f} images/s".format(
+            native_time, args.images / native_time))
+        to_float = '-f' in args.options or '--float' in args.options
+        max_diff = compare(python_file, native_file, to_float)
+    if max_diff is None:
+        sys.exit(1)
+    # One step is 1 for bytes and 1 / px-division for floats.
+    if not to_float and max_diff > 1:
+        sys.exit("ERROR: Pixels differ by more than one step")
+if __name__ == '__main__':
+    main()
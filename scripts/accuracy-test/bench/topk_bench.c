@@ -0,0 +1,466 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * Micro-benchmark of the top-k decoders used by accuracy_measure.
+ *
+ * Runs every decoder in topk.c on 1001 and 1000 class outputs of its element
+ * type and stride. The generic decoders are run with a pitch that has no
+ * specialised decoder. The uint8 and CV25 decoders are also compared with
+ * the partial selection sort that accuracy_measure used before, reproduced as
+ * it was, i.e. on the CV25 layout it scans one entry per output byte. Every
+ * result is checked against a full scan of the same output.
+ *
+ * Usage: ./topk_bench [ROUNDS]
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "topk.h"
+
+// Number of different outputs each case is run on.
+#define NUM_OUTPUTS (256)
+#define DEFAULT_ROUNDS (20)
+#define K (5)
+// Stride the generic decoders are run with.
+#define GENERIC_STRIDE (12)
+#define MAX_CASES (64)
+
+typedef struct benchCase {
+    char name[32];
+    const topkDecoder* decoder;
+    // Bytes from one score to the next.
+    size_t stride;
+    size_t numClasses;
+    // True for outputs drawn uniformly, false for softmax shaped outputs.
+    bool uniform;
+} benchCase;
+
+/**
+ * brief Returns the time of the monotonic clock in nanoseconds.
+ *
+ * return Current time in nanoseconds.
+ */
+static uint64_t getTimeNs(void);
+
+/**
+ * brief Returns a pseudo random number, reproducible between runs.
+ *
+ * param state State of the generator, updated on return.
+ * return Random 32-bit number.
+ */
+static uint32_t nextRandom(uint64_t* state);
+
+/**
+ * brief Converts a float in [0, 1) to half precision, rounding down.
+ *
+ * Values below the smallest normal half precision number become 0.
+ *
+ * param value The value.
+ * return Bits of the half precision value.
+ */
+static uint16_t floatToHalf(float value);
+
+/**
+ * brief Checks topkHalfToFloat on values with a known conversion.
+ *
+ * return False if any value is converted wrongly.
+ */
+static bool checkHalfToFloat(void);
+
+/**
+ * brief Adds the cases of one decoder.
+ *
+ * param decoder The decoder.
+ * param cases Array of MAX_CASES cases.
+ * param numCases Number of cases in the array, updated on return.
+ */
+static void addCases(const topkDecoder* decoder, benchCase* cases,
+                     size_t* numCases);
+
+/**
+ * brief Fills one output with scores of the type and stride of a case.
+ *
+ * Softmax shaped outputs have a few high scores and the rest close to zero,
+ * which is what a classifier normally produces.
+ *
+ * param bc The case.
+ * param output Buffer of numClasses * stride bytes.
+ * param state Random generator state.
+ */
+static void fillOutput(const benchCase* bc, uint8_t* output, uint64_t* state);
+
+/**
+ * brief Reads the score of one class as a double, whatever the type.
+ *
+ * param bc The case.
+ * param output Start of the output.
+ * param idx Class index.
+ * return The score.
+ */
+static double readScore(const benchCase* bc, const uint8_t* output, size_t idx);
+
+/**
+ * brief Finds the top K scores the way accuracy_measure did before.
+ *
+ * This is the partial selection sort, including the int truncation of swapped
+ * CV25 scores and the scan of outputBytes entries on the CV25 layout.
+ *
+ * param cv25 True for the CV25 layout, false for uint8 scores.
+ * param output Start of the output.
+ * param outputBytes Size in bytes of the output.
+ * param scratch Scratch space of at least 3 * outputBytes ints.
+ * param indices Array of K indices, set on return.
+ */
+static void selectionSortTopk(bool cv25, const uint8_t* output,
+                              size_t outputBytes, int* scratch, int* indices);
+
+/**
+ * brief Checks a top-k result against a full scan of the output.
+ *
+ * param bc The case.
+ * param output Start of the output.
+ * param results Results from the decoder.
+ * param numResults Number of results.
+ * return False if the results are not the k highest scores in order.
+ */
+static bool checkResults(const benchCase* bc, const uint8_t* output,
+                         const topkResult* results, size_t numResults);
+
+static uint64_t getTimeNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static uint32_t nextRandom(uint64_t* state) {
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+
+    return (uint32_t) (*state >> 33);
+}
+
+static uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const int32_t exponent = (int32_t) ((bits >> 23) & 0xFF) - 127 + 15;
+    if (exponent <= 0) {
+        return 0;
+    }
+
+    return (uint16_t) (((uint32_t) exponent << 10) | ((bits >> 13) & 0x3FF));
+}
+
+static bool checkHalfToFloat(void) {
+    const struct {
+        uint16_t half;
+        float value;
+    } known[] = {
+        {0x0000, 0.0f},         {0x3C00, 1.0f},       {0xC000, -2.0f},
+        {0x3555, 0.333251953f}, {0x7BFF, 65504.0f},   {0x0400, 6.10351562e-5f},
+        {0x0001, 5.96046448e-8f}, {0x83FF, -6.09755516e-5f},
+    };
+
+    for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); i++) {
+        const float value = topkHalfToFloat(known[i].half);
+        if (value < known[i].value || value > known[i].value) {
+            fprintf(stderr, "Half 0x%04x converted to %g, expected %g\n",
+                    known[i].half, (double) value, (double) known[i].value);
+            return false;
+        }
+    }
+    const float inf = topkHalfToFloat(0xFC00);
+    const float nan = topkHalfToFloat(0x7E00);
+    if (!isinf(inf) || inf > 0.0f || !isnan(nan)) {
+        fprintf(stderr, "Half infinity or NaN converted wrongly\n");
+        return false;
+    }
+
+    return true;
+}
+
+static void addCases(const topkDecoder* decoder, benchCase* cases,
+                     size_t* numCases) {
+    const size_t classCounts[] = {1001, 1000};
+    const size_t stride = decoder->stride ? decoder->stride : GENERIC_STRIDE;
+
+    for (size_t c = 0; c < 2 && *numCases < MAX_CASES; c++) {
+        benchCase* bc = &cases[(*numCases)++];
+        snprintf(bc->name, sizeof(bc->name), "%s %zu", decoder->name,
+                 classCounts[c]);
+        bc->decoder = decoder;
+        bc->stride = stride;
+        bc->numClasses = classCounts[c];
+        bc->uniform = false;
+    }
+    if (decoder->type == TOPK_TYPE_UINT8 && decoder->stride == 1 &&
+        *numCases < MAX_CASES) {
+        benchCase* bc = &cases[(*numCases)++];
+        *bc = cases[*numCases - 3];
+        snprintf(bc->name, sizeof(bc->name), "%s 1001 uniform", decoder->name);
+        bc->uniform = true;
+    }
+}
+
+static void fillOutput(const benchCase* bc, uint8_t* output, uint64_t* state) {
+    memset(output, 0, bc->numClasses * bc->stride);
+
+    for (size_t i = 0; i < bc->numClasses; i++) {
+        const uint32_t r = nextRandom(state);
+        // Probability in [0, 1).
+        double p = (double) (r & 0xFFFF) / 65536.0;
+        if (!bc->uniform) {
+            // Mostly tiny values, now and then a larger one.
+            p = (r >> 16) % 64 == 0 ? p : p * p * p * 0.02;
+        }
+        uint8_t* dst = output + i * bc->stride;
+        switch (bc->decoder->type) {
+        case TOPK_TYPE_UINT8:
+            *dst = (uint8_t) (p * 255.0);
+            break;
+        case TOPK_TYPE_INT8: {
+            const int8_t value = (int8_t) (p * 255.0 - 128.0);
+            memcpy(dst, &value, sizeof(value));
+            break;
+        }
+        case TOPK_TYPE_FLOAT16: {
+            const uint16_t value = floatToHalf((float) p);
+            memcpy(dst, &value, sizeof(value));
+            break;
+        }
+        case TOPK_TYPE_FLOAT32: {
+            const float value = (float) p;
+            memcpy(dst, &value, sizeof(value));
+            break;
+        }
+        }
+    }
+}
+
+static double readScore(const benchCase* bc, const uint8_t* output, size_t idx) {
+    const uint8_t* p = output + idx * bc->stride;
+
+    switch (bc->decoder->type) {
+    case TOPK_TYPE_UINT8:
+        return *p;
+    case TOPK_TYPE_INT8:
+        return (int8_t) *p;
+    case TOPK_TYPE_FLOAT16: {
+        uint16_t half;
+        memcpy(&half, p, sizeof(half));
+        const float value = topkHalfToFloat(half);
+        return value;
+    }
+    case TOPK_TYPE_FLOAT32: {
+        float value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+    }
+
+    return 0.0;
+}
+
+static void selectionSortTopk(bool cv25, const uint8_t* output,
+                              size_t outputBytes, int* scratch, int* indices) {
+    const int scoreArraySize = (int) outputBytes;
+    int* scoreArray = scratch;
+    float* scoreArrayCv25 = (float*) (scratch + outputBytes);
+    int* scoreArrayIndices = scratch + 2 * outputBytes;
+    int l, m;
+    int max, temp;
+
+    if (cv25) {
+        for (size_t j = 0; j < outputBytes / TOPK_CVFLOW_STRIDE; j++) {
+            memcpy(&scoreArrayCv25[j], output + j * TOPK_CVFLOW_STRIDE,
+                   sizeof(float));
+            scoreArrayIndices[j] = (int) j;
+        }
+        for (l = 0; l < K; l++) {
+            max = l;
+            for (m = l + 1; m < scoreArraySize; m++) {
+                if (scoreArrayCv25[m] > scoreArrayCv25[max]) {
+                    max = m;
+                }
+            }
+            temp = (int) scoreArrayCv25[l];
+            scoreArrayCv25[l] = scoreArrayCv25[max];
+            scoreArrayCv25[max] = (float) temp;
+            temp = scoreArrayIndices[l];
+            scoreArrayIndices[l] = scoreArrayIndices[max];
+            scoreArrayIndices[max] = temp;
+        }
+    } else {
+        for (size_t j = 0; j < outputBytes; j++) {
+            scoreArray[j] = output[j];
+            scoreArrayIndices[j] = (int) j;
+        }
+        for (l = 0; l < K; l++) {
+            max = l;
+            for (m = l + 1; m < scoreArraySize; m++) {
+                if (scoreArray[m] > scoreArray[max]) {
+                    max = m;
+                }
+            }
+            temp = scoreArray[l];
+            scoreArray[l] = scoreArray[max];
+            scoreArray[max] = temp;
+            temp = scoreArrayIndices[l];
+            scoreArrayIndices[l] = scoreArrayIndices[max];
+            scoreArrayIndices[max] = temp;
+        }
+    }
+
+    for (l = 0; l < K; l++) {
+        indices[l] = scoreArrayIndices[l];
+    }
+}
+
+static bool checkResults(const benchCase* bc, const uint8_t* output,
+                         const topkResult* results, size_t numResults) {
+    const size_t numClasses = bc->numClasses;
+
+    if (numResults != (numClasses < K ? numClasses : K)) {
+        return false;
+    }
+    for (size_t r = 0; r < numResults; r++) {
+        const double score = readScore(bc, output, results[r].index);
+        if (score > results[r].score || score < results[r].score) {
+            return false;
+        }
+        if (r > 0 && (results[r].score > results[r - 1].score ||
+                      (!(results[r].score < results[r - 1].score) &&
+                       results[r].index < results[r - 1].index))) {
+            return false;
+        }
+    }
+    // Nothing outside of the results may beat the last one, and an equal
+    // score may only be left out if it comes later in the output.
+    const topkResult* last = &results[numResults - 1];
+    for (size_t i = 0; i < numClasses; i++) {
+        bool listed = false;
+        for (size_t r = 0; r < numResults; r++) {
+            listed = listed || results[r].index == i;
+        }
+        const double score = readScore(bc, output, i);
+        if (!listed && (score > last->score ||
+                        (!(score < last->score) && i < last->index))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv) {
+    benchCase cases[MAX_CASES];
+    size_t numCases = 0;
+    size_t numDecoders = 0;
+    const topkDecoder* decoders = topkGetDecoders(&numDecoders);
+    for (size_t d = 0; d < numDecoders; d++) {
+        addCases(&decoders[d], cases, &numCases);
+    }
+
+    const int rounds = argc > 1 ? atoi(argv[1]) : DEFAULT_ROUNDS;
+    if (rounds <= 0) {
+        fprintf(stderr, "Usage: %s [ROUNDS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    bool ok = checkHalfToFloat();
+    volatile size_t sink = 0;
+    printf("%-20s %14s %14s %9s\n", "case", "selection ns", "topk ns",
+           "speedup");
+
+    for (size_t c = 0; c < numCases; c++) {
+        const benchCase* bc = &cases[c];
+        const topkDecoder* decoder = bc->decoder;
+        const size_t outputBytes = bc->numClasses * bc->stride;
+        uint8_t* outputs = malloc(NUM_OUTPUTS * outputBytes);
+        int* scratch = calloc(3 * outputBytes, sizeof(int));
+        if (!outputs || !scratch) {
+            fprintf(stderr, "Out of memory\n");
+            return EXIT_FAILURE;
+        }
+        uint64_t state = 0x5eed + c;
+        for (size_t o = 0; o < NUM_OUTPUTS; o++) {
+            fillOutput(bc, outputs + o * outputBytes, &state);
+        }
+
+        topkResult results[K];
+        for (size_t o = 0; o < NUM_OUTPUTS; o++) {
+            const uint8_t* output = outputs + o * outputBytes;
+            const size_t n =
+                decoder->run(output, bc->numClasses, bc->stride, K, results);
+            if (!checkResults(bc, output, results, n)) {
+                fprintf(stderr, "%s: wrong result for output %zu\n", bc->name, o);
+                ok = false;
+                break;
+            }
+        }
+
+        // The selection sort only ever handled uint8 and the CV25 layout.
+        const bool isCv25 = decoder->type == TOPK_TYPE_FLOAT32 &&
+                            decoder->stride == TOPK_CVFLOW_STRIDE;
+        const bool hasReference =
+            isCv25 || (decoder->type == TOPK_TYPE_UINT8 && decoder->stride == 1);
+        uint64_t referenceNs = 0;
+        if (hasReference) {
+            int indices[K];
+            const uint64_t start = getTimeNs();
+            for (int r = 0; r < rounds; r++) {
+                for (size_t o = 0; o < NUM_OUTPUTS; o++) {
+                    selectionSortTopk(isCv25, outputs + o * outputBytes,
+                                      outputBytes, scratch, indices);
+                    sink += (size_t) indices[0];
+                }
+            }
+            referenceNs = getTimeNs() - start;
+        }
+
+        const uint64_t start = getTimeNs();
+        for (int r = 0; r < rounds; r++) {
+            for (size_t o = 0; o < NUM_OUTPUTS; o++) {
+                decoder->run(outputs + o * outputBytes, bc->numClasses,
+                             bc->stride, K, results);
+                sink += results[0].index;
+            }
+        }
+        const uint64_t topkNs = getTimeNs() - start;
+
+        const double calls = (double) rounds * NUM_OUTPUTS;
+        if (hasReference) {
+            printf("%-20s %14.0f %14.0f %8.1fx\n", bc->name,
+                   (double) referenceNs / calls, (double) topkNs / calls,
+                   (double) referenceNs / (double) topkNs);
+        } else {
+            printf("%-20s %14s %14.0f %9s\n", bc->name, "-",
+                   (double) topkNs / calls, "-");
+        }
+
+        free(scratch);
+        free(outputs);
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+
+# Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0>
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Conversion of COCO detection annotations to the ground truth read by
+# accuracy_measure with --detect.
+
+import argparse
+import json
+import os
+import shutil
+import sys
+
+
+def clip(value):
+    return min(max(value, 0.0), 1.0)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Writes the boxes of a COCO annotation file as ground "
+                    "truth for accuracy_measure --detect.")
+    parser.add_argument("annotations", metavar="ANNOTATIONS",
+                        help="COCO annotation file, e.g. "
+                             "instances_val2017.json.")
+    parser.add_argument("output", metavar="OUTPUT",
+                        help="Ground truth file to write.")
+    parser.add_argument("--category-ids", action="store_true",
+                        help="Number the classes by category id minus one, "
+                             "as the TensorFlow SSD models do, instead of "
+                             "in the order of the category ids.")
+    parser.add_argument("--images", metavar="DIR",
+                        help="Directory of the images in the annotation file. "
+                             "If given, the images are copied to "
+                             "--image-output, named by their ids.")
+    parser.add_argument("--image-output", metavar="DIR", default="coco",
+                        help="Directory to copy the images to, by default "
+                             "coco.")
+    args = parser.parse_args()
+
+    with open(args.annotations, encoding="utf-8") as file:
+        coco = json.load(file)
+
+    # Models exported by Ultralytics number the classes in the order of the
+    # category ids, which are not contiguous.
+    classes = {category["id"]: index for index, category in
+               enumerate(sorted(coco["categories"], key=lambda c: c["id"]))}
+    if args.category_ids:
+        classes = {category["id"]: category["id"] - 1
+                   for category in coco["categories"]}
+    images = {image["id"]: image for image in coco["images"]}
+    boxes = {image_id: [] for image_id in images}
+    for annotation in coco["annotations"]:
+        boxes[annotation["image_id"]].append(annotation)
+
+    with open(args.output, "w", encoding="utf-8") as file:
+        file.write("# image class x1 y1 x2 y2 [crowd]\n")
+        for image_id in sorted(images):
+            image = images[image_id]
+            width = image["width"]
+            height = image["height"]
+            if not boxes[image_id]:
+                file.write(f"{image_id}\n")
+            for annotation in boxes[image_id]:
+                x, y, w, h = annotation["bbox"]
+                file.write(f"{image_id} {classes[annotation['category_id']]}"
+                           f" {clip(x / width):.6f} {clip(y / height):.6f}"
+                           f" {clip((x + w) / width):.6f}"
+                           f" {clip((y + h) / height):.6f}"
+                           f" {annotation.get('iscrowd', 0)}\n")
+
+    print(f"Wrote {sum(len(b) for b in boxes.values())} boxes of "
+          f"{len(images)} images and {len(classes)} classes to {args.output}")
+
+    if args.images is None:
+        return
+    os.makedirs(args.image_output, exist_ok=True)
+    for image_id in sorted(images):
+        source = os.path.join(args.images, images[image_id]["file_name"])
+        if not os.path.isfile(source):
+            print(f"Warning: {source} not found", file=sys.stderr)
+            continue
+        shutil.copyfile(source,
+                        os.path.join(args.image_output, f"{image_id}.JPEG"))
+
+
+if __name__ == "__main__":
+    main()
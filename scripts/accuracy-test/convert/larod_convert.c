@@ -0,0 +1,1083 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * This file implements a native version of larod_convert.py.
+ *
+ * Images are decoded with libjpeg, resized with the same bilinear filter as
+ * OpenCV (see resize.h) and written as raw RGB bytes or floats, either one
+ * .bin file per image or all of them into one packed dataset (see
+ * ../app/dataset.h). The images are spread over a pool of threads, each
+ * with its own scratch buffers, and every image is written with a single
+ * write of the whole padded image.
+ */
+
+#include <argp.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <jpeglib.h>
+
+#include "dataset.h"
+#include "resize.h"
+
+#define KEY_PACK_ALIGNMENT (128)
+
+// Upper bound for the number of threads.
+#define MAX_THREADS (256)
+
+typedef struct convertArgs {
+    unsigned int height;
+    unsigned int width;
+    const char* imagesDir;
+    const char* outputDir;
+    const char* packFile;
+    const char* labelsFile;
+    const char* groundTruthFile;
+    bool separatePlanes;
+    bool toFloat;
+    float pxDiv;
+    float pxSub;
+    size_t alignment;
+    size_t pitch;
+    size_t packAlignment;
+    size_t threads;
+} convertArgs;
+
+typedef struct imageFile {
+    char* name;
+    // Length of the name without the extension.
+    size_t stemLen;
+    bool numeric;
+    unsigned long long number;
+} imageFile;
+
+typedef struct convertJob {
+    const convertArgs* args;
+    imageFile* files;
+    size_t numFiles;
+    // Bytes of pixel data in a row and bytes between two rows.
+    size_t widthBytes;
+    size_t rowBytes;
+    size_t imageBytes;
+    // Value written for each 8-bit pixel value when converting to float.
+    float floatTable[256];
+    int packFd;
+    uint64_t dataOffset;
+    uint64_t imageStride;
+    // True for every image that was converted.
+    bool* converted;
+    atomic_size_t next;
+    atomic_bool failed;
+} convertJob;
+
+typedef struct worker {
+    convertJob* job;
+    pthread_t thread;
+    resizer* resize;
+    uint8_t* fileData;
+    size_t fileCap;
+    uint8_t* decoded;
+    size_t decodedCap;
+    uint8_t* resized;
+    uint8_t* image;
+} worker;
+
+typedef struct jpegError {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+} jpegError;
+
+static int parseOpt(int key, char* arg, struct argp_state* state);
+static int parseSize(const char* arg, size_t* value, size_t limit,
+                     bool allowZero);
+static int parseFloat(const char* arg, float* value, bool allowNegative);
+
+/**
+ * brief Orders image files by their numeric name, then by name.
+ *
+ * param a First imageFile.
+ * param b Second imageFile.
+ * return Negative, zero or positive like strcmp.
+ */
+static int compareFiles(const void* a, const void* b);
+
+/**
+ * brief Lists the files of the image directory in conversion order.
+ *
+ * param dir Path to the directory.
+ * param filesPtr Pointer to the allocated list.
+ * param numFiles Pointer to the number of files.
+ * return False if any errors occur, otherwise true.
+ */
+static bool listImages(const char* dir, imageFile** filesPtr, size_t* numFiles);
+
+/**
+ * brief Reads a whole file into a buffer.
+ *
+ * param path Path to the file.
+ * param buf Pointer to the buffer, grown as needed.
+ * param cap Pointer to the size of the buffer.
+ * param size Pointer to the size of the file.
+ * return False if any errors occur, otherwise true.
+ */
+static bool readFile(const char* path, uint8_t** buf, size_t* cap,
+                     size_t* size);
+
+/**
+ * brief Reads the annotations file, one class per non-empty row.
+ *
+ * param path Path to the file.
+ * param classesPtr Pointer to the allocated classes.
+ * param numClasses Pointer to the number of classes read.
+ * return False if any errors occur, otherwise true.
+ */
+static bool readGroundTruth(const char* path, int32_t** classesPtr,
+                            size_t* numClasses);
+
+/**
+ * brief Writes a whole buffer, retrying short writes.
+ *
+ * param fd File to write to.
+ * param buf Data to write.
+ * param size Number of bytes to write.
+ * param offset Offset in the file, or -1 to write at the file position.
+ * return False if any errors occur, otherwise true.
+ */
+static bool writeAll(int fd, const void* buf, size_t size, off_t offset);
+
+/**
+ * brief libjpeg error handler, returns to decodeJpeg.
+ *
+ * param cinfo The decompressor.
+ */
+static void jpegErrorExit(j_common_ptr cinfo);
+
+/**
+ * brief Decodes a JPEG image into interleaved RGB.
+ *
+ * CMYK images are converted the same way as by OpenCV.
+ *
+ * param w The worker, whose decoded buffer receives the pixels.
+ * param data The JPEG file.
+ * param size Size of the file.
+ * param width Pointer to the width of the image.
+ * param height Pointer to the height of the image.
+ * return False if the image could not be decoded, otherwise true.
+ */
+static bool decodeJpeg(worker* w, const uint8_t* data, size_t size,
+                       size_t* width, size_t* height);
+
+/**
+ * brief Lays out a resized RGB image as planes or interleaved rows.
+ *
+ * Padding at the end of the rows is left as it is, i.e. zero.
+ *
+ * param job The conversion.
+ * param rgb Resized interleaved RGB pixels.
+ * param image Destination of job->imageBytes bytes.
+ */
+static void storeImage(const convertJob* job, const uint8_t* rgb,
+                       uint8_t* image);
+
+/**
+ * brief Converts one image and writes it to its place.
+ *
+ * param w The worker.
+ * param idx Position of the image in the file list.
+ * return False if the output could not be written, otherwise true. Images
+ * that cannot be read only cause a warning.
+ */
+static bool convertImage(worker* w, size_t idx);
+
+/**
+ * brief Converts images until there are none left.
+ *
+ * param arg The worker.
+ * return NULL.
+ */
+static void* workerRun(void* arg);
+
+/**
+ * brief Writes the header, index and labels of a packed dataset.
+ *
+ * param job The conversion, with all images written.
+ * param labels Labels text, or NULL.
+ * param labelsLen Length of the labels text.
+ * param labelsOffset Offset of the labels text in the file.
+ * param groundTruth Class of each image number, or NULL.
+ * param numGroundTruth Number of classes in groundTruth.
+ * param count Pointer to the number of images packed.
+ * return False if any errors occur, otherwise true.
+ */
+static bool finishPack(const convertJob* job, const char* labels,
+                       size_t labelsLen, uint64_t labelsOffset,
+                       const int32_t* groundTruth, size_t numGroundTruth,
+                       size_t* count);
+
+static const struct argp_option opts[] = {
+    {"separate-planes", 'p', NULL, 0,
+     "Create separated color planes. Default is interleaved RGB colors.", 0},
+    {"float", 'f', NULL, 0, "Convert pixel values to float (32-bit).", 0},
+    {"px-division", 's', "S", 0,
+     "Divide the pixel values with S when converting to float (see option "
+     "\"--float\"). Default is 1, i.e. no division.",
+     0},
+    {"px-subtraction", 'm', "M", 0,
+     "Subtract M from the pixel values when converting to float (see option "
+     "\"--float\"). M may be negative to add to the values. Default is 0, "
+     "i.e. no subtraction.",
+     0},
+    {"alignment", 'a', "A", 0,
+     "Row alignment in bytes. Rows will be padded to a multiple of the "
+     "alignment. Not to be used when pitch is used.",
+     0},
+    {"pitch", 'w', "P", 0,
+     "Row pitch in bytes. Rows will be padded to match the pitch. Not to be "
+     "used when alignment is used.",
+     0},
+    {"pack", 'k', "FILE", 0,
+     "Write all images into a single packed dataset FILE instead of one .bin "
+     "file per image. Images are stored in the order of their numeric file "
+     "names.",
+     0},
+    {"labels", 'l', "FILE", 0,
+     "Labels file to embed in the packed dataset (see option \"--pack\").", 0},
+    {"ground-truth", 'g', "FILE", 0,
+     "Annotations file to embed in the packed dataset (see option "
+     "\"--pack\"). Row N holds the class of image N.",
+     0},
+    {"pack-alignment", KEY_PACK_ALIGNMENT, "A", 0,
+     "Alignment in bytes of each image in the packed dataset. Must be a "
+     "multiple of the page size of the device. Default is 4096.",
+     0},
+    {"output-dir", 'o', "DIR", 0,
+     "Directory to write one .bin file per image to when not packing. "
+     "Default is output.",
+     0},
+    {"threads", 'j', "N", 0,
+     "Number of images converted at the same time. Default is the number of "
+     "online CPUs.",
+     0},
+    {0}};
+
+static const struct argp argp = {
+    opts, parseOpt, "HEIGHT WIDTH IMAGES",
+    "Reads the JPEG images in the directory IMAGES, resizes them to WIDTH x "
+    "HEIGHT and writes them as raw RGB bytes. Produces the same output as "
+    "larod_convert.py.",
+    NULL, NULL, NULL};
+
+static int parseOpt(int key, char* arg, struct argp_state* state) {
+    convertArgs* args = state->input;
+    int ret = 0;
+
+    switch (key) {
+    case 'p':
+        args->separatePlanes = true;
+        break;
+    case 'f':
+        args->toFloat = true;
+        break;
+    case 's':
+        ret = parseFloat(arg, &args->pxDiv, false);
+        if (ret || args->pxDiv <= 0.0f) {
+            argp_failure(state, EXIT_FAILURE, ret ? ret : EINVAL,
+                         "invalid pixel division");
+        }
+        break;
+    case 'm':
+        ret = parseFloat(arg, &args->pxSub, true);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid pixel subtraction");
+        }
+        break;
+    case 'a':
+        ret = parseSize(arg, &args->alignment, UINT32_MAX, true);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid alignment");
+        }
+        break;
+    case 'w':
+        ret = parseSize(arg, &args->pitch, UINT32_MAX, true);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid pitch");
+        }
+        break;
+    case 'k':
+        args->packFile = arg;
+        break;
+    case 'l':
+        args->labelsFile = arg;
+        break;
+    case 'g':
+        args->groundTruthFile = arg;
+        break;
+    case KEY_PACK_ALIGNMENT:
+        ret = parseSize(arg, &args->packAlignment, UINT32_MAX, false);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid pack alignment");
+        }
+        break;
+    case 'o':
+        args->outputDir = arg;
+        break;
+    case 'j':
+        ret = parseSize(arg, &args->threads, MAX_THREADS, false);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid number of threads");
+        }
+        break;
+    case ARGP_KEY_ARG: {
+        size_t size;
+        if (state->arg_num == 0 || state->arg_num == 1) {
+            ret = parseSize(arg, &size, JPEG_MAX_DIMENSION, false);
+            if (ret) {
+                argp_failure(state, EXIT_FAILURE, ret, "invalid %s",
+                             state->arg_num == 0 ? "height" : "width");
+            }
+            if (state->arg_num == 0) {
+                args->height = (unsigned int) size;
+            } else {
+                args->width = (unsigned int) size;
+            }
+        } else if (state->arg_num == 2) {
+            args->imagesDir = arg;
+        } else {
+            argp_error(state, "Too many arguments given");
+        }
+        break;
+    }
+    case ARGP_KEY_END:
+        if (state->arg_num != 3) {
+            argp_error(state, "Invalid number of arguments given");
+        }
+        if (!args->toFloat && (args->pxDiv < 1.0f || args->pxDiv > 1.0f ||
+                               args->pxSub > 0.0f)) {
+            argp_error(state, "Options \"--px-division\" and "
+                              "\"--px-subtraction\" require option "
+                              "\"--float\"");
+        }
+        if (args->alignment > 0 && args->pitch > 0) {
+            argp_error(state, "Not allowed to use both alignment and pitch");
+        }
+        if (!args->packFile && (args->labelsFile || args->groundTruthFile)) {
+            argp_error(state, "Options \"--labels\" and \"--ground-truth\" "
+                              "require option \"--pack\"");
+        }
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+/**
+ * brief Parses a string as a size
+ *
+ * param arg String to parse.
+ * param value Pointer to the parsed size.
+ * param limit Largest allowed value.
+ * param allowZero True if 0 is allowed.
+ * return Positive errno style return code (zero means success).
+ */
+static int parseSize(const char* arg, size_t* value, size_t limit,
+                     bool allowZero) {
+    char* endPtr;
+
+    errno = 0;
+    const unsigned long long v = strtoull(arg, &endPtr, 0);
+    if (*endPtr != '\0' || arg[0] == '\0' || arg[0] == '-' ||
+        (v == 0 && !allowZero)) {
+        return EINVAL;
+    } else if (errno == ERANGE || v > limit) {
+        return ERANGE;
+    }
+    *value = (size_t) v;
+
+    return 0;
+}
+
+/**
+ * brief Parses a string as a finite float
+ *
+ * param arg String to parse.
+ * param value Pointer to the parsed number.
+ * param allowNegative Accept numbers below zero.
+ * return Positive errno style return code (zero means success).
+ */
+static int parseFloat(const char* arg, float* value, bool allowNegative) {
+    char* endPtr;
+
+    errno = 0;
+    const float v = strtof(arg, &endPtr);
+    if (*endPtr != '\0' || arg[0] == '\0' || !isfinite(v) ||
+        (!allowNegative && v < 0.0f)) {
+        return EINVAL;
+    } else if (errno == ERANGE) {
+        return ERANGE;
+    }
+    *value = v;
+
+    return 0;
+}
+
+static int compareFiles(const void* a, const void* b) {
+    const imageFile* fa = a;
+    const imageFile* fb = b;
+
+    if (fa->numeric != fb->numeric) {
+        return fa->numeric ? -1 : 1;
+    }
+    if (fa->number != fb->number) {
+        return fa->number < fb->number ? -1 : 1;
+    }
+
+    return strcmp(fa->name, fb->name);
+}
+
+static bool listImages(const char* dir, imageFile** filesPtr,
+                       size_t* numFiles) {
+    bool ret = false;
+    imageFile* files = NULL;
+    size_t count = 0;
+    size_t cap = 0;
+
+    DIR* d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "Could not open directory %s: %s\n", dir,
+                strerror(errno));
+        return false;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(d))) {
+        if (strcmp(entry->d_name, ".") == 0 ||
+            strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (count == cap) {
+            cap = cap ? 2 * cap : 1024;
+            imageFile* grown = realloc(files, cap * sizeof(imageFile));
+            if (!grown) {
+                fprintf(stderr, "Could not allocate the file list\n");
+                goto end;
+            }
+            files = grown;
+        }
+        imageFile* f = &files[count];
+        memset(f, 0, sizeof(*f));
+        f->name = strdup(entry->d_name);
+        if (!f->name) {
+            fprintf(stderr, "Could not allocate the file list\n");
+            goto end;
+        }
+        count++;
+
+        const char* dot = strrchr(f->name, '.');
+        // A leading dot does not start an extension, like os.path.splitext.
+        f->stemLen = dot && dot != f->name ? (size_t) (dot - f->name)
+                                           : strlen(f->name);
+        f->numeric = f->stemLen > 0;
+        for (size_t i = 0; i < f->stemLen; i++) {
+            if (f->name[i] < '0' || f->name[i] > '9') {
+                f->numeric = false;
+                break;
+            }
+        }
+        if (f->numeric) {
+            f->number = strtoull(f->name, NULL, 10);
+        }
+    }
+
+    qsort(files, count, sizeof(imageFile), compareFiles);
+    ret = true;
+
+end:
+    closedir(d);
+    if (!ret) {
+        for (size_t i = 0; i < count; i++) {
+            free(files[i].name);
+        }
+        free(files);
+        return false;
+    }
+    *filesPtr = files;
+    *numFiles = count;
+
+    return true;
+}
+
+static bool readFile(const char* path, uint8_t** buf, size_t* cap,
+                     size_t* size) {
+    bool ret = false;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        goto end;
+    }
+    const size_t fileSize = (size_t) st.st_size;
+    if (fileSize > *cap) {
+        uint8_t* grown = realloc(*buf, fileSize);
+        if (!grown) {
+            goto end;
+        }
+        *buf = grown;
+        *cap = fileSize;
+    }
+
+    size_t done = 0;
+    while (done < fileSize) {
+        ssize_t n = read(fd, *buf + done, fileSize - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            goto end;
+        }
+        done += (size_t) n;
+    }
+    *size = fileSize;
+    ret = true;
+
+end:
+    close(fd);
+
+    return ret;
+}
+
+static bool readGroundTruth(const char* path, int32_t** classesPtr,
+                            size_t* numClasses) {
+    bool ret = false;
+    int32_t* classes = NULL;
+    size_t count = 0;
+    size_t cap = 0;
+    char line[64];
+
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        char* endPtr;
+        errno = 0;
+        long value = strtol(line, &endPtr, 10);
+        if (endPtr == line) {
+            // Blank rows are skipped, anything else is an error.
+            if (strspn(line, " \t\r\n") != strlen(line)) {
+                fprintf(stderr, "Invalid class %s in %s\n", line, path);
+                goto end;
+            }
+            continue;
+        }
+        if (errno || value < INT32_MIN || value > INT32_MAX ||
+            strspn(endPtr, " \t\r\n") != strlen(endPtr)) {
+            fprintf(stderr, "Invalid class %s in %s\n", line, path);
+            goto end;
+        }
+        if (count == cap) {
+            cap = cap ? 2 * cap : 1024;
+            int32_t* grown = realloc(classes, cap * sizeof(int32_t));
+            if (!grown) {
+                fprintf(stderr, "Could not allocate the annotations\n");
+                goto end;
+            }
+            classes = grown;
+        }
+        classes[count++] = (int32_t) value;
+    }
+    if (ferror(fp)) {
+        fprintf(stderr, "Could not read %s\n", path);
+        goto end;
+    }
+    ret = true;
+
+end:
+    fclose(fp);
+    if (!ret) {
+        free(classes);
+        return false;
+    }
+    *classesPtr = classes;
+    *numClasses = count;
+
+    return true;
+}
+
+static bool writeAll(int fd, const void* buf, size_t size, off_t offset) {
+    const uint8_t* data = buf;
+
+    while (size > 0) {
+        ssize_t n = offset < 0 ? write(fd, data, size)
+                               : pwrite(fd, data, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= (size_t) n;
+        if (offset >= 0) {
+            offset += n;
+        }
+    }
+
+    return true;
+}
+
+static void jpegErrorExit(j_common_ptr cinfo) {
+    jpegError* err = (jpegError*) cinfo->err;
+    longjmp(err->jump, 1);
+}
+
+static bool decodeJpeg(worker* w, const uint8_t* data, size_t size,
+                       size_t* width, size_t* height) {
+    struct jpeg_decompress_struct cinfo;
+    jpegError err;
+
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpegErrorExit;
+    if (setjmp(err.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, data, (unsigned long) size);
+    jpeg_read_header(&cinfo, TRUE);
+    // Like OpenCV, everything but CMYK is converted to RGB by libjpeg, using
+    // its SIMD colour conversion.
+    cinfo.out_color_space = cinfo.num_components == 4 ? JCS_CMYK : JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+
+    const size_t rowBytes =
+        (size_t) cinfo.output_width * (size_t) cinfo.output_components;
+    const size_t needed = rowBytes * cinfo.output_height;
+    if (needed > w->decodedCap) {
+        uint8_t* grown = realloc(w->decoded, needed);
+        if (!grown) {
+            jpeg_destroy_decompress(&cinfo);
+            return false;
+        }
+        w->decoded = grown;
+        w->decodedCap = needed;
+    }
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = w->decoded + (size_t) cinfo.output_scanline * rowBytes;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+
+    if (cinfo.out_color_space == JCS_CMYK) {
+        // Same as icvCvt_CMYK2BGR_8u_C4C3R in OpenCV. Works in place since
+        // the RGB pixel never passes the CMYK pixel being read.
+        const size_t numPixels = (size_t) cinfo.output_width * cinfo.output_height;
+        for (size_t i = 0; i < numPixels; i++) {
+            const uint8_t* cmyk = w->decoded + 4 * i;
+            const int k = cmyk[3];
+            const int c = k - (((255 - cmyk[0]) * k) >> 8);
+            const int m = k - (((255 - cmyk[1]) * k) >> 8);
+            const int y = k - (((255 - cmyk[2]) * k) >> 8);
+            w->decoded[3 * i] = (uint8_t) c;
+            w->decoded[3 * i + 1] = (uint8_t) m;
+            w->decoded[3 * i + 2] = (uint8_t) y;
+        }
+    }
+    *width = cinfo.output_width;
+    *height = cinfo.output_height;
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    return true;
+}
+
+static void storeImage(const convertJob* job, const uint8_t* rgb,
+                       uint8_t* image) {
+    const size_t width = job->args->width;
+    const size_t height = job->args->height;
+
+    if (!job->args->separatePlanes) {
+        const size_t n = 3 * width;
+        for (size_t y = 0; y < height; y++) {
+            const uint8_t* src = rgb + y * n;
+            uint8_t* row = image + y * job->rowBytes;
+            if (!job->args->toFloat) {
+                memcpy(row, src, n);
+                continue;
+            }
+            for (size_t i = 0; i < n; i++) {
+                memcpy(row + i * sizeof(float), &job->floatTable[src[i]],
+                       sizeof(float));
+            }
+        }
+        return;
+    }
+
+    for (size_t c = 0; c < 3; c++) {
+        for (size_t y = 0; y < height; y++) {
+            const uint8_t* src = rgb + y * 3 * width + c;
+            uint8_t* row = image + (c * height + y) * job->rowBytes;
+            if (!job->args->toFloat) {
+                for (size_t x = 0; x < width; x++) {
+                    row[x] = src[3 * x];
+                }
+                continue;
+            }
+            for (size_t x = 0; x < width; x++) {
+                memcpy(row + x * sizeof(float), &job->floatTable[src[3 * x]],
+                       sizeof(float));
+            }
+        }
+    }
+}
+
+static bool convertImage(worker* w, size_t idx) {
+    const convertJob* job = w->job;
+    const convertArgs* args = job->args;
+    const imageFile* f = &job->files[idx];
+    char path[PATH_MAX];
+    size_t size = 0;
+    size_t width = 0;
+    size_t height = 0;
+
+    if (snprintf(path, sizeof(path), "%s/%s", args->imagesDir, f->name) >=
+            (int) sizeof(path) ||
+        !readFile(path, &w->fileData, &w->fileCap, &size) ||
+        !decodeJpeg(w, w->fileData, size, &width, &height)) {
+        fprintf(stderr, "WARNING: Could not read image %s/%s\n",
+                args->imagesDir, f->name);
+        return true;
+    }
+    if (!resizeBilinear(w->resize, w->decoded, width, height, 3 * width,
+                        w->resized, args->width, args->height, 3)) {
+        fprintf(stderr, "Could not allocate the resize buffers\n");
+        return false;
+    }
+    storeImage(job, w->resized, w->image);
+
+    if (args->packFile) {
+        const off_t offset = (off_t) (job->dataOffset + idx * job->imageStride);
+        if (!writeAll(job->packFd, w->image, job->imageBytes, offset)) {
+            fprintf(stderr, "Could not write to %s: %s\n", args->packFile,
+                    strerror(errno));
+            return false;
+        }
+        job->converted[idx] = true;
+        printf("Image %s packed as image %llu\n", f->name,
+               f->numeric ? f->number : (unsigned long long) idx + 1);
+        return true;
+    }
+
+    if (snprintf(path, sizeof(path), "%s/%.*s.bin", args->outputDir,
+                 (int) f->stemLen, f->name) >= (int) sizeof(path)) {
+        fprintf(stderr, "Output path for %s is too long\n", f->name);
+        return false;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    const bool written = writeAll(fd, w->image, job->imageBytes, -1);
+    if (!written) {
+        fprintf(stderr, "Could not write to %s: %s\n", path, strerror(errno));
+    }
+    if (close(fd) && written) {
+        fprintf(stderr, "Could not write to %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    if (written) {
+        job->converted[idx] = true;
+        printf("Output file written to %s\n", path);
+    }
+
+    return written;
+}
+
+static void* workerRun(void* arg) {
+    worker* w = arg;
+    convertJob* job = w->job;
+
+    while (!atomic_load(&job->failed)) {
+        const size_t idx = atomic_fetch_add(&job->next, 1);
+        if (idx >= job->numFiles) {
+            break;
+        }
+        if (!convertImage(w, idx)) {
+            atomic_store(&job->failed, true);
+        }
+    }
+
+    return NULL;
+}
+
+static bool finishPack(const convertJob* job, const char* labels,
+                       size_t labelsLen, uint64_t labelsOffset,
+                       const int32_t* groundTruth, size_t numGroundTruth,
+                       size_t* count) {
+    const convertArgs* args = job->args;
+    bool ret = false;
+    size_t numPacked = 0;
+
+    datasetIndexEntry* index = calloc(job->numFiles ? job->numFiles : 1,
+                                      sizeof(datasetIndexEntry));
+    if (!index) {
+        fprintf(stderr, "Could not allocate the dataset index\n");
+        return false;
+    }
+    for (size_t i = 0; i < job->numFiles; i++) {
+        if (!job->converted[i]) {
+            continue;
+        }
+        const imageFile* f = &job->files[i];
+        const unsigned long long imageId = f->numeric ? f->number : i + 1;
+        if (imageId > UINT32_MAX) {
+            fprintf(stderr, "Image number of %s is too large\n", f->name);
+            goto end;
+        }
+        datasetIndexEntry* entry = &index[numPacked++];
+        entry->offset = job->dataOffset + i * job->imageStride;
+        entry->imageId = (uint32_t) imageId;
+        entry->groundTruth = imageId > 0 && imageId <= numGroundTruth
+                                 ? groundTruth[imageId - 1]
+                                 : -1;
+    }
+
+    datasetHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DATASET_MAGIC, sizeof(header.magic));
+    header.version = DATASET_VERSION;
+    header.headerBytes = sizeof(datasetHeader);
+    header.flags = (labelsLen ? DATASET_FLAG_LABELS : 0) |
+                   (numGroundTruth ? DATASET_FLAG_GROUND_TRUTH : 0);
+    header.width = args->width;
+    header.height = args->height;
+    header.channels = 3;
+    header.layout = args->separatePlanes ? DATASET_LAYOUT_PLANAR
+                                         : DATASET_LAYOUT_INTERLEAVED;
+    header.dataType = args->toFloat ? DATASET_DATA_TYPE_FLOAT32
+                                    : DATASET_DATA_TYPE_UINT8;
+    header.pitch = (uint32_t) (args->alignment || args->pitch ? job->rowBytes : 0);
+    header.count = (uint32_t) numPacked;
+    header.alignment = (uint32_t) args->packAlignment;
+    header.imageBytes = job->imageBytes;
+    header.imageStride = job->imageStride;
+    header.indexOffset = sizeof(datasetHeader);
+    header.dataOffset = job->dataOffset;
+    header.labelsOffset = labelsLen ? labelsOffset : 0;
+    header.labelsBytes = labelsLen;
+
+    // Every image slot is kept, so images that could not be read leave a
+    // hole and the others stay where their thread wrote them.
+    if (ftruncate(job->packFd,
+                  (off_t) (job->dataOffset + job->numFiles * job->imageStride)) ||
+        !writeAll(job->packFd, &header, sizeof(header), 0) ||
+        !writeAll(job->packFd, index, numPacked * sizeof(datasetIndexEntry),
+                  (off_t) sizeof(header)) ||
+        !writeAll(job->packFd, labels, labelsLen, (off_t) labelsOffset)) {
+        fprintf(stderr, "Could not write to %s: %s\n", args->packFile,
+                strerror(errno));
+        goto end;
+    }
+    *count = numPacked;
+    ret = true;
+
+end:
+    free(index);
+
+    return ret;
+}
+
+int main(int argc, char** argv) {
+    convertArgs args = {
+        .outputDir = "output",
+        .pxDiv = 1.0f,
+        .packAlignment = 4096,
+    };
+    convertJob job;
+    worker* workers = NULL;
+    size_t numStarted = 0;
+    char* labels = NULL;
+    size_t labelsLen = 0;
+    int32_t* groundTruth = NULL;
+    size_t numGroundTruth = 0;
+    int ret = EXIT_FAILURE;
+
+    memset(&job, 0, sizeof(job));
+    job.packFd = -1;
+    if (argp_parse(&argp, argc, argv, 0, NULL, &args)) {
+        return EXIT_FAILURE;
+    }
+    if (!args.threads) {
+        const long online = sysconf(_SC_NPROCESSORS_ONLN);
+        args.threads = online > 0 ? (size_t) online : 1;
+        args.threads = args.threads > MAX_THREADS ? MAX_THREADS : args.threads;
+    }
+    job.args = &args;
+
+    job.widthBytes = (size_t) args.width * (args.toFloat ? sizeof(float) : 1) *
+                     (args.separatePlanes ? 1 : 3);
+    job.rowBytes = job.widthBytes;
+    if (args.alignment) {
+        job.rowBytes = (job.widthBytes + args.alignment - 1) / args.alignment *
+                       args.alignment;
+    } else if (args.pitch) {
+        if (args.pitch < job.widthBytes) {
+            fprintf(stderr, "Pitch %zu is less than the %zu bytes of a row\n",
+                    args.pitch, job.widthBytes);
+            return EXIT_FAILURE;
+        }
+        job.rowBytes = args.pitch;
+    }
+    job.imageBytes = job.rowBytes * args.height * (args.separatePlanes ? 3 : 1);
+    for (size_t v = 0; v < 256; v++) {
+        job.floatTable[v] = ((float) v - args.pxSub) / args.pxDiv;
+    }
+
+    if (!listImages(args.imagesDir, &job.files, &job.numFiles)) {
+        goto end;
+    }
+    job.converted = calloc(job.numFiles ? job.numFiles : 1, sizeof(bool));
+    if (!job.converted) {
+        fprintf(stderr, "Could not allocate the file list\n");
+        goto end;
+    }
+
+    uint64_t labelsOffset = 0;
+    if (args.packFile) {
+        if (args.labelsFile) {
+            size_t cap = 0;
+            if (!readFile(args.labelsFile, (uint8_t**) &labels, &cap,
+                          &labelsLen)) {
+                fprintf(stderr, "Could not read %s\n", args.labelsFile);
+                goto end;
+            }
+        }
+        if (args.groundTruthFile &&
+            !readGroundTruth(args.groundTruthFile, &groundTruth,
+                             &numGroundTruth)) {
+            goto end;
+        }
+        const uint64_t alignment = args.packAlignment;
+        job.imageStride =
+            (job.imageBytes + alignment - 1) / alignment * alignment;
+        labelsOffset =
+            sizeof(datasetHeader) + job.numFiles * sizeof(datasetIndexEntry);
+        job.dataOffset =
+            (labelsOffset + labelsLen + alignment - 1) / alignment * alignment;
+
+        job.packFd = open(args.packFile,
+                          O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (job.packFd < 0) {
+            fprintf(stderr, "Could not open %s: %s\n", args.packFile,
+                    strerror(errno));
+            goto end;
+        }
+    }
+
+    const size_t numThreads =
+        args.threads < job.numFiles ? args.threads : job.numFiles;
+    workers = calloc(numThreads ? numThreads : 1, sizeof(worker));
+    if (!workers) {
+        fprintf(stderr, "Could not allocate the workers\n");
+        goto end;
+    }
+    atomic_init(&job.next, 0);
+    atomic_init(&job.failed, false);
+    for (size_t i = 0; i < numThreads; i++) {
+        worker* w = &workers[i];
+        w->job = &job;
+        w->resized = malloc(3 * (size_t) args.width * args.height);
+        // Padding is never written, so it stays zero for every image.
+        w->image = calloc(1, job.imageBytes);
+        if (!w->resized || !w->image || !resizerCreate(&w->resize)) {
+            fprintf(stderr, "Could not allocate the image buffers\n");
+            atomic_store(&job.failed, true);
+            break;
+        }
+        int err = pthread_create(&w->thread, NULL, workerRun, w);
+        if (err) {
+            fprintf(stderr, "Could not start a thread: %s\n", strerror(err));
+            atomic_store(&job.failed, true);
+            break;
+        }
+        numStarted++;
+    }
+    for (size_t i = 0; i < numStarted; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    if (atomic_load(&job.failed)) {
+        goto end;
+    }
+
+    if (args.packFile) {
+        size_t count = 0;
+        if (!finishPack(&job, labels, labelsLen, labelsOffset, groundTruth,
+                        numGroundTruth, &count)) {
+            goto end;
+        }
+        printf("Packed dataset with %zu images written to %s\n", count,
+               args.packFile);
+    }
+    ret = EXIT_SUCCESS;
+
+end:
+    if (workers) {
+        for (size_t i = 0; i < numThreads; i++) {
+            resizerDestroy(&workers[i].resize);
+            free(workers[i].fileData);
+            free(workers[i].decoded);
+            free(workers[i].resized);
+            free(workers[i].image);
+        }
+        free(workers);
+    }
+    if (job.packFd >= 0 && close(job.packFd) && ret == EXIT_SUCCESS) {
+        fprintf(stderr, "Could not write to %s: %s\n", args.packFile,
+                strerror(errno));
+        ret = EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < job.numFiles; i++) {
+        free(job.files[i].name);
+    }
+    free(job.files);
+    free(job.converted);
+    free(labels);
+    free(groundTruth);
+
+    return ret;
+}
@@ -0,0 +1,282 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * This file implements the bilinear resize used by the image converter.
+ */
+
+#include "resize.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Fractional bits of the interpolation weights, as in OpenCV.
+#define COEF_BITS (11)
+#define COEF_SCALE (1 << COEF_BITS)
+
+struct resizer {
+    // Horizontally resized source rows, scaled down by 16 to fit in 16 bits.
+    int16_t* rows[2];
+    // Source row held by each of rows, or -1.
+    long rowSrc[2];
+    size_t rowCap;
+    // Byte offsets of the left and right source pixel of every output column.
+    int32_t* xofs;
+    int16_t* alpha;
+    size_t xCap;
+    int32_t* yofs;
+    int16_t* beta;
+    size_t yCap;
+};
+
+/**
+ * brief Computes the source positions and weights of one dimension.
+ *
+ * param dstSize Size of the destination.
+ * param srcSize Size of the source.
+ * param ofs Source index of the first of the two neighbours of every
+ * destination index.
+ * param coeffs Weights of the two neighbours of every destination index.
+ */
+static void computeCoeffs(size_t dstSize, size_t srcSize, int32_t* ofs,
+                          int16_t* coeffs);
+
+/**
+ * brief Grows a buffer to hold at least a number of elements.
+ *
+ * param buf Pointer to the buffer.
+ * param count Number of elements needed.
+ * param elemSize Size of an element.
+ * return False if out of memory, otherwise true.
+ */
+static bool growBuffer(void** buf, size_t count, size_t elemSize);
+
+/**
+ * brief Resizes one source row horizontally.
+ *
+ * param r The resizer.
+ * param srcRow The source row.
+ * param dst Destination of dstWidth * channels values.
+ * param dstWidth Width of the destination in pixels.
+ * param channels Number of interleaved channels.
+ */
+static void resizeRow(const resizer* r, const uint8_t* srcRow, int16_t* dst,
+                      size_t dstWidth, size_t channels);
+
+/**
+ * brief Blends two horizontally resized rows into an output row.
+ *
+ * param row0 Upper row.
+ * param row1 Lower row.
+ * param b0 Weight of the upper row.
+ * param b1 Weight of the lower row.
+ * param dst Output row.
+ * param n Number of values in a row.
+ */
+static void blendRows(const int16_t* row0, const int16_t* row1, int16_t b0,
+                      int16_t b1, uint8_t* dst, size_t n);
+
+static void computeCoeffs(size_t dstSize, size_t srcSize, int32_t* ofs,
+                          int16_t* coeffs) {
+    const double scale = (double) srcSize / (double) dstSize;
+
+    for (size_t d = 0; d < dstSize; d++) {
+        float f = (float) (((double) d + 0.5) * scale - 0.5);
+        const float whole = floorf(f);
+        long s = (long) whole;
+        f -= whole;
+        if (s < 0) {
+            f = 0.0f;
+            s = 0;
+        }
+        if (s >= (long) srcSize - 1) {
+            f = 0.0f;
+            s = (long) srcSize - 1;
+        }
+        ofs[d] = (int32_t) s;
+        coeffs[2 * d] = (int16_t) lrintf((1.0f - f) * COEF_SCALE);
+        coeffs[2 * d + 1] = (int16_t) lrintf(f * COEF_SCALE);
+    }
+}
+
+static bool growBuffer(void** buf, size_t count, size_t elemSize) {
+    void* p = realloc(*buf, count * elemSize);
+    if (!p) {
+        return false;
+    }
+    *buf = p;
+
+    return true;
+}
+
+static void resizeRow(const resizer* r, const uint8_t* srcRow, int16_t* dst,
+                      size_t dstWidth, size_t channels) {
+    for (size_t dx = 0; dx < dstWidth; dx++) {
+        const uint8_t* s0 = srcRow + r->xofs[2 * dx];
+        const uint8_t* s1 = srcRow + r->xofs[2 * dx + 1];
+        const int a0 = r->alpha[2 * dx];
+        const int a1 = r->alpha[2 * dx + 1];
+        for (size_t c = 0; c < channels; c++) {
+            dst[dx * channels + c] = (int16_t) ((s0[c] * a0 + s1[c] * a1) >> 4);
+        }
+    }
+}
+
+static void blendRows(const int16_t* row0, const int16_t* row1, int16_t b0,
+                      int16_t b1, uint8_t* dst, size_t n) {
+    size_t i = 0;
+    // (b * (v >> 4)) >> 16 summed and rounded by 2 bits, like OpenCV.
+#if defined(__ARM_NEON)
+    const int16x4_t vb0 = vdup_n_s16(b0);
+    const int16x4_t vb1 = vdup_n_s16(b1);
+    const int16x8_t two = vdupq_n_s16(2);
+    for (; i + 8 <= n; i += 8) {
+        const int16x8_t r0 = vld1q_s16(row0 + i);
+        const int16x8_t r1 = vld1q_s16(row1 + i);
+        const int16x8_t y0 = vcombine_s16(
+            vshrn_n_s32(vmull_s16(vget_low_s16(r0), vb0), 16),
+            vshrn_n_s32(vmull_s16(vget_high_s16(r0), vb0), 16));
+        const int16x8_t y1 = vcombine_s16(
+            vshrn_n_s32(vmull_s16(vget_low_s16(r1), vb1), 16),
+            vshrn_n_s32(vmull_s16(vget_high_s16(r1), vb1), 16));
+        const int16x8_t sum = vshrq_n_s16(vqaddq_s16(vqaddq_s16(y0, y1), two), 2);
+        vst1_u8(dst + i, vqmovun_s16(sum));
+    }
+#elif defined(__SSE2__)
+    const __m128i vb0 = _mm_set1_epi16(b0);
+    const __m128i vb1 = _mm_set1_epi16(b1);
+    const __m128i two = _mm_set1_epi16(2);
+    for (; i + 16 <= n; i += 16) {
+        const __m128i r0a = _mm_loadu_si128((const __m128i*) (row0 + i));
+        const __m128i r0b = _mm_loadu_si128((const __m128i*) (row0 + i + 8));
+        const __m128i r1a = _mm_loadu_si128((const __m128i*) (row1 + i));
+        const __m128i r1b = _mm_loadu_si128((const __m128i*) (row1 + i + 8));
+        __m128i a = _mm_adds_epi16(_mm_mulhi_epi16(r0a, vb0),
+                                   _mm_mulhi_epi16(r1a, vb1));
+        __m128i b = _mm_adds_epi16(_mm_mulhi_epi16(r0b, vb0),
+                                   _mm_mulhi_epi16(r1b, vb1));
+        a = _mm_srai_epi16(_mm_adds_epi16(a, two), 2);
+        b = _mm_srai_epi16(_mm_adds_epi16(b, two), 2);
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(a, b));
+    }
+#endif
+    for (; i < n; i++) {
+        const int v = (((b0 * row0[i]) >> 16) + ((b1 * row1[i]) >> 16) + 2) >> 2;
+        dst[i] = (uint8_t) (v < 0 ? 0 : v > 255 ? 255 : v);
+    }
+}
+
+bool resizerCreate(resizer** resizerPtr) {
+    resizer* r = calloc(1, sizeof(resizer));
+    if (!r) {
+        return false;
+    }
+    *resizerPtr = r;
+
+    return true;
+}
+
+void resizerDestroy(resizer** resizerPtr) {
+    if (!resizerPtr || !*resizerPtr) {
+        return;
+    }
+    resizer* r = *resizerPtr;
+    free(r->rows[0]);
+    free(r->rows[1]);
+    free(r->xofs);
+    free(r->alpha);
+    free(r->yofs);
+    free(r->beta);
+    free(r);
+    *resizerPtr = NULL;
+}
+
+bool resizeBilinear(resizer* r, const uint8_t* src, size_t srcWidth,
+                    size_t srcHeight, size_t srcStride, uint8_t* dst,
+                    size_t dstWidth, size_t dstHeight, size_t channels) {
+    const size_t rowLen = dstWidth * channels;
+
+    if (rowLen > r->rowCap) {
+        if (!growBuffer((void**) &r->rows[0], rowLen, sizeof(int16_t)) ||
+            !growBuffer((void**) &r->rows[1], rowLen, sizeof(int16_t))) {
+            return false;
+        }
+        r->rowCap = rowLen;
+    }
+    if (dstWidth > r->xCap) {
+        if (!growBuffer((void**) &r->xofs, 2 * dstWidth, sizeof(int32_t)) ||
+            !growBuffer((void**) &r->alpha, 2 * dstWidth, sizeof(int16_t))) {
+            return false;
+        }
+        r->xCap = dstWidth;
+    }
+    if (dstHeight > r->yCap) {
+        if (!growBuffer((void**) &r->yofs, dstHeight, sizeof(int32_t)) ||
+            !growBuffer((void**) &r->beta, 2 * dstHeight, sizeof(int16_t))) {
+            return false;
+        }
+        r->yCap = dstHeight;
+    }
+
+    // xofs holds the byte offsets of both neighbours, the right one clamped
+    // to the last pixel, where its weight is 0.
+    computeCoeffs(dstWidth, srcWidth, r->xofs, r->alpha);
+    for (size_t dx = dstWidth; dx-- > 0;) {
+        const int32_t sx = r->xofs[dx];
+        const int32_t sx1 = sx + 1 < (int32_t) srcWidth ? sx + 1 : sx;
+        r->xofs[2 * dx] = sx * (int32_t) channels;
+        r->xofs[2 * dx + 1] = sx1 * (int32_t) channels;
+    }
+    computeCoeffs(dstHeight, srcHeight, r->yofs, r->beta);
+
+    r->rowSrc[0] = -1;
+    r->rowSrc[1] = -1;
+    for (size_t dy = 0; dy < dstHeight; dy++) {
+        const long sy0 = r->yofs[dy];
+        const long sy1 = sy0 + 1 < (long) srcHeight ? sy0 + 1 : sy0;
+        // Rows move down monotonically, so the lower row of the previous
+        // output row is usually the upper row of this one.
+        if (r->rowSrc[1] == sy0 && r->rowSrc[0] != sy0) {
+            int16_t* tmp = r->rows[0];
+            r->rows[0] = r->rows[1];
+            r->rows[1] = tmp;
+            r->rowSrc[0] = sy0;
+            r->rowSrc[1] = -1;
+        }
+        if (r->rowSrc[0] != sy0) {
+            resizeRow(r, src + (size_t) sy0 * srcStride, r->rows[0], dstWidth,
+                      channels);
+            r->rowSrc[0] = sy0;
+        }
+        if (r->rowSrc[1] != sy1) {
+            resizeRow(r, src + (size_t) sy1 * srcStride, r->rows[1], dstWidth,
+                      channels);
+            r->rowSrc[1] = sy1;
+        }
+        blendRows(r->rows[0], r->rows[1], r->beta[2 * dy], r->beta[2 * dy + 1],
+                  dst + dy * rowLen, rowLen);
+    }
+
+    return true;
+}
@@ -0,0 +1,74 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * This header file declares the bilinear resize used by the image converter.
+ *
+ * The arithmetic follows OpenCV's INTER_LINEAR resize of 8-bit images, which
+ * larod_convert.py uses: pixel centres are aligned, the weights are fixed
+ * point with 11 fractional bits and the vertical pass rounds like the SIMD
+ * code of OpenCV. Converted images therefore match the Python tool to within
+ * one step for every pixel.
+ *
+ * The horizontal pass is done once per source row and kept for the next
+ * output row. The vertical pass, where most of the time goes, uses NEON or
+ * SSE2 when available.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct resizer resizer;
+
+/**
+ * brief Creates a resizer with its own scratch buffers.
+ *
+ * Each thread needs its own resizer. The buffers grow as needed, so one
+ * resizer can be used for images of any size.
+ *
+ * param resizerPtr Pointer to the created resizer.
+ * return False if out of memory, otherwise true.
+ */
+bool resizerCreate(resizer** resizerPtr);
+
+/**
+ * brief Frees a resizer.
+ *
+ * param resizerPtr Pointer to the resizer. Set to NULL on return.
+ */
+void resizerDestroy(resizer** resizerPtr);
+
+/**
+ * brief Resizes an interleaved 8-bit image.
+ *
+ * param r The resizer.
+ * param src Source pixels, rows of srcWidth * channels bytes.
+ * param srcWidth Width of the source in pixels.
+ * param srcHeight Height of the source in pixels.
+ * param srcStride Bytes between the starts of two source rows.
+ * param dst Destination pixels, rows of dstWidth * channels bytes.
+ * param dstWidth Width of the destination in pixels.
+ * param dstHeight Height of the destination in pixels.
+ * param channels Number of interleaved channels, at most 4.
+ * return False if out of memory, otherwise true.
+ */
+bool resizeBilinear(resizer* r, const uint8_t* src, size_t srcWidth,
+                    size_t srcHeight, size_t srcStride, uint8_t* dst,
+                    size_t dstWidth, size_t dstHeight, size_t channels);
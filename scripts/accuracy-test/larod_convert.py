@@ -18,17 +18,39 @@
 
 import argparse
 import os
+import struct
 import sys
 from math import ceil
 import cv2
 import numpy as np
+
+# Packed dataset container, see app/dataset.h for the layout.
+DATASET_MAGIC = b'AXDS'
+DATASET_VERSION = 1
+DATASET_FLAG_LABELS = 1 << 0
+DATASET_FLAG_GROUND_TRUTH = 1 << 1
+DATASET_LAYOUT_INTERLEAVED = 0
+DATASET_LAYOUT_PLANAR = 1
+DATASET_DATA_TYPE_UINT8 = 0
+DATASET_DATA_TYPE_FLOAT32 = 1
+# magic, version, headerBytes, flags, width, height, channels, layout,
+# dataType, pitch, count, alignment, imageBytes, imageStride, indexOffset,
+# dataOffset, labelsOffset, labelsBytes
+DATASET_HEADER = struct.Struct('<4s11I6Q')
+# offset, imageId, groundTruth
+DATASET_INDEX_ENTRY = struct.Struct('<QIi')
+def align_up(value, alignment):
+    """Round value up to a multiple of alignment"""
+    return (value + alignment - 1) // alignment * alignment
 class ConvertImage:
     """Convert image to binary image"""
     # pylint: disable=too-many-instance-attributes
     def __init__(self, separate_planes,  # pylint: disable=too-many-arguments
                  height, width, images, output_filename,
                  to_float, px_div, px_sub,
-                 alignment, pitch):
+                 alignment, pitch,
+                 pack_filename, labels_filename, ground_truth_filename,
+                 pack_alignment):
         self.separate_planes = separate_planes
         self.height = height
         self.width = width
@@ -39,6 +61,10 @@ class ConvertImage:
         self.px_sub = px_sub
         self.alignment = alignment
         self.pitch = pitch
+        self.pack_filename = pack_filename
+        self.labels_filename = labels_filename
+        self.ground_truth_filename = ground_truth_filename
+        self.pack_alignment = pack_alignment
     def write_data(self, binary_file, data, width_bytes, pitch_bytes=0):
         """Write data to disk"""
         if pitch_bytes in (width_bytes, 0):
@@ -53,13 +79,11 @@ class ConvertImage:
     def write_data_with_padding(binary_file, data,
                                 width_bytes, pitch_bytes):
         """Add padding and write data to binary file"""
-        padding_size = pitch_bytes - width_bytes
-        i = 0
-        for byte in data.tobytes():
-            binary_file.write(bytes([byte]))
-            i += 1
-            if i % width_bytes == 0:
-                binary_file.write(b'\0' * padding_size)
+        rows = np.frombuffer(data.tobytes(), dtype=np.uint8)
+        rows = rows.reshape(-1, width_bytes)
+        padded = np.zeros((rows.shape[0], pitch_bytes), dtype=np.uint8)
+        padded[:, :width_bytes] = rows
+        binary_file.write(padded.tobytes())
     def check_arguments(self):
         """Check option conditions"""
         if not self.to_float and (self.px_div != 1 or self.px_sub != 0):
@@ -68,47 +92,126 @@ class ConvertImage:
                      "requires option \"--float\"")
         if self.alignment > 0 and self.pitch > 0:
             sys.exit('Not allowed to use both alignment and pitch')
+        if not self.pack_filename and (self.labels_filename or
+                                       self.ground_truth_filename):
+            sys.exit("ERROR: Options \"--labels\" and \"--ground-truth\" "
+                     "requires option \"--pack\"")
+    def convert_image(self, img_file, binary_file):
+        """Convert one image and write it to binary_file"""
+        img = cv2.imread(self.images + '/' + img_file)
+        if img is None:
+            print("WARNING: Could not read image", self.images + '/' + img_file)
+            return False
+        # size in bytes for one row
+        width_bytes = self.width
+        # OpenCV reads the image in BGR order.
+        img = cv2.cvtColor(img, cv2.COLOR_BGR2RGB)
+        if self.to_float:
+            img = cv2.resize(img,
+                             (self.width, self.height)).astype(np.float32)
+            img -= self.px_sub
+            img /= self.px_div
+            # float is used, 4 bytes per pixel
+            width_bytes *= 4
+        else:
+            img = cv2.resize(img, (self.width, self.height))
+        if not self.separate_planes:
+            # RGB interleaved each pixel is containing r, g and b data
+            width_bytes *= 3
+        if self.alignment > 0:
+            self.pitch = int(ceil(width_bytes / float(self.alignment)) *
+                             self.alignment)
+        if self.separate_planes:
+            r_val, g_val, b_val = cv2.split(img)
+            self.write_data(binary_file, r_val, width_bytes, self.pitch)
+            self.write_data(binary_file, g_val, width_bytes, self.pitch)
+            self.write_data(binary_file, b_val, width_bytes, self.pitch)
+        else:
+            self.write_data(binary_file, img, width_bytes, self.pitch)
+        return True
+    def image_bytes(self):
+        """Size in bytes of one converted image"""
+        width_bytes = self.width * (4 if self.to_float else 1)
+        if not self.separate_planes:
+            width_bytes *= 3
+        pitch = self.pitch
+        if self.alignment > 0:
+            pitch = int(ceil(width_bytes / float(self.alignment)) *
+                        self.alignment)
+        rows = self.height * (3 if self.separate_planes else 1)
+        return rows * max(width_bytes, pitch)
     def convert(self):
         """Convert images"""
         self.check_arguments()
+        if self.pack_filename:
+            self.convert_packed()
+            return
         for img_file in os.listdir(self.images):
             self.output_filename = 'output/' + os.path.splitext(img_file)[0] + '.bin'
-            img = cv2.imread(self.images + '/' + img_file)
-            if img is None:
-                print("WARNING: Could not read image", self.images + '/' + img_file)
+            with open(self.output_filename, 'wb') as output_file:
+                converted = self.convert_image(img_file, output_file)
+            if not converted:
+                os.remove(self.output_filename)
                 continue
-            # size in bytes for one row
-            width_bytes = self.width
-            # OpenCV reads the image in BGR order.
-            img = cv2.cvtColor(img, cv2.COLOR_BGR2RGB)
-            if self.to_float:
-                img = cv2.resize(img,
-                                 (self.width, self.height)).astype(np.float32)
-                img -= self.px_sub
-                img /= self.px_div
-                # float is used, 4 bytes per pixel
-                width_bytes *= 4
-            else:
-                img = cv2.resize(img, (self.width, self.height))
-            if not self.separate_planes:
-                # RGB interleaved each pixel is containing r, g and b data
-                width_bytes *= 3
-            if self.alignment > 0:
-                self.pitch = int(ceil(width_bytes / float(self.alignment)) *
-                                 self.alignment)
-            if self.separate_planes:
-                r_val, g_val, b_val = cv2.split(img)
-                with open(self.output_filename, 'wb') as output_file:
-                    self.write_data(output_file, r_val, width_bytes,
-                                    self.pitch)
-                    self.write_data(output_file, g_val, width_bytes,
-                                    self.pitch)
-                    self.write_data(output_file, b_val, width_bytes,
-                                    self.pitch)
-            else:
-                with open(self.output_filename, 'wb') as output_file:
-                    self.write_data(output_file, img, width_bytes, self.pitch)
             print("Output file written to {}".format(self.output_filename))
+    def convert_packed(self):
+        """Convert images into a single packed dataset file"""
+        # pylint: disable=too-many-locals
+        # Images are numbered by their file name, e.g. 13453.JPEG as written
+        # by rename_files.py, and stored in that order.
+        img_files = sorted(os.listdir(self.images),
+                           key=lambda f: (not os.path.splitext(f)[0].isdigit(),
+                                          int(os.path.splitext(f)[0])
+                                          if os.path.splitext(f)[0].isdigit()
+                                          else 0, f))
+        labels = b''
+        if self.labels_filename:
+            with open(self.labels_filename, 'rb') as labels_file:
+                labels = labels_file.read()
+        ground_truth = []
+        if self.ground_truth_filename:
+            with open(self.ground_truth_filename, 'r') as ground_truth_file:
+                ground_truth = [int(line) for line in ground_truth_file
+                                if line.strip()]
+        image_bytes = self.image_bytes()
+        image_stride = align_up(image_bytes, self.pack_alignment)
+        index_offset = DATASET_HEADER.size
+        labels_offset = index_offset + len(img_files) * DATASET_INDEX_ENTRY.size
+        data_offset = align_up(labels_offset + len(labels),
+                               self.pack_alignment)
+        index = []
+        with open(self.pack_filename, 'wb') as pack_file:
+            for position, img_file in enumerate(img_files):
+                offset = data_offset + len(index) * image_stride
+                pack_file.seek(offset)
+                if not self.convert_image(img_file, pack_file):
+                    continue
+                stem = os.path.splitext(img_file)[0]
+                image_id = int(stem) if stem.isdigit() else position + 1
+                label = (ground_truth[image_id - 1]
+                         if 0 < image_id <= len(ground_truth) else -1)
+                index.append(DATASET_INDEX_ENTRY.pack(offset, image_id, label))
+                print("Image {} packed as image {}".format(img_file, image_id))
+            # Pad the last image so that every image can be mapped in full.
+            pack_file.truncate(data_offset + len(index) * image_stride)
+            flags = ((DATASET_FLAG_LABELS if labels else 0) |
+                     (DATASET_FLAG_GROUND_TRUTH if ground_truth else 0))
+            pack_file.seek(0)
+            pack_file.write(DATASET_HEADER.pack(
+                DATASET_MAGIC, DATASET_VERSION, DATASET_HEADER.size, flags,
+                self.width, self.height, 3,
+                DATASET_LAYOUT_PLANAR if self.separate_planes
+                else DATASET_LAYOUT_INTERLEAVED,
+                DATASET_DATA_TYPE_FLOAT32 if self.to_float
+                else DATASET_DATA_TYPE_UINT8,
+                self.pitch, len(index), self.pack_alignment,
+                image_bytes, image_stride, index_offset, data_offset,
+                labels_offset if labels else 0, len(labels)))
+            pack_file.write(b''.join(index))
+            pack_file.seek(labels_offset)
+            pack_file.write(labels)
+        print("Packed dataset with {} images written to {}".format(
+            len(index), self.pack_filename))
 def non_empty_str(string):
     """Verify that string is not empty"""
     if not string:
@@ -160,9 +263,10 @@ if __name__ == '__main__':
                         "to float (see option \"--float\"). Default is 1, "
                         "i.e. no division.")
     PARSER.add_argument("-m", "--px-subtraction", metavar="M",
-                        type=non_negative_float, dest="px_sub", default=0,
+                        type=float, dest="px_sub", default=0,
                         help="Subtract the pixel values with M when "
                         "converting to float (see option \"--float\"). "
+                        "M may be negative to add to the values. "
                         "Default is 0, i.e. no subtraction.")
     PARSER.add_argument("-a", "--alignment", metavar="A",
                         type=non_negative_int, dest="alignment", default=0,
@@ -174,6 +278,26 @@ if __name__ == '__main__':
                         help="Row pitch in bytes. Rows will be padded to "
                              "match the pitch. Not to be used when alignment "
                              "is used")
+    PARSER.add_argument("-k", "--pack", metavar="FILE", type=non_empty_str,
+                        dest="pack_filename",
+                        help="Write all images into a single packed dataset "
+                        "FILE instead of one .bin file per image. Images are "
+                        "stored in the order of their numeric file names.")
+    PARSER.add_argument("-l", "--labels", metavar="FILE", type=non_empty_str,
+                        dest="labels_filename",
+                        help="Labels file to embed in the packed dataset "
+                        "(see option \"--pack\").")
+    PARSER.add_argument("-g", "--ground-truth", metavar="FILE",
+                        type=non_empty_str, dest="ground_truth_filename",
+                        help="Annotations file to embed in the packed "
+                        "dataset (see option \"--pack\"). Row N holds the "
+                        "class of image N.")
+    PARSER.add_argument("--pack-alignment", metavar="A",
+                        type=positive_int, dest="pack_alignment",
+                        default=4096,
+                        help="Alignment in bytes of each image in the packed "
+                        "dataset. Must be a multiple of the page size of the "
+                        "device. Default is 4096.")
     PARSER.add_argument("-v", "--version", action="version")
     ARGUMENTS = PARSER.parse_args()
     CONVERT_IMAGE = ConvertImage(**vars(ARGUMENTS))
@@ -0,0 +1,407 @@
+#!/usr/bin/env python3
+
+# Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0>
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# History of the benchmark results, and detection of regressions.
+#
+# Every measurement is appended to a JSON Lines file per device model in the
+# history directory, one file per camera so that the benchmark jobs of
+# different cameras never append to the same file. Entries are never changed.
+#
+# USAGE:
+# python3 ./bench_history.py record /tmp/larod_out.txt
+# python3 ./bench_history.py add-accuracy report.json -m Q1656-LE -v 11.8.61
+# python3 ./bench_history.py compare [-m Q1656-LE] [--base 11.7.57 --new 11.8.61]
+
+import argparse
+import datetime
+import glob
+import hashlib
+import json
+import math
+import os
+import re
+import sys
+
+HISTORY_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                           'history')
+# Version of the entries, increased if their layout changes.
+ENTRY_VERSION = 1
+
+
+#the JSON reports of larod_bench in the log of the test application, one per
+#model. The log may have been joined on one line by the shell, so the end of
+#each report is found by decoding it.
+def extract_bench_reports(larod_output):
+    decoder = json.JSONDecoder()
+    reports = {}
+    regex = r"result: \.\/models(\S+\.(?:tflite|bin)) (?=\{)"
+    for match in re.finditer(regex, larod_output):
+        try:
+            reports[match.group(1)] = decoder.raw_decode(larod_output,
+                                                         match.end())[0]
+        except ValueError:
+            print('Unable to decode the report of ' + match.group(1),
+                  file=sys.stderr)
+    return reports
+
+
+#the mean latency printed by larod-client, as logged by older versions of
+#the test application
+def extract_client_means(larod_output):
+    regex = r"result: \.\/models((.*?).(tflite|bin)) (.*?) job: (.*?) ms"
+    return {match[0]: float(match[4])
+            for match in re.findall(regex, larod_output)}
+
+
+#a "Name:value." line of the log
+def extract_field(larod_output, name):
+    match = re.search(name + r":(.*?)\.(?:\s|$)", larod_output)
+    return match.group(1).strip() if match else None
+
+
+def extract_chip(larod_output):
+    match = re.search(r"Running tests using chip: (\S+)", larod_output)
+    return match.group(1) if match else None
+
+
+def extract_hashes(larod_output):
+    regex = r"sha256: \./models(\S+) ([0-9a-f]{64})"
+    return dict(re.findall(regex, larod_output))
+
+
+def file_sha256(path):
+    digest = hashlib.sha256()
+    with open(path, 'rb') as f:
+        for block in iter(lambda: f.read(1 << 20), b''):
+            digest.update(block)
+    return digest.hexdigest()
+
+
+def history_file(history_dir, device_model):
+    name = re.sub(r'[^A-Za-z0-9._-]+', '_', device_model or 'unknown')
+    return os.path.join(history_dir, name + '.jsonl')
+
+
+#all entries of the history, oldest first
+def read_history(history_dir=HISTORY_DIR):
+    entries = []
+    for path in sorted(glob.glob(os.path.join(history_dir, '*.jsonl'))):
+        with open(path, 'r') as f:
+            entries.extend(json.loads(line) for line in f if line.strip())
+    entries.sort(key=lambda entry: entry['recorded'])
+    return entries
+
+
+def append_entries(entries, history_dir=HISTORY_DIR):
+    os.makedirs(history_dir, exist_ok=True)
+    for entry in entries:
+        with open(history_file(history_dir, entry['device_model']), 'a') as f:
+            f.write(json.dumps(entry, sort_keys=True) + '\n')
+
+
+def new_entry(kind, run, device_model, soc, chip, axis_os, model, sha256):
+    return {'version': ENTRY_VERSION,
+            'kind': kind,
+            'run': run,
+            'recorded': datetime.datetime.now(datetime.timezone.utc)
+                        .strftime('%Y-%m-%dT%H:%M:%SZ'),
+            'device_model': device_model,
+            'soc': soc,
+            'chip': chip,
+            'axis_os': axis_os,
+            'model': model,
+            'model_sha256': sha256}
+
+
+#the entries of one log of the test application. The run is named after the
+#log, so that recording the same log again adds nothing.
+def entries_from_log(larod_output, models_dir=None):
+    run = hashlib.sha256(larod_output.encode('utf-8')).hexdigest()[:16]
+    device_model = extract_field(larod_output, 'Model name')
+    soc = extract_field(larod_output, 'SoC')
+    axis_os = extract_field(larod_output, 'AXIS OS')
+    chip = extract_chip(larod_output)
+    hashes = extract_hashes(larod_output)
+
+    def model_hash(model):
+        if model in hashes:
+            return hashes[model]
+        path = os.path.join(models_dir, model.lstrip('/')) if models_dir else None
+        return file_sha256(path) if path and os.path.isfile(path) else None
+
+    entries = []
+    reports = extract_bench_reports(larod_output)
+    for model, report in reports.items():
+        entry = new_entry('latency', run, device_model, soc,
+                          report.get('device') or chip, axis_os, model,
+                          model_hash(model))
+        for key in ('latency', 'confidence_interval', 'quantiles_ms',
+                    'samples_ms', 'round_p50_ms', 'startup', 'memory'):
+            if key in report:
+                entry[key] = report[key]
+        entries.append(entry)
+    for model, mean in extract_client_means(larod_output).items():
+        if model not in reports:
+            entry = new_entry('latency', run, device_model, soc, chip,
+                              axis_os, model, model_hash(model))
+            entry['latency'] = {'mean_ms': mean}
+            entries.append(entry)
+    return entries
+
+
+def record_log(larod_output, history_dir=HISTORY_DIR, models_dir=None):
+    entries = entries_from_log(larod_output, models_dir)
+    recorded = {(entry['device_model'], entry['run'])
+                for entry in read_history(history_dir)}
+    entries = [entry for entry in entries
+               if (entry['device_model'], entry['run']) not in recorded]
+    append_entries(entries, history_dir)
+    return entries
+
+
+#the results of a run report of the accuracy test
+def entry_from_accuracy(report, device_model, axis_os, soc, sha256):
+    entry = new_entry('accuracy', None, device_model, soc, report.get('device'),
+                      axis_os, report.get('model'), sha256)
+    entry['run'] = hashlib.sha256(json.dumps(report, sort_keys=True)
+                                  .encode('utf-8')).hexdigest()[:16]
+    scored = report.get('scored') or 0
+    accuracy = {'images': report.get('images'), 'scored': scored}
+    for key in ('top1', 'top5'):
+        if key in report:
+            accuracy[key] = report[key]
+            accuracy[key + '_rate'] = report[key] / scored if scored else None
+    for key in ('map', 'map50', 'map75'):
+        if key in report:
+            accuracy[key] = report[key]
+    entry['accuracy'] = accuracy
+    entry['throughput_ips'] = report.get('throughput_ips')
+    if 'startup' in report:
+        entry['startup'] = report['startup']
+    return entry
+
+
+#Mann-Whitney U test of whether the values of new tend to be larger than the
+#values of base. Returns the one-sided p-value from the normal approximation
+#with correction for ties, and the probability that a value of new is larger
+#than a value of base.
+def mann_whitney_greater(base, new):
+    n1 = len(new)
+    n2 = len(base)
+    values = sorted([(v, 0) for v in base] + [(v, 1) for v in new])
+    rank_sum = 0.0
+    ties = 0.0
+    i = 0
+    while i < len(values):
+        j = i
+        while j < len(values) and values[j][0] == values[i][0]:
+            j += 1
+        rank = (i + j + 1) / 2.0
+        rank_sum += rank * sum(1 for v in values[i:j] if v[1] == 1)
+        ties += (j - i) ** 3 - (j - i)
+        i = j
+    u = rank_sum - n1 * (n1 + 1) / 2.0
+    n = n1 + n2
+    variance = n1 * n2 / 12.0 * ((n + 1) - ties / (n * (n - 1)))
+    if variance <= 0.0:
+        return 1.0, 0.5
+    z = (u - n1 * n2 / 2.0 - 0.5) / math.sqrt(variance)
+    return 0.5 * math.erfc(z / math.sqrt(2.0)), u / (n1 * n2)
+
+
+#the typical latency of an entry, the median if it was measured
+def typical_ms(entry):
+    latency = entry.get('latency', {})
+    return latency.get('p50_ms', latency.get('mean_ms'))
+
+
+#compares two latency entries of the same model and device. The test needs
+#the latencies larod_bench picked at random with --samples, which are
+#independent draws from each run. Percentiles are not: their number is fixed
+#whatever the length of the run, so entries that only have percentiles are
+#compared on the change of the median alone, without a p-value, and their
+#verdict says so.
+def compare_entries(base, new, alpha, min_change):
+    result = {'base': base, 'new': new, 'p_value': None, 'p_greater': None}
+    base_ms = typical_ms(base)
+    new_ms = typical_ms(new)
+    result['change'] = (new_ms - base_ms) / base_ms \
+        if base_ms and new_ms is not None else None
+    if base.get('model_sha256') and new.get('model_sha256') and \
+            base['model_sha256'] != new['model_sha256']:
+        result['verdict'] = 'model changed'
+        return result
+    if result['change'] is None:
+        result['verdict'] = 'no baseline'
+        return result
+    if base.get('samples_ms') and new.get('samples_ms'):
+        slower_p, result['p_greater'] = \
+            mann_whitney_greater(base['samples_ms'], new['samples_ms'])
+        faster_p, _ = mann_whitney_greater(new['samples_ms'],
+                                           base['samples_ms'])
+        #the p-value of the direction the median moved in
+        result['p_value'] = slower_p if result['change'] >= 0.0 else faster_p
+        if slower_p < alpha and result['change'] >= min_change:
+            result['verdict'] = 'SLOWER'
+        elif faster_p < alpha and result['change'] <= -min_change:
+            result['verdict'] = 'faster'
+        else:
+            result['verdict'] = 'no change'
+    elif base.get('quantiles_ms') and new.get('quantiles_ms'):
+        _, result['p_greater'] = \
+            mann_whitney_greater(base['quantiles_ms'], new['quantiles_ms'])
+        if result['change'] >= min_change:
+            result['verdict'] = 'slower, untested'
+        elif result['change'] <= -min_change:
+            result['verdict'] = 'faster, untested'
+        else:
+            result['verdict'] = 'no change, untested'
+    else:
+        result['verdict'] = 'no distribution'
+    return result
+
+
+#pairs of latency entries to compare: for every model on every device, the
+#latest entry of the base release against the latest of the new one, or the
+#two latest entries if no releases are given
+def pairs_to_compare(entries, base_os=None, new_os=None, device_model=None,
+                     model=None):
+    groups = {}
+    for entry in entries:
+        if entry['kind'] != 'latency' or \
+                (device_model and entry['device_model'] != device_model) or \
+                (model and model not in entry['model']):
+            continue
+        key = (entry['device_model'], entry['chip'], entry['model'])
+        groups.setdefault(key, []).append(entry)
+    pairs = []
+    for key in sorted(groups, key=lambda k: tuple(str(v) for v in k)):
+        group = groups[key]
+        if base_os or new_os:
+            base = [e for e in group if e['axis_os'] == base_os] if base_os \
+                else group[:-1]
+            new = [e for e in group if e['axis_os'] == new_os] if new_os \
+                else group[-1:]
+            if base and new and base[-1] is not new[-1]:
+                pairs.append((base[-1], new[-1]))
+        elif len(group) >= 2:
+            pairs.append((group[-2], group[-1]))
+    return pairs
+
+
+def print_comparison(results):
+    def ms(entry):
+        value = typical_ms(entry)
+        return '-' if value is None else '%.2f' % value
+
+    print('%-12s %-48s %-12s %-12s %9s %9s %8s %9s  %s' %
+          ('device', 'model', 'base os', 'new os', 'base ms', 'new ms',
+           'change', 'p', 'verdict'))
+    for result in results:
+        base = result['base']
+        new = result['new']
+        print('%-12s %-48s %-12s %-12s %9s %9s %7.1f%% %9s  %s' %
+              (base['device_model'], base['model'], base['axis_os'],
+               new['axis_os'], ms(base), ms(new),
+               100.0 * (result['change'] or 0.0),
+               '-' if result['p_value'] is None else '%.2g' % result['p_value'],
+               result['verdict']))
+
+
+def compare(entries, base_os=None, new_os=None, device_model=None, model=None,
+            alpha=0.01, min_change=0.01):
+    return [compare_entries(base, new, alpha, min_change)
+            for base, new in pairs_to_compare(entries, base_os, new_os,
+                                              device_model, model)]
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Store benchmark results and detect regressions')
+    parser.add_argument('--history', type=str, default=HISTORY_DIR,
+                        help='Directory of the history, one JSON Lines file '
+                             'per device model')
+    commands = parser.add_subparsers(dest='command', required=True)
+
+    record = commands.add_parser(
+        'record', help='Add the results in a log of the test application')
+    record.add_argument('log', type=str, help='Log of the test application')
+    record.add_argument('--models', type=str,
+                        help='Directory of the tested models, to hash the '
+                             'models if the log has no hashes')
+
+    accuracy = commands.add_parser(
+        'add-accuracy', help='Add a --report of the accuracy test')
+    accuracy.add_argument('report', type=str, help='JSON report')
+    accuracy.add_argument('-m', '--device-model', type=str, required=True,
+                          help='Device model, e.g. Q1656-LE')
+    accuracy.add_argument('-v', '--axis-os', type=str, required=True,
+                          help='AXIS OS version of the device')
+    accuracy.add_argument('-s', '--soc', type=str, help='SoC of the device')
+    accuracy.add_argument('-f', '--model-file', type=str,
+                          help='The model that was tested, to hash it')
+
+    comparison = commands.add_parser(
+        'compare', help='Compare the latencies of two runs of every model',
+        description='Compare the latencies of two runs of every model. Runs '
+                    'with latencies picked by larod_bench --samples are '
+                    'tested for a shift of the distribution. Runs with only '
+                    'percentiles are compared on the median alone, since '
+                    'the percentiles are not independent samples, and their '
+                    'verdict is marked untested.')
+    comparison.add_argument('-m', '--device-model', type=str,
+                            help='Only compare on this device model')
+    comparison.add_argument('--model', type=str,
+                            help='Only compare models whose path contains '
+                                 'this')
+    comparison.add_argument('--base', type=str,
+                            help='AXIS OS version to compare against, by '
+                                 'default the run before the latest')
+    comparison.add_argument('--new', type=str,
+                            help='AXIS OS version to compare, by default the '
+                                 'latest run')
+    comparison.add_argument('--alpha', type=float, default=0.01,
+                            help='Significance level of the test of the '
+                                 'sampled latencies')
+    comparison.add_argument('--min-change', type=float, default=0.01,
+                            help='Smallest relative change of the median that '
+                                 'is reported, e.g. 0.01 for 1%%')
+
+    args = parser.parse_args()
+
+    if args.command == 'record':
+        with open(args.log, 'r') as f:
+            entries = record_log(f.read(), args.history, args.models)
+        print('Recorded %d results' % len(entries))
+    elif args.command == 'add-accuracy':
+        with open(args.report, 'r') as f:
+            report = json.load(f)
+        sha256 = file_sha256(args.model_file) if args.model_file else None
+        append_entries([entry_from_accuracy(report, args.device_model,
+                                            args.axis_os, args.soc, sha256)],
+                       args.history)
+    else:
+        results = compare(read_history(args.history), args.base, args.new,
+                          args.device_model, args.model, args.alpha,
+                          args.min_change)
+        print_comparison(results)
+        # A non-zero exit status lets a workflow fail on a regression
+        if any(result['verdict'] == 'SLOWER' for result in results):
+            sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,399 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file parses the arguments to the benchmark.
+ */
+
+#include "argparse.h"
+
+#include <argp.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#define KEY_USAGE (127)
+#define KEY_MIN_ROUNDS (128)
+#define KEY_MAX_ROUNDS (129)
+#define KEY_CI_TARGET (130)
+#define KEY_CONFIDENCE (131)
+#define KEY_RESAMPLES (132)
+#define KEY_SEED (133)
+#define KEY_PUBLIC (134)
+#define KEY_MODEL_ID (135)
+#define KEY_DELETE_MODEL (136)
+#define KEY_MEMORY (137)
+#define KEY_MEMORY_INTERVAL (138)
+#define KEY_LAROD_PID (139)
+#define KEY_QUANTILES (140)
+#define KEY_SOAK (141)
+#define KEY_SOAK_WINDOW (142)
+#define KEY_SAMPLES (143)
+
+// Upper bound for the number of jobs of the warm-up and of every round.
+#define MAX_ITERATIONS (1000000)
+// Upper bound for the number of rounds.
+#define MAX_ROUNDS (1000)
+// Upper bound for the number of bootstrap resamples.
+#define MAX_RESAMPLES (100000)
+// Upper bound for the time between two memory samples, in milliseconds.
+#define MAX_MEMORY_INTERVAL_MS (60000)
+// Upper bound for the number of intervals of the percentiles in the report.
+#define MAX_QUANTILES (1000)
+// Upper bound for the number of latencies picked for the report.
+#define MAX_SAMPLES (100000)
+// Upper bound for the length of a soak run and of its windows, a week.
+#define MAX_SOAK_S (7 * 24 * 3600)
+
+static int parseOpt(int key, char* arg, struct argp_state* state);
+static int parseUInt(const char* arg, unsigned long long* i,
+                     unsigned long long min, unsigned long long max);
+static bool parseOpenFraction(const char* arg, double* value);
+
+const struct argp_option opts[] = {
+    {"device", 'c', "DEVICE", 0,
+     "Chooses device DEVICE to run on, e.g. cpu-tflite or "
+     "axis-a8-dlpu-tflite. If not specified, the default device for a new "
+     "connection will be used.",
+     0},
+    {"warmup", 'w', "N", 0,
+     "Number of jobs run before measuring, to let caches, clocks and the "
+     "device settle. Their latencies are thrown away. Default is 10.",
+     0},
+    {"iterations", 'n', "N", 0,
+     "Number of jobs measured in each round. Default is 100.",
+     0},
+    {"min-rounds", KEY_MIN_ROUNDS, "N", 0,
+     "Smallest number of rounds measured, even if the confidence interval "
+     "is already narrow enough. Default is 2.",
+     0},
+    {"max-rounds", KEY_MAX_ROUNDS, "N", 0,
+     "Largest number of rounds measured. The report tells if the confidence "
+     "interval did not get narrow enough in that many rounds. Default is 20.",
+     0},
+    {"ci-target", KEY_CI_TARGET, "F", 0,
+     "Stop measuring when the confidence interval of the median latency is "
+     "narrower than F times the median. Default is 0.01.",
+     0},
+    {"confidence", KEY_CONFIDENCE, "F", 0,
+     "Confidence level of the intervals. Default is 0.95.",
+     0},
+    {"resamples", KEY_RESAMPLES, "N", 0,
+     "Number of bootstrap resamples of the latencies used to compute the "
+     "confidence intervals. Default is 2000.",
+     0},
+    {"seed", KEY_SEED, "N", 0,
+     "Seed of the bootstrap resampling. Default is 1.",
+     0},
+    {"public", KEY_PUBLIC, NULL, 0,
+     "Load MODEL with public access, so that other processes can use it "
+     "with --model-id without loading it again. The model is left loaded "
+     "when the benchmark exits and its id is in the report.",
+     0},
+    {"model-id", KEY_MODEL_ID, "ID", 0,
+     "Use the public model ID, e.g. loaded by an earlier run with --public, "
+     "instead of loading MODEL. MODEL is then only used as the name of the "
+     "model in the report and may be left out.",
+     0},
+    {"delete-model", KEY_DELETE_MODEL, NULL, 0,
+     "Delete the model from larod when done, also if it is public or was "
+     "given with --model-id.",
+     0},
+    {"memory", KEY_MEMORY, NULL, 0,
+     "Sample the memory of the benchmark and the larod service while the "
+     "model is loaded and run, and add the peak and steady-state RSS, PSS, "
+     "dma-buf and CMA use to the report. Reading the memory of larod needs "
+     "root.",
+     0},
+    {"memory-interval", KEY_MEMORY_INTERVAL, "MS", 0,
+     "Time between two memory samples in milliseconds. Default is 50.",
+     0},
+    {"larod-pid", KEY_LAROD_PID, "PID", 0,
+     "Pid of the larod service to sample with --memory. By default the "
+     "process named larod is used.",
+     0},
+    {"quantiles", KEY_QUANTILES, "N", 0,
+     "Add N + 1 evenly spaced percentiles of the latencies, from the min to "
+     "the max, to the report, so that the whole distribution can be stored "
+     "and compared with later runs. Default is 0, none.",
+     0},
+    {"samples", KEY_SAMPLES, "N", 0,
+     "Add N latencies picked at random from all the measured jobs to the "
+     "report, in the order they were measured, so that a later run can be "
+     "tested for a shift of the distribution. Default is 0, none.",
+     0},
+    {"soak", KEY_SOAK, "SECONDS", 0,
+     "Run jobs for SECONDS of wall-clock time instead of in rounds, e.g. "
+     "1800, to see how the latency drifts as the device heats up. The "
+     "latency of every window of --soak-window is summarized together with "
+     "the temperature of the thermal zones and the CPU frequency, and the "
+     "drift from the first to the last window and the worst window are in "
+     "the report. The latency and intervals of the report are those of the "
+     "last window.",
+     0},
+    {"soak-window", KEY_SOAK_WINDOW, "SECONDS", 0,
+     "Length of a window of --soak. The run is rounded up to whole "
+     "windows. Default is 60.",
+     0},
+    {"output", 'o', "FILE", 0,
+     "Write the JSON report to FILE instead of stdout.",
+     0},
+    {"help", 'h', NULL, 0, "Print this help text and exit.", 0},
+    {"usage", KEY_USAGE, NULL, 0, "Print short usage message and exit.", 0},
+    {0}};
+const struct argp argp = {
+    opts,
+    parseOpt,
+    "[MODEL]",
+    "Measures the latency of larod jobs running MODEL. The time to connect "
+    "to larod, get the device, load the model, allocate its tensors and run "
+    "the first job is measured once. After a warm-up, the jobs are run one "
+    "at a time in rounds and the latency of every job is measured. Rounds "
+    "are added until the bootstrap confidence interval of the median "
+    "latency is narrow enough. A JSON report with the startup times, min, "
+    "p50, p90, p99, max, mean and standard deviation of the latencies and "
+    "the confidence intervals of the median and the mean is written at the "
+    "end.\n\nExample call:\n"
+    "larod_bench -c cpu-tflite /tmp/mobilenet_v2_1.0_224_quant.tflite",
+    NULL,
+    NULL,
+    NULL};
+
+bool parseArgs(int argc, char** argv, args_t* args) {
+    if (argp_parse(&argp, argc, argv, ARGP_NO_HELP, NULL, args)) {
+        return false;
+    }
+    return true;
+}
+
+int parseOpt(int key, char* arg, struct argp_state* state) {
+    args_t* args = state->input;
+    unsigned long long value;
+    int ret;
+
+    switch (key) {
+    case 'c':
+        args->deviceName = arg;
+        break;
+    case 'w':
+        ret = parseUInt(arg, &value, 0, MAX_ITERATIONS);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret,
+                         "invalid number of warm-up jobs");
+        }
+        args->warmup = (size_t) value;
+        break;
+    case 'n':
+        ret = parseUInt(arg, &value, 1, MAX_ITERATIONS);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret,
+                         "invalid number of iterations");
+        }
+        args->iterations = (size_t) value;
+        break;
+    case KEY_MIN_ROUNDS:
+        ret = parseUInt(arg, &value, 1, MAX_ROUNDS);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid number of rounds");
+        }
+        args->minRounds = (size_t) value;
+        break;
+    case KEY_MAX_ROUNDS:
+        ret = parseUInt(arg, &value, 1, MAX_ROUNDS);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid number of rounds");
+        }
+        args->maxRounds = (size_t) value;
+        break;
+    case KEY_CI_TARGET:
+        if (!parseOpenFraction(arg, &args->ciTarget)) {
+            argp_error(state, "invalid confidence interval target %s", arg);
+        }
+        break;
+    case KEY_CONFIDENCE:
+        if (!parseOpenFraction(arg, &args->confidence)) {
+            argp_error(state, "invalid confidence level %s", arg);
+        }
+        break;
+    case KEY_RESAMPLES:
+        ret = parseUInt(arg, &value, 1, MAX_RESAMPLES);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret,
+                         "invalid number of resamples");
+        }
+        args->resamples = (size_t) value;
+        break;
+    case KEY_SEED:
+        ret = parseUInt(arg, &value, 0, ULLONG_MAX - 1);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid seed");
+        }
+        args->seed = (uint64_t) value;
+        break;
+    case KEY_PUBLIC:
+        args->publicModel = true;
+        break;
+    case KEY_MODEL_ID:
+        ret = parseUInt(arg, &value, 1, ULLONG_MAX - 1);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid model id");
+        }
+        args->modelId = (uint64_t) value;
+        break;
+    case KEY_DELETE_MODEL:
+        args->deleteModel = true;
+        break;
+    case KEY_MEMORY:
+        args->memory = true;
+        break;
+    case KEY_MEMORY_INTERVAL:
+        ret = parseUInt(arg, &value, 1, MAX_MEMORY_INTERVAL_MS);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid memory interval");
+        }
+        args->memoryIntervalMs = (unsigned) value;
+        break;
+    case KEY_LAROD_PID:
+        ret = parseUInt(arg, &value, 1, INT_MAX);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid larod pid");
+        }
+        args->larodPid = (pid_t) value;
+        break;
+    case KEY_QUANTILES:
+        ret = parseUInt(arg, &value, 0, MAX_QUANTILES);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret,
+                         "invalid number of quantiles");
+        }
+        args->quantiles = (size_t) value;
+        break;
+    case KEY_SAMPLES:
+        ret = parseUInt(arg, &value, 0, MAX_SAMPLES);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret,
+                         "invalid number of samples");
+        }
+        args->samples = (size_t) value;
+        break;
+    case KEY_SOAK:
+        ret = parseUInt(arg, &value, 1, MAX_SOAK_S);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid soak time");
+        }
+        args->soakS = (unsigned) value;
+        break;
+    case KEY_SOAK_WINDOW:
+        ret = parseUInt(arg, &value, 1, MAX_SOAK_S);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid soak window");
+        }
+        args->soakWindowS = (unsigned) value;
+        break;
+    case 'o':
+        args->outputFile = arg;
+        break;
+    case 'h':
+        argp_state_help(state, stdout, ARGP_HELP_STD_HELP);
+        break;
+    case KEY_USAGE:
+        argp_state_help(state, stdout, ARGP_HELP_USAGE | ARGP_HELP_EXIT_OK);
+        break;
+    case ARGP_KEY_ARG:
+        if (state->arg_num == 0) {
+            args->modelFile = arg;
+        } else {
+            argp_error(state, "Too many arguments given");
+        }
+        break;
+    case ARGP_KEY_INIT:
+        args->modelFile = NULL;
+        args->modelId = 0;
+        args->publicModel = false;
+        args->deleteModel = false;
+        args->deviceName = NULL;
+        args->outputFile = NULL;
+        args->warmup = 10;
+        args->iterations = 100;
+        args->minRounds = 2;
+        args->maxRounds = 20;
+        args->ciTarget = 0.01;
+        args->confidence = 0.95;
+        args->resamples = 2000;
+        args->seed = 1;
+        args->memory = false;
+        args->memoryIntervalMs = 50;
+        args->larodPid = 0;
+        args->quantiles = 0;
+        args->samples = 0;
+        args->soakS = 0;
+        args->soakWindowS = 60;
+        break;
+    case ARGP_KEY_END:
+        if (state->arg_num != 1 && !(state->arg_num == 0 && args->modelId)) {
+            argp_error(state, "Invalid number of arguments given");
+        }
+        if (args->publicModel && args->modelId) {
+            argp_error(state, "--public cannot be combined with --model-id");
+        }
+        if (args->minRounds > args->maxRounds) {
+            argp_error(state, "--min-rounds is larger than --max-rounds");
+        }
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+/**
+ * brief Parses a string as an unsigned long long in a range
+ *
+ * param arg String to parse.
+ * param i Pointer to the number being the result of parsing.
+ * param min Smallest number allowed.
+ * param max Largest number allowed.
+ * return Positive errno style return code (zero means success).
+ */
+static int parseUInt(const char* arg, unsigned long long* i,
+                     unsigned long long min, unsigned long long max) {
+    char* endPtr;
+
+    *i = strtoull(arg, &endPtr, 0);
+    if (endPtr == arg || *endPtr != '\0' || arg[0] == '-') {
+        return EINVAL;
+    } else if (*i == ULLONG_MAX || *i < min || *i > max) {
+        return ERANGE;
+    }
+
+    return 0;
+}
+
+/**
+ * brief Parses a number between 0 and 1, both excluded
+ *
+ * param arg String to parse.
+ * param value Pointer to the parsed number.
+ * return False if the string is not a number between 0 and 1, otherwise true.
+ */
+static bool parseOpenFraction(const char* arg, double* value) {
+    char* endPtr;
+
+    *value = strtod(arg, &endPtr);
+
+    return endPtr != arg && *endPtr == '\0' && *value > 0.0 && *value < 1.0;
+}
@@ -0,0 +1,70 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file parses the arguments to the benchmark.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct args_t {
+    // Model file, may be NULL if modelId is given.
+    char* modelFile;
+    // Id of a public model to get instead of loading modelFile, 0 if not
+    // given.
+    uint64_t modelId;
+    // Load modelFile as a public model and leave it loaded.
+    bool publicModel;
+    // Delete the model when done, also if it is public.
+    bool deleteModel;
+    // Device to run on, NULL for the default device of the connection.
+    char* deviceName;
+    // JSON report file, NULL to print the report on stdout.
+    char* outputFile;
+    // Jobs run and thrown away before measuring.
+    size_t warmup;
+    // Jobs measured per round.
+    size_t iterations;
+    size_t minRounds;
+    size_t maxRounds;
+    // Width of the confidence interval of the median, relative to the
+    // median, at which the measurement stops.
+    double ciTarget;
+    double confidence;
+    size_t resamples;
+    uint64_t seed;
+    // Sample the memory of the benchmark and the larod service.
+    bool memory;
+    // Time between two memory samples, in milliseconds.
+    unsigned memoryIntervalMs;
+    // Pid of the larod service, 0 to look it up by name.
+    pid_t larodPid;
+    // Number of intervals of the percentiles in the report, 0 for none.
+    size_t quantiles;
+    // Number of latencies picked at random for the report, 0 for none.
+    size_t samples;
+    // Wall-clock time of a soak run in seconds, 0 to measure in rounds.
+    unsigned soakS;
+    // Length of a window of a soak run, in seconds.
+    unsigned soakWindowS;
+} args_t;
+
+bool parseArgs(int argc, char** argv, args_t* args);
@@ -0,0 +1,182 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file implements the larod job run by the benchmarks.
+ */
+
+#include "benchjob.h"
+
+#include <syslog.h>
+
+bool benchSetupJob(const benchJobConfig* config, int modelFd, benchJob* job,
+                   const char** deviceName, benchStartup* startup) {
+    larodError* error = NULL;
+    bool ret = false;
+
+    uint64_t startNs = benchNowNs();
+    if (!larodConnect(&job->conn, &error)) {
+        syslog(LOG_ERR, "Could not connect to larod: %s", error->msg);
+        goto end;
+    }
+    uint64_t endNs = benchNowNs();
+    startup->connectNs = endNs - startNs;
+
+    startNs = endNs;
+    const larodDevice* dev =
+        larodGetDevice(job->conn, config->deviceName, 0, &error);
+    if (!dev) {
+        syslog(LOG_ERR, "Unable to get device %s: %s",
+               config->deviceName ? config->deviceName : "(default)",
+               error->msg);
+        goto end;
+    }
+    endNs = benchNowNs();
+    startup->deviceNs = endNs - startNs;
+    *deviceName = larodGetDeviceName(dev, &error);
+    if (!*deviceName) {
+        syslog(LOG_ERR, "Unable to get device name: %s", error->msg);
+        goto end;
+    }
+
+    // A model got by id runs on the device it was loaded on.
+    startNs = benchNowNs();
+    if (config->modelId) {
+        job->model = larodGetModel(job->conn, config->modelId, &error);
+        if (!job->model) {
+            syslog(LOG_ERR, "Unable to get model %llu: %s",
+                   (unsigned long long) config->modelId, error->msg);
+            goto end;
+        }
+    } else {
+        job->model = larodLoadModel(job->conn, modelFd, dev,
+                                    config->publicModel
+                                        ? LAROD_ACCESS_PUBLIC
+                                        : LAROD_ACCESS_PRIVATE,
+                                    "Benchmark model", NULL, &error);
+        if (!job->model) {
+            syslog(LOG_ERR, "Unable to load model: %s", error->msg);
+            goto end;
+        }
+    }
+    endNs = benchNowNs();
+    startup->loadNs = endNs - startNs;
+    startup->reused = config->modelId != 0;
+    startup->publicModel = config->publicModel || startup->reused;
+    job->keepModel = startup->publicModel && !config->deleteModel;
+    startup->modelId = larodGetModelId(job->model, &error);
+    if (startup->modelId == LAROD_INVALID_MODEL_ID) {
+        syslog(LOG_ERR, "Unable to get model id: %s", error->msg);
+        goto end;
+    }
+
+    startNs = endNs;
+    job->inputs = larodAllocModelInputs(job->conn, job->model, 0,
+                                        &job->numInputs, NULL, &error);
+    if (!job->inputs) {
+        syslog(LOG_ERR, "Failed allocating input tensors: %s", error->msg);
+        goto end;
+    }
+    job->outputs = larodAllocModelOutputs(job->conn, job->model, 0,
+                                          &job->numOutputs, NULL, &error);
+    if (!job->outputs) {
+        syslog(LOG_ERR, "Failed allocating output tensors: %s", error->msg);
+        goto end;
+    }
+
+    job->request = larodCreateJobRequest(job->model, job->inputs,
+                                         job->numInputs, job->outputs,
+                                         job->numOutputs, NULL, &error);
+    if (!job->request) {
+        syslog(LOG_ERR, "Failed creating job request: %s", error->msg);
+        goto end;
+    }
+    startup->allocNs = benchNowNs() - startNs;
+
+    ret = true;
+
+end:
+    larodClearError(&error);
+
+    return ret;
+}
+
+void benchDestroyJob(benchJob* job) {
+    larodError* error = NULL;
+
+    larodDestroyJobRequest(&job->request);
+    if (job->inputs &&
+        !larodDestroyTensors(job->conn, &job->inputs, job->numInputs, &error)) {
+        syslog(LOG_ERR, "Failed to destroy input tensors: %s", error->msg);
+        larodClearError(&error);
+    }
+    if (job->outputs &&
+        !larodDestroyTensors(job->conn, &job->outputs, job->numOutputs,
+                             &error)) {
+        syslog(LOG_ERR, "Failed to destroy output tensors: %s", error->msg);
+        larodClearError(&error);
+    }
+    if (job->model && !job->keepModel &&
+        !larodDeleteModel(job->conn, job->model, &error)) {
+        syslog(LOG_ERR, "Unable to delete model: %s", error->msg);
+        larodClearError(&error);
+    }
+    larodDestroyModel(&job->model);
+    if (job->conn && !larodDisconnect(&job->conn, &error)) {
+        syslog(LOG_ERR, "Failed to disconnect: %s", error->msg);
+        larodClearError(&error);
+    }
+}
+
+bool benchRunJobs(const benchJob* job, size_t count, benchSamples* samples) {
+    larodError* error = NULL;
+
+    for (size_t i = 0; i < count; i++) {
+        const uint64_t startNs = benchNowNs();
+        if (!larodRunJob(job->conn, job->request, &error)) {
+            syslog(LOG_ERR, "Unable to run job: %s (%d)", error->msg,
+                   error->code);
+            larodClearError(&error);
+            return false;
+        }
+        const uint64_t endNs = benchNowNs();
+
+        if (samples && !benchAddSample(samples, endNs - startNs)) {
+            syslog(LOG_ERR, "Out of memory for latencies");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void benchWriteJsonString(FILE* file, const char* str) {
+    if (!str) {
+        fputs("null", file);
+        return;
+    }
+    fputc('"', file);
+    for (const unsigned char* c = (const unsigned char*) str; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(file, "\\u%04x", *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
@@ -0,0 +1,113 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file declares the larod job run by the benchmarks: a
+ * connection of its own, a loaded model, tensors allocated by larod and a
+ * job request, set up and run the same way by larod_bench and larod_mix.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "benchstats.h"
+#include "larod.h"
+
+typedef struct benchJobConfig {
+    // Device to run on, NULL for the default device of the connection.
+    const char* deviceName;
+    // Id of a public model to get instead of loading the model file, 0 to
+    // load it.
+    uint64_t modelId;
+    // Load the model as a public model and leave it loaded.
+    bool publicModel;
+    // Delete the model when done, also if it is public.
+    bool deleteModel;
+} benchJobConfig;
+
+typedef struct benchJob {
+    larodConnection* conn;
+    larodModel* model;
+    larodTensor** inputs;
+    size_t numInputs;
+    larodTensor** outputs;
+    size_t numOutputs;
+    larodJobRequest* request;
+    // Leave the model loaded when done.
+    bool keepModel;
+} benchJob;
+
+typedef struct benchStartup {
+    uint64_t modelId;
+    bool publicModel;
+    // The model was got by id instead of loaded.
+    bool reused;
+    uint64_t connectNs;
+    uint64_t deviceNs;
+    // Time to load the model, or to get it if reused.
+    uint64_t loadNs;
+    uint64_t allocNs;
+    uint64_t firstJobNs;
+} benchStartup;
+
+/**
+ * brief Connects to larod, loads or gets the model and sets up a job running
+ * it, timing each step.
+ *
+ * The tensors are allocated by larod, so they are of the kind the device
+ * prefers, and their contents are left as allocated.
+ *
+ * param config Device and model to use.
+ * param modelFd File descriptor of the model file, -1 if config->modelId is
+ * given.
+ * param job Pointer to the zero initialized job to set up. Everything set up
+ * is released by benchDestroyJob, also if this fails.
+ * param deviceName Pointer to the name of the device, set on success.
+ * param startup Pointer to the startup times, set on success.
+ * return False if any error occurred, otherwise true.
+ */
+bool benchSetupJob(const benchJobConfig* config, int modelFd, benchJob* job,
+                   const char** deviceName, benchStartup* startup);
+
+/**
+ * brief Releases everything set up by benchSetupJob.
+ *
+ * param job The job.
+ */
+void benchDestroyJob(benchJob* job);
+
+/**
+ * brief Runs the job a number of times, one job at a time.
+ *
+ * param job The job.
+ * param count Number of jobs to run.
+ * param samples Samples to add the latency of every job to, NULL to not
+ * measure.
+ * return False if a job failed or out of memory, otherwise true.
+ */
+bool benchRunJobs(const benchJob* job, size_t count, benchSamples* samples);
+
+/**
+ * brief Writes a string as a JSON string, with quotes and escapes.
+ *
+ * param file File to write to.
+ * param str String to write, NULL is written as null.
+ */
+void benchWriteJsonString(FILE* file, const char* str);
@@ -0,0 +1,333 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file implements the statistics of the job latencies.
+ */
+
+#include "benchstats.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * brief Orders two uint64_t values, for qsort.
+ *
+ * param a Pointer to the first value.
+ * param b Pointer to the second value.
+ * return Negative, zero or positive as a is less than, equal to or greater
+ * than b.
+ */
+static int compareNs(const void* a, const void* b);
+
+/**
+ * brief Orders two doubles, for qsort.
+ *
+ * param a Pointer to the first value.
+ * param b Pointer to the second value.
+ * return Negative, zero or positive as a is less than, equal to or greater
+ * than b.
+ */
+static int compareDouble(const void* a, const void* b);
+
+/**
+ * brief Returns a percentile of sorted values, interpolating linearly
+ * between the two closest values.
+ *
+ * param sorted Sorted values.
+ * param count Number of values, at least one.
+ * param percentile Percentile between 0 and 100.
+ * return The percentile.
+ */
+static double percentileNs(const uint64_t* sorted, size_t count,
+                           double percentile);
+
+/**
+ * brief Same as percentileNs, for doubles.
+ */
+static double percentileDouble(const double* sorted, size_t count,
+                               double percentile);
+
+/**
+ * brief Returns the median of values, reordering them.
+ *
+ * Quickselect, so linear in the number of values on average.
+ *
+ * param values Values, reordered on return.
+ * param count Number of values, at least one.
+ * return The median, the mean of the two middle values for an even count.
+ */
+static double medianNs(uint64_t* values, size_t count);
+
+/**
+ * brief Returns the next number of a xorshift64* generator.
+ *
+ * param state State of the generator, never 0.
+ * return A pseudo-random number.
+ */
+static uint64_t nextRandom(uint64_t* state);
+
+static int compareNs(const void* a, const void* b) {
+    const uint64_t x = *(const uint64_t*) a;
+    const uint64_t y = *(const uint64_t*) b;
+
+    return (x > y) - (x < y);
+}
+
+static int compareDouble(const void* a, const void* b) {
+    const double x = *(const double*) a;
+    const double y = *(const double*) b;
+
+    return (x > y) - (x < y);
+}
+
+static double percentileNs(const uint64_t* sorted, size_t count,
+                           double percentile) {
+    const double pos = percentile / 100.0 * (double) (count - 1);
+    const double floorPos = floor(pos);
+    const size_t lower = (size_t) floorPos;
+    if (lower + 1 >= count) {
+        return (double) sorted[count - 1];
+    }
+    const double frac = pos - floorPos;
+
+    return (double) sorted[lower] +
+           frac * ((double) sorted[lower + 1] - (double) sorted[lower]);
+}
+
+static double percentileDouble(const double* sorted, size_t count,
+                               double percentile) {
+    const double pos = percentile / 100.0 * (double) (count - 1);
+    const double floorPos = floor(pos);
+    const size_t lower = (size_t) floorPos;
+    if (lower + 1 >= count) {
+        return sorted[count - 1];
+    }
+    const double frac = pos - floorPos;
+
+    return sorted[lower] + frac * (sorted[lower + 1] - sorted[lower]);
+}
+
+static double medianNs(uint64_t* values, size_t count) {
+    const size_t k = (count - 1) / 2;
+    size_t left = 0;
+    size_t right = count - 1;
+
+    // Partition around the middle value until position k holds the value it
+    // would hold if the values were sorted.
+    while (left < right) {
+        const uint64_t pivot = values[left + (right - left) / 2];
+        size_t i = left;
+        size_t j = right;
+        while (i <= j) {
+            while (values[i] < pivot) {
+                i++;
+            }
+            while (values[j] > pivot) {
+                j--;
+            }
+            if (i <= j) {
+                const uint64_t tmp = values[i];
+                values[i] = values[j];
+                values[j] = tmp;
+                i++;
+                if (j == 0) {
+                    break;
+                }
+                j--;
+            }
+        }
+        if (k <= j) {
+            right = j;
+        } else if (k >= i) {
+            left = i;
+        } else {
+            break;
+        }
+    }
+
+    if (count % 2) {
+        return (double) values[k];
+    }
+    // Everything after k is at least values[k], the other middle value is
+    // the smallest of them.
+    uint64_t upper = values[k + 1];
+    for (size_t i = k + 2; i < count; i++) {
+        if (values[i] < upper) {
+            upper = values[i];
+        }
+    }
+
+    return ((double) values[k] + (double) upper) / 2.0;
+}
+
+static uint64_t nextRandom(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+uint64_t benchNowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+bool benchAddSample(benchSamples* samples, uint64_t ns) {
+    if (samples->count == samples->capacity) {
+        const size_t capacity = samples->capacity ? 2 * samples->capacity
+                                                  : 1024;
+        uint64_t* grown = realloc(samples->ns, capacity * sizeof(uint64_t));
+        if (!grown) {
+            return false;
+        }
+        samples->ns = grown;
+        samples->capacity = capacity;
+    }
+    samples->ns[samples->count++] = ns;
+
+    return true;
+}
+
+void benchFreeSamples(benchSamples* samples) {
+    free(samples->ns);
+    samples->ns = NULL;
+    samples->count = 0;
+    samples->capacity = 0;
+}
+
+bool benchSummarize(const benchSamples* samples, benchSummary* summary) {
+    const size_t n = samples->count;
+    uint64_t* sorted = malloc(n * sizeof(uint64_t));
+    if (!sorted) {
+        return false;
+    }
+    memcpy(sorted, samples->ns, n * sizeof(uint64_t));
+    qsort(sorted, n, sizeof(uint64_t), compareNs);
+
+    double sum = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        sum += (double) sorted[i];
+    }
+    const double mean = sum / (double) n;
+    double squares = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        const double diff = (double) sorted[i] - mean;
+        squares += diff * diff;
+    }
+
+    summary->count = n;
+    summary->minMs = (double) sorted[0] / 1e6;
+    summary->p50Ms = percentileNs(sorted, n, 50.0) / 1e6;
+    summary->p90Ms = percentileNs(sorted, n, 90.0) / 1e6;
+    summary->p99Ms = percentileNs(sorted, n, 99.0) / 1e6;
+    summary->maxMs = (double) sorted[n - 1] / 1e6;
+    summary->meanMs = mean / 1e6;
+    summary->stddevMs = n > 1 ? sqrt(squares / (double) (n - 1)) / 1e6 : 0.0;
+
+    free(sorted);
+
+    return true;
+}
+
+bool benchQuantiles(const benchSamples* samples, size_t count,
+                    double* quantilesMs) {
+    const size_t n = samples->count;
+    uint64_t* sorted = malloc(n * sizeof(uint64_t));
+    if (!sorted) {
+        return false;
+    }
+    memcpy(sorted, samples->ns, n * sizeof(uint64_t));
+    qsort(sorted, n, sizeof(uint64_t), compareNs);
+
+    for (size_t i = 0; i <= count; i++) {
+        quantilesMs[i] =
+            percentileNs(sorted, n, 100.0 * (double) i / (double) count) / 1e6;
+    }
+
+    free(sorted);
+
+    return true;
+}
+
+size_t benchSubsample(const benchSamples* samples, size_t count, uint64_t seed,
+                      double* samplesMs) {
+    const size_t n = samples->count;
+    size_t taken = 0;
+
+    // Selection sampling: every latency is picked with probability the
+    // number still to pick over the number left.
+    uint64_t state = seed ? seed : 1;
+    for (size_t i = 0; i < n && taken < count; i++) {
+        if (nextRandom(&state) % (n - i) < count - taken) {
+            samplesMs[taken++] = (double) samples->ns[i] / 1e6;
+        }
+    }
+
+    return taken;
+}
+
+bool benchBootstrap(const benchSamples* samples, double level,
+                    size_t resamples, uint64_t seed, benchInterval* interval) {
+    const size_t n = samples->count;
+    bool ret = false;
+    uint64_t* resample = malloc(n * sizeof(uint64_t));
+    double* medians = malloc(resamples * sizeof(double));
+    double* means = malloc(resamples * sizeof(double));
+    if (!resample || !medians || !means) {
+        goto end;
+    }
+
+    // xorshift64* must not start at 0.
+    uint64_t state = seed ? seed : 1;
+    for (size_t r = 0; r < resamples; r++) {
+        double sum = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            const uint64_t ns = samples->ns[nextRandom(&state) % n];
+            resample[i] = ns;
+            sum += (double) ns;
+        }
+        means[r] = sum / (double) n;
+        medians[r] = medianNs(resample, n);
+    }
+    qsort(medians, resamples, sizeof(double), compareDouble);
+    qsort(means, resamples, sizeof(double), compareDouble);
+
+    const double tail = (1.0 - level) / 2.0 * 100.0;
+    interval->level = level;
+    interval->resamples = resamples;
+    interval->p50LowMs = percentileDouble(medians, resamples, tail) / 1e6;
+    interval->p50HighMs =
+        percentileDouble(medians, resamples, 100.0 - tail) / 1e6;
+    interval->meanLowMs = percentileDouble(means, resamples, tail) / 1e6;
+    interval->meanHighMs =
+        percentileDouble(means, resamples, 100.0 - tail) / 1e6;
+    ret = true;
+
+end:
+    free(resample);
+    free(medians);
+    free(means);
+
+    return ret;
+}
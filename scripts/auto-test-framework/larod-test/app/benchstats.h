@@ -0,0 +1,141 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file declares the statistics of the job latencies measured by
+ * the benchmark.
+ *
+ * Every latency is kept, so the percentiles are exact. A benchmark runs
+ * thousands of jobs at most, a few kB of samples.
+ *
+ * The confidence intervals are percentile bootstrap intervals: the samples
+ * are resampled with replacement, the statistic is computed on every
+ * resample, and the interval is the range holding the middle part of those
+ * values. The resampling uses its own seeded generator, so the same samples
+ * always give the same interval.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct benchSamples {
+    uint64_t* ns;
+    size_t count;
+    size_t capacity;
+} benchSamples;
+
+typedef struct benchSummary {
+    size_t count;
+    double minMs;
+    double p50Ms;
+    double p90Ms;
+    double p99Ms;
+    double maxMs;
+    double meanMs;
+    double stddevMs;
+} benchSummary;
+
+typedef struct benchInterval {
+    // Confidence level, e.g. 0.95.
+    double level;
+    size_t resamples;
+    double p50LowMs;
+    double p50HighMs;
+    double meanLowMs;
+    double meanHighMs;
+} benchInterval;
+
+/**
+ * brief Reads the monotonic clock.
+ *
+ * return Time in nanoseconds from an arbitrary starting point.
+ */
+uint64_t benchNowNs(void);
+
+/**
+ * brief Adds one latency to the samples, growing the array if needed.
+ *
+ * param samples The samples, zero initialized before the first call.
+ * param ns The latency in nanoseconds.
+ * return False if out of memory, otherwise true.
+ */
+bool benchAddSample(benchSamples* samples, uint64_t ns);
+
+/**
+ * brief Frees the samples.
+ *
+ * param samples The samples. Left empty and can be reused.
+ */
+void benchFreeSamples(benchSamples* samples);
+
+/**
+ * brief Computes min, percentiles, max, mean and standard deviation.
+ *
+ * Percentiles interpolate linearly between the two closest samples. The
+ * standard deviation is the sample standard deviation, 0 for one sample.
+ *
+ * param samples The samples, at least one.
+ * param summary Pointer to the summary to fill in.
+ * return False if out of memory, otherwise true.
+ */
+bool benchSummarize(const benchSamples* samples, benchSummary* summary);
+
+/**
+ * brief Computes evenly spaced percentiles, a compact form of the whole
+ * distribution that can be stored and compared between runs.
+ *
+ * param samples The samples, at least one.
+ * param count Number of intervals, count + 1 percentiles are computed from
+ * the min to the max.
+ * param quantilesMs Array of count + 1 percentiles to fill in.
+ * return False if out of memory, otherwise true.
+ */
+bool benchQuantiles(const benchSamples* samples, size_t count,
+                    double* quantilesMs);
+
+/**
+ * brief Picks a random subset of the latencies, in the order they were
+ * measured.
+ *
+ * Every subset of the same size is equally likely, so the subset is a sample
+ * of independent latencies that a later run can be tested against, unlike
+ * percentiles, whose number does not depend on how many jobs were run.
+ *
+ * param samples The samples.
+ * param count Number of latencies to pick.
+ * param seed Seed of the choice, the same seed gives the same subset.
+ * param samplesMs Array of count latencies to fill in.
+ * return Number of latencies picked, the smaller of count and the number of
+ * samples.
+ */
+size_t benchSubsample(const benchSamples* samples, size_t count, uint64_t seed,
+                      double* samplesMs);
+
+/**
+ * brief Computes bootstrap confidence intervals of the median and the mean.
+ *
+ * param samples The samples, at least one.
+ * param level Confidence level between 0 and 1.
+ * param resamples Number of resamples, at least one.
+ * param seed Seed of the resampling, the same seed gives the same result.
+ * param interval Pointer to the intervals to fill in.
+ * return False if out of memory, otherwise true.
+ */
+bool benchBootstrap(const benchSamples* samples, double level,
+                    size_t resamples, uint64_t seed, benchInterval* interval);
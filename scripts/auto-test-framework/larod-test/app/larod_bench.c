@@ -0,0 +1,424 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * - larod_bench -
+ *
+ * This application measures the latency of inference jobs on a larod device.
+ *
+ * The model is loaded once and its input and output tensors are allocated by
+ * larod. How long it takes to connect, get the device, load the model,
+ * allocate the tensors and run the first job is measured, since for large
+ * models this is a large part of the startup of an application. A public
+ * model loaded by an earlier run can be used by id instead, to measure what
+ * reusing it saves.
+ *
+ * After a warm-up, the same job is run synchronously in rounds and the time
+ * of every larodRunJob call is recorded. After each round the bootstrap
+ * confidence interval of the median latency is computed, and the
+ * measurement stops when it is narrow enough or when the largest number of
+ * rounds is reached.
+ *
+ * With --soak, the jobs are instead run for a fixed wall-clock time, and the
+ * latency, temperature and CPU frequency are followed window by window, see
+ * soak.h.
+ *
+ * With --memory, the memory of the benchmark and the larod service is
+ * sampled in a thread while the model is loaded and run, see memprof.h.
+ *
+ * The result is a JSON report on one line, printed on stdout or written to
+ * a file, so that it can be read by scripts instead of scraping the output
+ * of larod-client.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "argparse.h"
+#include "benchjob.h"
+#include "benchstats.h"
+#include "memprof.h"
+#include "soak.h"
+
+typedef struct benchResult {
+    const char* deviceName;
+    benchStartup startup;
+    size_t rounds;
+    bool converged;
+    benchSummary summary;
+    benchInterval interval;
+    // Median latency of every round, to see drift between rounds.
+    double* roundP50Ms;
+    // Evenly spaced percentiles of all latencies, NULL unless asked for.
+    double* quantilesMs;
+    // Latencies picked at random from all jobs, NULL unless asked for.
+    double* samplesMs;
+    size_t numSamples;
+    // Memory used while loading and running, NULL without --memory.
+    memprof* memory;
+    // Windows of a soak run, NULL without --soak.
+    soak* soak;
+} benchResult;
+
+/**
+ * brief Measures rounds of jobs until the confidence interval of the median
+ * is narrow enough.
+ *
+ * param job The job.
+ * param args The arguments.
+ * param samples Samples of all rounds, filled in.
+ * param result Pointer to the result to fill in.
+ * return False if a job failed or out of memory, otherwise true.
+ */
+static bool measure(const benchJob* job, const args_t* args,
+                    benchSamples* samples, benchResult* result);
+
+/**
+ * brief Runs jobs window by window for the time of a soak run.
+ *
+ * The summary and confidence intervals of the result are those of the last
+ * window, the steady state.
+ *
+ * param job The job.
+ * param args The arguments.
+ * param samples Samples of the last window, filled in.
+ * param result Pointer to the result to fill in.
+ * return False if a job failed or out of memory, otherwise true.
+ */
+static bool runSoak(const benchJob* job, const args_t* args,
+                    benchSamples* samples, benchResult* result);
+
+/**
+ * brief Writes the JSON report of a benchmark on one line.
+ *
+ * param file File to write to.
+ * param args The arguments.
+ * param result The result.
+ */
+static void writeReport(FILE* file, const args_t* args,
+                        const benchResult* result);
+
+static bool measure(const benchJob* job, const args_t* args,
+                    benchSamples* samples, benchResult* result) {
+    benchSamples round = {0};
+    bool ret = false;
+
+    result->roundP50Ms = malloc(args->maxRounds * sizeof(double));
+    if (!result->roundP50Ms) {
+        syslog(LOG_ERR, "Out of memory for rounds");
+        goto end;
+    }
+
+    for (result->rounds = 0; result->rounds < args->maxRounds;) {
+        round.count = 0;
+        if (!benchRunJobs(job, args->iterations, &round)) {
+            goto end;
+        }
+        for (size_t i = 0; i < round.count; i++) {
+            if (!benchAddSample(samples, round.ns[i])) {
+                syslog(LOG_ERR, "Out of memory for latencies");
+                goto end;
+            }
+        }
+
+        benchSummary roundSummary;
+        if (!benchSummarize(&round, &roundSummary) ||
+            !benchSummarize(samples, &result->summary) ||
+            !benchBootstrap(samples, args->confidence, args->resamples,
+                            args->seed, &result->interval)) {
+            syslog(LOG_ERR, "Out of memory for statistics");
+            goto end;
+        }
+        result->roundP50Ms[result->rounds++] = roundSummary.p50Ms;
+
+        const double width =
+            result->interval.p50HighMs - result->interval.p50LowMs;
+        result->converged = width <= args->ciTarget * result->summary.p50Ms;
+        syslog(LOG_INFO, "Round %zu: p50 %.3f ms, all rounds p50 %.3f ms, "
+               "%g%% interval %.3f - %.3f ms", result->rounds,
+               roundSummary.p50Ms, result->summary.p50Ms,
+               100.0 * args->confidence, result->interval.p50LowMs,
+               result->interval.p50HighMs);
+        if (result->converged && result->rounds >= args->minRounds) {
+            break;
+        }
+    }
+
+    if (!result->converged) {
+        syslog(LOG_WARNING, "The confidence interval of the median is wider "
+               "than %g times the median after %zu rounds", args->ciTarget,
+               result->rounds);
+    }
+    ret = true;
+
+end:
+    benchFreeSamples(&round);
+
+    return ret;
+}
+
+static bool runSoak(const benchJob* job, const args_t* args,
+                    benchSamples* samples, benchResult* result) {
+    const size_t numWindows =
+        (args->soakS + args->soakWindowS - 1) / args->soakWindowS;
+    const uint64_t windowNs = (uint64_t) args->soakWindowS * 1000000000ULL;
+
+    if (!soakCreate(args->soakWindowS, numWindows, &result->soak)) {
+        syslog(LOG_ERR, "Out of memory for the soak windows");
+        return false;
+    }
+    syslog(LOG_INFO, "Soaking for %zu windows of %u s", numWindows,
+           args->soakWindowS);
+    for (size_t w = 0; w < numWindows; w++) {
+        const uint64_t startNs = benchNowNs();
+        uint64_t nowNs = startNs;
+        samples->count = 0;
+        while (nowNs - startNs < windowNs) {
+            if (!benchRunJobs(job, 1, samples)) {
+                return false;
+            }
+            nowNs = benchNowNs();
+        }
+        if (!soakAddWindow(result->soak, samples, nowNs - startNs)) {
+            syslog(LOG_ERR, "Out of memory for statistics");
+            return false;
+        }
+    }
+    soakLog(result->soak);
+
+    if (!benchSummarize(samples, &result->summary) ||
+        !benchBootstrap(samples, args->confidence, args->resamples,
+                        args->seed, &result->interval)) {
+        syslog(LOG_ERR, "Out of memory for statistics");
+        return false;
+    }
+    const double width = result->interval.p50HighMs - result->interval.p50LowMs;
+    result->converged = width <= args->ciTarget * result->summary.p50Ms;
+
+    return true;
+}
+
+static void writeReport(FILE* file, const args_t* args,
+                        const benchResult* result) {
+    const benchSummary* s = &result->summary;
+    const benchInterval* ci = &result->interval;
+    const benchStartup* st = &result->startup;
+
+    fputs("{\"model\": ", file);
+    benchWriteJsonString(file, args->modelFile);
+    fputs(", \"device\": ", file);
+    benchWriteJsonString(file, result->deviceName);
+    fprintf(file, ", \"startup\": {\"model_id\": %llu, \"public\": %s, "
+            "\"reused\": %s, \"connect_ms\": %.4f, \"device_ms\": %.4f, "
+            "\"load_ms\": %.4f, \"alloc_ms\": %.4f, \"first_job_ms\": %.4f, "
+            "\"first_job_vs_p50\": %.3f}",
+            (unsigned long long) st->modelId,
+            st->publicModel ? "true" : "false",
+            st->reused ? "true" : "false", (double) st->connectNs / 1e6,
+            (double) st->deviceNs / 1e6, (double) st->loadNs / 1e6,
+            (double) st->allocNs / 1e6, (double) st->firstJobNs / 1e6,
+            s->p50Ms > 0.0 ? (double) st->firstJobNs / 1e6 / s->p50Ms : 0.0);
+    fprintf(file, ", \"warmup_jobs\": %zu, \"jobs_per_round\": %zu, "
+            "\"rounds\": %zu, \"converged\": %s",
+            args->warmup, args->iterations, result->rounds,
+            result->converged ? "true" : "false");
+    fprintf(file, ", \"latency\": {\"count\": %zu, \"min_ms\": %.4f, "
+            "\"p50_ms\": %.4f, \"p90_ms\": %.4f, \"p99_ms\": %.4f, "
+            "\"max_ms\": %.4f, \"mean_ms\": %.4f, \"stddev_ms\": %.4f}",
+            s->count, s->minMs, s->p50Ms, s->p90Ms, s->p99Ms, s->maxMs,
+            s->meanMs, s->stddevMs);
+    fprintf(file, ", \"confidence_interval\": {\"level\": %g, "
+            "\"resamples\": %zu, \"target\": %g, \"p50_low_ms\": %.4f, "
+            "\"p50_high_ms\": %.4f, \"mean_low_ms\": %.4f, "
+            "\"mean_high_ms\": %.4f}",
+            ci->level, ci->resamples, args->ciTarget, ci->p50LowMs,
+            ci->p50HighMs, ci->meanLowMs, ci->meanHighMs);
+    fputs(", \"round_p50_ms\": [", file);
+    for (size_t r = 0; r < result->rounds; r++) {
+        fprintf(file, "%s%.4f", r ? ", " : "", result->roundP50Ms[r]);
+    }
+    fputc(']', file);
+    if (result->quantilesMs) {
+        fputs(", \"quantiles_ms\": [", file);
+        for (size_t i = 0; i <= args->quantiles; i++) {
+            fprintf(file, "%s%.4f", i ? ", " : "", result->quantilesMs[i]);
+        }
+        fputc(']', file);
+    }
+    if (result->samplesMs) {
+        fputs(", \"samples_ms\": [", file);
+        for (size_t i = 0; i < result->numSamples; i++) {
+            fprintf(file, "%s%.4f", i ? ", " : "", result->samplesMs[i]);
+        }
+        fputc(']', file);
+    }
+    if (result->memory) {
+        fputs(", \"memory\": ", file);
+        memprofWriteJson(result->memory, file);
+    }
+    if (result->soak) {
+        fputs(", \"soak\": ", file);
+        soakWriteJson(result->soak, file);
+    }
+    fputs("}\n", file);
+}
+
+int main(int argc, char** argv) {
+    bool ret = false;
+    int modelFd = -1;
+    benchJob job = {0};
+    benchSamples samples = {0};
+    benchResult result = {0};
+    args_t args;
+
+    // Messages also go to stderr when the benchmark is run from a shell. Under
+    // ACAP stderr already ends up in the system log, where they would show up
+    // twice.
+    const int logStderr = isatty(STDERR_FILENO) ? LOG_PERROR : 0;
+    openlog("larod_bench", LOG_PID | LOG_CONS | logStderr, LOG_USER);
+
+    if (!parseArgs(argc, argv, &args)) {
+        goto end;
+    }
+
+    if (!args.modelId) {
+        modelFd = open(args.modelFile, O_RDONLY);
+        if (modelFd < 0) {
+            syslog(LOG_ERR, "Unable to open model file %s: %s",
+                   args.modelFile, strerror(errno));
+            goto end;
+        }
+    }
+
+    if (args.memory) {
+        struct stat modelStat;
+        uint64_t modelFileBytes = 0;
+        if (args.modelFile && stat(args.modelFile, &modelStat) == 0) {
+            modelFileBytes = (uint64_t) modelStat.st_size;
+        }
+        if (!memprofStart(args.memoryIntervalMs, args.larodPid,
+                          modelFileBytes, &result.memory)) {
+            goto end;
+        }
+        memprofSetPhase(result.memory, MEMPROF_PHASE_LOAD);
+    }
+
+    const benchJobConfig config = {args.deviceName, args.modelId,
+                                   args.publicModel, args.deleteModel};
+    if (!benchSetupJob(&config, modelFd, &job, &result.deviceName,
+                       &result.startup)) {
+        goto end;
+    }
+
+    // The first job often pays for work the device defers, e.g. mapping the
+    // tensors or compiling the model, so it is timed on its own.
+    benchSamples first = {0};
+    const bool firstRan = benchRunJobs(&job, 1, &first);
+    if (firstRan) {
+        result.startup.firstJobNs = first.ns[0];
+    }
+    benchFreeSamples(&first);
+    if (!firstRan) {
+        goto end;
+    }
+    if (result.memory) {
+        memprofSetPhase(result.memory, MEMPROF_PHASE_IDLE);
+    }
+
+    const benchStartup* st = &result.startup;
+    syslog(LOG_INFO, "Startup: connect %.3f ms, device %.3f ms, %s model "
+           "%llu %.3f ms, tensors %.3f ms, first job %.3f ms",
+           (double) st->connectNs / 1e6, (double) st->deviceNs / 1e6,
+           st->reused ? "get" : "load", (unsigned long long) st->modelId,
+           (double) st->loadNs / 1e6, (double) st->allocNs / 1e6,
+           (double) st->firstJobNs / 1e6);
+    if (job.keepModel && !st->reused) {
+        syslog(LOG_INFO, "Public model %llu is left loaded, use it with "
+               "--model-id %llu", (unsigned long long) st->modelId,
+               (unsigned long long) st->modelId);
+    }
+
+    syslog(LOG_INFO, "Warming up with %zu jobs", args.warmup);
+    if (!benchRunJobs(&job, args.warmup, NULL)) {
+        goto end;
+    }
+    if (result.memory) {
+        memprofSetPhase(result.memory, MEMPROF_PHASE_STEADY);
+    }
+    if (args.soakS ? !runSoak(&job, &args, &samples, &result)
+                   : !measure(&job, &args, &samples, &result)) {
+        goto end;
+    }
+    if (result.memory) {
+        memprofStop(result.memory);
+        memprofLog(result.memory);
+    }
+    if (args.quantiles) {
+        result.quantilesMs = malloc((args.quantiles + 1) * sizeof(double));
+        if (!result.quantilesMs ||
+            !benchQuantiles(&samples, args.quantiles, result.quantilesMs)) {
+            syslog(LOG_ERR, "Out of memory for percentiles");
+            goto end;
+        }
+    }
+
+    if (args.samples) {
+        result.samplesMs = malloc(args.samples * sizeof(double));
+        if (!result.samplesMs) {
+            syslog(LOG_ERR, "Out of memory for samples");
+            goto end;
+        }
+        result.numSamples = benchSubsample(&samples, args.samples, args.seed,
+                                           result.samplesMs);
+    }
+
+    FILE* file = args.outputFile ? fopen(args.outputFile, "w") : stdout;
+    if (!file) {
+        syslog(LOG_ERR, "Unable to open report file %s: %s", args.outputFile,
+               strerror(errno));
+        goto end;
+    }
+    writeReport(file, &args, &result);
+    const bool writeFailed = ferror(file) != 0;
+    if ((file == stdout ? fflush(file) : fclose(file)) != 0 || writeFailed) {
+        syslog(LOG_ERR, "Unable to write report");
+        goto end;
+    }
+
+    ret = true;
+
+end:
+    benchDestroyJob(&job);
+    if (modelFd >= 0) {
+        close(modelFd);
+    }
+    benchFreeSamples(&samples);
+    free(result.roundP50Ms);
+    free(result.quantilesMs);
+    free(result.samplesMs);
+    memprofDestroy(&result.memory);
+    soakDestroy(&result.soak);
+
+    closelog();
+
+    return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
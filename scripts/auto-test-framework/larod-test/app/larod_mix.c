@@ -0,0 +1,573 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * - larod_mix -
+ *
+ * This application measures how models running at the same time on one
+ * larod device slow each other down, e.g. a detector and a classifier
+ * sharing the DLPU of a camera.
+ *
+ * The models are listed in a config file, one per line, each with its
+ * device and a target rate in jobs per second, or max to run as fast as it
+ * can. Every model is loaded on its own connection and run from its own
+ * thread, one job at a time, the same way larod_bench runs a single model.
+ * A model with a target rate runs its jobs on a fixed schedule; if it falls
+ * more than a period behind, the schedule restarts from now instead of
+ * catching up in a burst, and the job is counted as late.
+ *
+ * All the models are loaded and warmed up first. Then every model is run
+ * alone for the time of a phase, with the others loaded but idle, and last
+ * all the models are run together for as long. The threads of a phase all
+ * wait for the same start time, so the models contend from the first job.
+ *
+ * The result is a JSON report on one line with the latency percentiles and
+ * the throughput of every model alone and together, and the ratio between
+ * them.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "benchjob.h"
+#include "benchstats.h"
+#include "mixargs.h"
+
+// Upper bound for the number of models in the config file.
+#define MIX_MAX_MODELS (16)
+// Upper bound for the target rate of a model, in jobs per second.
+#define MIX_MAX_RATE (100000.0)
+// Time given to the threads of a phase to start before the first job.
+#define MIX_START_DELAY_NS (100000000ULL)
+
+typedef enum mixPhase {
+    MIX_PHASE_ISOLATION,
+    MIX_PHASE_CONTENTION,
+    MIX_NUM_PHASES
+} mixPhase;
+
+typedef struct mixPhaseResult {
+    // The model was run in the phase.
+    bool ran;
+    // Wall-clock time from the start of the phase to its end or to the end
+    // of the last job, whichever is later.
+    uint64_t lengthNs;
+    // Jobs that started more than a period after they were due.
+    size_t lateJobs;
+    benchSummary summary;
+} mixPhaseResult;
+
+typedef struct mixModel {
+    char* modelFile;
+    // Device given in the config file.
+    char* configDevice;
+    // Target rate in jobs per second, 0 to run as fast as possible.
+    double rate;
+    int modelFd;
+    benchJob job;
+    // Name of the device as reported by larod.
+    const char* deviceName;
+    benchStartup startup;
+    // Latency of every job of the phase being run.
+    benchSamples samples;
+    mixPhaseResult phases[MIX_NUM_PHASES];
+    // The phase being run and its start and end on the monotonic clock.
+    mixPhase phase;
+    uint64_t startNs;
+    uint64_t endNs;
+    pthread_t thread;
+    // The thread of the phase ran to the end.
+    bool ok;
+} mixModel;
+
+/**
+ * brief Reads the models from the config file.
+ *
+ * param path The config file.
+ * param models Array of MIX_MAX_MODELS zero initialized models, filled in.
+ * param numModels Pointer to the number of models read, set even if this
+ * fails, so that they can be freed.
+ * return False if the file could not be read or a line is invalid,
+ * otherwise true.
+ */
+static bool readConfig(const char* path, mixModel* models, size_t* numModels);
+
+/**
+ * brief Parses the target rate of a model.
+ *
+ * param str The rate in jobs per second, or max.
+ * param rate Pointer to the rate, 0 for max.
+ * return False if the rate is invalid, otherwise true.
+ */
+static bool parseRate(const char* str, double* rate);
+
+/**
+ * brief Sleeps until a time on the monotonic clock.
+ *
+ * param ns The time to wake up at, see benchNowNs.
+ * return The time after waking up.
+ */
+static uint64_t sleepUntil(uint64_t ns);
+
+/**
+ * brief Thread running the jobs of a model for a phase.
+ *
+ * Sets ok of the model if all the jobs ran and their latency could be
+ * summarized.
+ *
+ * param arg The mixModel, with its phase, startNs and endNs set.
+ * return NULL.
+ */
+static void* runModel(void* arg);
+
+/**
+ * brief Runs some of the models together for a phase, each from its own
+ * thread.
+ *
+ * param models The models to run.
+ * param count Number of models to run.
+ * param phase The phase to record the results in.
+ * param durationNs Wall-clock time of the phase.
+ * return False if a thread could not be started or a job failed, otherwise
+ * true.
+ */
+static bool runPhase(mixModel* models, size_t count, mixPhase phase,
+                     uint64_t durationNs);
+
+/**
+ * brief Logs the latency and throughput of a model in both phases.
+ *
+ * param model The model.
+ */
+static void logModel(const mixModel* model);
+
+/**
+ * brief Writes the result of a model in a phase as a JSON object, or null if
+ * the model was not run in the phase.
+ *
+ * param file File to write to.
+ * param result The result.
+ */
+static void writePhase(FILE* file, const mixPhaseResult* result);
+
+/**
+ * brief Writes a JSON member with the ratio of two numbers, null if the
+ * first number is not positive.
+ *
+ * param file File to write to.
+ * param name Name of the member.
+ * param from The number alone.
+ * param to The number together.
+ */
+static void writeRatio(FILE* file, const char* name, double from, double to);
+
+/**
+ * brief Writes the JSON report of the benchmark on one line.
+ *
+ * param file File to write to.
+ * param args The arguments.
+ * param models The models.
+ * param numModels Number of models.
+ */
+static void writeReport(FILE* file, const mixArgs* args,
+                        const mixModel* models, size_t numModels);
+
+/**
+ * brief Returns the number of jobs per second of a phase.
+ *
+ * param result The result of a model in a phase.
+ * return Jobs per second, 0 if the phase was not run.
+ */
+static double jobsPerS(const mixPhaseResult* result);
+
+static bool parseRate(const char* str, double* rate) {
+    char* endPtr;
+
+    if (strcmp(str, "max") == 0) {
+        *rate = 0.0;
+        return true;
+    }
+    *rate = strtod(str, &endPtr);
+
+    return endPtr != str && *endPtr == '\0' && isfinite(*rate) &&
+           *rate > 0.0 && *rate <= MIX_MAX_RATE;
+}
+
+static bool readConfig(const char* path, mixModel* models, size_t* numModels) {
+    char* line = NULL;
+    size_t lineSize = 0;
+    size_t lineNum = 0;
+    bool ret = false;
+
+    *numModels = 0;
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        syslog(LOG_ERR, "Unable to open config file %s: %s", path,
+               strerror(errno));
+        return false;
+    }
+
+    while (getline(&line, &lineSize, file) >= 0) {
+        char* save = NULL;
+        lineNum++;
+        const char* modelFile = strtok_r(line, " \t\r\n", &save);
+        if (!modelFile || modelFile[0] == '#') {
+            continue;
+        }
+        const char* device = strtok_r(NULL, " \t\r\n", &save);
+        const char* rate = strtok_r(NULL, " \t\r\n", &save);
+        if (!device || !rate || strtok_r(NULL, " \t\r\n", &save)) {
+            syslog(LOG_ERR, "%s:%zu: expected a model file, a device and a "
+                   "rate", path, lineNum);
+            goto end;
+        }
+        if (*numModels == MIX_MAX_MODELS) {
+            syslog(LOG_ERR, "%s:%zu: more than %d models", path, lineNum,
+                   MIX_MAX_MODELS);
+            goto end;
+        }
+
+        mixModel* model = &models[*numModels];
+        model->modelFd = -1;
+        (*numModels)++;
+        if (!parseRate(rate, &model->rate)) {
+            syslog(LOG_ERR, "%s:%zu: invalid rate %s, expected jobs per "
+                   "second or max", path, lineNum, rate);
+            goto end;
+        }
+        model->modelFile = strdup(modelFile);
+        model->configDevice = strdup(device);
+        if (!model->modelFile || !model->configDevice) {
+            syslog(LOG_ERR, "Out of memory for the config");
+            goto end;
+        }
+    }
+    if (ferror(file)) {
+        syslog(LOG_ERR, "Unable to read config file %s", path);
+        goto end;
+    }
+    if (*numModels == 0) {
+        syslog(LOG_ERR, "No models in config file %s", path);
+        goto end;
+    }
+
+    ret = true;
+
+end:
+    free(line);
+    fclose(file);
+
+    return ret;
+}
+
+static uint64_t sleepUntil(uint64_t ns) {
+    const struct timespec ts = {(time_t) (ns / 1000000000ULL),
+                                (long) (ns % 1000000000ULL)};
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+           EINTR) {
+    }
+
+    return benchNowNs();
+}
+
+static void* runModel(void* arg) {
+    mixModel* model = arg;
+    mixPhaseResult* result = &model->phases[model->phase];
+    const uint64_t periodNs =
+        model->rate > 0.0 ? (uint64_t) (1e9 / model->rate) : 0;
+    uint64_t dueNs = model->startNs;
+    uint64_t nowNs;
+
+    model->samples.count = 0;
+    for (nowNs = sleepUntil(model->startNs); nowNs < model->endNs;
+         nowNs = benchNowNs()) {
+        if (periodNs) {
+            if (dueNs > nowNs) {
+                if (dueNs >= model->endNs) {
+                    break;
+                }
+                sleepUntil(dueNs);
+            } else if (nowNs - dueNs > periodNs) {
+                // Catching up would run a burst the real application never
+                // runs, so the schedule restarts from now.
+                result->lateJobs++;
+                dueNs = nowNs;
+            }
+            dueNs += periodNs;
+        }
+        if (!benchRunJobs(&model->job, 1, &model->samples)) {
+            return NULL;
+        }
+    }
+
+    result->ran = true;
+    result->lengthNs =
+        (nowNs > model->endNs ? nowNs : model->endNs) - model->startNs;
+    if (!model->samples.count) {
+        syslog(LOG_ERR, "No jobs of %s ran", model->modelFile);
+        return NULL;
+    }
+    if (!benchSummarize(&model->samples, &result->summary)) {
+        syslog(LOG_ERR, "Out of memory for statistics");
+        return NULL;
+    }
+    model->ok = true;
+
+    return NULL;
+}
+
+static bool runPhase(mixModel* models, size_t count, mixPhase phase,
+                     uint64_t durationNs) {
+    const uint64_t startNs = benchNowNs() + MIX_START_DELAY_NS;
+    size_t started;
+    bool ret = true;
+
+    for (started = 0; started < count; started++) {
+        mixModel* model = &models[started];
+        model->phase = phase;
+        model->startNs = startNs;
+        model->endNs = startNs + durationNs;
+        model->ok = false;
+        const int err =
+            pthread_create(&model->thread, NULL, runModel, model);
+        if (err) {
+            syslog(LOG_ERR, "Unable to start the thread of %s: %s",
+                   model->modelFile, strerror(err));
+            ret = false;
+            break;
+        }
+    }
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(models[i].thread, NULL);
+        ret = ret && models[i].ok;
+    }
+
+    return ret;
+}
+
+static double jobsPerS(const mixPhaseResult* result) {
+    if (!result->ran || !result->lengthNs) {
+        return 0.0;
+    }
+
+    return (double) result->summary.count * 1e9 / (double) result->lengthNs;
+}
+
+static void logModel(const mixModel* model) {
+    const mixPhaseResult* alone = &model->phases[MIX_PHASE_ISOLATION];
+    const mixPhaseResult* together = &model->phases[MIX_PHASE_CONTENTION];
+
+    if (alone->ran) {
+        syslog(LOG_INFO, "%s alone: p50 %.3f ms, p99 %.3f ms, %.1f jobs/s, "
+               "%zu late", model->modelFile, alone->summary.p50Ms,
+               alone->summary.p99Ms, jobsPerS(alone), alone->lateJobs);
+    }
+    syslog(LOG_INFO, "%s together: p50 %.3f ms, p99 %.3f ms, %.1f jobs/s, "
+           "%zu late", model->modelFile, together->summary.p50Ms,
+           together->summary.p99Ms, jobsPerS(together), together->lateJobs);
+    if (alone->ran && alone->summary.p50Ms > 0.0 && jobsPerS(alone) > 0.0) {
+        syslog(LOG_INFO, "%s together vs alone: p50 x%.2f, p99 x%.2f, "
+               "jobs/s x%.2f", model->modelFile,
+               together->summary.p50Ms / alone->summary.p50Ms,
+               together->summary.p99Ms / alone->summary.p99Ms,
+               jobsPerS(together) / jobsPerS(alone));
+    }
+}
+
+static void writePhase(FILE* file, const mixPhaseResult* result) {
+    const benchSummary* s = &result->summary;
+
+    if (!result->ran) {
+        fputs("null", file);
+        return;
+    }
+    fprintf(file, "{\"duration_s\": %.3f, \"jobs\": %zu, "
+            "\"jobs_per_s\": %.3f, \"late_jobs\": %zu",
+            (double) result->lengthNs / 1e9, s->count, jobsPerS(result),
+            result->lateJobs);
+    fprintf(file, ", \"latency\": {\"count\": %zu, \"min_ms\": %.4f, "
+            "\"p50_ms\": %.4f, \"p90_ms\": %.4f, \"p99_ms\": %.4f, "
+            "\"max_ms\": %.4f, \"mean_ms\": %.4f, \"stddev_ms\": %.4f}}",
+            s->count, s->minMs, s->p50Ms, s->p90Ms, s->p99Ms, s->maxMs,
+            s->meanMs, s->stddevMs);
+}
+
+static void writeRatio(FILE* file, const char* name, double from, double to) {
+    if (from > 0.0) {
+        fprintf(file, "\"%s\": %.3f", name, to / from);
+    } else {
+        fprintf(file, "\"%s\": null", name);
+    }
+}
+
+static void writeReport(FILE* file, const mixArgs* args,
+                        const mixModel* models, size_t numModels) {
+    fprintf(file, "{\"duration_s\": %u, \"warmup_jobs\": %zu, \"models\": [",
+            args->durationS, args->warmup);
+    for (size_t i = 0; i < numModels; i++) {
+        const mixModel* m = &models[i];
+        const mixPhaseResult* alone = &m->phases[MIX_PHASE_ISOLATION];
+        const mixPhaseResult* together = &m->phases[MIX_PHASE_CONTENTION];
+
+        fputs(i ? ", {\"model\": " : "{\"model\": ", file);
+        benchWriteJsonString(file, m->modelFile);
+        fputs(", \"device\": ", file);
+        benchWriteJsonString(file, m->deviceName);
+        if (m->rate > 0.0) {
+            fprintf(file, ", \"target_jobs_per_s\": %g", m->rate);
+        } else {
+            fputs(", \"target_jobs_per_s\": null", file);
+        }
+        fprintf(file, ", \"load_ms\": %.4f, \"first_job_ms\": %.4f",
+                (double) m->startup.loadNs / 1e6,
+                (double) m->startup.firstJobNs / 1e6);
+        fputs(", \"isolation\": ", file);
+        writePhase(file, alone);
+        fputs(", \"contention\": ", file);
+        writePhase(file, together);
+        if (alone->ran) {
+            fputs(", \"contention_vs_isolation\": {", file);
+            writeRatio(file, "p50", alone->summary.p50Ms,
+                       together->summary.p50Ms);
+            fputs(", ", file);
+            writeRatio(file, "p90", alone->summary.p90Ms,
+                       together->summary.p90Ms);
+            fputs(", ", file);
+            writeRatio(file, "p99", alone->summary.p99Ms,
+                       together->summary.p99Ms);
+            fputs(", ", file);
+            writeRatio(file, "mean", alone->summary.meanMs,
+                       together->summary.meanMs);
+            fputs(", ", file);
+            writeRatio(file, "jobs_per_s", jobsPerS(alone),
+                       jobsPerS(together));
+            fputc('}', file);
+        } else {
+            fputs(", \"contention_vs_isolation\": null", file);
+        }
+        fputc('}', file);
+    }
+    fputs("]}\n", file);
+}
+
+int main(int argc, char** argv) {
+    bool ret = false;
+    mixModel models[MIX_MAX_MODELS];
+    size_t numModels = 0;
+    mixArgs args;
+
+    memset(models, 0, sizeof(models));
+
+    // Messages also go to stderr when the benchmark is run from a shell. Under
+    // ACAP stderr already ends up in the system log, where they would show up
+    // twice.
+    const int logStderr = isatty(STDERR_FILENO) ? LOG_PERROR : 0;
+    openlog("larod_mix", LOG_PID | LOG_CONS | logStderr, LOG_USER);
+
+    if (!parseMixArgs(argc, argv, &args) ||
+        !readConfig(args.configFile, models, &numModels)) {
+        goto end;
+    }
+
+    // Every model is loaded before any is measured, so that the models run
+    // alone share the device memory as they do together.
+    for (size_t i = 0; i < numModels; i++) {
+        mixModel* m = &models[i];
+        m->modelFd = open(m->modelFile, O_RDONLY);
+        if (m->modelFd < 0) {
+            syslog(LOG_ERR, "Unable to open model file %s: %s", m->modelFile,
+                   strerror(errno));
+            goto end;
+        }
+        const benchJobConfig config = {m->configDevice, 0, false, false};
+        if (!benchSetupJob(&config, m->modelFd, &m->job, &m->deviceName,
+                           &m->startup)) {
+            goto end;
+        }
+
+        benchSamples first = {0};
+        const bool firstRan = benchRunJobs(&m->job, 1, &first);
+        if (firstRan) {
+            m->startup.firstJobNs = first.ns[0];
+        }
+        benchFreeSamples(&first);
+        if (!firstRan || !benchRunJobs(&m->job, args.warmup, NULL)) {
+            goto end;
+        }
+        syslog(LOG_INFO, "Loaded %s on %s in %.3f ms, first job %.3f ms",
+               m->modelFile, m->deviceName, (double) m->startup.loadNs / 1e6,
+               (double) m->startup.firstJobNs / 1e6);
+    }
+
+    const uint64_t durationNs = (uint64_t) args.durationS * 1000000000ULL;
+    if (!args.noIsolation) {
+        for (size_t i = 0; i < numModels; i++) {
+            syslog(LOG_INFO, "Running %s alone for %u s", models[i].modelFile,
+                   args.durationS);
+            if (!runPhase(&models[i], 1, MIX_PHASE_ISOLATION, durationNs)) {
+                goto end;
+            }
+        }
+    }
+    syslog(LOG_INFO, "Running %zu models together for %u s", numModels,
+           args.durationS);
+    if (!runPhase(models, numModels, MIX_PHASE_CONTENTION, durationNs)) {
+        goto end;
+    }
+    for (size_t i = 0; i < numModels; i++) {
+        logModel(&models[i]);
+    }
+
+    FILE* file = args.outputFile ? fopen(args.outputFile, "w") : stdout;
+    if (!file) {
+        syslog(LOG_ERR, "Unable to open report file %s: %s", args.outputFile,
+               strerror(errno));
+        goto end;
+    }
+    writeReport(file, &args, models, numModels);
+    const bool writeFailed = ferror(file) != 0;
+    if ((file == stdout ? fflush(file) : fclose(file)) != 0 || writeFailed) {
+        syslog(LOG_ERR, "Unable to write report");
+        goto end;
+    }
+
+    ret = true;
+
+end:
+    for (size_t i = 0; i < numModels; i++) {
+        benchDestroyJob(&models[i].job);
+        if (models[i].modelFd >= 0) {
+            close(models[i].modelFd);
+        }
+        benchFreeSamples(&models[i].samples);
+        free(models[i].modelFile);
+        free(models[i].configDevice);
+    }
+
+    closelog();
+
+    return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
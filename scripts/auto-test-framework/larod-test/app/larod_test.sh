@@ -18,8 +18,13 @@ echo "Reading device model"
 model=$(parhandclient getgroup root.Brand.ProdNbr | cut -d "\"" -f 2)
 echo "Model name:$model."
 
+# The startup and latency of each model are tracked per AXIS OS release
+version=$(parhandclient getgroup root.Properties.Firmware.Version | cut -d "\"" -f 2)
+echo "AXIS OS:$version."
+
 echo "Reading SoC"
 SoC=$(parhandclient getgroup root.Properties.System.Soc | cut -d "\"" -f 2)
+echo "SoC:$SoC."
 
 if [ "$SoC" = "Ambarella CV25" ]; then
 	echo "Testing models via cv25"
@@ -43,7 +48,28 @@ echo "Running tests using chip: $chip"
 # for all the files in the folder
 for file in "$folder"*; do
 	echo "Testing $file"
-	larod_out=$(larod-client -R 1000 -w 5 -p -c $chip -g "$file" -i '' | grep "Mean execution time for job:")
+	# The hash tells a changed model apart from a slower device in the history
+	echo "sha256: $file $(sha256sum "$file" | cut -d " " -f 1)"
+	# At least 1000 measured jobs, more if the latency is noisy. The JSON
+	# report is printed on one line, with 101 percentiles of the latencies to
+	# store in the history and 300 latencies picked at random to test later
+	# runs against.
+	larod_out=$(./larod_bench -w 5 -n 250 --min-rounds 4 --memory --quantiles 100 --samples 300 -c $chip "$file")
 	echo "result: $file $larod_out"
 done
+
+# Deployments run several models at once on the same device, e.g. a detector
+# and a classifier, so the models of the SoC are also measured together, each
+# as fast as it can, and compared with each of them alone.
+set -- "$folder"*
+if [ $# -gt 1 ]; then
+	echo "Testing the models together"
+	mixconf=$(mktemp)
+	for file in "$@"; do
+		echo "$file $chip max" >>"$mixconf"
+	done
+	mix_out=$(./larod_mix -w 5 -t 20 "$mixconf")
+	echo "mix: $mix_out"
+	rm -f "$mixconf"
+fi
 echo "Done"
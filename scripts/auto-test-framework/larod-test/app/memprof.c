@@ -0,0 +1,616 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file implements the memory profiler of the benchmark.
+ */
+
+#include "memprof.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+// Largest /proc file read, smaps_rollup, status and meminfo all fit.
+#define PROC_FILE_BYTES (8192)
+// Largest number of dma-bufs of a process told apart by inode. Any more are
+// counted as they come.
+#define MAX_DMABUFS (1024)
+
+typedef struct memUsage {
+    uint64_t rssKb;
+    uint64_t pssKb;
+    uint64_t dmabufKb;
+} memUsage;
+
+typedef struct memSample {
+    memUsage client;
+    memUsage larod;
+    bool larodOk;
+    uint64_t cmaUsedKb;
+} memSample;
+
+typedef struct memPhaseStats {
+    uint64_t count;
+    uint64_t larodCount;
+    memSample peak;
+    memSample sum;
+} memPhaseStats;
+
+struct memprof {
+    pthread_t thread;
+    bool threadStarted;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool stop;
+    memprofPhase phase;
+    unsigned intervalMs;
+    pid_t clientPid;
+    // -1 if the larod service is not sampled.
+    pid_t larodPid;
+    // Cleared, and a warning logged, the first time larod cannot be read.
+    bool larodReadable;
+    // False on kernels without smaps_rollup, where only RSS is known.
+    bool hasPss;
+    // CmaTotal of /proc/meminfo, 0 if the system has no CMA.
+    uint64_t cmaTotalKb;
+    uint64_t modelFileBytes;
+    uint64_t numSamples;
+    memPhaseStats phases[MEMPROF_NUM_PHASES];
+};
+
+/**
+ * brief Reads a small file in one go, NUL terminated.
+ *
+ * param path Path of the file.
+ * param buf Buffer of PROC_FILE_BYTES bytes.
+ * return False if the file could not be read, otherwise true.
+ */
+static bool readProcFile(const char* path, char* buf);
+
+/**
+ * brief Finds a "Name: value" line of a /proc file and parses the value.
+ *
+ * param text Contents of the file.
+ * param name Name of the line, including the colon.
+ * param value Pointer to the parsed value.
+ * return False if there is no such line, otherwise true.
+ */
+static bool findValue(const char* text, const char* name, uint64_t* value);
+
+/**
+ * brief Reads the RSS and PSS of a process.
+ *
+ * param prof The profiler, hasPss is cleared if smaps_rollup is missing.
+ * param pid The process.
+ * param usage Pointer to the usage, rssKb and pssKb are set.
+ * return False if the memory of the process could not be read, otherwise
+ * true.
+ */
+static bool readProcessMemory(memprof* prof, pid_t pid, memUsage* usage);
+
+/**
+ * brief Sums the sizes of the dma-bufs a process has open.
+ *
+ * A buffer open several times is counted once.
+ *
+ * param pid The process.
+ * return The size in kB, 0 if the fds could not be read.
+ */
+static uint64_t readDmabufKb(pid_t pid);
+
+/**
+ * brief Reads the CMA in use in the whole system.
+ *
+ * param usedKb Pointer to CmaTotal - CmaFree.
+ * param totalKb Pointer to CmaTotal, may be NULL.
+ * return False if /proc/meminfo has no CMA, otherwise true.
+ */
+static bool readCma(uint64_t* usedKb, uint64_t* totalKb);
+
+/**
+ * brief Looks for the larod service among the processes.
+ *
+ * return Pid of the first process named larod, -1 if there is none.
+ */
+static pid_t findLarodPid(void);
+
+/**
+ * brief Takes one sample of all processes.
+ *
+ * param prof The profiler.
+ * param sample Pointer to the sample to fill in.
+ */
+static void takeSample(memprof* prof, memSample* sample);
+
+/**
+ * brief Counts a sample in a phase. Called with the mutex held.
+ *
+ * param prof The profiler.
+ * param phase The phase.
+ * param sample The sample.
+ */
+static void countSample(memprof* prof, memprofPhase phase,
+                        const memSample* sample);
+
+/**
+ * brief Samples at the interval until stopped.
+ *
+ * param arg The profiler.
+ * return NULL.
+ */
+static void* sampleLoop(void* arg);
+
+/**
+ * brief Writes the memory of a process as a JSON object.
+ *
+ * param file File to write to.
+ * param usage The usage.
+ * param hasPss False to write the PSS as null.
+ */
+static void writeUsage(FILE* file, const memUsage* usage, bool hasPss);
+
+/**
+ * brief Writes the baseline, the peak while loading and the peak and mean
+ * while running of one process as a JSON object.
+ *
+ * param prof The profiler.
+ * param file File to write to.
+ * param larod True for the larod service, false for the benchmark.
+ */
+static void writeProcess(const memprof* prof, FILE* file, bool larod);
+
+/**
+ * brief Returns the mean of the samples of a phase.
+ *
+ * param stats The phase.
+ * param larod True for the larod service, false for the benchmark.
+ * return The mean usage, zero if the phase has no samples.
+ */
+static memUsage meanUsage(const memPhaseStats* stats, bool larod);
+
+static bool readProcFile(const char* path, char* buf) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    size_t done = 0;
+    while (done < PROC_FILE_BYTES - 1) {
+        const ssize_t n = read(fd, buf + done, PROC_FILE_BYTES - 1 - done);
+        if (n < 0) {
+            close(fd);
+            return false;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += (size_t) n;
+    }
+    buf[done] = '\0';
+    close(fd);
+
+    return true;
+}
+
+static bool findValue(const char* text, const char* name, uint64_t* value) {
+    const size_t len = strlen(name);
+
+    for (const char* line = text; line && *line;) {
+        if (!strncmp(line, name, len)) {
+            char* end;
+            const unsigned long long parsed = strtoull(line + len, &end, 10);
+            if (end == line + len) {
+                return false;
+            }
+            *value = (uint64_t) parsed;
+            return true;
+        }
+        line = strchr(line, '\n');
+        line = line ? line + 1 : NULL;
+    }
+
+    return false;
+}
+
+static bool readProcessMemory(memprof* prof, pid_t pid, memUsage* usage) {
+    char path[64];
+    char buf[PROC_FILE_BYTES];
+
+    if (prof->hasPss) {
+        snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", (int) pid);
+        if (readProcFile(path, buf)) {
+            return findValue(buf, "Rss:", &usage->rssKb) &&
+                   findValue(buf, "Pss:", &usage->pssKb);
+        }
+        if (errno != ENOENT) {
+            return false;
+        }
+        // Kernels before 4.14 have no smaps_rollup, and summing smaps would
+        // cost more than the jobs being measured.
+        prof->hasPss = false;
+    }
+    snprintf(path, sizeof(path), "/proc/%d/status", (int) pid);
+    usage->pssKb = 0;
+
+    return readProcFile(path, buf) && findValue(buf, "VmRSS:", &usage->rssKb);
+}
+
+static uint64_t readDmabufKb(pid_t pid) {
+    char path[64];
+    char buf[PROC_FILE_BYTES];
+    uint64_t inodes[MAX_DMABUFS];
+    size_t numInodes = 0;
+    uint64_t bytes = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/fdinfo", (int) pid);
+    DIR* dir = opendir(path);
+    if (!dir) {
+        return 0;
+    }
+    for (struct dirent* entry = readdir(dir); entry; entry = readdir(dir)) {
+        if (!isdigit((unsigned char) entry->d_name[0])) {
+            continue;
+        }
+        char fdPath[320];
+        snprintf(fdPath, sizeof(fdPath), "%s/%s", path, entry->d_name);
+        uint64_t size;
+        uint64_t inode;
+        // Only dma-bufs name the driver that exported them.
+        if (!readProcFile(fdPath, buf) || !strstr(buf, "exp_name:") ||
+            !findValue(buf, "size:", &size)) {
+            continue;
+        }
+        if (findValue(buf, "ino:", &inode)) {
+            bool seen = false;
+            for (size_t i = 0; i < numInodes && !seen; i++) {
+                seen = inodes[i] == inode;
+            }
+            if (seen) {
+                continue;
+            }
+            if (numInodes < MAX_DMABUFS) {
+                inodes[numInodes++] = inode;
+            }
+        }
+        bytes += size;
+    }
+    closedir(dir);
+
+    return bytes / 1024;
+}
+
+static bool readCma(uint64_t* usedKb, uint64_t* totalKb) {
+    char buf[PROC_FILE_BYTES];
+    uint64_t total;
+    uint64_t free;
+
+    if (!readProcFile("/proc/meminfo", buf) ||
+        !findValue(buf, "CmaTotal:", &total) ||
+        !findValue(buf, "CmaFree:", &free) || total == 0) {
+        return false;
+    }
+    *usedKb = total > free ? total - free : 0;
+    if (totalKb) {
+        *totalKb = total;
+    }
+
+    return true;
+}
+
+static pid_t findLarodPid(void) {
+    char buf[PROC_FILE_BYTES];
+    pid_t pid = -1;
+
+    DIR* dir = opendir("/proc");
+    if (!dir) {
+        return -1;
+    }
+    for (struct dirent* entry = readdir(dir); entry && pid < 0;
+         entry = readdir(dir)) {
+        if (!isdigit((unsigned char) entry->d_name[0])) {
+            continue;
+        }
+        char path[320];
+        snprintf(path, sizeof(path), "/proc/%s/comm", entry->d_name);
+        if (readProcFile(path, buf) && !strcmp(buf, "larod\n")) {
+            pid = (pid_t) atoi(entry->d_name);
+        }
+    }
+    closedir(dir);
+
+    return pid;
+}
+
+static void takeSample(memprof* prof, memSample* sample) {
+    memset(sample, 0, sizeof(*sample));
+
+    readProcessMemory(prof, prof->clientPid, &sample->client);
+    sample->client.dmabufKb = readDmabufKb(prof->clientPid);
+    if (prof->larodPid > 0 && prof->larodReadable) {
+        sample->larodOk =
+            readProcessMemory(prof, prof->larodPid, &sample->larod);
+        if (sample->larodOk) {
+            sample->larod.dmabufKb = readDmabufKb(prof->larodPid);
+        } else {
+            syslog(LOG_WARNING, "Unable to read the memory of the larod "
+                   "service, pid %d: %s. It is left out of the report.",
+                   (int) prof->larodPid, strerror(errno));
+            prof->larodReadable = false;
+        }
+    }
+    if (prof->cmaTotalKb) {
+        readCma(&sample->cmaUsedKb, NULL);
+    }
+}
+
+static void countSample(memprof* prof, memprofPhase phase,
+                        const memSample* sample) {
+    memPhaseStats* stats = &prof->phases[phase];
+    memSample* peak = &stats->peak;
+    memSample* sum = &stats->sum;
+
+    prof->numSamples++;
+    if (phase == MEMPROF_PHASE_IDLE) {
+        return;
+    }
+#define COUNT(field)                                                           \
+    do {                                                                       \
+        sum->field += sample->field;                                           \
+        if (sample->field > peak->field) {                                     \
+            peak->field = sample->field;                                       \
+        }                                                                      \
+    } while (0)
+    stats->count++;
+    COUNT(client.rssKb);
+    COUNT(client.pssKb);
+    COUNT(client.dmabufKb);
+    COUNT(cmaUsedKb);
+    if (sample->larodOk) {
+        stats->larodCount++;
+        COUNT(larod.rssKb);
+        COUNT(larod.pssKb);
+        COUNT(larod.dmabufKb);
+    }
+#undef COUNT
+}
+
+static void* sampleLoop(void* arg) {
+    memprof* prof = arg;
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    pthread_mutex_lock(&prof->mutex);
+    while (!prof->stop) {
+        deadline.tv_nsec += (long) prof->intervalMs * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        while (!prof->stop &&
+               pthread_cond_timedwait(&prof->cond, &prof->mutex, &deadline) !=
+                   ETIMEDOUT) {
+        }
+        if (prof->stop) {
+            break;
+        }
+        pthread_mutex_unlock(&prof->mutex);
+
+        memSample sample;
+        takeSample(prof, &sample);
+
+        pthread_mutex_lock(&prof->mutex);
+        countSample(prof, prof->phase, &sample);
+    }
+    pthread_mutex_unlock(&prof->mutex);
+
+    return NULL;
+}
+
+bool memprofStart(unsigned intervalMs, pid_t larodPid, uint64_t modelFileBytes,
+                  memprof** profPtr) {
+    memprof* prof = calloc(1, sizeof(memprof));
+    if (!prof) {
+        syslog(LOG_ERR, "Out of memory for the memory profiler");
+        return false;
+    }
+    pthread_mutex_init(&prof->mutex, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&prof->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    prof->intervalMs = intervalMs;
+    prof->clientPid = getpid();
+    prof->larodPid = larodPid ? larodPid : findLarodPid();
+    prof->larodReadable = true;
+    prof->hasPss = true;
+    prof->modelFileBytes = modelFileBytes;
+    uint64_t cmaUsedKb;
+    if (!readCma(&cmaUsedKb, &prof->cmaTotalKb)) {
+        prof->cmaTotalKb = 0;
+    }
+    if (prof->larodPid > 0) {
+        syslog(LOG_INFO, "Sampling the memory of the larod service, pid %d, "
+               "every %u ms", (int) prof->larodPid, intervalMs);
+    } else if (larodPid == 0) {
+        syslog(LOG_INFO, "No larod service process found, only the memory "
+               "of the benchmark is sampled");
+    }
+
+    memSample sample;
+    takeSample(prof, &sample);
+    countSample(prof, MEMPROF_PHASE_BASELINE, &sample);
+    prof->phase = MEMPROF_PHASE_BASELINE;
+
+    if (pthread_create(&prof->thread, NULL, sampleLoop, prof)) {
+        syslog(LOG_ERR, "Unable to start the memory sampling thread");
+        memprofDestroy(&prof);
+        return false;
+    }
+    prof->threadStarted = true;
+    *profPtr = prof;
+
+    return true;
+}
+
+void memprofSetPhase(memprof* prof, memprofPhase phase) {
+    memSample sample;
+    takeSample(prof, &sample);
+
+    pthread_mutex_lock(&prof->mutex);
+    countSample(prof, prof->phase, &sample);
+    prof->phase = phase;
+    pthread_mutex_unlock(&prof->mutex);
+}
+
+void memprofStop(memprof* prof) {
+    if (!prof->threadStarted) {
+        return;
+    }
+    pthread_mutex_lock(&prof->mutex);
+    prof->stop = true;
+    pthread_cond_signal(&prof->cond);
+    pthread_mutex_unlock(&prof->mutex);
+    pthread_join(prof->thread, NULL);
+    prof->threadStarted = false;
+
+    memprofSetPhase(prof, MEMPROF_PHASE_IDLE);
+}
+
+static memUsage meanUsage(const memPhaseStats* stats, bool larod) {
+    const uint64_t count = larod ? stats->larodCount : stats->count;
+    const memUsage* sum = larod ? &stats->sum.larod : &stats->sum.client;
+    memUsage mean = {0};
+
+    if (count) {
+        mean.rssKb = sum->rssKb / count;
+        mean.pssKb = sum->pssKb / count;
+        mean.dmabufKb = sum->dmabufKb / count;
+    }
+
+    return mean;
+}
+
+static void writeUsage(FILE* file, const memUsage* usage, bool hasPss) {
+    fprintf(file, "{\"rss_kb\": %llu, \"pss_kb\": ",
+            (unsigned long long) usage->rssKb);
+    if (hasPss) {
+        fprintf(file, "%llu", (unsigned long long) usage->pssKb);
+    } else {
+        fputs("null", file);
+    }
+    fprintf(file, ", \"dmabuf_kb\": %llu}",
+            (unsigned long long) usage->dmabufKb);
+}
+
+static void writeProcess(const memprof* prof, FILE* file, bool larod) {
+    const memPhaseStats* baseline = &prof->phases[MEMPROF_PHASE_BASELINE];
+    const memPhaseStats* load = &prof->phases[MEMPROF_PHASE_LOAD];
+    const memPhaseStats* steady = &prof->phases[MEMPROF_PHASE_STEADY];
+    const memUsage baselineMean = meanUsage(baseline, larod);
+    const memUsage steadyMean = meanUsage(steady, larod);
+
+    fprintf(file, "{\"pid\": %d, \"baseline\": ",
+            (int) (larod ? prof->larodPid : prof->clientPid));
+    writeUsage(file, &baselineMean, prof->hasPss);
+    fputs(", \"load_peak\": ", file);
+    writeUsage(file, larod ? &load->peak.larod : &load->peak.client,
+               prof->hasPss);
+    fputs(", \"steady_peak\": ", file);
+    writeUsage(file, larod ? &steady->peak.larod : &steady->peak.client,
+               prof->hasPss);
+    fputs(", \"steady_mean\": ", file);
+    writeUsage(file, &steadyMean, prof->hasPss);
+    fputc('}', file);
+}
+
+void memprofWriteJson(const memprof* prof, FILE* file) {
+    const memPhaseStats* baseline = &prof->phases[MEMPROF_PHASE_BASELINE];
+    const memPhaseStats* load = &prof->phases[MEMPROF_PHASE_LOAD];
+    const memPhaseStats* steady = &prof->phases[MEMPROF_PHASE_STEADY];
+
+    fprintf(file, "{\"model_file_bytes\": %llu, \"interval_ms\": %u, "
+            "\"samples\": %llu, \"client\": ",
+            (unsigned long long) prof->modelFileBytes, prof->intervalMs,
+            (unsigned long long) prof->numSamples);
+    writeProcess(prof, file, false);
+    fputs(", \"larod\": ", file);
+    if (prof->larodPid > 0 && prof->larodReadable &&
+        steady->larodCount > 0) {
+        writeProcess(prof, file, true);
+    } else {
+        fputs("null", file);
+    }
+    fputs(", \"cma\": ", file);
+    if (prof->cmaTotalKb) {
+        fprintf(file, "{\"total_kb\": %llu, \"baseline_used_kb\": %llu, "
+                "\"load_peak_used_kb\": %llu, \"steady_peak_used_kb\": %llu, "
+                "\"steady_mean_used_kb\": %llu}",
+                (unsigned long long) prof->cmaTotalKb,
+                (unsigned long long) (baseline->count
+                                          ? baseline->sum.cmaUsedKb /
+                                                baseline->count
+                                          : 0),
+                (unsigned long long) load->peak.cmaUsedKb,
+                (unsigned long long) steady->peak.cmaUsedKb,
+                (unsigned long long) (steady->count
+                                          ? steady->sum.cmaUsedKb /
+                                                steady->count
+                                          : 0));
+    } else {
+        fputs("null", file);
+    }
+    fputc('}', file);
+}
+
+void memprofLog(const memprof* prof) {
+    const memPhaseStats* load = &prof->phases[MEMPROF_PHASE_LOAD];
+    const memPhaseStats* steady = &prof->phases[MEMPROF_PHASE_STEADY];
+
+    syslog(LOG_INFO, "Memory of the benchmark: RSS peak %llu kB loading, "
+           "%llu kB running", (unsigned long long) load->peak.client.rssKb,
+           (unsigned long long) steady->peak.client.rssKb);
+    if (prof->larodPid > 0 && prof->larodReadable && steady->larodCount) {
+        syslog(LOG_INFO, "Memory of larod: RSS peak %llu kB loading, %llu kB "
+               "running, dma-buf peak %llu kB running",
+               (unsigned long long) load->peak.larod.rssKb,
+               (unsigned long long) steady->peak.larod.rssKb,
+               (unsigned long long) steady->peak.larod.dmabufKb);
+    }
+    if (prof->cmaTotalKb) {
+        syslog(LOG_INFO, "CMA in use: peak %llu kB loading, %llu kB running "
+               "of %llu kB", (unsigned long long) load->peak.cmaUsedKb,
+               (unsigned long long) steady->peak.cmaUsedKb,
+               (unsigned long long) prof->cmaTotalKb);
+    }
+}
+
+void memprofDestroy(memprof** profPtr) {
+    if (!profPtr || !*profPtr) {
+        return;
+    }
+    memprof* prof = *profPtr;
+    memprofStop(prof);
+    pthread_cond_destroy(&prof->cond);
+    pthread_mutex_destroy(&prof->mutex);
+    free(prof);
+    *profPtr = NULL;
+}
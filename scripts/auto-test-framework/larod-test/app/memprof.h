@@ -0,0 +1,114 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file declares the memory profiler of the benchmark.
+ *
+ * A thread samples the memory of the benchmark itself and of the larod
+ * service at a fixed interval while the model is loaded and run:
+ *
+ *     RSS and PSS     from /proc/<pid>/smaps_rollup, or only RSS from
+ *                     /proc/<pid>/status on kernels without it.
+ *     dma-buf         the size of the dma-bufs a process has open, from
+ *                     /proc/<pid>/fdinfo, each buffer counted once.
+ *     CMA             CmaTotal - CmaFree of /proc/meminfo, for the whole
+ *                     system, since the accelerators allocate from it.
+ *
+ * Each sample is counted in the phase the benchmark is in, so that the peak
+ * while loading the model is told apart from the peak and the mean while
+ * running it. The memory of the larod service can only be read by root or
+ * by the user running the service; if it cannot be read, it is left out.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+typedef enum {
+    // Samples are taken but not counted, e.g. during the warm-up.
+    MEMPROF_PHASE_IDLE,
+    // Before the model is loaded.
+    MEMPROF_PHASE_BASELINE,
+    // From connecting to larod until the first job is done.
+    MEMPROF_PHASE_LOAD,
+    // While the measured jobs run.
+    MEMPROF_PHASE_STEADY,
+    MEMPROF_NUM_PHASES,
+} memprofPhase;
+
+typedef struct memprof memprof;
+
+/**
+ * brief Starts sampling in a thread of its own, in MEMPROF_PHASE_BASELINE.
+ *
+ * param intervalMs Time between two samples, in milliseconds.
+ * param larodPid Pid of the larod service, 0 to look for a process named
+ * larod, -1 to not sample it.
+ * param modelFileBytes Size of the model file, only reported.
+ * param profPtr Pointer to the created profiler.
+ * return False if out of memory or the thread could not be started,
+ * otherwise true.
+ */
+bool memprofStart(unsigned intervalMs, pid_t larodPid, uint64_t modelFileBytes,
+                  memprof** profPtr);
+
+/**
+ * brief Moves to another phase.
+ *
+ * A sample is taken right away and counted in the phase that ends, so that
+ * short phases such as loading a small model get at least one sample.
+ *
+ * param prof The profiler.
+ * param phase The phase that starts.
+ */
+void memprofSetPhase(memprof* prof, memprofPhase phase);
+
+/**
+ * brief Stops sampling, after a last sample counted in the current phase.
+ *
+ * param prof The profiler.
+ */
+void memprofStop(memprof* prof);
+
+/**
+ * brief Writes the memory used in each phase as a JSON object.
+ *
+ * The object holds the model file size, the interval and number of samples,
+ * and for the benchmark, the larod service and CMA the baseline, the peak
+ * while loading, and the peak and mean while running, in kB. The larod
+ * service and CMA are null if they could not be read.
+ *
+ * param prof The profiler, stopped.
+ * param file File to write to.
+ */
+void memprofWriteJson(const memprof* prof, FILE* file);
+
+/**
+ * brief Logs the peak memory of the benchmark and the larod service.
+ *
+ * param prof The profiler, stopped.
+ */
+void memprofLog(const memprof* prof);
+
+/**
+ * brief Stops sampling if needed and frees the profiler.
+ *
+ * param profPtr Pointer to the profiler. Set to NULL on return.
+ */
+void memprofDestroy(memprof** profPtr);
@@ -0,0 +1,172 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file parses the arguments to the mixed-model benchmark.
+ */
+
+#include "mixargs.h"
+
+#include <argp.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#define KEY_USAGE (127)
+#define KEY_NO_ISOLATION (128)
+
+// Upper bound for the number of warm-up jobs of every model.
+#define MAX_WARMUP (1000000)
+// Upper bound for the length of a phase, a day.
+#define MAX_DURATION_S (24 * 3600)
+
+static int parseOpt(int key, char* arg, struct argp_state* state);
+static int parseUInt(const char* arg, unsigned long long* i,
+                     unsigned long long min, unsigned long long max);
+
+const struct argp_option opts[] = {
+    {"duration", 't', "SECONDS", 0,
+     "Wall-clock time of every phase: of every model alone and of all the "
+     "models together. Default is 20.",
+     0},
+    {"warmup", 'w', "N", 0,
+     "Number of jobs run by every model before measuring, to let caches, "
+     "clocks and the device settle. Their latencies are thrown away. "
+     "Default is 10.",
+     0},
+    {"no-isolation", KEY_NO_ISOLATION, NULL, 0,
+     "Only run the models together, not every model alone first. The "
+     "report then has no isolation numbers to compare with.",
+     0},
+    {"output", 'o', "FILE", 0,
+     "Write the JSON report to FILE instead of stdout.",
+     0},
+    {"help", 'h', NULL, 0, "Print this help text and exit.", 0},
+    {"usage", KEY_USAGE, NULL, 0, "Print short usage message and exit.", 0},
+    {0}};
+const struct argp argp = {
+    opts,
+    parseOpt,
+    "CONFIG",
+    "Measures how models running at the same time on one device slow each "
+    "other down. Every model listed in CONFIG is loaded on its own larod "
+    "connection and run from its own thread, either at a target rate or "
+    "as fast as it can. Every model is first run alone, with the others "
+    "loaded but idle, and then all the models are run together, each phase "
+    "for the same time. A JSON report with the latency percentiles and the "
+    "throughput of every model in both phases, and how much worse they got "
+    "together, is written at the end.\n\n"
+    "CONFIG has one model per line: the model file, the device and the "
+    "target rate in jobs per second, or max to run as fast as possible. "
+    "Empty lines and lines starting with # are skipped, e.g.\n\n"
+    "  # model                          device               rate\n"
+    "  models/artpec8/yolov5n.tflite    axis-a8-dlpu-tflite  10\n"
+    "  models/artpec8/mobilenet_v2_1.0_224_quant.tflite "
+    "axis-a8-dlpu-tflite max\n\n"
+    "Example call:\n"
+    "larod_mix -t 30 /tmp/mix.conf",
+    NULL,
+    NULL,
+    NULL};
+
+bool parseMixArgs(int argc, char** argv, mixArgs* args) {
+    if (argp_parse(&argp, argc, argv, ARGP_NO_HELP, NULL, args)) {
+        return false;
+    }
+    return true;
+}
+
+int parseOpt(int key, char* arg, struct argp_state* state) {
+    mixArgs* args = state->input;
+    unsigned long long value;
+    int ret;
+
+    switch (key) {
+    case 't':
+        ret = parseUInt(arg, &value, 1, MAX_DURATION_S);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret, "invalid duration");
+        }
+        args->durationS = (unsigned) value;
+        break;
+    case 'w':
+        ret = parseUInt(arg, &value, 0, MAX_WARMUP);
+        if (ret) {
+            argp_failure(state, EXIT_FAILURE, ret,
+                         "invalid number of warm-up jobs");
+        }
+        args->warmup = (size_t) value;
+        break;
+    case KEY_NO_ISOLATION:
+        args->noIsolation = true;
+        break;
+    case 'o':
+        args->outputFile = arg;
+        break;
+    case 'h':
+        argp_state_help(state, stdout, ARGP_HELP_STD_HELP);
+        break;
+    case KEY_USAGE:
+        argp_state_help(state, stdout, ARGP_HELP_USAGE | ARGP_HELP_EXIT_OK);
+        break;
+    case ARGP_KEY_ARG:
+        if (state->arg_num == 0) {
+            args->configFile = arg;
+        } else {
+            argp_error(state, "Too many arguments given");
+        }
+        break;
+    case ARGP_KEY_INIT:
+        args->configFile = NULL;
+        args->outputFile = NULL;
+        args->warmup = 10;
+        args->durationS = 20;
+        args->noIsolation = false;
+        break;
+    case ARGP_KEY_END:
+        if (state->arg_num != 1) {
+            argp_error(state, "Invalid number of arguments given");
+        }
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+/**
+ * brief Parses a string as an unsigned long long in a range
+ *
+ * param arg String to parse.
+ * param i Pointer to the number being the result of parsing.
+ * param min Smallest number allowed.
+ * param max Largest number allowed.
+ * return Positive errno style return code (zero means success).
+ */
+static int parseUInt(const char* arg, unsigned long long* i,
+                     unsigned long long min, unsigned long long max) {
+    char* endPtr;
+
+    *i = strtoull(arg, &endPtr, 0);
+    if (endPtr == arg || *endPtr != '\0' || arg[0] == '-') {
+        return EINVAL;
+    } else if (*i == ULLONG_MAX || *i < min || *i > max) {
+        return ERANGE;
+    }
+
+    return 0;
+}
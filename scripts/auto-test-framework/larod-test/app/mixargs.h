@@ -0,0 +1,39 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file parses the arguments to the mixed-model benchmark.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct mixArgs {
+    // Config file listing the models to run together.
+    char* configFile;
+    // JSON report file, NULL to print the report on stdout.
+    char* outputFile;
+    // Jobs run and thrown away per model before measuring.
+    size_t warmup;
+    // Wall-clock time of every phase in seconds.
+    unsigned durationS;
+    // Skip running every model alone first.
+    bool noIsolation;
+} mixArgs;
+
+bool parseMixArgs(int argc, char** argv, mixArgs* args);
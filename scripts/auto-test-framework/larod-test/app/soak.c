@@ -0,0 +1,485 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file implements the soak run of the benchmark.
+ */
+
+#include "soak.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+// Directories of the sensors, overridden to test on a host without them.
+#ifndef SOAK_THERMAL_DIR
+#define SOAK_THERMAL_DIR "/sys/class/thermal"
+#endif
+#ifndef SOAK_CPUFREQ_DIR
+#define SOAK_CPUFREQ_DIR "/sys/devices/system/cpu/cpufreq"
+#endif
+
+// Largest number of thermal zones and cpufreq policies read. Any more are
+// left out.
+#define MAX_ZONES (16)
+#define MAX_POLICIES (8)
+// Longest name of a thermal zone kept.
+#define ZONE_NAME_BYTES (32)
+// Value of a sensor that could not be read.
+#define SENSOR_UNREAD (LONG_MIN)
+
+typedef struct soakSensors {
+    // Millidegrees Celsius.
+    long temp[MAX_ZONES];
+    // kHz.
+    long curFreq[MAX_POLICIES];
+    long maxFreq[MAX_POLICIES];
+} soakSensors;
+
+typedef struct soakWindow {
+    double startS;
+    double lengthS;
+    benchSummary latency;
+    soakSensors sensors;
+} soakWindow;
+
+struct soak {
+    unsigned windowS;
+    size_t numWindows;
+    size_t count;
+    soakWindow* windows;
+    double elapsedS;
+    size_t numZones;
+    unsigned zones[MAX_ZONES];
+    char zoneNames[MAX_ZONES][ZONE_NAME_BYTES];
+    size_t numPolicies;
+    unsigned policies[MAX_POLICIES];
+    soakSensors start;
+};
+
+/**
+ * brief Reads a sysfs file holding one integer.
+ *
+ * param path Path of the file.
+ * param value Pointer to the value.
+ * return False if the file could not be read or parsed, otherwise true.
+ */
+static bool readLong(const char* path, long* value);
+
+/**
+ * brief Lists the numbered entries of a directory, e.g. thermal_zone<n>,
+ * in order, keeping those that have a readable file.
+ *
+ * param dir The directory.
+ * param prefix Name of the entries before the number.
+ * param file File that must be readable in the entry.
+ * param ids Array of up to max numbers to fill in.
+ * param max Largest number of entries kept.
+ * return Number of entries kept.
+ */
+static size_t findEntries(const char* dir, const char* prefix,
+                          const char* file, unsigned* ids, size_t max);
+
+/**
+ * brief Orders two unsigned values, for qsort.
+ *
+ * param a Pointer to the first value.
+ * param b Pointer to the second value.
+ * return Negative, zero or positive as a is less than, equal to or greater
+ * than b.
+ */
+static int compareUnsigned(const void* a, const void* b);
+
+/**
+ * brief Reads all sensors that were found.
+ *
+ * param s The soak run.
+ * param sensors Pointer to the readings, SENSOR_UNREAD if a read failed.
+ */
+static void readSensors(const soak* s, soakSensors* sensors);
+
+/**
+ * brief Returns the hottest zone of a reading.
+ *
+ * param s The soak run.
+ * param sensors The reading.
+ * return Millidegrees Celsius, SENSOR_UNREAD if no zone was read.
+ */
+static long hottest(const soak* s, const soakSensors* sensors);
+
+/**
+ * brief Returns the highest max frequency of a reading.
+ *
+ * param s The soak run.
+ * param sensors The reading.
+ * return kHz, SENSOR_UNREAD if no policy was read.
+ */
+static long highestMaxFreq(const soak* s, const soakSensors* sensors);
+
+/**
+ * brief Returns the window with the highest p99 latency.
+ *
+ * param s The soak run, with at least one window.
+ * return Index of the window.
+ */
+static size_t worstWindow(const soak* s);
+
+/**
+ * brief Returns the change from one value to another in percent.
+ *
+ * param from First value.
+ * param to Last value.
+ * return The change, 0 if from is 0.
+ */
+static double changePct(double from, double to);
+
+/**
+ * brief Writes the readings of a sensor as a JSON array, in the unit of
+ * the report.
+ *
+ * param file File to write to.
+ * param values Readings.
+ * param count Number of readings.
+ * param scale Divisor from the unit read to the unit of the report.
+ */
+static void writeReadings(FILE* file, const long* values, size_t count,
+                          double scale);
+
+/**
+ * brief Writes the readings of all sensors as JSON members.
+ *
+ * param s The soak run.
+ * param file File to write to.
+ * param sensors The readings.
+ */
+static void writeSensors(const soak* s, FILE* file,
+                         const soakSensors* sensors);
+
+static bool readLong(const char* path, long* value) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    const bool ok = fscanf(file, "%ld", value) == 1;
+    fclose(file);
+
+    return ok;
+}
+
+static int compareUnsigned(const void* a, const void* b) {
+    const unsigned ua = *(const unsigned*) a;
+    const unsigned ub = *(const unsigned*) b;
+
+    return (ua > ub) - (ua < ub);
+}
+
+static size_t findEntries(const char* dir, const char* prefix,
+                          const char* file, unsigned* ids, size_t max) {
+    const size_t prefixLen = strlen(prefix);
+    size_t count = 0;
+
+    DIR* d = opendir(dir);
+    if (!d) {
+        return 0;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL && count < max) {
+        char* end;
+        if (strncmp(entry->d_name, prefix, prefixLen) != 0) {
+            continue;
+        }
+        const unsigned long id =
+            strtoul(entry->d_name + prefixLen, &end, 10);
+        if (end == entry->d_name + prefixLen || *end != '\0' ||
+            id > UINT_MAX) {
+            continue;
+        }
+        char path[PATH_MAX];
+        long value;
+        snprintf(path, sizeof(path), "%s/%s/%s", dir, entry->d_name, file);
+        if (readLong(path, &value)) {
+            ids[count++] = (unsigned) id;
+        }
+    }
+    closedir(d);
+    qsort(ids, count, sizeof(unsigned), compareUnsigned);
+
+    return count;
+}
+
+static void readSensors(const soak* s, soakSensors* sensors) {
+    char path[PATH_MAX];
+
+    for (size_t z = 0; z < s->numZones; z++) {
+        snprintf(path, sizeof(path), SOAK_THERMAL_DIR "/thermal_zone%u/temp",
+                 s->zones[z]);
+        if (!readLong(path, &sensors->temp[z])) {
+            sensors->temp[z] = SENSOR_UNREAD;
+        }
+    }
+    for (size_t p = 0; p < s->numPolicies; p++) {
+        snprintf(path, sizeof(path),
+                 SOAK_CPUFREQ_DIR "/policy%u/scaling_cur_freq",
+                 s->policies[p]);
+        if (!readLong(path, &sensors->curFreq[p])) {
+            sensors->curFreq[p] = SENSOR_UNREAD;
+        }
+        snprintf(path, sizeof(path),
+                 SOAK_CPUFREQ_DIR "/policy%u/scaling_max_freq",
+                 s->policies[p]);
+        if (!readLong(path, &sensors->maxFreq[p])) {
+            sensors->maxFreq[p] = SENSOR_UNREAD;
+        }
+    }
+}
+
+static long hottest(const soak* s, const soakSensors* sensors) {
+    long max = SENSOR_UNREAD;
+
+    for (size_t z = 0; z < s->numZones; z++) {
+        max = sensors->temp[z] > max ? sensors->temp[z] : max;
+    }
+
+    return max;
+}
+
+static long highestMaxFreq(const soak* s, const soakSensors* sensors) {
+    long max = SENSOR_UNREAD;
+
+    for (size_t p = 0; p < s->numPolicies; p++) {
+        max = sensors->maxFreq[p] > max ? sensors->maxFreq[p] : max;
+    }
+
+    return max;
+}
+
+static size_t worstWindow(const soak* s) {
+    size_t worst = 0;
+
+    for (size_t w = 1; w < s->count; w++) {
+        if (s->windows[w].latency.p99Ms > s->windows[worst].latency.p99Ms) {
+            worst = w;
+        }
+    }
+
+    return worst;
+}
+
+static double changePct(double from, double to) {
+    return from > 0.0 ? 100.0 * (to - from) / from : 0.0;
+}
+
+bool soakCreate(unsigned windowS, size_t numWindows, soak** soakPtr) {
+    soak* s = calloc(1, sizeof(soak));
+    if (!s) {
+        return false;
+    }
+    s->windows = calloc(numWindows, sizeof(soakWindow));
+    if (!s->windows) {
+        free(s);
+        return false;
+    }
+    s->windowS = windowS;
+    s->numWindows = numWindows;
+
+    s->numZones = findEntries(SOAK_THERMAL_DIR, "thermal_zone", "temp",
+                              s->zones, MAX_ZONES);
+    for (size_t z = 0; z < s->numZones; z++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), SOAK_THERMAL_DIR "/thermal_zone%u/type",
+                 s->zones[z]);
+        FILE* file = fopen(path, "r");
+        char* name = s->zoneNames[z];
+        if (!file || !fgets(name, ZONE_NAME_BYTES, file)) {
+            snprintf(name, ZONE_NAME_BYTES, "thermal_zone%u", s->zones[z]);
+        }
+        if (file) {
+            fclose(file);
+        }
+        // Keep the name safe to write as a JSON string.
+        for (char* c = name; *c; c++) {
+            if (*c == '\n') {
+                *c = '\0';
+                break;
+            }
+            if (*c == '"' || *c == '\\' || (unsigned char) *c < 0x20) {
+                *c = '_';
+            }
+        }
+    }
+    s->numPolicies = findEntries(SOAK_CPUFREQ_DIR, "policy",
+                                 "scaling_cur_freq", s->policies,
+                                 MAX_POLICIES);
+    if (!s->numZones && !s->numPolicies) {
+        syslog(LOG_WARNING, "No temperature or CPU frequency can be read, "
+               "only the latency is followed");
+    }
+    readSensors(s, &s->start);
+    *soakPtr = s;
+
+    return true;
+}
+
+bool soakAddWindow(soak* s, const benchSamples* samples, uint64_t lengthNs) {
+    soakWindow* w = &s->windows[s->count];
+
+    if (!benchSummarize(samples, &w->latency)) {
+        return false;
+    }
+    readSensors(s, &w->sensors);
+    w->startS = s->elapsedS;
+    w->lengthS = (double) lengthNs / 1e9;
+    s->elapsedS += w->lengthS;
+    s->count++;
+
+    const long temp = hottest(s, &w->sensors);
+    const long maxFreq = highestMaxFreq(s, &w->sensors);
+    syslog(LOG_INFO, "Window %zu of %zu: %zu jobs, p50 %.3f ms, p99 %.3f ms, "
+           "hottest zone %.1f C, max CPU frequency %ld MHz", s->count,
+           s->numWindows, w->latency.count, w->latency.p50Ms,
+           w->latency.p99Ms, temp == SENSOR_UNREAD ? 0.0 : (double) temp / 1e3,
+           maxFreq == SENSOR_UNREAD ? 0 : maxFreq / 1000);
+
+    return true;
+}
+
+void soakLog(const soak* s) {
+    const soakWindow* first = &s->windows[0];
+    const soakWindow* last = &s->windows[s->count - 1];
+    const size_t worst = worstWindow(s);
+
+    syslog(LOG_INFO, "Soak of %.0f s in %zu windows: p50 %.3f -> %.3f ms "
+           "(%+.1f%%), p99 %.3f -> %.3f ms (%+.1f%%), %.1f -> %.1f jobs/s",
+           s->elapsedS, s->count, first->latency.p50Ms, last->latency.p50Ms,
+           changePct(first->latency.p50Ms, last->latency.p50Ms),
+           first->latency.p99Ms, last->latency.p99Ms,
+           changePct(first->latency.p99Ms, last->latency.p99Ms),
+           (double) first->latency.count / first->lengthS,
+           (double) last->latency.count / last->lengthS);
+    syslog(LOG_INFO, "Worst window %zu at %.0f s: p99 %.3f ms, p50 %.3f ms",
+           worst + 1, s->windows[worst].startS,
+           s->windows[worst].latency.p99Ms, s->windows[worst].latency.p50Ms);
+
+    const long startTemp = hottest(s, &s->start);
+    const long lastTemp = hottest(s, &last->sensors);
+    if (startTemp != SENSOR_UNREAD && lastTemp != SENSOR_UNREAD) {
+        syslog(LOG_INFO, "Hottest zone %.1f C before, %.1f C at the end",
+               (double) startTemp / 1e3, (double) lastTemp / 1e3);
+    }
+    const long startFreq = highestMaxFreq(s, &s->start);
+    const long lastFreq = highestMaxFreq(s, &last->sensors);
+    if (startFreq != SENSOR_UNREAD && lastFreq != SENSOR_UNREAD) {
+        syslog(lastFreq < startFreq ? LOG_WARNING : LOG_INFO,
+               "Max CPU frequency %ld MHz before, %ld MHz at the end%s",
+               startFreq / 1000, lastFreq / 1000,
+               lastFreq < startFreq ? ", the CPU was throttled" : "");
+    }
+}
+
+static void writeReadings(FILE* file, const long* values, size_t count,
+                          double scale) {
+    fputc('[', file);
+    for (size_t i = 0; i < count; i++) {
+        if (values[i] == SENSOR_UNREAD) {
+            fprintf(file, "%snull", i ? ", " : "");
+        } else {
+            fprintf(file, "%s%g", i ? ", " : "", (double) values[i] / scale);
+        }
+    }
+    fputc(']', file);
+}
+
+static void writeSensors(const soak* s, FILE* file,
+                         const soakSensors* sensors) {
+    fputs("\"temp_c\": ", file);
+    writeReadings(file, sensors->temp, s->numZones, 1e3);
+    fputs(", \"cpu_mhz\": ", file);
+    writeReadings(file, sensors->curFreq, s->numPolicies, 1e3);
+    fputs(", \"cpu_max_mhz\": ", file);
+    writeReadings(file, sensors->maxFreq, s->numPolicies, 1e3);
+}
+
+void soakWriteJson(const soak* s, FILE* file) {
+    const soakWindow* first = &s->windows[0];
+    const soakWindow* last = &s->windows[s->count - 1];
+    const size_t worst = worstWindow(s);
+
+    fprintf(file, "{\"duration_s\": %.3f, \"window_s\": %u, \"zones\": [",
+            s->elapsedS, s->windowS);
+    for (size_t z = 0; z < s->numZones; z++) {
+        fprintf(file, "%s\"%s\"", z ? ", " : "", s->zoneNames[z]);
+    }
+    fputs("], \"policies\": [", file);
+    for (size_t p = 0; p < s->numPolicies; p++) {
+        fprintf(file, "%s\"policy%u\"", p ? ", " : "", s->policies[p]);
+    }
+    fputs("], \"before\": {", file);
+    writeSensors(s, file, &s->start);
+    fputs("}, \"windows\": [", file);
+    for (size_t w = 0; w < s->count; w++) {
+        const soakWindow* win = &s->windows[w];
+        fprintf(file, "%s{\"start_s\": %.3f, \"jobs\": %zu, "
+                "\"jobs_per_s\": %.3f, \"p50_ms\": %.4f, \"p90_ms\": %.4f, "
+                "\"p99_ms\": %.4f, \"max_ms\": %.4f, \"mean_ms\": %.4f, ",
+                w ? ", " : "", win->startS, win->latency.count,
+                (double) win->latency.count / win->lengthS,
+                win->latency.p50Ms, win->latency.p90Ms, win->latency.p99Ms,
+                win->latency.maxMs, win->latency.meanMs);
+        writeSensors(s, file, &win->sensors);
+        fputc('}', file);
+    }
+    fprintf(file, "], \"drift\": {\"p50_pct\": %.3f, \"p99_pct\": %.3f, "
+            "\"mean_pct\": %.3f, \"jobs_per_s_pct\": %.3f",
+            changePct(first->latency.p50Ms, last->latency.p50Ms),
+            changePct(first->latency.p99Ms, last->latency.p99Ms),
+            changePct(first->latency.meanMs, last->latency.meanMs),
+            changePct((double) first->latency.count / first->lengthS,
+                      (double) last->latency.count / last->lengthS));
+    // The sensors drift from the idle device before the run.
+    const long startTemp = hottest(s, &s->start);
+    const long lastTemp = hottest(s, &last->sensors);
+    const long startFreq = highestMaxFreq(s, &s->start);
+    const long lastFreq = highestMaxFreq(s, &last->sensors);
+    if (startTemp != SENSOR_UNREAD && lastTemp != SENSOR_UNREAD) {
+        fprintf(file, ", \"hottest_temp_c\": %g",
+                (double) (lastTemp - startTemp) / 1e3);
+    } else {
+        fputs(", \"hottest_temp_c\": null", file);
+    }
+    if (startFreq != SENSOR_UNREAD && lastFreq != SENSOR_UNREAD) {
+        fprintf(file, ", \"cpu_max_mhz\": %g}",
+                (double) (lastFreq - startFreq) / 1e3);
+    } else {
+        fputs(", \"cpu_max_mhz\": null}", file);
+    }
+    fprintf(file, ", \"worst_window\": {\"index\": %zu, \"start_s\": %.3f, "
+            "\"p99_ms\": %.4f, \"p50_ms\": %.4f}}",
+            worst, s->windows[worst].startS, s->windows[worst].latency.p99Ms,
+            s->windows[worst].latency.p50Ms);
+}
+
+void soakDestroy(soak** soakPtr) {
+    soak* s = *soakPtr;
+    if (!s) {
+        return;
+    }
+
+    free(s->windows);
+    free(s);
+    *soakPtr = NULL;
+}
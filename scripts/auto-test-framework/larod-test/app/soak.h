@@ -0,0 +1,96 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file declares the soak run of the benchmark, which runs jobs
+ * for a fixed wall-clock time and follows how the latency changes as the
+ * device heats up.
+ *
+ * The run is cut into windows of a fixed length. For every window the
+ * latency of its jobs is summarized, and at its end the sensors are read:
+ *
+ *     temperature     /sys/class/thermal/thermal_zone<n>/temp of every
+ *                     zone, e.g. the CPU and the SoC, in degrees Celsius.
+ *     CPU frequency   scaling_cur_freq and scaling_max_freq of every
+ *                     policy in /sys/devices/system/cpu/cpufreq, in MHz.
+ *                     Thermal throttling lowers the max frequency.
+ *
+ * Sensors that cannot be read when the run starts are left out, so the run
+ * works the same on devices without them. The sensors are also read once
+ * before the first window, as a reference for the idle device.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "benchstats.h"
+
+typedef struct soak soak;
+
+/**
+ * brief Finds the sensors and reads them once, before any window.
+ *
+ * param windowS Length of a window, in seconds.
+ * param numWindows Number of windows of the run.
+ * param soakPtr Pointer to the created soak run.
+ * return False if out of memory, otherwise true.
+ */
+bool soakCreate(unsigned windowS, size_t numWindows, soak** soakPtr);
+
+/**
+ * brief Ends a window: summarizes the latency of its jobs and reads the
+ * sensors.
+ *
+ * param s The soak run, with fewer windows than numWindows so far.
+ * param samples Latency of every job of the window, at least one.
+ * param lengthNs Wall-clock length of the window.
+ * return False if out of memory, otherwise true.
+ */
+bool soakAddWindow(soak* s, const benchSamples* samples, uint64_t lengthNs);
+
+/**
+ * brief Logs the drift between the first and the last window and the worst
+ * window.
+ *
+ * param s The soak run, with at least one window.
+ */
+void soakLog(const soak* s);
+
+/**
+ * brief Writes the soak run as a JSON object.
+ *
+ * The object holds the length of the run and of a window, the names of the
+ * thermal zones and cpufreq policies, the sensors before the run, every
+ * window, the drift of the latency between the first and the last window in
+ * percent, the change of the hottest zone and of the highest max frequency
+ * from before the run to the last window, and the window with the highest
+ * p99 latency. Sensors that could not be read are null.
+ *
+ * param s The soak run, with at least one window.
+ * param file File to write to.
+ */
+void soakWriteJson(const soak* s, FILE* file);
+
+/**
+ * brief Frees a soak run.
+ *
+ * param soakPtr Pointer to the soak run. Set to NULL on return.
+ */
+void soakDestroy(soak** soakPtr);
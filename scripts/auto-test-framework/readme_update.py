@@ -15,6 +15,8 @@
 import os
 import re
 
+import bench_history
+
 tokens = \
     ['A8_tf1_mnv2', 'A8_P_tf1_mnv2', 'A7_tf1_mnv2','A7_tf2_mnv2','A7_tf2_mnv3','cv25_tf1_mnv2','cv25_tf1_ens', \
     'A7_tf1_ssd_mnv2','A7_tf1_ssd_md', 'A8_P_tf1_ssd_mnv2', 'A8_Q_tf1_ssd_mnv2', 'A8_P_tf1_ssd_md', 'A8_Q_tf1_ssd_md', 'A8_P_yolov5n', 'A8_Q_yolov5n', 'A8_Q_yolov5s', 'A8_Q_yolov5m', \
@@ -61,16 +63,14 @@ def read_larod_output(file_name):
     with open(file_name, 'r') as f:
         return f.read()
 
-def extract_inference_time(larod_output):
-    #extract model name from larod output
-    regex_model = "Model name:(.*?)\."
-    model = re.findall(regex_model, larod_output, re.MULTILINE)[0]
-
-    #extract inference time from larod output
-    regex = "result: \.\/models((.*?).(tflite|bin)) (.*?) job: (.*?) ms"
-    matches = re.findall(regex, larod_output, re.MULTILINE)
-    # filter file name and inference time
-    return {token_parameters[(match[0], model)]: match[4] for match in matches if (match[0], model) in token_parameters}
+#the latest mean latency of every token in the history
+def extract_inference_time(history):
+    times = {}
+    for entry in history:
+        key = (entry['model'], entry['device_model'])
+        if entry['kind'] == 'latency' and key in token_parameters:
+            times[token_parameters[key]] = "%.2f" % entry['latency']['mean_ms']
+    return times
 
 #generate section from value to add
 def generate_table(value_to_add, token):
@@ -91,8 +91,11 @@ def main():
     file_name = 'README.md'
 
     md_file = read_md_file(file_name)
+    #every run is kept in the history, the table shows the latest one
     larod_output = read_larod_output("/tmp/larod_out.txt")
-    inference_times = extract_inference_time(larod_output)
+    bench_history.record_log(larod_output)
+    history = bench_history.read_history()
+    inference_times = extract_inference_time(history)
     for token in tokens:
         token_index = find_token(md_file, token)
         if token_index != -1 and token in inference_times:
@@ -104,5 +107,8 @@ def main():
         else:
             print("Can't find token in file: " + token)
 
+    #flag the models that got slower since the previous run
+    bench_history.print_comparison(bench_history.compare(history))
+
 if __name__ == '__main__':
     main()
@@ -0,0 +1,144 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This header file declares the backends that execute jobs in the larod
+ * stand-in library: TensorFlow Lite models and image preprocessing.
+ *
+ * A backend only sees plain buffers. Reading inputs from and writing outputs
+ * to the tensor fds is done by larod_shim.c.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "larod.h"
+
+// Largest number of inputs or outputs of a model.
+#define SHIM_MAX_TENSORS (8)
+
+typedef struct shimTensorInfo {
+    larodTensorDataType dataType;
+    larodTensorDims dims;
+    size_t byteSize;
+} shimTensorInfo;
+
+typedef struct shimModelInfo {
+    size_t numInputs;
+    size_t numOutputs;
+    shimTensorInfo inputs[SHIM_MAX_TENSORS];
+    shimTensorInfo outputs[SHIM_MAX_TENSORS];
+} shimModelInfo;
+
+typedef struct tfliteBackend tfliteBackend;
+
+typedef enum {
+    SHIM_IMAGE_RGB_INTERLEAVED,
+    SHIM_IMAGE_RGB_PLANAR,
+} shimImageFormat;
+
+typedef struct shimImage {
+    shimImageFormat format;
+    size_t width;
+    size_t height;
+} shimImage;
+
+typedef struct shimCrop {
+    size_t x;
+    size_t y;
+    size_t width;
+    size_t height;
+} shimCrop;
+
+/**
+ * brief Creates a TensorFlow Lite interpreter for a model.
+ *
+ * The TensorFlow Lite C library is loaded with dlopen the first time this is
+ * called, so the stand-in library has no build time dependency on it.
+ *
+ * param data Model file contents. Must stay valid until the backend is
+ * destroyed.
+ * param size Size in bytes of the model file.
+ * param info Pointer to the model tensors, set on success.
+ * param backendPtr Pointer to the created backend.
+ * param errMsg Buffer for an error message.
+ * param errSize Size of errMsg.
+ * return False if the library or the model could not be loaded.
+ */
+bool tfliteBackendCreate(const void* data, size_t size, shimModelInfo* info,
+                         tfliteBackend** backendPtr, char* errMsg,
+                         size_t errSize);
+
+/**
+ * brief Runs the model on one set of inputs.
+ *
+ * Calls on the same backend are serialized, since a TensorFlow Lite
+ * interpreter can only run one inference at a time.
+ *
+ * param backend The backend.
+ * param inputs Input buffers, one per model input, of the size in info.
+ * param outputs Output buffers, one per model output, of the size in info.
+ * param errMsg Buffer for an error message.
+ * param errSize Size of errMsg.
+ * return False if the inference failed, otherwise true.
+ */
+bool tfliteBackendRun(tfliteBackend* backend, void* const* inputs,
+                      void* const* outputs, char* errMsg, size_t errSize);
+
+/**
+ * brief Destroys an interpreter created with tfliteBackendCreate.
+ *
+ * param backendPtr Pointer to the backend. Set to NULL on return.
+ */
+void tfliteBackendDestroy(tfliteBackend** backendPtr);
+
+/**
+ * brief Parses the name of an image format, as given in larod parameters.
+ *
+ * param name Name of the format, e.g. "rgb-interleaved".
+ * param format Pointer to the parsed format.
+ * return False if the format is not supported, otherwise true.
+ */
+bool preprocParseFormat(const char* name, shimImageFormat* format);
+
+/**
+ * brief Describes the tensors of a preprocessing model.
+ *
+ * param input Format and size of the input image.
+ * param output Format and size of the output image.
+ * param info Pointer to the description to fill in.
+ */
+void preprocDescribe(const shimImage* input, const shimImage* output,
+                     shimModelInfo* info);
+
+/**
+ * brief Crops, scales and converts an image.
+ *
+ * The crop is scaled to the output size with bilinear interpolation, with
+ * the pixel centres of the crop and the output aligned.
+ *
+ * param input Format and size of the input image.
+ * param output Format and size of the output image.
+ * param crop Part of the input to scale, inside the input image.
+ * param in Input pixels.
+ * param out Output pixels.
+ * return False if out of memory, otherwise true.
+ */
+bool preprocRun(const shimImage* input, const shimImage* output,
+                const shimCrop* crop, const uint8_t* in, uint8_t* out);
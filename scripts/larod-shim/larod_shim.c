@@ -0,0 +1,1344 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file implements a host stand-in for liblarod.
+ *
+ * Jobs are run in the calling process instead of by the larod service. Input
+ * tensors are read from their fds at their offsets and outputs are written
+ * back the same way, so the applications use exactly the same code paths as
+ * on a device. Each connection runs its asynchronous jobs in order on a
+ * thread of its own.
+ *
+ * Models are run by one of two backends, chosen by LAROD_SHIM_BACKEND:
+ *
+ *     tflite  TensorFlow Lite models run with the TFLite CPU interpreter.
+ *     fake    A deterministic fake accelerator, see runFake().
+ *     auto    tflite if the interpreter library and the model load, else
+ *             fake. This is the default.
+ *
+ * The fake accelerator takes its tensor sizes from LAROD_SHIM_INPUT_BYTES,
+ * LAROD_SHIM_OUTPUT_BYTES or LAROD_SHIM_OUTPUT_DIMS and
+ * LAROD_SHIM_NUM_OUTPUTS, and sleeps
+ * LAROD_SHIM_LATENCY_US per job. Jobs of all connections share one fake
+ * device, so the latency serializes them like a single accelerator would.
+ *
+ * Models loaded with LAROD_ACCESS_PUBLIC are copied to LAROD_SHIM_MODEL_DIR,
+ * one file per model id, so that larodGetModel finds them in any process
+ * until they are deleted with larodDeleteModel, as public models of the
+ * larod service outlive the session that loaded them.
+ *
+ * Models loaded on a device whose name ends with "-proc", e.g. cpu-proc, are
+ * preprocessing models instead. They are described by the image.input.* and
+ * image.output.* parameters and crop and scale RGB images, see
+ * preproc_backend.c.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "larod.h"
+
+#define ERROR_MSG_SIZE (256)
+
+#define DEFAULT_INPUT_BYTES (224 * 224 * 3)
+#define DEFAULT_OUTPUT_BYTES (1001)
+#define DEFAULT_MODEL_DIR "/tmp/larod-shim-models"
+
+// Ids of public models start here, so they never collide with the ids of
+// private models, which are counted per process.
+#define PUBLIC_MODEL_ID_BASE (1ull << 32)
+
+// Largest number of devices a connection hands out.
+#define MAX_DEVICES (8)
+// Largest number of entries of a parameter map, and length of its strings.
+#define MAX_MAP_ENTRIES (16)
+#define MAP_STR_LEN (64)
+
+struct larodDevice {
+    char name[64];
+};
+
+typedef struct shimJob {
+    larodJobRequest* req;
+    larodRunJobCallback callback;
+    void* userData;
+    struct shimJob* next;
+} shimJob;
+
+struct larodConnection {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t jobThread;
+    bool jobThreadStarted;
+    bool stop;
+    // Queue of asynchronous jobs, run in order by jobThread.
+    shimJob* head;
+    shimJob* tail;
+    // Devices handed out by larodGetDevice, the first one is the default.
+    larodDevice devices[MAX_DEVICES];
+    size_t numDevices;
+};
+
+struct larodModel {
+    uint64_t id;
+    // A copy of the model file is kept in LAROD_SHIM_MODEL_DIR.
+    bool isPublic;
+    shimModelInfo info;
+    // Model file contents and interpreter, NULL for the fake accelerator.
+    void* data;
+    size_t dataSize;
+    tfliteBackend* backend;
+    // Images of a preprocessing model, see loadPreprocModel.
+    bool isPreproc;
+    shimImage preprocInput;
+    shimImage preprocOutput;
+};
+
+struct larodTensor {
+    int fd;
+    size_t fdSize;
+    int64_t fdOffset;
+    uint32_t fdProps;
+    larodTensorDataType dataType;
+    larodTensorLayout layout;
+    larodTensorDims dims;
+    larodTensorPitches pitches;
+    size_t byteSize;
+};
+
+struct larodJobRequest {
+    const larodModel* model;
+    larodTensor* inputs[SHIM_MAX_TENSORS];
+    larodTensor* outputs[SHIM_MAX_TENSORS];
+    size_t numInputs;
+    size_t numOutputs;
+    // Crop of a preprocessing job, from the image.input.crop parameter.
+    bool hasCrop;
+    shimCrop crop;
+};
+
+typedef struct shimMapEntry {
+    char key[MAP_STR_LEN];
+    bool isStr;
+    char str[MAP_STR_LEN];
+    int64_t ints[4];
+    size_t numInts;
+} shimMapEntry;
+
+struct larodMap {
+    shimMapEntry entries[MAX_MAP_ENTRIES];
+    size_t numEntries;
+};
+
+static pthread_mutex_t fakeDeviceMutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t nextModelId = 1;
+
+/**
+ * brief Sets a larod error, if the caller asked for one.
+ *
+ * param error Pointer to the error to set, may be NULL.
+ * param code Error code.
+ * param fmt printf style format of the message.
+ * return Always false, so that it can be returned directly.
+ */
+static bool setError(larodError** error, larodErrorCode code, const char* fmt,
+                     ...) __attribute__((format(printf, 3, 4)));
+
+/**
+ * brief Reads a size from the environment.
+ *
+ * param name Name of the environment variable.
+ * param defaultValue Value used if the variable is not set.
+ * return The size.
+ */
+static size_t envSize(const char* name, size_t defaultValue);
+
+/**
+ * brief Reads tensor dimensions from an environment variable, e.g. 1x84x8400.
+ *
+ * param name Name of the environment variable.
+ * param dims Pointer to the dimensions, set if the variable is valid.
+ * return False if the variable is not set or not valid, otherwise true.
+ */
+static bool envDims(const char* name, larodTensorDims* dims);
+
+/**
+ * brief Reads a whole file from the start, without moving the file offset.
+ *
+ * param fd File descriptor.
+ * param dataPtr Pointer to a heap buffer with the contents, set on success.
+ * param sizePtr Pointer to the size of the contents.
+ * return False if the file could not be read, otherwise true.
+ */
+static bool readWholeFile(int fd, void** dataPtr, size_t* sizePtr);
+
+/**
+ * brief Returns the file a public model is kept in.
+ *
+ * param id Id of the model.
+ * param path Buffer for the path.
+ * param size Size of path.
+ */
+static void publicModelPath(uint64_t id, char* path, size_t size);
+
+/**
+ * brief Copies a model file to LAROD_SHIM_MODEL_DIR under a new id.
+ *
+ * param model The loaded model, its id is set on success.
+ * param fd File descriptor of the model file.
+ * param error Pointer to an error, set on failure.
+ * return False if the copy could not be written, otherwise true.
+ */
+static bool publishModel(larodModel* model, int fd, larodError** error);
+
+/**
+ * brief Describes the tensors of the fake accelerator.
+ *
+ * param info Pointer to the description to fill in.
+ */
+static void describeFakeModel(shimModelInfo* info);
+
+/**
+ * brief Runs the fake accelerator.
+ *
+ * Every output byte j is input byte j modulo the size of the first input, so
+ * the output is fully determined by the input. The fake device then sleeps
+ * for LAROD_SHIM_LATENCY_US.
+ *
+ * param info Tensors of the model.
+ * param inputs Input buffers.
+ * param outputs Output buffers.
+ */
+static void runFake(const shimModelInfo* info, void* const* inputs,
+                    void* const* outputs);
+
+/**
+ * brief Looks up an entry of a parameter map.
+ *
+ * param map The map, may be NULL.
+ * param key Key of the entry.
+ * return The entry, or NULL if there is none.
+ */
+static const shimMapEntry* mapFind(const larodMap* map, const char* key);
+
+/**
+ * brief Looks up an entry of a parameter map to set, adding it if needed.
+ *
+ * param map The map.
+ * param key Key of the entry.
+ * param error Pointer to larod error, set if the map is full.
+ * return The entry, or NULL on failure.
+ */
+static shimMapEntry* mapSet(larodMap* map, const char* key,
+                            larodError** error);
+
+/**
+ * brief Reads an image size and format from preprocessing parameters.
+ *
+ * param params The model parameters.
+ * param prefix "image.input" or "image.output".
+ * param image Pointer to the image description to fill in.
+ * param error Pointer to larod error, set on failure.
+ * return False if any errors occur, otherwise true.
+ */
+static bool readImageParams(const larodMap* params, const char* prefix,
+                            shimImage* image, larodError** error);
+
+/**
+ * brief Sets up a preprocessing model from its parameters.
+ *
+ * param model The model.
+ * param params The model parameters.
+ * param error Pointer to larod error, set on failure.
+ * return False if any errors occur, otherwise true.
+ */
+static bool loadPreprocModel(larodModel* model, const larodMap* params,
+                             larodError** error);
+
+/**
+ * brief Takes the parameters of a job request that the backends use.
+ *
+ * param req The job request.
+ * param params The parameters, may be NULL.
+ * param error Pointer to larod error, set on failure.
+ * return False if any errors occur, otherwise true.
+ */
+static bool applyJobParams(larodJobRequest* req, const larodMap* params,
+                           larodError** error);
+
+/**
+ * brief Runs one job: reads the inputs, runs the backend, writes the outputs.
+ *
+ * param req The job request.
+ * param error Pointer to larod error, set on failure.
+ * return False if any errors occur, otherwise true.
+ */
+static bool runJob(const larodJobRequest* req, larodError** error);
+
+/**
+ * brief Thread running the asynchronous jobs of a connection in order.
+ *
+ * param arg The connection.
+ * return NULL.
+ */
+static void* jobThreadMain(void* arg);
+
+/**
+ * brief Creates unbacked tensors matching the inputs or outputs of a model.
+ *
+ * param model The model.
+ * param inputs True for the inputs, false for the outputs.
+ * param numTensors Pointer to the number of tensors created.
+ * param error Pointer to larod error, set on failure.
+ * return Array of tensors, or NULL on failure.
+ */
+static larodTensor** createTensors(const larodModel* model, bool inputs,
+                                   size_t* numTensors, larodError** error);
+
+/**
+ * brief Creates tensors backed by memfds for the inputs or outputs of a model.
+ *
+ * See createTensors. dma-buf tensors are not supported.
+ */
+static larodTensor** allocTensors(const larodModel* model, bool inputs,
+                                  const uint32_t fdPropFlags,
+                                  size_t* numTensors, larodError** error);
+
+static bool setError(larodError** error, larodErrorCode code, const char* fmt,
+                     ...) {
+    if (!error) {
+        return false;
+    }
+    larodError* e = calloc(1, sizeof(larodError));
+    char* msg = malloc(ERROR_MSG_SIZE);
+    if (!e || !msg) {
+        free(e);
+        free(msg);
+        return false;
+    }
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(msg, ERROR_MSG_SIZE, fmt, args);
+    va_end(args);
+    e->code = code;
+    e->msg = msg;
+    *error = e;
+
+    return false;
+}
+
+static size_t envSize(const char* name, size_t defaultValue) {
+    const char* value = getenv(name);
+
+    return value ? (size_t) strtoull(value, NULL, 0) : defaultValue;
+}
+
+static bool envDims(const char* name, larodTensorDims* dims) {
+    const char* value = getenv(name);
+    larodTensorDims parsed = {{0}, 0};
+
+    while (value && *value) {
+        char* end = NULL;
+        const unsigned long long dim = strtoull(value, &end, 10);
+        if (end == value || dim == 0 || parsed.len == LAROD_TENSOR_MAX_LEN ||
+            (*end != 'x' && *end != '\0')) {
+            return false;
+        }
+        parsed.dims[parsed.len++] = (size_t) dim;
+        value = *end ? end + 1 : end;
+    }
+    if (parsed.len == 0) {
+        return false;
+    }
+    *dims = parsed;
+
+    return true;
+}
+
+static bool readWholeFile(int fd, void** dataPtr, size_t* sizePtr) {
+    const off_t size = lseek(fd, 0, SEEK_END);
+    if (size <= 0) {
+        return false;
+    }
+    uint8_t* data = malloc((size_t) size);
+    if (!data) {
+        return false;
+    }
+    size_t done = 0;
+    while (done < (size_t) size) {
+        const ssize_t n = pread(fd, data + done, (size_t) size - done, (off_t) done);
+        if (n <= 0) {
+            free(data);
+            return false;
+        }
+        done += (size_t) n;
+    }
+    *dataPtr = data;
+    *sizePtr = (size_t) size;
+
+    return true;
+}
+
+static void publicModelPath(uint64_t id, char* path, size_t size) {
+    const char* dir = getenv("LAROD_SHIM_MODEL_DIR");
+
+    snprintf(path, size, "%s/%llu", dir ? dir : DEFAULT_MODEL_DIR,
+             (unsigned long long) id);
+}
+
+static bool publishModel(larodModel* model, int fd, larodError** error) {
+    const char* dir = getenv("LAROD_SHIM_MODEL_DIR");
+    void* data = model->data;
+    size_t size = model->dataSize;
+    char path[PATH_MAX];
+    int out = -1;
+    bool ret = false;
+
+    // The fake accelerator does not read the model file.
+    if (!data && !readWholeFile(fd, &data, &size)) {
+        setError(error, LAROD_ERROR_LOAD_MODEL, "Unable to read model file");
+        goto end;
+    }
+    if (mkdir(dir ? dir : DEFAULT_MODEL_DIR, 0700) && errno != EEXIST) {
+        setError(error, LAROD_ERROR_LOAD_MODEL, "Unable to create %s: %s",
+                 dir ? dir : DEFAULT_MODEL_DIR, strerror(errno));
+        goto end;
+    }
+    // The first free id, claimed by creating its file.
+    for (uint64_t id = PUBLIC_MODEL_ID_BASE; out < 0; id++) {
+        publicModelPath(id, path, sizeof(path));
+        out = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (out < 0 && errno != EEXIST) {
+            setError(error, LAROD_ERROR_LOAD_MODEL, "Unable to create %s: %s",
+                     path, strerror(errno));
+            goto end;
+        }
+        model->id = id;
+    }
+    size_t done = 0;
+    while (done < size) {
+        const ssize_t n = write(out, (const uint8_t*) data + done, size - done);
+        if (n <= 0) {
+            setError(error, LAROD_ERROR_LOAD_MODEL, "Unable to write %s",
+                     path);
+            unlink(path);
+            goto end;
+        }
+        done += (size_t) n;
+    }
+    model->isPublic = true;
+    ret = true;
+
+end:
+    if (out >= 0) {
+        close(out);
+    }
+    if (data != model->data) {
+        free(data);
+    }
+
+    return ret;
+}
+
+static void describeFakeModel(shimModelInfo* info) {
+    memset(info, 0, sizeof(*info));
+
+    info->numInputs = 1;
+    info->inputs[0].dataType = LAROD_TENSOR_DATA_TYPE_UINT8;
+    info->inputs[0].byteSize =
+        envSize("LAROD_SHIM_INPUT_BYTES", DEFAULT_INPUT_BYTES);
+    info->inputs[0].dims = (larodTensorDims){{1, info->inputs[0].byteSize}, 2};
+    if (info->inputs[0].byteSize == DEFAULT_INPUT_BYTES) {
+        info->inputs[0].dims = (larodTensorDims){{1, 224, 224, 3}, 4};
+    }
+
+    info->numOutputs = envSize("LAROD_SHIM_NUM_OUTPUTS", 1);
+    if (info->numOutputs < 1 || info->numOutputs > SHIM_MAX_TENSORS) {
+        info->numOutputs = 1;
+    }
+    larodTensorDims outputDims;
+    const bool haveDims = envDims("LAROD_SHIM_OUTPUT_DIMS", &outputDims);
+    for (size_t o = 0; o < info->numOutputs; o++) {
+        info->outputs[o].dataType = LAROD_TENSOR_DATA_TYPE_UINT8;
+        if (haveDims) {
+            info->outputs[o].dims = outputDims;
+            info->outputs[o].byteSize = 1;
+            for (size_t d = 0; d < outputDims.len; d++) {
+                info->outputs[o].byteSize *= outputDims.dims[d];
+            }
+            continue;
+        }
+        info->outputs[o].byteSize =
+            envSize("LAROD_SHIM_OUTPUT_BYTES", DEFAULT_OUTPUT_BYTES);
+        info->outputs[o].dims =
+            (larodTensorDims){{1, info->outputs[o].byteSize}, 2};
+    }
+}
+
+static void runFake(const shimModelInfo* info, void* const* inputs,
+                    void* const* outputs) {
+    const uint8_t* in = inputs[0];
+    const size_t inBytes = info->inputs[0].byteSize;
+
+    for (size_t o = 0; o < info->numOutputs; o++) {
+        uint8_t* out = outputs[o];
+        for (size_t j = 0; j < info->outputs[o].byteSize; j++) {
+            out[j] = in[j % inBytes];
+        }
+    }
+
+    const size_t latencyUs = envSize("LAROD_SHIM_LATENCY_US", 0);
+    pthread_mutex_lock(&fakeDeviceMutex);
+    if (latencyUs) {
+        struct timespec ts = {(time_t) (latencyUs / 1000000),
+                              (long) (latencyUs % 1000000) * 1000};
+        nanosleep(&ts, NULL);
+    }
+    pthread_mutex_unlock(&fakeDeviceMutex);
+}
+
+static const shimMapEntry* mapFind(const larodMap* map, const char* key) {
+    if (!map) {
+        return NULL;
+    }
+    for (size_t i = 0; i < map->numEntries; i++) {
+        if (!strcmp(map->entries[i].key, key)) {
+            return &map->entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+static shimMapEntry* mapSet(larodMap* map, const char* key,
+                            larodError** error) {
+    shimMapEntry* entry = (shimMapEntry*) mapFind(map, key);
+    if (entry) {
+        return entry;
+    }
+    if (map->numEntries == MAX_MAP_ENTRIES || strlen(key) >= MAP_STR_LEN) {
+        setError(error, LAROD_ERROR_ALLOC, "Unable to add %s to map", key);
+        return NULL;
+    }
+    entry = &map->entries[map->numEntries++];
+    memset(entry, 0, sizeof(*entry));
+    snprintf(entry->key, sizeof(entry->key), "%s", key);
+
+    return entry;
+}
+
+static bool readImageParams(const larodMap* params, const char* prefix,
+                            shimImage* image, larodError** error) {
+    char key[MAP_STR_LEN];
+
+    snprintf(key, sizeof(key), "%s.format", prefix);
+    const shimMapEntry* format = mapFind(params, key);
+    if (!format || !format->isStr ||
+        !preprocParseFormat(format->str, &image->format)) {
+        return setError(error, LAROD_ERROR_LOAD_MODEL,
+                        "Missing or unsupported %s", key);
+    }
+    snprintf(key, sizeof(key), "%s.size", prefix);
+    const shimMapEntry* size = mapFind(params, key);
+    if (!size || size->numInts != 2 || size->ints[0] <= 0 ||
+        size->ints[1] <= 0) {
+        return setError(error, LAROD_ERROR_LOAD_MODEL, "Missing or invalid %s",
+                        key);
+    }
+    image->width = (size_t) size->ints[0];
+    image->height = (size_t) size->ints[1];
+
+    return true;
+}
+
+static bool loadPreprocModel(larodModel* model, const larodMap* params,
+                             larodError** error) {
+    if (!readImageParams(params, "image.input", &model->preprocInput, error) ||
+        !readImageParams(params, "image.output", &model->preprocOutput,
+                         error)) {
+        return false;
+    }
+    model->isPreproc = true;
+    preprocDescribe(&model->preprocInput, &model->preprocOutput, &model->info);
+
+    return true;
+}
+
+static bool applyJobParams(larodJobRequest* req, const larodMap* params,
+                           larodError** error) {
+    const shimMapEntry* crop = mapFind(params, "image.input.crop");
+    if (!crop) {
+        return true;
+    }
+    if (crop->numInts != 4 || crop->ints[0] < 0 || crop->ints[1] < 0 ||
+        crop->ints[2] <= 0 || crop->ints[3] <= 0) {
+        return setError(error, LAROD_ERROR_JOB, "Invalid image.input.crop");
+    }
+    req->hasCrop = true;
+    req->crop = (shimCrop){(size_t) crop->ints[0], (size_t) crop->ints[1],
+                           (size_t) crop->ints[2], (size_t) crop->ints[3]};
+
+    return true;
+}
+
+static bool runJob(const larodJobRequest* req, larodError** error) {
+    const shimModelInfo* info = &req->model->info;
+    void* inputs[SHIM_MAX_TENSORS] = {NULL};
+    void* outputs[SHIM_MAX_TENSORS] = {NULL};
+    char errMsg[ERROR_MSG_SIZE];
+    bool ret = false;
+
+    if (req->numInputs != info->numInputs ||
+        req->numOutputs != info->numOutputs) {
+        return setError(error, LAROD_ERROR_TENSOR_MISMATCH,
+                        "Model has %zu inputs and %zu outputs, job has %zu and %zu",
+                        info->numInputs, info->numOutputs, req->numInputs,
+                        req->numOutputs);
+    }
+
+    for (size_t i = 0; i < info->numInputs; i++) {
+        const larodTensor* tensor = req->inputs[i];
+        const size_t size = info->inputs[i].byteSize;
+        inputs[i] = malloc(size);
+        if (!inputs[i]) {
+            setError(error, LAROD_ERROR_ALLOC, "Out of memory");
+            goto end;
+        }
+        if (tensor->fd < 0 ||
+            pread(tensor->fd, inputs[i], size, (off_t) tensor->fdOffset) !=
+                (ssize_t) size) {
+            setError(error, LAROD_ERROR_FD, "Unable to read %zu bytes of input "
+                     "%zu from fd %d at offset %lld", size, i, tensor->fd,
+                     (long long) tensor->fdOffset);
+            goto end;
+        }
+    }
+    for (size_t o = 0; o < info->numOutputs; o++) {
+        outputs[o] = malloc(info->outputs[o].byteSize);
+        if (!outputs[o]) {
+            setError(error, LAROD_ERROR_ALLOC, "Out of memory");
+            goto end;
+        }
+    }
+
+    if (req->model->isPreproc) {
+        const shimImage* in = &req->model->preprocInput;
+        const shimCrop crop =
+            req->hasCrop ? req->crop : (shimCrop){0, 0, in->width, in->height};
+        if (crop.x + crop.width > in->width ||
+            crop.y + crop.height > in->height) {
+            setError(error, LAROD_ERROR_JOB, "Crop is outside the input image");
+            goto end;
+        }
+        if (!preprocRun(in, &req->model->preprocOutput, &crop, inputs[0],
+                        outputs[0])) {
+            setError(error, LAROD_ERROR_ALLOC, "Out of memory");
+            goto end;
+        }
+    } else if (req->model->backend) {
+        if (!tfliteBackendRun(req->model->backend, inputs, outputs, errMsg,
+                              sizeof(errMsg))) {
+            setError(error, LAROD_ERROR_JOB, "%s", errMsg);
+            goto end;
+        }
+    } else {
+        runFake(info, inputs, outputs);
+    }
+
+    for (size_t o = 0; o < info->numOutputs; o++) {
+        const larodTensor* tensor = req->outputs[o];
+        const size_t size = info->outputs[o].byteSize;
+        if (tensor->fd < 0 ||
+            pwrite(tensor->fd, outputs[o], size, (off_t) tensor->fdOffset) !=
+                (ssize_t) size) {
+            setError(error, LAROD_ERROR_FD, "Unable to write %zu bytes of "
+                     "output %zu to fd %d", size, o, tensor->fd);
+            goto end;
+        }
+    }
+
+    ret = true;
+
+end:
+    for (size_t i = 0; i < SHIM_MAX_TENSORS; i++) {
+        free(inputs[i]);
+        free(outputs[i]);
+    }
+
+    return ret;
+}
+
+static void* jobThreadMain(void* arg) {
+    larodConnection* conn = arg;
+
+    pthread_mutex_lock(&conn->mutex);
+    for (;;) {
+        while (!conn->head && !conn->stop) {
+            pthread_cond_wait(&conn->cond, &conn->mutex);
+        }
+        if (!conn->head) {
+            break;
+        }
+        shimJob* job = conn->head;
+        conn->head = job->next;
+        if (!conn->head) {
+            conn->tail = NULL;
+        }
+        pthread_mutex_unlock(&conn->mutex);
+
+        larodError* error = NULL;
+        runJob(job->req, &error);
+        job->callback(job->userData, error);
+        larodClearError(&error);
+        free(job->req);
+        free(job);
+
+        pthread_mutex_lock(&conn->mutex);
+    }
+    pthread_mutex_unlock(&conn->mutex);
+
+    return NULL;
+}
+
+static larodTensor** createTensors(const larodModel* model, bool inputs,
+                                   size_t* numTensors, larodError** error) {
+    const size_t num = inputs ? model->info.numInputs : model->info.numOutputs;
+    larodTensor** tensors = calloc(num, sizeof(larodTensor*));
+    if (!tensors) {
+        setError(error, LAROD_ERROR_ALLOC, "Out of memory");
+        return NULL;
+    }
+
+    for (size_t i = 0; i < num; i++) {
+        const shimTensorInfo* info =
+            inputs ? &model->info.inputs[i] : &model->info.outputs[i];
+        larodTensor* tensor = calloc(1, sizeof(larodTensor));
+        if (!tensor) {
+            larodDestroyTensors(NULL, &tensors, num, NULL);
+            setError(error, LAROD_ERROR_ALLOC, "Out of memory");
+            return NULL;
+        }
+        tensor->fd = -1;
+        tensor->dataType = info->dataType;
+        tensor->dims = info->dims;
+        tensor->byteSize = info->byteSize;
+        tensor->layout = inputs && info->dims.len == 4
+                             ? LAROD_TENSOR_LAYOUT_NHWC
+                             : LAROD_TENSOR_LAYOUT_UNSPECIFIED;
+        // Tensors are densely packed, so each pitch is the size of the
+        // remaining dimensions.
+        tensor->pitches.len = info->dims.len;
+        size_t pitch = info->byteSize;
+        for (size_t d = 0; d < info->dims.len; d++) {
+            tensor->pitches.pitches[d] = pitch;
+            if (info->dims.dims[d]) {
+                pitch /= info->dims.dims[d];
+            }
+        }
+        tensors[i] = tensor;
+    }
+    *numTensors = num;
+
+    return tensors;
+}
+
+static larodTensor** allocTensors(const larodModel* model, bool inputs,
+                                  const uint32_t fdPropFlags,
+                                  size_t* numTensors, larodError** error) {
+    if (fdPropFlags & LAROD_FD_PROP_DMABUF) {
+        setError(error, LAROD_ERROR_ALLOC, "dma-buf tensors are not supported");
+        return NULL;
+    }
+    larodTensor** tensors = createTensors(model, inputs, numTensors, error);
+    if (!tensors) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < *numTensors; i++) {
+        int fd = memfd_create("larod-shim", 0);
+        if (fd < 0 || ftruncate(fd, (off_t) tensors[i]->byteSize) < 0) {
+            setError(error, LAROD_ERROR_ALLOC, "Unable to create memfd: %s",
+                     strerror(errno));
+            if (fd >= 0) {
+                close(fd);
+            }
+            larodDestroyTensors(NULL, &tensors, *numTensors, NULL);
+            return NULL;
+        }
+        tensors[i]->fd = fd;
+        tensors[i]->fdSize = tensors[i]->byteSize;
+        tensors[i]->fdProps = LAROD_FD_TYPE_DISK;
+    }
+
+    return tensors;
+}
+
+void larodClearError(larodError** error) {
+    if (!error || !*error) {
+        return;
+    }
+    free((void*) (*error)->msg);
+    free(*error);
+    *error = NULL;
+}
+
+bool larodConnect(larodConnection** conn, larodError** error) {
+    larodConnection* c = calloc(1, sizeof(larodConnection));
+    if (!c) {
+        return setError(error, LAROD_ERROR_ALLOC, "Out of memory");
+    }
+    pthread_mutex_init(&c->mutex, NULL);
+    pthread_cond_init(&c->cond, NULL);
+    snprintf(c->devices[0].name, sizeof(c->devices[0].name), "cpu-tflite");
+    c->numDevices = 1;
+    *conn = c;
+
+    return true;
+}
+
+bool larodDisconnect(larodConnection** conn, larodError** error) {
+    (void) error;
+    if (!conn || !*conn) {
+        return true;
+    }
+    larodConnection* c = *conn;
+
+    // Jobs already queued are run before the thread stops, like the service
+    // finishes them before closing the session.
+    pthread_mutex_lock(&c->mutex);
+    c->stop = true;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->mutex);
+    if (c->jobThreadStarted) {
+        pthread_join(c->jobThread, NULL);
+    }
+    pthread_cond_destroy(&c->cond);
+    pthread_mutex_destroy(&c->mutex);
+    free(c);
+    *conn = NULL;
+
+    return true;
+}
+
+const larodDevice* larodGetDevice(const larodConnection* conn, const char* name,
+                                  const uint32_t instance, larodError** error) {
+    (void) instance;
+    // Every device name is accepted. The backend is chosen per model, from
+    // the device name and LAROD_SHIM_BACKEND.
+    larodConnection* c = (larodConnection*) conn;
+    if (!name) {
+        return &c->devices[0];
+    }
+    for (size_t i = 0; i < c->numDevices; i++) {
+        if (!strcmp(c->devices[i].name, name)) {
+            return &c->devices[i];
+        }
+    }
+    if (c->numDevices == MAX_DEVICES) {
+        setError(error, LAROD_ERROR_INVALID_CHIP_ID, "Too many devices");
+        return NULL;
+    }
+    larodDevice* dev = &c->devices[c->numDevices++];
+    snprintf(dev->name, sizeof(dev->name), "%s", name);
+
+    return dev;
+}
+
+const char* larodGetDeviceName(const larodDevice* dev, larodError** error) {
+    (void) error;
+
+    return dev->name;
+}
+
+larodModel* larodLoadModel(larodConnection* conn, const int fd,
+                           const larodDevice* dev, const larodAccess access,
+                           const char* name, const larodMap* params,
+                           larodError** error) {
+    (void) conn;
+    (void) name;
+
+    larodModel* model = calloc(1, sizeof(larodModel));
+    if (!model) {
+        setError(error, LAROD_ERROR_ALLOC, "Out of memory");
+        return NULL;
+    }
+    model->id = __atomic_fetch_add(&nextModelId, 1, __ATOMIC_RELAXED);
+
+    const char* devName = dev ? dev->name : "";
+    const size_t devNameLen = strlen(devName);
+    if (devNameLen >= 5 && !strcmp(devName + devNameLen - 5, "-proc")) {
+        if (!loadPreprocModel(model, params, error)) {
+            goto error;
+        }
+        return model;
+    }
+    if (fd < 0) {
+        setError(error, LAROD_ERROR_LOAD_MODEL,
+                 "Device %s needs a model file", devName);
+        goto error;
+    }
+
+    const char* backendName = getenv("LAROD_SHIM_BACKEND");
+    backendName = backendName ? backendName : "auto";
+    if (strcmp(backendName, "fake") && strcmp(backendName, "tflite") &&
+        strcmp(backendName, "auto")) {
+        setError(error, LAROD_ERROR_LOAD_MODEL, "Unknown LAROD_SHIM_BACKEND %s",
+                 backendName);
+        goto error;
+    }
+
+    if (strcmp(backendName, "fake")) {
+        char errMsg[ERROR_MSG_SIZE] = "Unable to read model file";
+        if (readWholeFile(fd, &model->data, &model->dataSize) &&
+            tfliteBackendCreate(model->data, model->dataSize, &model->info,
+                                &model->backend, errMsg, sizeof(errMsg))) {
+            goto loaded;
+        }
+        if (!strcmp(backendName, "tflite")) {
+            setError(error, LAROD_ERROR_LOAD_MODEL, "%s", errMsg);
+            goto error;
+        }
+        free(model->data);
+        model->data = NULL;
+    }
+
+    describeFakeModel(&model->info);
+
+loaded:
+    if (access == LAROD_ACCESS_PUBLIC && !publishModel(model, fd, error)) {
+        goto error;
+    }
+
+    return model;
+
+error:
+    larodDestroyModel(&model);
+
+    return NULL;
+}
+
+larodModel* larodGetModel(larodConnection* conn, const uint64_t modelId,
+                          larodError** error) {
+    char path[PATH_MAX];
+    publicModelPath(modelId, path, sizeof(path));
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        setError(error, LAROD_ERROR_MODEL_NOT_FOUND, "Model %llu not found",
+                 (unsigned long long) modelId);
+        return NULL;
+    }
+
+    // The copy is loaded again, only the handle is shared with the process
+    // that loaded the model.
+    larodModel* model =
+        larodLoadModel(conn, fd, larodGetDevice(conn, NULL, 0, NULL),
+                       LAROD_ACCESS_PRIVATE, NULL, NULL, error);
+    close(fd);
+    if (model) {
+        model->id = modelId;
+        model->isPublic = true;
+    }
+
+    return model;
+}
+
+uint64_t larodGetModelId(const larodModel* model, larodError** error) {
+    (void) error;
+
+    return model->id;
+}
+
+void larodDestroyModel(larodModel** model) {
+    if (!model || !*model) {
+        return;
+    }
+    tfliteBackendDestroy(&(*model)->backend);
+    free((*model)->data);
+    free(*model);
+    *model = NULL;
+}
+
+bool larodDeleteModel(larodConnection* conn, larodModel* model,
+                      larodError** error) {
+    (void) conn;
+
+    if (!model->isPublic) {
+        return true;
+    }
+    char path[PATH_MAX];
+    publicModelPath(model->id, path, sizeof(path));
+    if (unlink(path)) {
+        return setError(error, LAROD_ERROR_DELETE_MODEL,
+                        "Unable to delete model %llu: %s",
+                        (unsigned long long) model->id, strerror(errno));
+    }
+
+    return true;
+}
+
+larodTensor** larodCreateModelInputs(const larodModel* model,
+                                     size_t* numTensors, larodError** error) {
+    return createTensors(model, true, numTensors, error);
+}
+
+larodTensor** larodCreateModelOutputs(const larodModel* model,
+                                      size_t* numTensors, larodError** error) {
+    return createTensors(model, false, numTensors, error);
+}
+
+larodTensor** larodAllocModelInputs(larodConnection* conn,
+                                    const larodModel* model,
+                                    const uint32_t fdPropFlags,
+                                    size_t* numTensors, larodMap* params,
+                                    larodError** error) {
+    (void) conn;
+    (void) params;
+
+    return allocTensors(model, true, fdPropFlags, numTensors, error);
+}
+
+larodTensor** larodAllocModelOutputs(larodConnection* conn,
+                                     const larodModel* model,
+                                     const uint32_t fdPropFlags,
+                                     size_t* numTensors, larodMap* params,
+                                     larodError** error) {
+    (void) conn;
+    (void) params;
+
+    return allocTensors(model, false, fdPropFlags, numTensors, error);
+}
+
+bool larodDestroyTensors(larodConnection* conn, larodTensor*** tensors,
+                         size_t numTensors, larodError** error) {
+    (void) conn;
+    (void) error;
+    if (!tensors || !*tensors) {
+        return true;
+    }
+    for (size_t i = 0; i < numTensors; i++) {
+        free((*tensors)[i]);
+    }
+    free(*tensors);
+    *tensors = NULL;
+
+    return true;
+}
+
+bool larodSetTensorFd(larodTensor* tensor, const int fd, larodError** error) {
+    (void) error;
+    tensor->fd = fd;
+
+    return true;
+}
+
+int larodGetTensorFd(const larodTensor* tensor, larodError** error) {
+    (void) error;
+
+    return tensor->fd;
+}
+
+bool larodSetTensorFdSize(larodTensor* tensor, const size_t size,
+                          larodError** error) {
+    (void) error;
+    tensor->fdSize = size;
+
+    return true;
+}
+
+bool larodGetTensorFdSize(const larodTensor* tensor, size_t* size,
+                          larodError** error) {
+    (void) error;
+    *size = tensor->fdSize;
+
+    return true;
+}
+
+bool larodSetTensorFdOffset(larodTensor* tensor, const int64_t offset,
+                            larodError** error) {
+    if (offset < 0) {
+        return setError(error, LAROD_ERROR_FD, "Negative fd offset %lld",
+                        (long long) offset);
+    }
+    tensor->fdOffset = offset;
+
+    return true;
+}
+
+int64_t larodGetTensorFdOffset(const larodTensor* tensor, larodError** error) {
+    (void) error;
+
+    return tensor->fdOffset;
+}
+
+bool larodSetTensorFdProps(larodTensor* tensor, const uint32_t fdPropFlags,
+                           larodError** error) {
+    (void) error;
+    tensor->fdProps = fdPropFlags;
+
+    return true;
+}
+
+bool larodGetTensorFdProps(const larodTensor* tensor, uint32_t* fdPropFlags,
+                           larodError** error) {
+    (void) error;
+    *fdPropFlags = tensor->fdProps;
+
+    return true;
+}
+
+bool larodTrackTensor(larodConnection* conn, larodTensor* tensor,
+                      larodError** error) {
+    (void) conn;
+    (void) tensor;
+    (void) error;
+
+    return true;
+}
+
+const larodTensorDims* larodGetTensorDims(const larodTensor* tensor,
+                                          larodError** error) {
+    (void) error;
+
+    return &tensor->dims;
+}
+
+const larodTensorPitches* larodGetTensorPitches(const larodTensor* tensor,
+                                                larodError** error) {
+    (void) error;
+
+    return &tensor->pitches;
+}
+
+larodTensorDataType larodGetTensorDataType(const larodTensor* tensor,
+                                           larodError** error) {
+    (void) error;
+
+    return tensor->dataType;
+}
+
+larodTensorLayout larodGetTensorLayout(const larodTensor* tensor,
+                                       larodError** error) {
+    (void) error;
+
+    return tensor->layout;
+}
+
+bool larodGetTensorByteSize(const larodTensor* tensor, size_t* byteSize,
+                            larodError** error) {
+    (void) error;
+    *byteSize = tensor->byteSize;
+
+    return true;
+}
+
+larodJobRequest* larodCreateJobRequest(const larodModel* model,
+                                       larodTensor** inTensors,
+                                       size_t numInTensors,
+                                       larodTensor** outTensors,
+                                       size_t numOutTensors, larodMap* params,
+                                       larodError** error) {
+    larodJobRequest* req = calloc(1, sizeof(larodJobRequest));
+    if (!req) {
+        setError(error, LAROD_ERROR_ALLOC, "Out of memory");
+        return NULL;
+    }
+    req->model = model;
+    if (!larodSetJobRequestInputs(req, inTensors, numInTensors, error) ||
+        !larodSetJobRequestOutputs(req, outTensors, numOutTensors, error) ||
+        !applyJobParams(req, params, error)) {
+        free(req);
+        return NULL;
+    }
+
+    return req;
+}
+
+void larodDestroyJobRequest(larodJobRequest** jobReq) {
+    if (jobReq) {
+        free(*jobReq);
+        *jobReq = NULL;
+    }
+}
+
+bool larodSetJobRequestInputs(larodJobRequest* jobReq, larodTensor** tensors,
+                              const size_t numTensors, larodError** error) {
+    if (numTensors > SHIM_MAX_TENSORS) {
+        return setError(error, LAROD_ERROR_TENSOR_MISMATCH, "Too many inputs");
+    }
+    for (size_t i = 0; i < numTensors; i++) {
+        jobReq->inputs[i] = tensors[i];
+    }
+    jobReq->numInputs = numTensors;
+
+    return true;
+}
+
+bool larodSetJobRequestOutputs(larodJobRequest* jobReq, larodTensor** tensors,
+                               const size_t numTensors, larodError** error) {
+    if (numTensors > SHIM_MAX_TENSORS) {
+        return setError(error, LAROD_ERROR_TENSOR_MISMATCH, "Too many outputs");
+    }
+    for (size_t i = 0; i < numTensors; i++) {
+        jobReq->outputs[i] = tensors[i];
+    }
+    jobReq->numOutputs = numTensors;
+
+    return true;
+}
+
+bool larodSetJobRequestParams(larodJobRequest* jobReq, const larodMap* params,
+                              larodError** error) {
+    return applyJobParams(jobReq, params, error);
+}
+
+bool larodRunJob(larodConnection* conn, const larodJobRequest* jobReq,
+                 larodError** error) {
+    (void) conn;
+
+    return runJob(jobReq, error);
+}
+
+bool larodRunJobAsync(larodConnection* conn, const larodJobRequest* jobReq,
+                      larodRunJobCallback callback, void* userData,
+                      larodError** error) {
+    // The request is copied, like the service does, so the caller may change
+    // it as soon as this returns. The tensors it points to must stay valid.
+    shimJob* job = calloc(1, sizeof(shimJob));
+    larodJobRequest* req = malloc(sizeof(larodJobRequest));
+    if (!job || !req) {
+        free(job);
+        free(req);
+        return setError(error, LAROD_ERROR_ALLOC, "Out of memory");
+    }
+    *req = *jobReq;
+    job->req = req;
+    job->callback = callback;
+    job->userData = userData;
+
+    pthread_mutex_lock(&conn->mutex);
+    if (!conn->jobThreadStarted) {
+        int err = pthread_create(&conn->jobThread, NULL, jobThreadMain, conn);
+        if (err) {
+            pthread_mutex_unlock(&conn->mutex);
+            free(req);
+            free(job);
+            return setError(error, LAROD_ERROR_JOB,
+                            "Unable to start job thread: %s", strerror(err));
+        }
+        conn->jobThreadStarted = true;
+    }
+    if (conn->tail) {
+        conn->tail->next = job;
+    } else {
+        conn->head = job;
+    }
+    conn->tail = job;
+    pthread_cond_signal(&conn->cond);
+    pthread_mutex_unlock(&conn->mutex);
+
+    return true;
+}
+
+larodMap* larodCreateMap(larodError** error) {
+    larodMap* map = calloc(1, sizeof(larodMap));
+    if (!map) {
+        setError(error, LAROD_ERROR_ALLOC, "Out of memory");
+    }
+
+    return map;
+}
+
+void larodDestroyMap(larodMap** map) {
+    if (map) {
+        free(*map);
+        *map = NULL;
+    }
+}
+
+bool larodMapSetStr(larodMap* map, const char* key, const char* value,
+                    larodError** error) {
+    shimMapEntry* entry = mapSet(map, key, error);
+    if (!entry) {
+        return false;
+    }
+    if (strlen(value) >= MAP_STR_LEN) {
+        return setError(error, LAROD_ERROR_ALLOC, "Value of %s is too long",
+                        key);
+    }
+    entry->isStr = true;
+    entry->numInts = 0;
+    snprintf(entry->str, sizeof(entry->str), "%s", value);
+
+    return true;
+}
+
+bool larodMapSetInt(larodMap* map, const char* key, const int64_t value,
+                    larodError** error) {
+    shimMapEntry* entry = mapSet(map, key, error);
+    if (!entry) {
+        return false;
+    }
+    entry->isStr = false;
+    entry->ints[0] = value;
+    entry->numInts = 1;
+
+    return true;
+}
+
+bool larodMapSetIntArr2(larodMap* map, const char* key, const int64_t value0,
+                        const int64_t value1, larodError** error) {
+    shimMapEntry* entry = mapSet(map, key, error);
+    if (!entry) {
+        return false;
+    }
+    entry->isStr = false;
+    entry->ints[0] = value0;
+    entry->ints[1] = value1;
+    entry->numInts = 2;
+
+    return true;
+}
+
+bool larodMapSetIntArr4(larodMap* map, const char* key, const int64_t value0,
+                        const int64_t value1, const int64_t value2,
+                        const int64_t value3, larodError** error) {
+    shimMapEntry* entry = mapSet(map, key, error);
+    if (!entry) {
+        return false;
+    }
+    entry->isStr = false;
+    entry->ints[0] = value0;
+    entry->ints[1] = value1;
+    entry->ints[2] = value2;
+    entry->ints[3] = value3;
+    entry->numInts = 4;
+
+    return true;
+}
@@ -0,0 +1,151 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * This file implements the image preprocessing of the larod stand-in
+ * library, a plain C version of what the cpu-proc device does on a device.
+ */
+
+#include "backend.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * brief Computes the source position of every output index in one dimension.
+ *
+ * param outSize Size of the output.
+ * param start First input index of the crop.
+ * param size Size of the crop.
+ * param index Left or upper input index of every output index.
+ * param weight Weight of the next input index, the other one gets 1 - weight.
+ */
+static void computeTaps(size_t outSize, size_t start, size_t size,
+                        size_t* index, float* weight);
+
+/**
+ * brief Returns the offset of a sample of an image.
+ *
+ * param image Format and size of the image.
+ * param x Column.
+ * param y Row.
+ * param c Channel.
+ * return Offset in bytes from the start of the image.
+ */
+static size_t sampleOffset(const shimImage* image, size_t x, size_t y,
+                           size_t c);
+
+static void computeTaps(size_t outSize, size_t start, size_t size,
+                        size_t* index, float* weight) {
+    const float scale = (float) size / (float) outSize;
+
+    for (size_t i = 0; i < outSize; i++) {
+        float pos = ((float) i + 0.5f) * scale - 0.5f;
+        pos = pos < 0.0f ? 0.0f : pos;
+        size_t idx = (size_t) pos;
+        float frac = pos - (float) idx;
+        if (idx >= size - 1) {
+            idx = size - 1;
+            frac = 0.0f;
+        }
+        index[i] = start + idx;
+        weight[i] = frac;
+    }
+}
+
+static size_t sampleOffset(const shimImage* image, size_t x, size_t y,
+                           size_t c) {
+    if (image->format == SHIM_IMAGE_RGB_PLANAR) {
+        return (c * image->height + y) * image->width + x;
+    }
+
+    return (y * image->width + x) * 3 + c;
+}
+
+bool preprocParseFormat(const char* name, shimImageFormat* format) {
+    if (!strcmp(name, "rgb-interleaved")) {
+        *format = SHIM_IMAGE_RGB_INTERLEAVED;
+    } else if (!strcmp(name, "rgb-planar")) {
+        *format = SHIM_IMAGE_RGB_PLANAR;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+void preprocDescribe(const shimImage* input, const shimImage* output,
+                     shimModelInfo* info) {
+    const shimImage* images[2] = {input, output};
+    shimTensorInfo* tensors[2] = {&info->inputs[0], &info->outputs[0]};
+
+    memset(info, 0, sizeof(*info));
+    info->numInputs = 1;
+    info->numOutputs = 1;
+    for (size_t t = 0; t < 2; t++) {
+        const shimImage* image = images[t];
+        tensors[t]->dataType = LAROD_TENSOR_DATA_TYPE_UINT8;
+        tensors[t]->byteSize = image->width * image->height * 3;
+        tensors[t]->dims =
+            image->format == SHIM_IMAGE_RGB_PLANAR
+                ? (larodTensorDims){{1, 3, image->height, image->width}, 4}
+                : (larodTensorDims){{1, image->height, image->width, 3}, 4};
+    }
+}
+
+bool preprocRun(const shimImage* input, const shimImage* output,
+                const shimCrop* crop, const uint8_t* in, uint8_t* out) {
+    size_t* xIndex = malloc(output->width * sizeof(size_t));
+    float* xWeight = malloc(output->width * sizeof(float));
+    size_t* yIndex = malloc(output->height * sizeof(size_t));
+    float* yWeight = malloc(output->height * sizeof(float));
+    const bool ret = xIndex && xWeight && yIndex && yWeight;
+
+    if (ret) {
+        computeTaps(output->width, crop->x, crop->width, xIndex, xWeight);
+        computeTaps(output->height, crop->y, crop->height, yIndex, yWeight);
+        const size_t lastX = crop->x + crop->width - 1;
+        const size_t lastY = crop->y + crop->height - 1;
+        for (size_t y = 0; y < output->height; y++) {
+            const size_t y0 = yIndex[y];
+            const size_t y1 = y0 < lastY ? y0 + 1 : y0;
+            const float wy = yWeight[y];
+            for (size_t x = 0; x < output->width; x++) {
+                const size_t x0 = xIndex[x];
+                const size_t x1 = x0 < lastX ? x0 + 1 : x0;
+                const float wx = xWeight[x];
+                for (size_t c = 0; c < 3; c++) {
+                    const float top =
+                        (float) in[sampleOffset(input, x0, y0, c)] * (1.0f - wx) +
+                        (float) in[sampleOffset(input, x1, y0, c)] * wx;
+                    const float bottom =
+                        (float) in[sampleOffset(input, x0, y1, c)] * (1.0f - wx) +
+                        (float) in[sampleOffset(input, x1, y1, c)] * wx;
+                    const float value = top * (1.0f - wy) + bottom * wy + 0.5f;
+                    out[sampleOffset(output, x, y, c)] =
+                        (uint8_t) (value > 255.0f ? 255.0f : value);
+                }
+            }
+        }
+    }
+    free(xIndex);
+    free(xWeight);
+    free(yIndex);
+    free(yWeight);
+
+    return ret;
+}
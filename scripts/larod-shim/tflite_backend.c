@@ -0,0 +1,324 @@
+/**
+ * Copyright (C) 2023 Axis Communications AB, Lund, Sweden
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     <http://www.apache.org/licenses/LICENSE-2.0>
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * This file runs models with the TensorFlow Lite C API.
+ *
+ * The few functions needed are looked up with dlsym, so neither the
+ * TensorFlow Lite headers nor the library are needed to build. The library
+ * is taken from LAROD_SHIM_TFLITE_LIB, default libtensorflowlite_c.so, and
+ * the number of interpreter threads from LAROD_SHIM_TFLITE_THREADS.
+ */
+
+#include "backend.h"
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DEFAULT_TFLITE_LIB "libtensorflowlite_c.so"
+
+// Values of TfLiteType and TfLiteStatus in the TensorFlow Lite C API.
+#define TFLITE_OK (0)
+#define TFLITE_FLOAT32 (1)
+#define TFLITE_INT32 (2)
+#define TFLITE_UINT8 (3)
+#define TFLITE_INT64 (4)
+#define TFLITE_BOOL (6)
+#define TFLITE_INT16 (7)
+#define TFLITE_INT8 (9)
+#define TFLITE_FLOAT16 (10)
+
+typedef struct TfLiteModel TfLiteModel;
+typedef struct TfLiteInterpreterOptions TfLiteInterpreterOptions;
+typedef struct TfLiteInterpreter TfLiteInterpreter;
+typedef struct TfLiteTensor TfLiteTensor;
+
+typedef struct tfliteApi {
+    TfLiteModel* (*modelCreate)(const void*, size_t);
+    void (*modelDelete)(TfLiteModel*);
+    TfLiteInterpreterOptions* (*optionsCreate)(void);
+    void (*optionsSetNumThreads)(TfLiteInterpreterOptions*, int32_t);
+    void (*optionsDelete)(TfLiteInterpreterOptions*);
+    TfLiteInterpreter* (*interpreterCreate)(const TfLiteModel*,
+                                            const TfLiteInterpreterOptions*);
+    void (*interpreterDelete)(TfLiteInterpreter*);
+    int (*allocateTensors)(TfLiteInterpreter*);
+    int (*invoke)(TfLiteInterpreter*);
+    int32_t (*inputCount)(const TfLiteInterpreter*);
+    TfLiteTensor* (*inputTensor)(const TfLiteInterpreter*, int32_t);
+    int32_t (*outputCount)(const TfLiteInterpreter*);
+    const TfLiteTensor* (*outputTensor)(const TfLiteInterpreter*, int32_t);
+    int (*tensorType)(const TfLiteTensor*);
+    int32_t (*tensorNumDims)(const TfLiteTensor*);
+    int32_t (*tensorDim)(const TfLiteTensor*, int32_t);
+    size_t (*tensorByteSize)(const TfLiteTensor*);
+    int (*copyFromBuffer)(TfLiteTensor*, const void*, size_t);
+    int (*copyToBuffer)(const TfLiteTensor*, void*, size_t);
+} tfliteApi;
+
+struct tfliteBackend {
+    pthread_mutex_t mutex;
+    TfLiteModel* model;
+    TfLiteInterpreter* interpreter;
+    shimModelInfo info;
+};
+
+static pthread_once_t apiOnce = PTHREAD_ONCE_INIT;
+static tfliteApi api;
+static bool apiLoaded;
+static char apiError[256];
+
+/**
+ * brief Loads the TensorFlow Lite C library and looks up its functions.
+ *
+ * Called once through pthread_once. Sets apiLoaded, or apiError on failure.
+ */
+static void loadApi(void);
+
+/**
+ * brief Looks up a symbol of the TensorFlow Lite C library.
+ *
+ * param lib Handle of the library.
+ * param name Name of the symbol.
+ * param fn Pointer to the function pointer to set.
+ * return False if the symbol is missing, otherwise true.
+ */
+static bool lookup(void* lib, const char* name, void* fn);
+
+/**
+ * brief Converts a TfLiteType to the corresponding larod data type.
+ *
+ * param type TfLiteType value.
+ * return The larod data type, LAROD_TENSOR_DATA_TYPE_UNSPECIFIED if there is
+ * no corresponding type.
+ */
+static larodTensorDataType toLarodType(int type);
+
+/**
+ * brief Describes a tensor of the interpreter.
+ *
+ * param tensor The tensor.
+ * param info Pointer to the description to fill in.
+ */
+static void describeTensor(const TfLiteTensor* tensor, shimTensorInfo* info);
+
+static bool lookup(void* lib, const char* name, void* fn) {
+    void* sym = dlsym(lib, name);
+    if (!sym) {
+        snprintf(apiError, sizeof(apiError),
+                 "TensorFlow Lite library has no symbol %s", name);
+        return false;
+    }
+    // Function and object pointers have the same representation on every
+    // platform supported by dlsym.
+    *(void**) fn = sym;
+
+    return true;
+}
+
+static void loadApi(void) {
+    const char* path = getenv("LAROD_SHIM_TFLITE_LIB");
+    path = path ? path : DEFAULT_TFLITE_LIB;
+
+    void* lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!lib) {
+        snprintf(apiError, sizeof(apiError), "Unable to load %s: %s", path,
+                 dlerror());
+        return;
+    }
+
+    apiLoaded = lookup(lib, "TfLiteModelCreate", &api.modelCreate) &&
+                lookup(lib, "TfLiteModelDelete", &api.modelDelete) &&
+                lookup(lib, "TfLiteInterpreterOptionsCreate", &api.optionsCreate) &&
+                lookup(lib, "TfLiteInterpreterOptionsSetNumThreads",
+                       &api.optionsSetNumThreads) &&
+                lookup(lib, "TfLiteInterpreterOptionsDelete", &api.optionsDelete) &&
+                lookup(lib, "TfLiteInterpreterCreate", &api.interpreterCreate) &&
+                lookup(lib, "TfLiteInterpreterDelete", &api.interpreterDelete) &&
+                lookup(lib, "TfLiteInterpreterAllocateTensors",
+                       &api.allocateTensors) &&
+                lookup(lib, "TfLiteInterpreterInvoke", &api.invoke) &&
+                lookup(lib, "TfLiteInterpreterGetInputTensorCount",
+                       &api.inputCount) &&
+                lookup(lib, "TfLiteInterpreterGetInputTensor", &api.inputTensor) &&
+                lookup(lib, "TfLiteInterpreterGetOutputTensorCount",
+                       &api.outputCount) &&
+                lookup(lib, "TfLiteInterpreterGetOutputTensor",
+                       &api.outputTensor) &&
+                lookup(lib, "TfLiteTensorType", &api.tensorType) &&
+                lookup(lib, "TfLiteTensorNumDims", &api.tensorNumDims) &&
+                lookup(lib, "TfLiteTensorDim", &api.tensorDim) &&
+                lookup(lib, "TfLiteTensorByteSize", &api.tensorByteSize) &&
+                lookup(lib, "TfLiteTensorCopyFromBuffer", &api.copyFromBuffer) &&
+                lookup(lib, "TfLiteTensorCopyToBuffer", &api.copyToBuffer);
+    if (!apiLoaded) {
+        dlclose(lib);
+    }
+}
+
+static larodTensorDataType toLarodType(int type) {
+    switch (type) {
+    case TFLITE_FLOAT32:
+        return LAROD_TENSOR_DATA_TYPE_FLOAT32;
+    case TFLITE_INT32:
+        return LAROD_TENSOR_DATA_TYPE_INT32;
+    case TFLITE_UINT8:
+        return LAROD_TENSOR_DATA_TYPE_UINT8;
+    case TFLITE_INT64:
+        return LAROD_TENSOR_DATA_TYPE_INT64;
+    case TFLITE_BOOL:
+        return LAROD_TENSOR_DATA_TYPE_BOOL;
+    case TFLITE_INT16:
+        return LAROD_TENSOR_DATA_TYPE_INT16;
+    case TFLITE_INT8:
+        return LAROD_TENSOR_DATA_TYPE_INT8;
+    case TFLITE_FLOAT16:
+        return LAROD_TENSOR_DATA_TYPE_FLOAT16;
+    default:
+        return LAROD_TENSOR_DATA_TYPE_UNSPECIFIED;
+    }
+}
+
+static void describeTensor(const TfLiteTensor* tensor, shimTensorInfo* info) {
+    info->dataType = toLarodType(api.tensorType(tensor));
+    info->byteSize = api.tensorByteSize(tensor);
+
+    const int32_t numDims = api.tensorNumDims(tensor);
+    info->dims.len = 0;
+    for (int32_t d = 0; d < numDims && d < LAROD_TENSOR_MAX_LEN; d++) {
+        info->dims.dims[info->dims.len++] = (size_t) api.tensorDim(tensor, d);
+    }
+}
+
+bool tfliteBackendCreate(const void* data, size_t size, shimModelInfo* info,
+                         tfliteBackend** backendPtr, char* errMsg,
+                         size_t errSize) {
+    pthread_once(&apiOnce, loadApi);
+    if (!apiLoaded) {
+        snprintf(errMsg, errSize, "%s", apiError);
+        return false;
+    }
+
+    tfliteBackend* backend = calloc(1, sizeof(tfliteBackend));
+    TfLiteInterpreterOptions* options = NULL;
+    if (!backend) {
+        snprintf(errMsg, errSize, "Out of memory");
+        return false;
+    }
+    pthread_mutex_init(&backend->mutex, NULL);
+
+    backend->model = api.modelCreate(data, size);
+    if (!backend->model) {
+        snprintf(errMsg, errSize, "Not a valid TensorFlow Lite model");
+        goto error;
+    }
+
+    options = api.optionsCreate();
+    const char* threads = getenv("LAROD_SHIM_TFLITE_THREADS");
+    api.optionsSetNumThreads(options, threads ? atoi(threads) : 1);
+    backend->interpreter = api.interpreterCreate(backend->model, options);
+    if (!backend->interpreter ||
+        api.allocateTensors(backend->interpreter) != TFLITE_OK) {
+        snprintf(errMsg, errSize, "Unable to create interpreter for model");
+        goto error;
+    }
+
+    const int32_t numInputs = api.inputCount(backend->interpreter);
+    const int32_t numOutputs = api.outputCount(backend->interpreter);
+    if (numInputs > SHIM_MAX_TENSORS || numOutputs > SHIM_MAX_TENSORS) {
+        snprintf(errMsg, errSize, "Model has more than %d inputs or outputs",
+                 SHIM_MAX_TENSORS);
+        goto error;
+    }
+    backend->info.numInputs = (size_t) numInputs;
+    backend->info.numOutputs = (size_t) numOutputs;
+    for (int32_t i = 0; i < numInputs; i++) {
+        describeTensor(api.inputTensor(backend->interpreter, i),
+                       &backend->info.inputs[i]);
+    }
+    for (int32_t i = 0; i < numOutputs; i++) {
+        describeTensor(api.outputTensor(backend->interpreter, i),
+                       &backend->info.outputs[i]);
+    }
+
+    api.optionsDelete(options);
+    *info = backend->info;
+    *backendPtr = backend;
+
+    return true;
+
+error:
+    if (options) {
+        api.optionsDelete(options);
+    }
+    tfliteBackendDestroy(&backend);
+
+    return false;
+}
+
+bool tfliteBackendRun(tfliteBackend* backend, void* const* inputs,
+                      void* const* outputs, char* errMsg, size_t errSize) {
+    bool ret = false;
+
+    pthread_mutex_lock(&backend->mutex);
+    for (size_t i = 0; i < backend->info.numInputs; i++) {
+        if (api.copyFromBuffer(api.inputTensor(backend->interpreter, (int32_t) i),
+                               inputs[i],
+                               backend->info.inputs[i].byteSize) != TFLITE_OK) {
+            snprintf(errMsg, errSize, "Unable to set input %zu", i);
+            goto end;
+        }
+    }
+    if (api.invoke(backend->interpreter) != TFLITE_OK) {
+        snprintf(errMsg, errSize, "Inference failed");
+        goto end;
+    }
+    for (size_t i = 0; i < backend->info.numOutputs; i++) {
+        if (api.copyToBuffer(api.outputTensor(backend->interpreter, (int32_t) i),
+                             outputs[i],
+                             backend->info.outputs[i].byteSize) != TFLITE_OK) {
+            snprintf(errMsg, errSize, "Unable to get output %zu", i);
+            goto end;
+        }
+    }
+
+    ret = true;
+
+end:
+    pthread_mutex_unlock(&backend->mutex);
+
+    return ret;
+}
+
+void tfliteBackendDestroy(tfliteBackend** backendPtr) {
+    if (!backendPtr || !*backendPtr) {
+        return;
+    }
+    tfliteBackend* backend = *backendPtr;
+
+    if (backend->interpreter) {
+        api.interpreterDelete(backend->interpreter);
+    }
+    if (backend->model) {
+        api.modelDelete(backend->model);
+    }
+    pthread_mutex_destroy(&backend->mutex);
+    free(backend);
+    *backendPtr = NULL;
+}
@@ -14,8 +14,10 @@
 
 # USAGE:
 # python3 ./model_performance_tester.py -m <MODEL_PATH> -c <CHIP> -i <IP> -u <USER> <PASS>
+# python3 ./model_performance_tester.py -m <MODEL_PATH> -c <CHIP> -i <IP> -u <USER> <PASS> -b <LAROD_BENCH> -o <REPORT>
 
 import paramiko
+import json
 import os
 import argparse
 import re
@@ -29,7 +31,30 @@ chipset = {
         'CV25': 'ambarella-cvflow'
     }
 
-def run_speed_test(DEVICE_IP, PORT, DEVICE_USERNAME, DEVICE_PASSWORD, MODEL_PATH, TEST_DURATION, CHIP):
+def run_bench(ssh, bench_path, device_model_location, TEST_DURATION, CHIP, SOAK=None):
+    # larod_bench measures every job and prints a JSON report on one line
+    device_bench_location = '/tmp/larod_bench'
+    sftp = ssh.open_sftp()
+    sftp.put(bench_path, device_bench_location)
+    sftp.chmod(device_bench_location, 0o755)
+    sftp.close()
+
+    soak = ' --soak ' + str(SOAK) if SOAK else ''
+    ssh_stdin, ssh_stdout, ssh_stderr = ssh.exec_command(
+        device_bench_location + ' -n ' + str(TEST_DURATION) + ' --memory' +
+        soak + ' -c ' + chipset[CHIP] + ' ' + device_model_location)
+    out = ssh_stdout.read().decode('utf-8')
+    err = ssh_stderr.read().decode('utf-8')
+    ssh.exec_command('rm ' + device_bench_location)
+    try:
+        return json.loads(out)
+    except ValueError:
+        print('Something went wrong:')
+        print(out)
+        print(err)
+        return None
+
+def run_speed_test(DEVICE_IP, PORT, DEVICE_USERNAME, DEVICE_PASSWORD, MODEL_PATH, TEST_DURATION, CHIP, BENCH_PATH=None, REPORT_PATH=None, SOAK=None):
 
     # Take model name from path
     model_name = MODEL_PATH.split('/')[-1]
@@ -47,6 +72,54 @@ def run_speed_test(DEVICE_IP, PORT, DEVICE_USERNAME, DEVICE_PASSWORD, MODEL_PATH
     sftp.close()
 
     print('Starting Test...')
+    if BENCH_PATH:
+        report = run_bench(ssh, BENCH_PATH, device_model_location, TEST_DURATION, CHIP, SOAK)
+        ssh.exec_command('rm ' + device_model_location)
+        ssh.close()
+        if report is None:
+            return -1
+        latency = report['latency']
+        ci = report['confidence_interval']
+        startup = report['startup']
+        print('Startup: connect %.2f ms, load model %.2f ms, first job %.2f ms' %
+              (startup['connect_ms'], startup['load_ms'], startup['first_job_ms']))
+        print('Latency over %d jobs: min %.2f ms, p50 %.2f ms, p90 %.2f ms, '
+              'p99 %.2f ms, max %.2f ms, mean %.2f ms, stddev %.2f ms' %
+              (latency['count'], latency['min_ms'], latency['p50_ms'],
+               latency['p90_ms'], latency['p99_ms'], latency['max_ms'],
+               latency['mean_ms'], latency['stddev_ms']))
+        print('%g%% confidence interval of p50: %.2f - %.2f ms%s' %
+              (100 * ci['level'], ci['p50_low_ms'], ci['p50_high_ms'],
+               '' if report['converged'] else ' (wider than the target)'))
+        memory = report.get('memory')
+        if memory:
+            for name, label in (('client', 'larod_bench'), ('larod', 'larod')):
+                if memory[name]:
+                    print('Memory of %s: RSS peak %d kB loading, %d kB running' %
+                          (label, memory[name]['load_peak']['rss_kb'],
+                           memory[name]['steady_peak']['rss_kb']))
+            if memory['cma']:
+                print('CMA in use: peak %d kB loading, %d kB running' %
+                      (memory['cma']['load_peak_used_kb'],
+                       memory['cma']['steady_peak_used_kb']))
+        soak = report.get('soak')
+        if soak:
+            first, last = soak['windows'][0], soak['windows'][-1]
+            worst = soak['windows'][soak['worst_window']['index']]
+            drift = soak['drift']
+            print('Soak of %.0f s: p50 %.2f -> %.2f ms (%+.1f%%), p99 %.2f -> %.2f ms (%+.1f%%)' %
+                  (soak['duration_s'], first['p50_ms'], last['p50_ms'], drift['p50_pct'],
+                   first['p99_ms'], last['p99_ms'], drift['p99_pct']))
+            print('Worst window at %.0f s: p99 %.2f ms' % (worst['start_s'], worst['p99_ms']))
+            if drift['hottest_temp_c'] is not None:
+                print('Hottest zone %+.1f C from before the run' % drift['hottest_temp_c'])
+            if drift['cpu_max_mhz'] is not None:
+                print('Max CPU frequency %+.0f MHz from before the run' % drift['cpu_max_mhz'])
+        if REPORT_PATH:
+            with open(REPORT_PATH, 'w') as f:
+                json.dump(report, f, indent=2)
+        return latency['mean_ms']
+
     ssh_stdin, ssh_stdout, ssh_stderr = ssh.exec_command(
         'larod-client -R ' + str(TEST_DURATION) + ' -p' +
         ' -c ' + chipset[CHIP] +
@@ -75,11 +148,14 @@ if __name__ == '__main__':
 
     parser = argparse.ArgumentParser(description='Run a speed test of a model on the device')
     parser.add_argument('-m', '--model_path', type=str, help='Model path', required=True)
-    parser.add_argument('-d', '--test_duration', type=int, help='Test duration (iterations)', default=100)
+    parser.add_argument('-d', '--test_duration', type=int, help='Test duration (iterations, per round with --bench)', default=100)
     parser.add_argument('-c', '--chip', type=str, choices=chipset.keys(), help='Chipset', required=True)
     parser.add_argument('-i', '--device_ip', type=str, help='Device IP', required=True)
     parser.add_argument('-p', '--device_port', type=int, help='Device port for ssh', default=22)
     parser.add_argument('-u', '--device_credentials', nargs=2, type=str, help='Device username and password divided by space', required=True)
+    parser.add_argument('-b', '--bench', type=str, help='larod_bench built for the device, to measure percentiles and confidence intervals instead of the mean of larod-client')
+    parser.add_argument('-o', '--output', type=str, help='Write the JSON report of --bench to this file')
+    parser.add_argument('-s', '--soak', type=int, help='Run --bench for this many seconds, e.g. 1800, and report how the latency drifts as the device heats up')
 
 
     args = parser.parse_args()
@@ -92,4 +168,7 @@ if __name__ == '__main__':
     DEVICE_USERNAME = args.device_credentials[0]
     DEVICE_PASSWORD = args.device_credentials[1]
 
-    run_speed_test(DEVICE_IP, DEVICE_PORT, DEVICE_USERNAME, DEVICE_PASSWORD, MODEL_PATH, TEST_DURATION, CHIP)
+    if args.soak and not args.bench:
+        parser.error('--soak needs --bench')
+
+    run_speed_test(DEVICE_IP, DEVICE_PORT, DEVICE_USERNAME, DEVICE_PASSWORD, MODEL_PATH, TEST_DURATION, CHIP, args.bench, args.output, args.soak)